@@ -0,0 +1,257 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <iio.h>
+
+#include "auto_export.h"
+
+struct auto_export_file {
+	gchar *paths[2];
+	guint64 size;
+};
+
+/* Queued to have the writer return */
+static struct export_snapshot auto_export_stop;
+
+int auto_export_format_from_string(const char *format)
+{
+	if (!strcmp(format, "sigmf"))
+		return EXPORT_SIGMF;
+	if (!strcmp(format, "csv"))
+		return EXPORT_CSV;
+	if (!strcmp(format, "mat"))
+		return EXPORT_MAT;
+
+	return -EINVAL;
+}
+
+const char * auto_export_format_to_string(enum export_format format)
+{
+	switch (format) {
+	case EXPORT_SIGMF:
+		return "sigmf";
+	case EXPORT_CSV:
+		return "csv";
+	case EXPORT_MAT:
+		return "mat";
+	default:
+		return "unknown";
+	}
+}
+
+static guint64 file_size(const char *path)
+{
+	struct stat st;
+
+	if (!path || stat(path, &st))
+		return 0;
+
+	return st.st_size;
+}
+
+static void auto_export_file_remove(struct auto_export_file *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(f->paths); i++) {
+		if (f->paths[i])
+			remove(f->paths[i]);
+		g_free(f->paths[i]);
+	}
+	g_free(f);
+}
+
+/* Drop the oldest files until under the caps, the newest always stays */
+static void auto_export_rotate(struct auto_export *ae)
+{
+	struct auto_export_file *f;
+
+	while (ae->files.length > 1 &&
+			((ae->cfg.max_files && ae->files.length > ae->cfg.max_files) ||
+			 (ae->cfg.max_bytes && ae->bytes > ae->cfg.max_bytes))) {
+		f = g_queue_pop_head(&ae->files);
+		ae->bytes -= f->size;
+		auto_export_file_remove(f);
+	}
+}
+
+static void auto_export_write(struct auto_export *ae, struct export_snapshot *s)
+{
+	struct auto_export_file *f = g_new0(struct auto_export_file, 1);
+	struct export_job *job;
+	gchar *base, *path;
+	int ret;
+
+	base = g_strdup_printf("%s_%06" G_GUINT64_FORMAT, ae->prefix,
+			ae->file_index++);
+
+	switch (ae->cfg.format) {
+	case EXPORT_SIGMF:
+		path = g_strdup(base);
+		f->paths[0] = g_strdup_printf("%s.sigmf-data", base);
+		f->paths[1] = g_strdup_printf("%s.sigmf-meta", base);
+		break;
+	case EXPORT_MAT:
+		path = g_strdup_printf("%s.mat", base);
+		f->paths[0] = g_strdup(path);
+		break;
+	default:
+		path = g_strdup_printf("%s.csv", base);
+		f->paths[0] = g_strdup(path);
+		f->paths[1] = g_strdup_printf("%s.json", base);
+		break;
+	}
+
+	job = export_job_new(ae->cfg.format, path, s);
+	ret = export_job_run(job);
+	export_job_unref(job);
+
+	/* CSV has no room for the capture details, they go next to it */
+	if (!ret && ae->cfg.format == EXPORT_CSV)
+		ret = export_snapshot_meta(f->paths[1], s);
+
+	if (ret) {
+		fprintf(stderr, "Auto export of %s failed: %s\n", path,
+				strerror(-ret));
+		g_atomic_int_inc(&ae->errors);
+		auto_export_file_remove(f);
+	} else {
+		f->size = file_size(f->paths[0]) + file_size(f->paths[1]);
+		ae->bytes += f->size;
+		g_queue_push_tail(&ae->files, f);
+		g_atomic_int_inc(&ae->written);
+		auto_export_rotate(ae);
+	}
+
+	g_free(path);
+	g_free(base);
+}
+
+/* Left unknown once the plot is gone, the device may be too */
+static void auto_export_read_gains(struct auto_export *ae,
+		struct export_snapshot *s)
+{
+	struct export_channel_meta *meta;
+	unsigned int i, c;
+
+	g_mutex_lock(&ae->lock);
+	for (i = 0; i < s->num_sections; i++) {
+		for (c = 0; c < s->sections[i].num_channels; c++) {
+			meta = &s->sections[i].meta[c];
+			if (meta->chn && !ae->closed &&
+					iio_channel_attr_read_double(meta->chn,
+						"hardwaregain", &meta->gain))
+				meta->gain = NAN;
+			meta->chn = NULL;
+		}
+	}
+	g_mutex_unlock(&ae->lock);
+}
+
+static gpointer auto_export_thread(gpointer data)
+{
+	struct auto_export *ae = data;
+	struct export_snapshot *s;
+
+	while ((s = g_async_queue_pop(ae->queue)) != &auto_export_stop) {
+		export_snapshot_detach(s);
+		auto_export_read_gains(ae, s);
+		auto_export_write(ae, s);
+		export_snapshot_unref(s);
+	}
+
+	printf("Auto export %s: %d files written, %u captures dropped, %d errors\n",
+			ae->prefix, ae->written, ae->dropped, ae->errors);
+
+	/* The files stay on disk, only the bookkeeping goes */
+	while (!g_queue_is_empty(&ae->files)) {
+		struct auto_export_file *f = g_queue_pop_head(&ae->files);
+
+		g_free(f->paths[0]);
+		g_free(f->paths[1]);
+		g_free(f);
+	}
+	g_async_queue_unref(ae->queue);
+	g_mutex_clear(&ae->lock);
+	g_free(ae->prefix);
+	g_free(ae);
+
+	return NULL;
+}
+
+struct auto_export * auto_export_new(const char *prefix,
+		const struct auto_export_config *cfg)
+{
+	struct auto_export *ae = g_new0(struct auto_export, 1);
+
+	ae->cfg = *cfg;
+	if (!ae->cfg.every)
+		ae->cfg.every = 1;
+	ae->prefix = g_strdup(prefix);
+	ae->start = g_get_monotonic_time();
+	g_queue_init(&ae->files);
+
+	ae->queue = g_async_queue_new();
+	g_mutex_init(&ae->lock);
+	ae->thread = g_thread_new("auto_export", auto_export_thread, ae);
+
+	return ae;
+}
+
+/*
+ * Captures already queued are still written, by the writer left to finish
+ * on its own; it frees ae last. Neither the capture buffers nor the device
+ * are used anymore once this returns.
+ */
+void auto_export_free(struct auto_export *ae)
+{
+	if (!ae)
+		return;
+
+	export_snapshots_detach_all();
+	g_mutex_lock(&ae->lock);
+	ae->closed = true;
+	g_mutex_unlock(&ae->lock);
+
+	g_async_queue_push(ae->queue, &auto_export_stop);
+	g_thread_unref(ae->thread);
+}
+
+/*
+ * Called for every capture. Tells whether this one is to be written and
+ * its sequence number; a capture that is due while the writer is
+ * AUTO_EXPORT_QUEUE_DEPTH captures behind is dropped.
+ */
+bool auto_export_due(struct auto_export *ae, guint64 *capture)
+{
+	guint64 n = ae->captures++;
+
+	if (ae->cfg.duration > 0.0 && g_get_monotonic_time() - ae->start >
+			ae->cfg.duration * G_USEC_PER_SEC)
+		return false;
+
+	if (n % ae->cfg.every)
+		return false;
+
+	if (g_async_queue_length(ae->queue) >= AUTO_EXPORT_QUEUE_DEPTH) {
+		ae->dropped++;
+		return false;
+	}
+
+	*capture = n;
+	return true;
+}
+
+void auto_export_push(struct auto_export *ae, struct export_snapshot *s)
+{
+	g_async_queue_push(ae->queue, export_snapshot_ref(s));
+}
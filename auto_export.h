@@ -0,0 +1,63 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __AUTO_EXPORT_H__
+#define __AUTO_EXPORT_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+#include "export.h"
+
+/* Captures waiting for the writer, more are dropped */
+#define AUTO_EXPORT_QUEUE_DEPTH	4
+
+struct auto_export_config {
+	enum export_format format;	/* EXPORT_SIGMF, EXPORT_CSV or EXPORT_MAT */
+	unsigned int every;		/* write one capture out of every */
+	double duration;		/* s, 0 means until stopped */
+	unsigned int max_files;		/* files kept, 0 means no limit */
+	guint64 max_bytes;		/* bytes kept, 0 means no limit */
+};
+
+/*
+ * Writes captures to <prefix>_<number> files from a thread of its own.
+ * The capture path only decides whether a capture is due and queues a
+ * borrowing snapshot of it; the writer copies the data and reads the
+ * channel gains. When the writer falls behind the capture is counted as
+ * dropped instead. Once over the caps, the oldest files are removed.
+ */
+struct auto_export {
+	struct auto_export_config cfg;
+	gchar *prefix;
+
+	GThread *thread;
+	GAsyncQueue *queue;
+	GMutex lock;
+	bool closed;			/* the device may be gone, under lock */
+
+	gint64 start;			/* monotonic, us */
+	guint64 captures;		/* seen, written or not */
+	unsigned int dropped;
+
+	/* writer side */
+	guint64 file_index;
+	GQueue files;
+	guint64 bytes;
+	gint written;
+	gint errors;
+};
+
+int auto_export_format_from_string(const char *format);
+const char * auto_export_format_to_string(enum export_format format);
+
+struct auto_export * auto_export_new(const char *prefix,
+		const struct auto_export_config *cfg);
+void auto_export_free(struct auto_export *ae);
+bool auto_export_due(struct auto_export *ae, guint64 *capture);
+void auto_export_push(struct auto_export *ae, struct export_snapshot *s);
+
+#endif /* __AUTO_EXPORT_H__ */
@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdbool.h>
+#include <string.h>
+
+#include "buffer_demux.h"
+
+/* Samples of chn from its first one to the end of the buffer */
+static size_t demux_count(const struct iio_buffer *buf,
+		const struct iio_channel *chn, size_t count)
+{
+	const char *first = iio_buffer_first(buf, chn);
+	const char *end = iio_buffer_end(buf);
+	ptrdiff_t step = iio_buffer_step(buf);
+	size_t avail;
+
+	if (!first || end <= first || step <= 0)
+		return 0;
+
+	avail = (end - first + step - 1) / step;
+
+	return count < avail ? count : avail;
+}
+
+static bool format_is_native16(const struct iio_data_format *format)
+{
+	return format->length == 16 && format->bits &&
+		format->bits + format->shift <= 16 && format->repeat <= 1 &&
+		format->is_be == (G_BYTE_ORDER == G_BIG_ENDIAN);
+}
+
+static gint64 sample_convert(const struct iio_channel *chn,
+		const struct iio_data_format *format, const void *src)
+{
+	if (format->length / 8 == 1) {
+		int8_t val;
+		iio_channel_convert(chn, &val, src);
+		if (format->is_signed)
+			return val;
+		return (uint8_t)val;
+	} else if (format->length / 8 == 2) {
+		int16_t val;
+		iio_channel_convert(chn, &val, src);
+		if (format->is_signed)
+			return val;
+		return (uint16_t)val;
+	} else if (format->length / 8 == 4) {
+		int32_t val;
+		iio_channel_convert(chn, &val, src);
+		if (format->is_signed)
+			return val;
+		return (uint32_t)val;
+	} else {
+		int64_t val;
+		iio_channel_convert(chn, &val, src);
+		return val;
+	}
+}
+
+/*
+ * The field is moved to the top of the word, then back down with the sign
+ * or zeros coming in: the shift and the sign extension of
+ * iio_channel_convert() in two shifts. Inlined for the common steps, so
+ * the loads are at constant strides the vectorizer can deinterleave.
+ */
+static inline __attribute__((always_inline)) void
+demux16_float(const char *src, ptrdiff_t step, size_t count,
+		unsigned lshift, unsigned rshift, bool is_signed, gfloat *dst)
+{
+	uint16_t v;
+	size_t i;
+
+	if (is_signed) {
+		for (i = 0; i < count; i++) {
+			memcpy(&v, src + i * step, sizeof(v));
+			dst[i] = (int16_t)(v << lshift) >> rshift;
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			memcpy(&v, src + i * step, sizeof(v));
+			dst[i] = (uint16_t)(v << lshift) >> rshift;
+		}
+	}
+}
+
+static inline __attribute__((always_inline)) void
+demux16_s16(const char *src, ptrdiff_t step, size_t count,
+		unsigned lshift, unsigned rshift, bool is_signed, int16_t *dst)
+{
+	uint16_t v;
+	size_t i;
+
+	/* Only a full 16 bits unsigned value can be out of range */
+	if (is_signed) {
+		for (i = 0; i < count; i++) {
+			memcpy(&v, src + i * step, sizeof(v));
+			dst[i] = (int16_t)(v << lshift) >> rshift;
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			memcpy(&v, src + i * step, sizeof(v));
+			v = (uint16_t)(v << lshift) >> rshift;
+			dst[i] = v > INT16_MAX ? INT16_MAX : v;
+		}
+	}
+}
+
+/* One or two channels of one or two 16 bits converters */
+#define DEMUX16(kernel, src, step, count, format, dst)			\
+	do {								\
+		unsigned l = 16 - (format)->bits - (format)->shift;	\
+		unsigned r = 16 - (format)->bits;			\
+		bool s = (format)->is_signed;				\
+									\
+		switch (step) {						\
+		case 2:							\
+			kernel(src, 2, count, l, r, s, dst);		\
+			break;						\
+		case 4:							\
+			kernel(src, 4, count, l, r, s, dst);		\
+			break;						\
+		case 8:							\
+			kernel(src, 8, count, l, r, s, dst);		\
+			break;						\
+		default:						\
+			kernel(src, step, count, l, r, s, dst);		\
+			break;						\
+		}							\
+	} while (0)
+
+size_t buffer_demux_float(const struct iio_buffer *buf,
+		const struct iio_channel *chn, gfloat *dst, size_t count)
+{
+	const struct iio_data_format *format = iio_channel_get_data_format(chn);
+	const char *src = iio_buffer_first(buf, chn);
+	ptrdiff_t step = iio_buffer_step(buf);
+	size_t i;
+
+	count = demux_count(buf, chn, count);
+
+	if (format_is_native16(format)) {
+		DEMUX16(demux16_float, src, step, count, format, dst);
+		return count;
+	}
+
+	for (i = 0; i < count; i++, src += step) {
+		if (format->length == 64 && !format->is_signed) {
+			uint64_t val;
+			iio_channel_convert(chn, &val, src);
+			dst[i] = (gfloat)val;
+		} else {
+			dst[i] = (gfloat)sample_convert(chn, format, src);
+		}
+	}
+
+	return count;
+}
+
+size_t buffer_demux_s16(const struct iio_buffer *buf,
+		const struct iio_channel *chn, int16_t *dst, size_t count)
+{
+	const struct iio_data_format *format = iio_channel_get_data_format(chn);
+	const char *src = iio_buffer_first(buf, chn);
+	ptrdiff_t step = iio_buffer_step(buf);
+	gint64 val;
+	size_t i;
+
+	count = demux_count(buf, chn, count);
+
+	if (format_is_native16(format)) {
+		DEMUX16(demux16_s16, src, step, count, format, dst);
+		return count;
+	}
+
+	for (i = 0; i < count; i++, src += step) {
+		val = sample_convert(chn, format, src);
+		dst[i] = CLAMP(val, INT16_MIN, INT16_MAX);
+	}
+
+	return count;
+}
@@ -0,0 +1,29 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __BUFFER_DEMUX_H__
+#define __BUFFER_DEMUX_H__
+
+#include <glib.h>
+#include <stdint.h>
+#include <iio.h>
+
+/*
+ * Bulk conversion of the samples of a buffer channel to host values, what
+ * iio_channel_convert() does one sample at a time. Channels of up to 16 bits
+ * stored in 16 in the host byte order, which is what most converters stream,
+ * go through a loop the compiler vectorizes; other formats are converted
+ * sample by sample.
+ * Up to count samples are written, from the first one of the buffer, and
+ * the number written is returned. The channel must be enabled.
+ */
+size_t buffer_demux_float(const struct iio_buffer *buf,
+		const struct iio_channel *chn, gfloat *dst, size_t count);
+/* Values that don't fit are clamped */
+size_t buffer_demux_s16(const struct iio_buffer *buf,
+		const struct iio_channel *chn, int16_t *dst, size_t count);
+
+#endif /* __BUFFER_DEMUX_H__ */
@@ -0,0 +1,173 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <float.h>
+
+#include "chanpower.h"
+
+#define MAIN_CHANNEL CHANPOWER_MAX_ADJACENT
+
+struct chanpower_standard {
+	const char *name;
+	double channel_bw;
+	double channel_spacing;
+	unsigned int num_adjacent;
+};
+
+/* E-UTRA ACLR, measured over the transmission bandwidth (RBs * 180 kHz) */
+static const struct chanpower_standard standards[] = {
+	{ "LTE1p4", 1080000.0, 1400000.0, 2 },
+	{ "LTE3", 2700000.0, 3000000.0, 2 },
+	{ "LTE5", 4500000.0, 5000000.0, 2 },
+	{ "LTE10", 9000000.0, 10000000.0, 2 },
+	{ "LTE15", 13500000.0, 15000000.0, 2 },
+	{ "LTE20", 18000000.0, 20000000.0, 2 },
+	{ "UMTS", 3840000.0, 5000000.0, 2 },
+};
+
+int chanpower_config_from_standard(struct chanpower_config *cfg,
+		const char *standard)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(standards) / sizeof(standards[0]); i++) {
+		if (strcmp(standard, standards[i].name))
+			continue;
+
+		cfg->channel_bw = standards[i].channel_bw;
+		cfg->channel_spacing = standards[i].channel_spacing;
+		cfg->num_adjacent = standards[i].num_adjacent;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+struct chanpower * chanpower_new(const struct chanpower_config *cfg)
+{
+	struct chanpower *cp;
+
+	if (cfg->channel_bw <= 0.0 || cfg->channel_spacing < 0.0)
+		return NULL;
+
+	cp = calloc(1, sizeof(*cp));
+	if (!cp)
+		return NULL;
+
+	cp->cfg = *cfg;
+	if (cp->cfg.num_adjacent > CHANPOWER_MAX_ADJACENT)
+		cp->cfg.num_adjacent = CHANPOWER_MAX_ADJACENT;
+	cp->noise_gain = 1.0;
+
+	return cp;
+}
+
+void chanpower_free(struct chanpower *cp)
+{
+	free(cp);
+}
+
+void chanpower_reset(struct chanpower *cp)
+{
+	cp->valid = false;
+	cp->win_size = 0;
+}
+
+/*
+ * Summing the bins of a window-weighted FFT over-counts noise by its
+ * equivalent noise bandwidth. For bins scaled by 1 / N^2 the integrated
+ * power needs N / sum(w^2).
+ */
+void chanpower_set_window(struct chanpower *cp, const double *win,
+		unsigned int n)
+{
+	double sum2 = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum2 += win[i] * win[i];
+
+	cp->noise_gain = sum2 > 0.0 ? n / sum2 : 1.0;
+	cp->win_size = n;
+}
+
+/* Integrate the bins in [lo, hi) (in bins); -1 if outside the trace */
+static double integrate(const gfloat *psd_db, unsigned int n,
+		double lo, double hi, double db_offset)
+{
+	double sum = 0.0;
+	unsigned int k, first, last;
+
+	if (lo < 0.0 || hi > n)
+		return -1.0;
+
+	first = (unsigned int)lo;
+	last = (unsigned int)ceil(hi);
+
+	for (k = first; k < last; k++) {
+		double overlap = MIN(k + 1.0, hi) - MAX((double)k, lo);
+
+		if (psd_db[k] == FLT_MAX)
+			return -1.0;
+		sum += overlap * pow(10.0, (psd_db[k] - db_offset) / 10.0);
+	}
+
+	return sum;
+}
+
+int chanpower_process(struct chanpower *cp, const gfloat *freq,
+		const gfloat *psd_db, unsigned int n, double freq_scale,
+		double db_offset)
+{
+	const struct chanpower_config *cfg = &cp->cfg;
+	double bin_hz, f0, main_db;
+	int c, adj = cfg->num_adjacent;
+
+	if (n < 2)
+		return -EINVAL;
+
+	bin_hz = (freq[1] - freq[0]) * freq_scale;
+	f0 = freq[0] * freq_scale;
+	if (bin_hz <= 0.0)
+		return -EINVAL;
+
+	for (c = -adj; c <= adj; c++) {
+		double fc = cfg->center + c * cfg->channel_spacing;
+		double lo = (fc - cfg->channel_bw / 2 - f0) / bin_hz + 0.5;
+		double hi = (fc + cfg->channel_bw / 2 - f0) / bin_hz + 0.5;
+		double lin = integrate(psd_db, n, lo, hi, db_offset);
+		double *avg = &cp->lin[MAIN_CHANNEL + c];
+
+		if (lin < 0.0) {
+			/* no data yet, or the channel is outside of the span */
+			*avg = NAN;
+			continue;
+		}
+
+		lin *= cp->noise_gain;
+		if (!cp->valid || cfg->avg <= 1 || isnan(*avg))
+			*avg = lin;
+		else
+			*avg += (lin - *avg) / cfg->avg;
+	}
+	cp->valid = !isnan(cp->lin[MAIN_CHANNEL]);
+	if (!cp->valid)
+		return -EAGAIN;
+
+	main_db = 10.0 * log10(cp->lin[MAIN_CHANNEL]);
+	for (c = -adj; c <= adj; c++) {
+		double lin = cp->lin[MAIN_CHANNEL + c];
+
+		cp->power[MAIN_CHANNEL + c] = isnan(lin) ? NAN : 10.0 * log10(lin);
+		cp->aclr[MAIN_CHANNEL + c] = cp->power[MAIN_CHANNEL + c] - main_db;
+	}
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __CHANPOWER_H__
+#define __CHANPOWER_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define CHANPOWER_MAX_ADJACENT	3
+
+struct chanpower_config {
+	double channel_bw;		/* Hz, integration bandwidth */
+	double channel_spacing;		/* Hz, center to center */
+	double center;			/* Hz, main channel, on the plot axis */
+	unsigned int num_adjacent;	/* channels on each side */
+	unsigned int avg;		/* frames, 0 or 1 means no averaging */
+};
+
+/*
+ * Channel power and ACLR from an FFT trace. The bins are integrated over
+ * each channel (partially covered edge bins count pro rata) and
+ * corrected with the noise bandwidth of the FFT window.
+ */
+struct chanpower {
+	struct chanpower_config cfg;
+
+	double noise_gain;		/* N / sum(w^2) */
+	unsigned int win_size;
+
+	/* index CHANPOWER_MAX_ADJACENT is the main channel */
+	double lin[2 * CHANPOWER_MAX_ADJACENT + 1];
+	gfloat power[2 * CHANPOWER_MAX_ADJACENT + 1];	/* dB */
+	gfloat aclr[2 * CHANPOWER_MAX_ADJACENT + 1];	/* dBc */
+	bool valid;
+};
+
+/* Configuration presets, e.g. "LTE10" */
+int chanpower_config_from_standard(struct chanpower_config *cfg,
+		const char *standard);
+
+struct chanpower * chanpower_new(const struct chanpower_config *cfg);
+void chanpower_free(struct chanpower *cp);
+void chanpower_reset(struct chanpower *cp);
+void chanpower_set_window(struct chanpower *cp, const double *win,
+		unsigned int n);
+int chanpower_process(struct chanpower *cp, const gfloat *freq,
+		const gfloat *psd_db, unsigned int n, double freq_scale,
+		double db_offset);
+
+#endif /* __CHANPOWER_H__ */
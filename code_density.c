@@ -0,0 +1,387 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "code_density.h"
+
+struct code_density_job {
+	struct code_density *cd;
+	const char *start;
+	size_t count;
+	ptrdiff_t step;
+	guint32 *hist;
+};
+
+int code_density_reference_from_string(const char *name)
+{
+	if (!strcmp(name, "sine"))
+		return CODE_DENSITY_SINE;
+	if (!strcmp(name, "ramp"))
+		return CODE_DENSITY_RAMP;
+	return -EINVAL;
+}
+
+/*
+ * Bin the raw codes. Signed codes get their MSB flipped, which maps two's
+ * complement to offset binary so that the histogram index follows the
+ * input level.
+ */
+#define DEFINE_BIN_FUNC(name, type, swap) \
+static void name(guint32 *hist, const char *p, size_t count, ptrdiff_t step, \
+		unsigned int shift, guint32 mask, guint32 flip, bool be) \
+{ \
+	size_t i; \
+	type v; \
+\
+	for (i = 0; i < count; i++, p += step) { \
+		memcpy(&v, p, sizeof(v)); \
+		if (be) \
+			v = swap(v); \
+		hist[((v >> shift) & mask) ^ flip]++; \
+	} \
+}
+
+#define NO_SWAP(v) (v)
+DEFINE_BIN_FUNC(bin_u8, guint8, NO_SWAP)
+DEFINE_BIN_FUNC(bin_u16, guint16, GUINT16_SWAP_LE_BE)
+DEFINE_BIN_FUNC(bin_u32, guint32, GUINT32_SWAP_LE_BE)
+
+static void code_density_worker(gpointer data, gpointer user_data)
+{
+	struct code_density_job *job = data;
+	struct code_density *cd = job->cd;
+	const struct iio_data_format *fmt = iio_channel_get_data_format(cd->chn);
+	guint32 mask = (1u << cd->bits) - 1;
+	guint32 flip = fmt->is_signed ? 1u << (cd->bits - 1) : 0;
+
+	memset(job->hist, 0, cd->num_codes * sizeof(*job->hist));
+
+	switch (fmt->length / 8) {
+	case 1:
+		bin_u8(job->hist, job->start, job->count, job->step,
+				fmt->shift, mask, flip, fmt->is_be);
+		break;
+	case 2:
+		bin_u16(job->hist, job->start, job->count, job->step,
+				fmt->shift, mask, flip, fmt->is_be);
+		break;
+	default:
+		bin_u32(job->hist, job->start, job->count, job->step,
+				fmt->shift, mask, flip, fmt->is_be);
+		break;
+	}
+
+	g_mutex_lock(&cd->work_lock);
+	if (--cd->pending == 0)
+		g_cond_signal(&cd->work_done);
+	g_mutex_unlock(&cd->work_lock);
+}
+
+static gpointer code_density_thread(gpointer data)
+{
+	struct code_density *cd = data;
+	struct code_density_job *jobs;
+	struct iio_buffer *buf;
+	unsigned int w, c;
+	int ret = 0;
+
+	jobs = g_new0(struct code_density_job, cd->num_workers);
+
+	buf = iio_device_create_buffer(cd->dev, cd->buffer_size, false);
+	if (!buf) {
+		ret = -errno;
+		fprintf(stderr, "Code density: unable to create buffer: %s\n",
+				strerror(errno));
+		goto out;
+	}
+
+	while (true) {
+		const char *first, *end;
+		ptrdiff_t step;
+		size_t count;
+		bool done;
+
+		g_mutex_lock(&cd->lock);
+		done = cd->stop;
+		g_mutex_unlock(&cd->lock);
+		if (done)
+			break;
+
+		ret = iio_buffer_refill(buf);
+		if (ret < 0) {
+			fprintf(stderr, "Code density: error while reading data: %s\n",
+					strerror(-ret));
+			break;
+		}
+		ret = 0;
+
+		first = iio_buffer_first(buf, cd->chn);
+		end = iio_buffer_end(buf);
+		step = iio_buffer_step(buf);
+		count = (end - first + step - 1) / step;
+		if (cd->target && count > cd->target - cd->total)
+			count = cd->target - cd->total;
+
+		/* One slice of the buffer for each worker */
+		cd->pending = cd->num_workers;
+		for (w = 0; w < cd->num_workers; w++) {
+			size_t lo = count * w / cd->num_workers;
+			size_t hi = count * (w + 1) / cd->num_workers;
+
+			jobs[w].cd = cd;
+			jobs[w].start = first + lo * step;
+			jobs[w].count = hi - lo;
+			jobs[w].step = step;
+			jobs[w].hist = cd->worker_hist[w];
+			g_thread_pool_push(cd->pool, &jobs[w], NULL);
+		}
+
+		g_mutex_lock(&cd->work_lock);
+		while (cd->pending)
+			g_cond_wait(&cd->work_done, &cd->work_lock);
+		g_mutex_unlock(&cd->work_lock);
+
+		g_mutex_lock(&cd->lock);
+		for (w = 0; w < cd->num_workers; w++) {
+			const guint32 *h = cd->worker_hist[w];
+
+			for (c = 0; c < cd->num_codes; c++)
+				cd->hist[c] += h[c];
+		}
+		cd->total += count;
+		if (cd->target && cd->total >= cd->target)
+			cd->stop = true;
+		g_mutex_unlock(&cd->lock);
+	}
+
+	iio_buffer_destroy(buf);
+out:
+	g_mutex_lock(&cd->lock);
+	cd->error = ret;
+	cd->running = false;
+	g_mutex_unlock(&cd->lock);
+	g_free(jobs);
+
+	return NULL;
+}
+
+struct code_density * code_density_new(struct iio_device *dev,
+		struct iio_channel *chn, enum code_density_reference reference,
+		unsigned int buffer_size, unsigned int num_workers)
+{
+	const struct iio_data_format *fmt = iio_channel_get_data_format(chn);
+	struct code_density *cd;
+	unsigned int w;
+
+	if (!fmt->bits || fmt->bits > CODE_DENSITY_MAX_BITS ||
+			(fmt->length != 8 && fmt->length != 16 && fmt->length != 32)) {
+		fprintf(stderr, "Code density: unsupported sample format of %u/%u bits\n",
+				fmt->bits, fmt->length);
+		return NULL;
+	}
+
+	if (!num_workers)
+		num_workers = g_get_num_processors();
+
+	cd = g_new0(struct code_density, 1);
+	cd->dev = dev;
+	cd->chn = chn;
+	cd->reference = reference;
+	cd->buffer_size = buffer_size;
+	cd->bits = fmt->bits;
+	cd->num_codes = 1u << fmt->bits;
+	cd->num_workers = num_workers;
+
+	cd->hist = g_new0(guint64, cd->num_codes);
+	cd->dnl = g_new(double, cd->num_codes);
+	cd->inl = g_new(double, cd->num_codes);
+	cd->worker_hist = g_new0(guint32 *, num_workers);
+	for (w = 0; w < num_workers; w++)
+		cd->worker_hist[w] = g_new(guint32, cd->num_codes);
+
+	g_mutex_init(&cd->lock);
+	g_mutex_init(&cd->work_lock);
+	g_cond_init(&cd->work_done);
+
+	cd->pool = g_thread_pool_new(code_density_worker, NULL, num_workers,
+			TRUE, NULL);
+	if (!cd->pool) {
+		code_density_free(cd);
+		return NULL;
+	}
+
+	return cd;
+}
+
+void code_density_free(struct code_density *cd)
+{
+	unsigned int w;
+
+	if (!cd)
+		return;
+
+	code_density_stop(cd);
+	if (cd->pool)
+		g_thread_pool_free(cd->pool, TRUE, TRUE);
+
+	for (w = 0; w < cd->num_workers; w++)
+		g_free(cd->worker_hist[w]);
+	g_free(cd->worker_hist);
+	g_free(cd->hist);
+	g_free(cd->dnl);
+	g_free(cd->inl);
+
+	g_mutex_clear(&cd->lock);
+	g_mutex_clear(&cd->work_lock);
+	g_cond_clear(&cd->work_done);
+	g_free(cd);
+}
+
+/* Nothing else may be streaming from the device while the test runs */
+int code_density_start(struct code_density *cd, guint64 target)
+{
+	if (cd->thread)
+		return -EBUSY;
+
+	memset(cd->hist, 0, cd->num_codes * sizeof(*cd->hist));
+	cd->total = 0;
+	cd->target = target;
+	cd->stop = false;
+	cd->error = 0;
+	cd->running = true;
+
+	iio_channel_enable(cd->chn);
+	cd->thread = g_thread_new("code_density", code_density_thread, cd);
+
+	return 0;
+}
+
+void code_density_stop(struct code_density *cd)
+{
+	if (!cd->thread)
+		return;
+
+	g_mutex_lock(&cd->lock);
+	cd->stop = true;
+	g_mutex_unlock(&cd->lock);
+
+	g_thread_join(cd->thread);
+	cd->thread = NULL;
+	iio_channel_disable(cd->chn);
+}
+
+bool code_density_running(struct code_density *cd)
+{
+	bool running;
+
+	g_mutex_lock(&cd->lock);
+	running = cd->running;
+	g_mutex_unlock(&cd->lock);
+
+	return running;
+}
+
+/*
+ * The code transition levels follow from the cumulative histogram: for a
+ * sine T[k] = -cos(pi * CH[k - 1] / total), for a ramp T[k] = CH[k - 1] /
+ * total. The codes at both ends of the hit range collect the clipped part
+ * of the input and only delimit it. DNL and INL are in LSB of the average
+ * code width, with INL relative to the line through the end points.
+ */
+int code_density_compute(struct code_density *cd)
+{
+	struct code_density_results *res = &cd->results;
+	guint64 *hist, total = 0, cumulative;
+	unsigned int c, lo, hi;
+	double t, t_first, lsb;
+
+	hist = g_new(guint64, cd->num_codes);
+	g_mutex_lock(&cd->lock);
+	memcpy(hist, cd->hist, cd->num_codes * sizeof(*hist));
+	g_mutex_unlock(&cd->lock);
+
+	for (c = 0; c < cd->num_codes; c++) {
+		cd->dnl[c] = NAN;
+		cd->inl[c] = NAN;
+		total += hist[c];
+	}
+
+	memset(res, 0, sizeof(*res));
+	res->total = total;
+
+	for (lo = 0; lo < cd->num_codes && !hist[lo]; lo++);
+	for (hi = cd->num_codes - 1; hi > lo && !hist[hi]; hi--);
+	if (lo + 3 > hi) {
+		g_free(hist);
+		return -EAGAIN;
+	}
+	res->first_code = lo;
+	res->last_code = hi;
+
+	/* Transition levels T[lo + 1] .. T[hi], stored in inl[] for now */
+	cumulative = hist[lo];
+	for (c = lo + 1; c <= hi; c++) {
+		double p = (double)cumulative / total;
+
+		if (cd->reference == CODE_DENSITY_SINE)
+			cd->inl[c] = -cos(M_PI * p);
+		else
+			cd->inl[c] = p;
+		cumulative += hist[c];
+	}
+
+	t_first = cd->inl[lo + 1];
+	lsb = (cd->inl[hi] - t_first) / (hi - lo - 1);
+
+	res->dnl_min = res->inl_min = INFINITY;
+	res->dnl_max = res->inl_max = -INFINITY;
+	for (c = lo + 1; c <= hi; c++) {
+		t = cd->inl[c];
+		if (c < hi) {
+			cd->dnl[c] = (cd->inl[c + 1] - t) / lsb - 1.0;
+			res->dnl_min = MIN(res->dnl_min, cd->dnl[c]);
+			res->dnl_max = MAX(res->dnl_max, cd->dnl[c]);
+			if (!hist[c])
+				res->missing_codes++;
+		}
+		cd->inl[c] = (t - t_first) / lsb - (c - lo - 1);
+		res->inl_min = MIN(res->inl_min, cd->inl[c]);
+		res->inl_max = MAX(res->inl_max, cd->inl[c]);
+	}
+
+	g_free(hist);
+	return 0;
+}
+
+int code_density_save(struct code_density *cd, const char *filename)
+{
+	guint64 *hist;
+	unsigned int c;
+	FILE *f;
+
+	f = fopen(filename, "w");
+	if (!f)
+		return -errno;
+
+	hist = g_new(guint64, cd->num_codes);
+	g_mutex_lock(&cd->lock);
+	memcpy(hist, cd->hist, cd->num_codes * sizeof(*hist));
+	g_mutex_unlock(&cd->lock);
+
+	fprintf(f, "code,hits,dnl,inl\n");
+	for (c = 0; c < cd->num_codes; c++)
+		fprintf(f, "%u,%" G_GUINT64_FORMAT ",%f,%f\n",
+				c, hist[c], cd->dnl[c], cd->inl[c]);
+
+	g_free(hist);
+	fclose(f);
+	return 0;
+}
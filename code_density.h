@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __CODE_DENSITY_H__
+#define __CODE_DENSITY_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <iio.h>
+
+#define CODE_DENSITY_MAX_BITS	20
+
+enum code_density_reference {
+	CODE_DENSITY_SINE,
+	CODE_DENSITY_RAMP,
+};
+
+struct code_density_results {
+	guint64 total;			/* samples in the histogram */
+	unsigned int first_code;	/* lowest code hit, taken as underrange */
+	unsigned int last_code;		/* highest code hit, taken as overrange */
+	unsigned int missing_codes;
+	double dnl_min, dnl_max;	/* LSB */
+	double inl_min, inl_max;	/* LSB, end point fit */
+};
+
+/*
+ * Code density (histogram) test of one ADC channel. A dedicated thread
+ * streams the device and bins the raw codes straight from the IIO buffer,
+ * split over a pool of workers with one histogram each; the partial
+ * histograms are merged into the total after every buffer. DNL and INL are
+ * computed from a snapshot of the total, against the distribution of a
+ * slightly overdriven sine or of a linear ramp.
+ */
+struct code_density {
+	struct iio_device *dev;
+	struct iio_channel *chn;
+	enum code_density_reference reference;
+	unsigned int buffer_size;
+	guint64 target;			/* samples to accumulate, 0 = no limit */
+
+	unsigned int bits;
+	unsigned int num_codes;
+
+	GThread *thread;
+	GThreadPool *pool;
+	unsigned int num_workers;
+	guint32 **worker_hist;
+	unsigned int pending;
+	GMutex work_lock;
+	GCond work_done;
+
+	GMutex lock;			/* protects the fields below */
+	guint64 *hist;
+	guint64 total;
+	bool running;
+	bool stop;
+	int error;
+
+	/* written by code_density_compute() */
+	double *dnl, *inl;		/* num_codes each, NAN out of range */
+	struct code_density_results results;
+};
+
+struct code_density * code_density_new(struct iio_device *dev,
+		struct iio_channel *chn, enum code_density_reference reference,
+		unsigned int buffer_size, unsigned int num_workers);
+void code_density_free(struct code_density *cd);
+int code_density_start(struct code_density *cd, guint64 target);
+void code_density_stop(struct code_density *cd);
+bool code_density_running(struct code_density *cd);
+int code_density_compute(struct code_density *cd);
+int code_density_save(struct code_density *cd, const char *filename);
+
+int code_density_reference_from_string(const char *name);
+
+#endif /* __CODE_DENSITY_H__ */
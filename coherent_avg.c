@@ -0,0 +1,138 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+
+#include "coherent_avg.h"
+
+struct coherent_avg * coherent_avg_new(unsigned int num_avg, bool moving,
+		unsigned int num_channels, unsigned int length)
+{
+	struct coherent_avg *a;
+	size_t size = (size_t)num_channels * length;
+
+	if (num_avg < 2 || !size)
+		return NULL;
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return NULL;
+
+	a->num_avg = num_avg;
+	a->moving = moving;
+	a->num_channels = num_channels;
+	a->length = length;
+
+	/* ADC codes are integers, so a double sum of them stays exact */
+	a->sum = calloc(size, sizeof(*a->sum));
+	if (!a->sum)
+		goto err_free;
+
+	if (moving) {
+		a->history = calloc(size * num_avg, sizeof(*a->history));
+		if (!a->history)
+			goto err_free;
+	}
+
+	return a;
+
+err_free:
+	coherent_avg_free(a);
+	return NULL;
+}
+
+void coherent_avg_free(struct coherent_avg *a)
+{
+	if (!a)
+		return;
+
+	free(a->sum);
+	free(a->history);
+	free(a);
+}
+
+void coherent_avg_reset(struct coherent_avg *a)
+{
+	size_t size = (size_t)a->num_channels * a->length;
+
+	memset(a->sum, 0, size * sizeof(*a->sum));
+	if (a->history)
+		memset(a->history, 0, size * a->num_avg * sizeof(*a->history));
+	a->count = 0;
+	a->head = 0;
+}
+
+static void block_add(double *__restrict sum, const gfloat *__restrict in,
+		unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum[i] += in[i];
+}
+
+static void block_output(double *__restrict sum, gfloat *__restrict data,
+		unsigned int n, double scale)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		data[i] = (gfloat)((sum[i] + data[i]) * scale);
+		sum[i] = 0.0;
+	}
+}
+
+static void moving_update(double *__restrict sum, gfloat *__restrict oldest,
+		gfloat *__restrict data, unsigned int n, double scale)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		gfloat in = data[i];
+
+		sum[i] += (double)in - oldest[i];
+		oldest[i] = in;
+		data[i] = (gfloat)(sum[i] * scale);
+	}
+}
+
+bool coherent_avg_update(struct coherent_avg *a, unsigned int channel,
+		gfloat *data)
+{
+	double *sum = a->sum + (size_t)channel * a->length;
+	gfloat *oldest;
+
+	if (channel >= a->num_channels)
+		return false;
+
+	if (a->moving) {
+		oldest = a->history + ((size_t)a->head * a->num_channels +
+				channel) * a->length;
+		moving_update(sum, oldest, data, a->length,
+				1.0 / MIN(a->count + 1, a->num_avg));
+		return true;
+	}
+
+	if (a->count + 1 < a->num_avg) {
+		block_add(sum, data, a->length);
+		return false;
+	}
+
+	block_output(sum, data, a->length, 1.0 / a->num_avg);
+	return true;
+}
+
+void coherent_avg_next(struct coherent_avg *a)
+{
+	if (a->moving) {
+		a->head = (a->head + 1) % a->num_avg;
+		if (a->count < a->num_avg)
+			a->count++;
+	} else if (++a->count == a->num_avg) {
+		a->count = 0;
+	}
+}
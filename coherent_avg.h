@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __COHERENT_AVG_H__
+#define __COHERENT_AVG_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+/*
+ * Time domain averaging of trigger aligned captures. In block mode the
+ * captures are summed and one average is output every num_avg captures;
+ * in moving mode the sum runs over the last num_avg captures and an
+ * average is output on every capture.
+ */
+struct coherent_avg {
+	unsigned int num_avg;
+	bool moving;
+	unsigned int num_channels;
+	unsigned int length;		/* samples per channel */
+
+	unsigned int count;		/* captures in the sum so far */
+	unsigned int head;		/* oldest capture of the history */
+	double *sum;			/* num_channels * length */
+	gfloat *history;		/* moving: num_avg * num_channels * length */
+};
+
+struct coherent_avg * coherent_avg_new(unsigned int num_avg, bool moving,
+		unsigned int num_channels, unsigned int length);
+void coherent_avg_free(struct coherent_avg *a);
+void coherent_avg_reset(struct coherent_avg *a);
+
+/*
+ * Add the capture of one channel. When the capture completes an average,
+ * the average is written back in place of the data and true is returned.
+ * coherent_avg_next() must be called once all channels were added.
+ */
+bool coherent_avg_update(struct coherent_avg *a, unsigned int channel,
+		gfloat *data);
+void coherent_avg_next(struct coherent_avg *a);
+
+#endif /* __COHERENT_AVG_H__ */
@@ -37,6 +37,7 @@ enum {
 	COMPLEX_FFT_TRANSFORM,
 	CROSS_CORRELATION_TRANSFORM,
 	FREQ_SPECTRUM_TRANSFORM,
+	EVM_TRANSFORM,
 	TRANSFORMS_TYPES_COUNT
 };
 
@@ -46,6 +47,10 @@ enum plot_channel_constraints {
 };
 
 typedef struct _transform Transform;
+struct persistence;
+struct demod;
+struct chanpower;
+struct coherent_avg;
 typedef struct _tr_list TrList;
 
 struct extra_info {
@@ -67,6 +72,9 @@ struct extra_dev_info {
 	bool channel_trigger_enabled;
 	bool trigger_falling_edge;
 	float trigger_value;
+	unsigned int time_avg;		/* captures averaged, 0 or 1 means off */
+	bool time_avg_moving;
+	struct coherent_avg *coherent_avg;
 	double adc_freq;
 	char adc_scale;
 	gfloat **channels_data_copy;
@@ -129,6 +137,7 @@ struct _time_settings {
 	gboolean apply_add_funct;
 	gfloat multiply_value;
 	gfloat add_value;
+	struct persistence *persistence;
 };
 
 struct _fft_settings {
@@ -144,12 +153,14 @@ struct _fft_settings {
 	GMutex *marker_lock;
 	enum marker_types *marker_type;
 	bool window_correction;
+	struct chanpower *chanpower;
 };
 
 struct _constellation_settings {
 	gfloat *x_source;
 	gfloat *y_source;
 	unsigned int num_samples;
+	struct persistence *persistence;
 };
 
 struct _cross_correlation_settings {
@@ -187,6 +198,7 @@ struct _freq_spectrum_settings {
 	gfloat fft_pwr_off;
 	unsigned fft_lower_clipping_limit;
 	unsigned fft_upper_clipping_limit;
+	gfloat *fft_mag;	/* of the clipped bins of one step */
 	struct _fft_alg_data *ffts_alg_data;
 	gfloat fft_corr;
 	unsigned int *maxXaxis;
@@ -198,6 +210,29 @@ struct _freq_spectrum_settings {
 	bool window_correction;
 };
 
+struct _evm_settings {
+	gfloat *i_source;
+	gfloat *q_source;
+	unsigned int num_samples;
+	int modulation;
+	gfloat samples_per_symbol;
+	bool eye_diagram;
+	struct demod *demod;		/* the results shown */
+	struct persistence *persistence;
+
+	/* The demodulation runs on a worker, off the capture path */
+	GThread *worker;
+	GMutex lock;
+	GCond cond;
+	struct demod *work;		/* of the worker */
+	gfloat *in_i, *in_q;		/* the capture handed to the worker */
+	bool pending;			/* in_i/in_q are the worker's */
+	bool ready;			/* work holds results not shown yet */
+	bool work_valid;
+	bool shown;			/* demod holds results */
+	bool stop;
+};
+
 Transform* Transform_new(int tr_type);
 void Transform_destroy(Transform *tr);
 void Transform_resize_x_axis(Transform *tr, int new_size);
@@ -0,0 +1,394 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "demod.h"
+
+static const char * const modulation_names[DEMOD_MODULATIONS_COUNT] = {
+	[DEMOD_BPSK] = "bpsk",
+	[DEMOD_QPSK] = "qpsk",
+	[DEMOD_QAM16] = "qam16",
+	[DEMOD_QAM64] = "qam64",
+};
+
+/* Number of levels on each of the I and Q axes */
+static const unsigned int modulation_levels[DEMOD_MODULATIONS_COUNT] = {
+	[DEMOD_BPSK] = 2,
+	[DEMOD_QPSK] = 2,
+	[DEMOD_QAM16] = 4,
+	[DEMOD_QAM64] = 8,
+};
+
+int demod_modulation_from_string(const char *name)
+{
+	int i;
+
+	for (i = 0; i < DEMOD_MODULATIONS_COUNT; i++)
+		if (!strcmp(name, modulation_names[i]))
+			return i;
+
+	return -EINVAL;
+}
+
+const char * demod_modulation_to_string(enum demod_modulation modulation)
+{
+	if (modulation >= DEMOD_MODULATIONS_COUNT)
+		return "unknown";
+
+	return modulation_names[modulation];
+}
+
+struct demod * demod_new(enum demod_modulation modulation, gfloat sps,
+		unsigned int capacity)
+{
+	struct demod *d;
+	unsigned int i;
+
+	if (modulation >= DEMOD_MODULATIONS_COUNT || sps < 2.0f ||
+			capacity < 4 * sps)
+		return NULL;
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	d->modulation = modulation;
+	d->sps = sps;
+	d->capacity = capacity;
+	d->max_symbols = (unsigned int)((capacity - 3) / sps);
+
+	d->sym_i = calloc(d->max_symbols, sizeof(gfloat));
+	d->sym_q = calloc(d->max_symbols, sizeof(gfloat));
+	d->ref_i = calloc(d->max_symbols, sizeof(gfloat));
+	d->ref_q = calloc(d->max_symbols, sizeof(gfloat));
+	d->eye_x = calloc(capacity, sizeof(gfloat));
+	d->eye_y = calloc(capacity, sizeof(gfloat));
+	d->mag2 = calloc(capacity, sizeof(gfloat));
+	d->om_cos = calloc(capacity, sizeof(gfloat));
+	d->om_sin = calloc(capacity, sizeof(gfloat));
+	if (!d->sym_i || !d->sym_q || !d->ref_i || !d->ref_q ||
+			!d->eye_x || !d->eye_y || !d->mag2 ||
+			!d->om_cos || !d->om_sin) {
+		demod_free(d);
+		return NULL;
+	}
+
+	/* The timing estimate correlates against this for every block */
+	for (i = 0; i < capacity; i++) {
+		double w = 2.0 * M_PI * fmod(i, sps) / sps;
+
+		d->om_cos[i] = cos(w);
+		d->om_sin[i] = sin(w);
+	}
+
+	return d;
+}
+
+void demod_free(struct demod *d)
+{
+	if (!d)
+		return;
+
+	free(d->sym_i);
+	free(d->sym_q);
+	free(d->ref_i);
+	free(d->ref_q);
+	free(d->eye_x);
+	free(d->eye_y);
+	free(d->mag2);
+	free(d->om_cos);
+	free(d->om_sin);
+	free(d);
+}
+
+/* Oerder & Meyr: phase of the symbol rate line of |x|^2 */
+static gfloat timing_estimate(struct demod *d, const gfloat *in_i,
+		const gfloat *in_q, unsigned int n)
+{
+	gfloat * __restrict mag2 = d->mag2;
+	const gfloat * __restrict c = d->om_cos;
+	const gfloat * __restrict s = d->om_sin;
+	gfloat re = 0.0f, im = 0.0f, tau;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		mag2[i] = in_i[i] * in_i[i] + in_q[i] * in_q[i];
+
+	for (i = 0; i < n; i++) {
+		re += mag2[i] * c[i];
+		im -= mag2[i] * s[i];
+	}
+
+	tau = -atan2f(im, re) / (2.0f * (gfloat)M_PI) * d->sps;
+	if (tau < 0.0f)
+		tau += d->sps;
+
+	return tau;
+}
+
+/* Cubic Lagrange interpolation of the symbols at tau + m * sps */
+static unsigned int interpolate_symbols(struct demod *d, const gfloat *in_i,
+		const gfloat *in_q, unsigned int n, gfloat tau)
+{
+	gfloat * __restrict sym_i = d->sym_i;
+	gfloat * __restrict sym_q = d->sym_q;
+	unsigned int m, count;
+
+	/* the interpolator needs one sample before and two after */
+	if (tau < 1.0f)
+		tau += d->sps;
+	if (n < tau + 3.0f)
+		return 0;
+
+	count = (unsigned int)((n - 3 - tau) / d->sps) + 1;
+	if (count > d->max_symbols)
+		count = d->max_symbols;
+
+	for (m = 0; m < count; m++) {
+		gfloat t = tau + m * d->sps;
+		unsigned int k = (unsigned int)t;
+		gfloat mu = t - k;
+		gfloat cm1 = -mu * (mu - 1.0f) * (mu - 2.0f) / 6.0f;
+		gfloat c0 = (mu + 1.0f) * (mu - 1.0f) * (mu - 2.0f) / 2.0f;
+		gfloat c1 = -(mu + 1.0f) * mu * (mu - 2.0f) / 2.0f;
+		gfloat c2 = (mu + 1.0f) * mu * (mu - 1.0f) / 6.0f;
+
+		sym_i[m] = cm1 * in_i[k - 1] + c0 * in_i[k] +
+			c1 * in_i[k + 1] + c2 * in_i[k + 2];
+		sym_q[m] = cm1 * in_q[k - 1] + c0 * in_q[k] +
+			c1 * in_q[k + 1] + c2 * in_q[k + 2];
+	}
+
+	return count;
+}
+
+/*
+ * Lag one product of the modulation free symbols, averaged over blocks of
+ * 'block' symbols after removing the current estimate 'w'. Bigger blocks
+ * average more noise out before the product but alias sooner, so the
+ * estimate is refined over growing block sizes.
+ */
+static gfloat freq_refine(const gfloat *p_i, const gfloat *p_q,
+		unsigned int count, gfloat power, gfloat w, unsigned int block)
+{
+	gfloat f_re = 0.0f, f_im = 0.0f, prev_re = 0.0f, prev_im = 0.0f;
+	unsigned int m, b, blocks = count / block;
+
+	if (blocks < 2)
+		return w;
+
+	for (b = 0; b < blocks; b++) {
+		gfloat b_re = 0.0f, b_im = 0.0f;
+
+		for (m = b * block; m < (b + 1) * block; m++) {
+			gfloat a = -power * w * m;
+			gfloat c = cosf(a), s = sinf(a);
+
+			b_re += p_i[m] * c - p_q[m] * s;
+			b_im += p_i[m] * s + p_q[m] * c;
+		}
+		if (b) {
+			f_re += b_re * prev_re + b_im * prev_im;
+			f_im += b_im * prev_re - b_re * prev_im;
+		}
+		prev_re = b_re;
+		prev_im = b_im;
+	}
+
+	return w + atan2f(f_im, f_re) / (power * block);
+}
+
+/*
+ * M-th power estimation: raising the symbols to the 2nd (BPSK) or 4th
+ * (QPSK, square QAM) power strips the modulation, what is left rotates
+ * with M times the carrier offset.
+ */
+static void carrier_estimate(struct demod *d, unsigned int count,
+		gfloat *freq, gfloat *phase)
+{
+	static const unsigned int blocks[] = { 1, 16, 128 };
+	const gfloat *sym_i = d->sym_i, *sym_q = d->sym_q;
+	gfloat * __restrict p_i = d->ref_i;
+	gfloat * __restrict p_q = d->ref_q;
+	bool bpsk = d->modulation == DEMOD_BPSK;
+	gfloat power = bpsk ? 2.0f : 4.0f;
+	gfloat s_re = 0.0f, s_im = 0.0f;
+	gfloat w = 0.0f, arg;
+	unsigned int m, i;
+
+	for (m = 0; m < count; m++) {
+		gfloat re = sym_i[m] * sym_i[m] - sym_q[m] * sym_q[m];
+		gfloat im = 2.0f * sym_i[m] * sym_q[m];
+
+		if (!bpsk) {
+			gfloat re2 = re * re - im * im;
+
+			im = 2.0f * re * im;
+			re = re2;
+		}
+		p_i[m] = re;
+		p_q[m] = im;
+	}
+
+	for (i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+		w = freq_refine(p_i, p_q, count, power, w, blocks[i]);
+
+	/* the phase is measured after removing the frequency ramp */
+	for (m = 0; m < count; m++) {
+		gfloat a = -power * w * m;
+		gfloat c = cosf(a), s = sinf(a);
+
+		s_re += p_i[m] * c - p_q[m] * s;
+		s_im += p_i[m] * s + p_q[m] * c;
+	}
+
+	arg = atan2f(s_im, s_re);
+	/* square constellations have sum(z^4) on the negative real axis */
+	if (!bpsk)
+		arg -= (gfloat)M_PI;
+
+	*freq = w;
+	*phase = arg / power;
+}
+
+static inline gfloat slice(gfloat x, gfloat step, gfloat max_level)
+{
+	gfloat u = 2.0f * floorf(x / (2.0f * step)) + 1.0f;
+
+	u = u > max_level ? max_level : u;
+	u = u < -max_level ? -max_level : u;
+
+	return u * step;
+}
+
+/* Decide on the nearest ideal point, constellation scaled to unit power */
+static void decide(struct demod *d, unsigned int count)
+{
+	const unsigned int levels = modulation_levels[d->modulation];
+	const gfloat max_level = levels - 1;
+	gfloat * __restrict ref_i = d->ref_i;
+	gfloat * __restrict ref_q = d->ref_q;
+	const gfloat *sym_i = d->sym_i, *sym_q = d->sym_q;
+	gfloat step;
+	unsigned int m;
+
+	if (d->modulation == DEMOD_BPSK) {
+		for (m = 0; m < count; m++) {
+			ref_i[m] = sym_i[m] < 0.0f ? -1.0f : 1.0f;
+			ref_q[m] = 0.0f;
+		}
+		return;
+	}
+
+	/* average power of an L x L square QAM with odd integer levels */
+	step = sqrtf(3.0f / (2.0f * (levels * levels - 1)));
+
+	for (m = 0; m < count; m++) {
+		ref_i[m] = slice(sym_i[m], step, max_level);
+		ref_q[m] = slice(sym_q[m], step, max_level);
+	}
+}
+
+static void scale_symbols(struct demod *d, unsigned int count, gfloat gain)
+{
+	unsigned int m;
+
+	for (m = 0; m < count; m++) {
+		d->sym_i[m] *= gain;
+		d->sym_q[m] *= gain;
+	}
+}
+
+int demod_process(struct demod *d, const gfloat *in_i, const gfloat *in_q,
+		unsigned int n)
+{
+	struct demod_results *res = &d->results;
+	gfloat tau, freq, phase, gain, corr, err, ref, peak;
+	unsigned int count, m, k;
+
+	if (!in_i || !in_q)
+		return -EINVAL;
+	if (n > d->capacity)
+		n = d->capacity;
+
+	tau = timing_estimate(d, in_i, in_q, n);
+	count = interpolate_symbols(d, in_i, in_q, n, tau);
+	if (count < 2)
+		return -EINVAL;
+	if (tau < 1.0f)
+		tau += d->sps;
+
+	carrier_estimate(d, count, &freq, &phase);
+
+	for (m = 0; m < count; m++) {
+		gfloat a = -(freq * m + phase);
+		gfloat c = cosf(a), s = sinf(a);
+		gfloat re = d->sym_i[m] * c - d->sym_q[m] * s;
+		gfloat im = d->sym_i[m] * s + d->sym_q[m] * c;
+
+		d->sym_i[m] = re;
+		d->sym_q[m] = im;
+	}
+
+	/* Normalize to unit power, then refine with a decision directed
+	 * least squares gain so the noise doesn't bias the scale. */
+	for (m = 0, err = 0.0f; m < count; m++)
+		err += d->sym_i[m] * d->sym_i[m] + d->sym_q[m] * d->sym_q[m];
+	if (err == 0.0f)
+		return -EINVAL;
+	gain = 1.0f / sqrtf(err / count);
+	scale_symbols(d, count, gain);
+
+	decide(d, count);
+	for (m = 0, corr = 0.0f, err = 0.0f; m < count; m++) {
+		corr += d->ref_i[m] * d->sym_i[m] + d->ref_q[m] * d->sym_q[m];
+		err += d->sym_i[m] * d->sym_i[m] + d->sym_q[m] * d->sym_q[m];
+	}
+	scale_symbols(d, count, corr / err);
+	gain *= corr / err;
+	decide(d, count);
+
+	for (m = 0, err = 0.0f, ref = 0.0f, peak = 0.0f; m < count; m++) {
+		gfloat e_i = d->sym_i[m] - d->ref_i[m];
+		gfloat e_q = d->sym_q[m] - d->ref_q[m];
+		gfloat e2 = e_i * e_i + e_q * e_q;
+
+		err += e2;
+		ref += d->ref_i[m] * d->ref_i[m] + d->ref_q[m] * d->ref_q[m];
+		peak = e2 > peak ? e2 : peak;
+	}
+
+	/* Unused tail repeats the first point, graphs have a fixed size */
+	for (m = count; m < d->max_symbols; m++) {
+		d->sym_i[m] = d->sym_i[0];
+		d->sym_q[m] = d->sym_q[0];
+	}
+
+	/* Eye: every sample corrected the same way, folded over two symbols
+	 * with the symbol instants at 0 and 1 */
+	for (k = 0; k < n; k++) {
+		gfloat t = (k - tau) / d->sps;
+		gfloat a = -(freq * t + phase);
+		gfloat x = fmodf(t + 0.5f, 2.0f);
+
+		d->eye_x[k] = (x < 0.0f ? x + 2.0f : x) - 0.5f;
+		d->eye_y[k] = gain * (in_i[k] * cosf(a) - in_q[k] * sinf(a));
+	}
+
+	res->num_symbols = count;
+	res->evm_rms = 100.0f * sqrtf(err / ref);
+	res->evm_peak = 100.0f * sqrtf(peak / (ref / count));
+	res->mer = err > 0.0f ? 10.0f * log10f(ref / err) : INFINITY;
+	res->timing_offset = tau;
+	res->freq_offset = freq / (2.0f * (gfloat)M_PI);
+	res->phase_offset = phase;
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __DEMOD_H__
+#define __DEMOD_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+enum demod_modulation {
+	DEMOD_BPSK,
+	DEMOD_QPSK,
+	DEMOD_QAM16,
+	DEMOD_QAM64,
+	DEMOD_MODULATIONS_COUNT
+};
+
+struct demod_results {
+	unsigned int num_symbols;
+	gfloat evm_rms;		/* % of the reference RMS */
+	gfloat evm_peak;	/* % of the reference RMS */
+	gfloat mer;		/* dB */
+	gfloat timing_offset;	/* samples */
+	gfloat freq_offset;	/* cycles per symbol */
+	gfloat phase_offset;	/* radians */
+};
+
+/*
+ * Non data-aided symbol recovery and EVM measurement of a captured I/Q
+ * block: Oerder-Meyr timing estimation, cubic interpolation at the
+ * symbol instants, M-th power carrier frequency/phase estimation and
+ * decision directed gain, followed by slicing against the ideal
+ * constellation.
+ */
+struct demod {
+	enum demod_modulation modulation;
+	gfloat sps;			/* samples per symbol */
+	unsigned int capacity;		/* max samples per block */
+	unsigned int max_symbols;
+
+	gfloat *sym_i, *sym_q;		/* corrected symbols */
+	gfloat *ref_i, *ref_q;		/* decisions */
+	gfloat *eye_x, *eye_y;		/* eye diagram, one point per sample */
+	gfloat *mag2;			/* scratch */
+	gfloat *om_cos, *om_sin;	/* symbol rate tone, for the timing */
+
+	struct demod_results results;
+};
+
+struct demod * demod_new(enum demod_modulation modulation, gfloat sps,
+		unsigned int capacity);
+void demod_free(struct demod *d);
+int demod_process(struct demod *d, const gfloat *in_i, const gfloat *in_q,
+		unsigned int n);
+
+int demod_modulation_from_string(const char *name);
+const char * demod_modulation_to_string(enum demod_modulation modulation);
+
+#endif /* __DEMOD_H__ */
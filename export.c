@@ -0,0 +1,900 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <matio.h>
+
+#include "export.h"
+#include "cJSON/cJSON.h"
+
+/* Snapshots still pointing to the capture buffers */
+G_LOCK_DEFINE_STATIC(borrowed);
+static GSList *borrowed_snapshots;
+
+/* Longest text of one float, "%g" never needs more */
+#define FLOAT_TEXT_MAX	32
+
+/* add backwards compat for <matio-1.5.0 */
+#if MATIO_MAJOR_VERSION == 1 && MATIO_MINOR_VERSION < 5
+typedef int mat_dim;
+#define Mat_CreateVer(name, hdr, ver)	Mat_Create(name, hdr)
+#define MAT_COMPRESSION_ZLIB		COMPRESSION_ZLIB
+#else
+typedef size_t mat_dim;
+#endif
+
+/* Mat_VarWriteAppend() showed up in matio-1.5.17 */
+#if MATIO_MAJOR_VERSION > 1 || (MATIO_MAJOR_VERSION == 1 && \
+	(MATIO_MINOR_VERSION > 5 || \
+	 (MATIO_MINOR_VERSION == 5 && MATIO_RELEASE_LEVEL >= 17)))
+#define MAT_APPEND 1
+#endif
+
+struct export_writer * export_writer_open(const char *path, bool binary)
+{
+	struct export_writer *w;
+	FILE *fp;
+
+	fp = fopen(path, binary ? "wb" : "w");
+	if (!fp)
+		return NULL;
+
+	w = g_new0(struct export_writer, 1);
+	w->fp = fp;
+	w->buf = g_malloc(EXPORT_BUFFER_SIZE);
+
+	return w;
+}
+
+static void export_flush(struct export_writer *w)
+{
+	if (w->len && !w->error && fwrite(w->buf, 1, w->len, w->fp) != w->len)
+		w->error = errno ? -errno : -EIO;
+	w->len = 0;
+}
+
+int export_writer_close(struct export_writer *w)
+{
+	int ret;
+
+	export_flush(w);
+	if (fclose(w->fp) && !w->error)
+		w->error = -errno;
+
+	ret = w->error;
+	g_free(w->buf);
+	g_free(w);
+
+	return ret;
+}
+
+static inline char * export_reserve(struct export_writer *w, size_t len)
+{
+	if (w->len + len > EXPORT_BUFFER_SIZE)
+		export_flush(w);
+
+	return w->buf + w->len;
+}
+
+void export_write(struct export_writer *w, const void *data, size_t len)
+{
+	if (len >= EXPORT_BUFFER_SIZE) {
+		export_flush(w);
+		if (!w->error && fwrite(data, 1, len, w->fp) != len)
+			w->error = errno ? -errno : -EIO;
+		return;
+	}
+
+	memcpy(export_reserve(w, len), data, len);
+	w->len += len;
+}
+
+void export_puts(struct export_writer *w, const char *s)
+{
+	export_write(w, s, strlen(s));
+}
+
+void export_printf(struct export_writer *w, const char *fmt, ...)
+{
+	va_list args;
+	gchar *s;
+
+	va_start(args, fmt);
+	s = g_strdup_vprintf(fmt, args);
+	va_end(args);
+
+	export_puts(w, s);
+	g_free(s);
+}
+
+/*
+ * "%g" of integral values below 1e6 is just their digits, which covers raw
+ * ADC codes. Anything else goes through snprintf.
+ */
+static inline size_t float_to_text(char *p, float value)
+{
+	char digits[8];
+	size_t len = 0, n = 0;
+	unsigned int u;
+
+	if (!(fabsf(value) < 1e6f) || value != (float)(int)value)
+		return snprintf(p, FLOAT_TEXT_MAX, "%g", value);
+
+	if (signbit(value))
+		p[len++] = '-';
+
+	u = (unsigned int)fabsf(value);
+	do {
+		digits[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+
+	while (n)
+		p[len++] = digits[--n];
+
+	return len;
+}
+
+void export_put_float(struct export_writer *w, float value)
+{
+	char *p = export_reserve(w, FLOAT_TEXT_MAX);
+
+	w->len += float_to_text(p, value);
+}
+
+void export_text_samples(struct export_writer *w, const float * const *data,
+		unsigned int num_channels, size_t first, size_t count,
+		const char *sep, const char *eol)
+{
+	size_t sep_len = strlen(sep), eol_len = strlen(eol);
+	size_t row_max = num_channels * (FLOAT_TEXT_MAX + sep_len) + eol_len;
+	size_t i, end = first + count;
+	unsigned int c;
+	char *p;
+
+	for (i = first; i < end; i++) {
+		p = export_reserve(w, row_max);
+
+		for (c = 0; c < num_channels; c++) {
+			if (c) {
+				memcpy(p, sep, sep_len);
+				p += sep_len;
+			}
+			p += float_to_text(p, data[c][i]);
+		}
+		memcpy(p, eol, eol_len);
+		p += eol_len;
+
+		w->len = p - w->buf;
+	}
+}
+
+void export_binary_samples(struct export_writer *w, const float * const *data,
+		unsigned int num_channels, size_t first, size_t count)
+{
+	size_t i, end = first + count;
+	unsigned int c;
+	guint32 v;
+	char *p;
+
+	/* A single channel on a little endian host is already in place */
+	if (num_channels == 1 && G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+		export_write(w, data[0] + first, count * sizeof(float));
+		return;
+	}
+
+	for (i = first; i < end; i++) {
+		p = export_reserve(w, num_channels * sizeof(v));
+
+		for (c = 0; c < num_channels; c++, p += sizeof(v)) {
+			memcpy(&v, &data[c][i], sizeof(v));
+			v = GUINT32_TO_LE(v);
+			memcpy(p, &v, sizeof(v));
+		}
+		w->len += num_channels * sizeof(v);
+	}
+}
+
+int export_sigmf_meta(const char *path, const struct export_sigmf_info *info)
+{
+	cJSON *root, *global, *captures, *capture;
+	GDateTime *now;
+	GString *desc;
+	gchar *text, *datetime;
+	unsigned int i;
+	int ret = 0;
+
+	desc = g_string_new("Channels:");
+	for (i = 0; i < info->num_channels; i++)
+		g_string_append_printf(desc, " %s", info->channel_names[i]);
+
+	now = g_date_time_new_from_unix_utc(info->timestamp / G_USEC_PER_SEC);
+	datetime = g_date_time_format(now, "%Y-%m-%dT%H:%M:%SZ");
+	g_date_time_unref(now);
+
+	root = cJSON_CreateObject();
+	global = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "global", global);
+	cJSON_AddStringToObject(global, "core:datatype", "rf32_le");
+	cJSON_AddStringToObject(global, "core:version", "1.0.0");
+	cJSON_AddNumberToObject(global, "core:sample_rate", info->sample_rate);
+	cJSON_AddNumberToObject(global, "core:num_channels", info->num_channels);
+	cJSON_AddStringToObject(global, "core:hw", info->hw);
+	cJSON_AddStringToObject(global, "core:recorder", "IIO Oscilloscope");
+	cJSON_AddStringToObject(global, "core:description", desc->str);
+
+	captures = cJSON_CreateArray();
+	cJSON_AddItemToObject(root, "captures", captures);
+	capture = cJSON_CreateObject();
+	cJSON_AddNumberToObject(capture, "core:sample_start", 0);
+	cJSON_AddStringToObject(capture, "core:datetime", datetime);
+	cJSON_AddItemToArray(captures, capture);
+
+	cJSON_AddItemToObject(root, "annotations", cJSON_CreateArray());
+
+	text = cJSON_Print(root);
+	if (!text || !g_file_set_contents(path, text, -1, NULL))
+		ret = -EIO;
+
+	cJSON_free(text);
+	cJSON_Delete(root);
+	g_string_free(desc, TRUE);
+	g_free(datetime);
+
+	return ret;
+}
+
+struct export_snapshot * export_snapshot_new(double sample_rate, const char *hw)
+{
+	struct export_snapshot *s = g_new0(struct export_snapshot, 1);
+
+	s->ref = 1;
+	s->sample_rate = sample_rate;
+	s->trigger_position = NAN;
+	s->timestamp = g_get_real_time();
+	s->hw = g_strdup(hw);
+
+	return s;
+}
+
+/* The section stays valid until the next one is added */
+struct export_section * export_snapshot_add_section(struct export_snapshot *s,
+		const char *header, unsigned int count)
+{
+	struct export_section *sec;
+
+	s->sections = g_renew(struct export_section, s->sections,
+			s->num_sections + 1);
+	sec = &s->sections[s->num_sections++];
+	memset(sec, 0, sizeof(*sec));
+	sec->header = g_strdup(header);
+	sec->count = count;
+	sec->borrowed = s->borrowed;
+
+	return sec;
+}
+
+void export_section_add_channel(struct export_section *sec, const char *name,
+		const float *data, const struct export_channel_meta *meta)
+{
+	unsigned int n = sec->num_channels++;
+
+	sec->data = g_renew(float *, sec->data, n + 1);
+	sec->names = g_renew(gchar *, sec->names, n + 1);
+	sec->meta = g_renew(struct export_channel_meta, sec->meta, n + 1);
+
+	if (sec->borrowed) {
+		sec->data[n] = (float *)data;
+	} else {
+		sec->data[n] = g_new(float, sec->count);
+		memcpy(sec->data[n], data, sec->count * sizeof(float));
+	}
+	sec->names[n] = g_strdup(name);
+	if (meta) {
+		sec->meta[n] = *meta;
+	} else {
+		sec->meta[n].full_scale = 1.0;
+		sec->meta[n].lo_freq = 0.0;
+		sec->meta[n].gain = NAN;
+		sec->meta[n].chn = NULL;
+	}
+}
+
+/* Call before adding the sections, from the thread that captures */
+void export_snapshot_borrow(struct export_snapshot *s)
+{
+	G_LOCK(borrowed);
+	s->borrowed = true;
+	borrowed_snapshots = g_slist_prepend(borrowed_snapshots, s);
+	G_UNLOCK(borrowed);
+}
+
+/* Called with the lock held */
+static void snapshot_copy_borrowed(struct export_snapshot *s)
+{
+	unsigned int i, c;
+
+	for (i = 0; i < s->num_sections; i++) {
+		struct export_section *sec = &s->sections[i];
+
+		if (!sec->borrowed)
+			continue;
+
+		for (c = 0; c < sec->num_channels; c++) {
+			const float *data = sec->data[c];
+
+			sec->data[c] = g_new(float, sec->count);
+			memcpy(sec->data[c], data, sec->count * sizeof(float));
+		}
+		sec->borrowed = false;
+	}
+	s->borrowed = false;
+}
+
+void export_snapshot_detach(struct export_snapshot *s)
+{
+	G_LOCK(borrowed);
+	if (s->borrowed) {
+		snapshot_copy_borrowed(s);
+		borrowed_snapshots = g_slist_remove(borrowed_snapshots, s);
+	}
+	G_UNLOCK(borrowed);
+}
+
+void export_snapshots_detach_all(void)
+{
+	GSList *node;
+
+	G_LOCK(borrowed);
+	for (node = borrowed_snapshots; node; node = g_slist_next(node))
+		snapshot_copy_borrowed(node->data);
+	g_slist_free(borrowed_snapshots);
+	borrowed_snapshots = NULL;
+	G_UNLOCK(borrowed);
+}
+
+struct export_snapshot * export_snapshot_ref(struct export_snapshot *s)
+{
+	g_atomic_int_inc(&s->ref);
+	return s;
+}
+
+void export_snapshot_unref(struct export_snapshot *s)
+{
+	unsigned int i, c;
+
+	if (!g_atomic_int_dec_and_test(&s->ref))
+		return;
+
+	G_LOCK(borrowed);
+	if (s->borrowed)
+		borrowed_snapshots = g_slist_remove(borrowed_snapshots, s);
+	G_UNLOCK(borrowed);
+
+	for (i = 0; i < s->num_sections; i++) {
+		struct export_section *sec = &s->sections[i];
+
+		for (c = 0; c < sec->num_channels; c++) {
+			if (!sec->borrowed)
+				g_free(sec->data[c]);
+			g_free(sec->names[c]);
+		}
+		g_free(sec->data);
+		g_free(sec->names);
+		g_free(sec->meta);
+		g_free(sec->header);
+	}
+	g_free(s->sections);
+	g_free(s->hw);
+	g_free(s);
+}
+
+/* JSON description of a capture, next to files that can't hold one */
+int export_snapshot_meta(const char *path, const struct export_snapshot *s)
+{
+	const struct export_section *sec = &s->sections[0];
+	cJSON *root, *channels, *ch;
+	GDateTime *dt;
+	gchar *text, *datetime;
+	unsigned int c;
+	int ret = 0;
+
+	dt = g_date_time_new_from_unix_utc(s->timestamp / G_USEC_PER_SEC);
+	datetime = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%SZ");
+	g_date_time_unref(dt);
+
+	root = cJSON_CreateObject();
+	cJSON_AddStringToObject(root, "device", s->hw ?: "");
+	cJSON_AddStringToObject(root, "datetime", datetime);
+	cJSON_AddNumberToObject(root, "capture", s->capture);
+	cJSON_AddNumberToObject(root, "sample_rate", s->sample_rate);
+	if (!isnan(s->trigger_position))
+		cJSON_AddNumberToObject(root, "trigger_position", s->trigger_position);
+
+	channels = cJSON_CreateArray();
+	cJSON_AddItemToObject(root, "channels", channels);
+	for (c = 0; c < sec->num_channels; c++) {
+		ch = cJSON_CreateObject();
+		cJSON_AddStringToObject(ch, "name", sec->names[c]);
+		cJSON_AddNumberToObject(ch, "lo_freq", sec->meta[c].lo_freq);
+		if (!isnan(sec->meta[c].gain))
+			cJSON_AddNumberToObject(ch, "gain", sec->meta[c].gain);
+		cJSON_AddItemToArray(channels, ch);
+	}
+
+	text = cJSON_Print(root);
+	if (!text || !g_file_set_contents(path, text, -1, NULL))
+		ret = -EIO;
+
+	cJSON_free(text);
+	cJSON_Delete(root);
+	g_free(datetime);
+
+	return ret;
+}
+
+struct export_job * export_job_new(enum export_format format,
+		const char *path, struct export_snapshot *snapshot)
+{
+	struct export_job *job = g_new0(struct export_job, 1);
+
+	job->ref = 1;
+	job->format = format;
+	job->path = g_strdup(path);
+	job->snapshot = export_snapshot_ref(snapshot);
+
+	return job;
+}
+
+void export_job_unref(struct export_job *job)
+{
+	if (!g_atomic_int_dec_and_test(&job->ref))
+		return;
+
+	export_snapshot_unref(job->snapshot);
+	g_free(job->path);
+	g_free(job);
+}
+
+/* Publish the progress, tell whether to go on */
+static bool export_job_step(struct export_job *job, size_t done, size_t total)
+{
+	g_atomic_int_set(&job->progress, total ? (gint)(done * 1000 / total) : 1000);
+	return !g_atomic_int_get(&job->cancel);
+}
+
+static size_t snapshot_total(const struct export_snapshot *s)
+{
+	size_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < s->num_sections; i++)
+		total += s->sections[i].count;
+
+	return total;
+}
+
+static int write_text_section(struct export_job *job, struct export_writer *w,
+		const struct export_section *sec, const char *sep,
+		const char *eol, size_t *done, size_t total)
+{
+	size_t i, n;
+
+	for (i = 0; i < sec->count; i += n) {
+		n = MIN(EXPORT_CHUNK_SAMPLES, sec->count - i);
+		export_text_samples(w, (const float * const *)sec->data,
+				sec->num_channels, i, n, sep, eol);
+		*done += n;
+		if (!export_job_step(job, *done, total))
+			return -ECANCELED;
+	}
+
+	return 0;
+}
+
+static int write_text(struct export_job *job, struct export_writer *w)
+{
+	const struct export_snapshot *s = job->snapshot;
+	size_t done = 0, total = snapshot_total(s);
+	double freq = s->sample_rate;
+	unsigned int i;
+	int ret = 0;
+
+	if (job->format == EXPORT_VSA) {
+		/* Make a VSA file header */
+		export_puts(w, "InputZoom\tTRUE\n");
+		export_puts(w, "InputCenter\t0\n");
+		export_puts(w, "InputRange\t1\n");
+		export_puts(w, "InputRefImped\t50\n");
+		export_puts(w, "XStart\t0\n");
+		export_printf(w, "XDelta\t%-.17f\n", 1.0/freq);
+		export_puts(w, "XDomain\t2\n");
+		export_puts(w, "XUnit\tSec\n");
+		export_puts(w, "YUnit\tV\n");
+		export_printf(w, "FreqValidMax\t%e\n", freq / 2);
+		export_printf(w, "FreqValidMin\t-%e\n", freq / 2);
+		export_puts(w, "Y\n");
+	}
+
+	for (i = 0; !ret && i < s->num_sections; i++) {
+		const struct export_section *sec = &s->sections[i];
+
+		switch (job->format) {
+		case EXPORT_VSA:
+			ret = write_text_section(job, w, sec, "\t", "\t\n",
+					&done, total);
+			break;
+		case EXPORT_TRANSFORM_CSV:
+			if (sec->header)
+				export_puts(w, sec->header);
+			if (!sec->num_channels)
+				continue;
+			ret = write_text_section(job, w, sec, ", ", ",\n",
+					&done, total);
+			break;
+		default:
+			ret = write_text_section(job, w, sec, ", ", ", \n",
+					&done, total);
+			break;
+		}
+		export_puts(w, "\n");
+	}
+
+	if (job->format != EXPORT_VSA)
+		export_puts(w, "\n");
+
+	return ret;
+}
+
+static int write_sigmf(struct export_job *job)
+{
+	const struct export_snapshot *s = job->snapshot;
+	const struct export_section *sec = &s->sections[0];
+	struct export_sigmf_info info;
+	struct export_writer *w;
+	gchar *data_name, *meta_name;
+	size_t i, n;
+	int ret = 0;
+
+	data_name = g_strdup_printf("%s.sigmf-data", job->path);
+	meta_name = g_strdup_printf("%s.sigmf-meta", job->path);
+
+	w = export_writer_open(data_name, true);
+	if (!w) {
+		ret = -errno;
+		goto out;
+	}
+
+	for (i = 0; !ret && i < sec->count; i += n) {
+		n = MIN(EXPORT_CHUNK_SAMPLES, sec->count - i);
+		export_binary_samples(w, (const float * const *)sec->data,
+				sec->num_channels, i, n);
+		if (!export_job_step(job, i + n, sec->count))
+			ret = -ECANCELED;
+	}
+
+	if (export_writer_close(w) && !ret)
+		ret = -EIO;
+	if (ret) {
+		remove(data_name);
+		goto out;
+	}
+
+	info.sample_rate = s->sample_rate;
+	info.timestamp = s->timestamp;
+	info.num_channels = sec->num_channels;
+	info.hw = s->hw;
+	info.channel_names = (const char * const *)sec->names;
+	ret = export_sigmf_meta(meta_name, &info);
+out:
+	g_free(data_name);
+	g_free(meta_name);
+	return ret;
+}
+
+static matvar_t * mat_double(double value)
+{
+	mat_dim dims[2] = {1, 1};
+
+	return Mat_VarCreate(NULL, MAT_C_DOUBLE, MAT_T_DOUBLE, 2, dims, &value, 0);
+}
+
+static matvar_t * mat_string(const char *str)
+{
+	mat_dim dims[2] = {1, strlen(str)};
+
+	return Mat_VarCreate(NULL, MAT_C_CHAR, MAT_T_UINT8, 2, dims,
+			(void *)str, 0);
+}
+
+/*
+ * Capture settings, as a struct next to the channel variables. scaled tells
+ * whether the channels were divided by their full_scale on the way out.
+ */
+static int write_mat_info(mat_t *mat, const struct export_snapshot *s,
+		bool scaled)
+{
+	const struct export_section *sec = &s->sections[0];
+	const char *fields[] = {
+		"device", "sample_rate", "lo_freq", "gain", "trigger_position",
+		"capture", "timestamp", "full_scale", "scaled",
+	};
+	mat_dim dims[2] = {1, 1}, col[2] = {sec->num_channels, 1};
+	double *lo, *gain, *full_scale;
+	matvar_t *info;
+	unsigned int c;
+	int ret;
+
+	lo = g_new(double, sec->num_channels);
+	gain = g_new(double, sec->num_channels);
+	full_scale = g_new(double, sec->num_channels);
+	for (c = 0; c < sec->num_channels; c++) {
+		lo[c] = sec->meta[c].lo_freq;
+		gain[c] = sec->meta[c].gain;
+		full_scale[c] = sec->meta[c].full_scale;
+	}
+
+	info = Mat_VarCreateStruct("capture_info", 2, dims, fields,
+			G_N_ELEMENTS(fields));
+	if (!info) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	Mat_VarSetStructFieldByName(info, "device", 0, mat_string(s->hw ?: ""));
+	Mat_VarSetStructFieldByName(info, "sample_rate", 0,
+			mat_double(s->sample_rate));
+	Mat_VarSetStructFieldByName(info, "lo_freq", 0, Mat_VarCreate(NULL,
+			MAT_C_DOUBLE, MAT_T_DOUBLE, 2, col, lo, 0));
+	Mat_VarSetStructFieldByName(info, "gain", 0, Mat_VarCreate(NULL,
+			MAT_C_DOUBLE, MAT_T_DOUBLE, 2, col, gain, 0));
+	Mat_VarSetStructFieldByName(info, "trigger_position", 0,
+			mat_double(s->trigger_position));
+	Mat_VarSetStructFieldByName(info, "capture", 0, mat_double(s->capture));
+	Mat_VarSetStructFieldByName(info, "timestamp", 0,
+			mat_double(s->timestamp / (double)G_USEC_PER_SEC));
+	Mat_VarSetStructFieldByName(info, "full_scale", 0, Mat_VarCreate(NULL,
+			MAT_C_DOUBLE, MAT_T_DOUBLE, 2, col, full_scale, 0));
+	Mat_VarSetStructFieldByName(info, "scaled", 0, mat_double(scaled));
+
+	ret = Mat_VarWrite(mat, info, MAT_COMPRESSION_ZLIB) ? -EIO : 0;
+	Mat_VarFree(info);
+out:
+	g_free(lo);
+	g_free(gain);
+	g_free(full_scale);
+	return ret;
+}
+
+#ifdef MAT_APPEND
+/*
+ * Append the channel one chunk at a time, scaling each chunk on its way
+ * out. Only a chunk is held besides the snapshot, whatever the capture
+ * length. Needs a v7.3 (HDF5) file.
+ */
+static int write_mat_chunked(struct export_job *job, mat_t *mat,
+		const char *name, unsigned int c, size_t *done, size_t total)
+{
+	const struct export_section *sec = &job->snapshot->sections[0];
+	const float *src = sec->data[c];
+	double scale = 1.0 / sec->meta[c].full_scale;
+	gdouble *tmp_data = NULL;
+	matvar_t *matvar;
+	mat_dim dims[2];
+	size_t i, j, n;
+	int ret = 0;
+
+	if (job->mat_scale)
+		tmp_data = g_new(gdouble, EXPORT_CHUNK_SAMPLES);
+
+	for (i = 0; !ret && i < sec->count; i += n) {
+		n = MIN(EXPORT_CHUNK_SAMPLES, sec->count - i);
+		dims[0] = n;
+		dims[1] = 1;
+
+		if (!job->mat_scale) {
+			matvar = Mat_VarCreate(name, MAT_C_SINGLE, MAT_T_SINGLE, 2,
+					dims, (void *)(src + i), MAT_F_DONT_COPY_DATA);
+		} else {
+			for (j = 0; j < n; j++)
+				tmp_data[j] = src[i + j] * scale;
+			matvar = Mat_VarCreate(name, MAT_C_DOUBLE, MAT_T_DOUBLE, 2,
+					dims, tmp_data, MAT_F_DONT_COPY_DATA);
+		}
+		if (!matvar) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (Mat_VarWriteAppend(mat, matvar, MAT_COMPRESSION_ZLIB, 1))
+			ret = -EIO;
+		Mat_VarFree(matvar);
+
+		*done += n;
+		if (!ret && !export_job_step(job, *done, total))
+			ret = -ECANCELED;
+	}
+
+	g_free(tmp_data);
+	return ret;
+}
+#endif
+
+/*
+ * v5 files take a variable in one go. Scaled channels go through a double
+ * copy of the one channel being written, not of the whole capture.
+ */
+static int write_mat_whole(struct export_job *job, mat_t *mat,
+		const char *name, unsigned int c, size_t *done, size_t total)
+{
+	const struct export_section *sec = &job->snapshot->sections[0];
+	mat_dim dims[2] = {sec->count, 1};
+	gdouble *tmp_data = NULL;
+	matvar_t *matvar;
+	size_t i;
+	int ret = 0;
+
+	if (!job->mat_scale) {
+		matvar = Mat_VarCreate(name, MAT_C_SINGLE, MAT_T_SINGLE, 2, dims,
+				sec->data[c], MAT_F_DONT_COPY_DATA);
+	} else {
+		double scale = 1.0 / sec->meta[c].full_scale;
+
+		tmp_data = g_new(gdouble, sec->count);
+		for (i = 0; i < sec->count; i++)
+			tmp_data[i] = sec->data[c][i] * scale;
+		matvar = Mat_VarCreate(name, MAT_C_DOUBLE, MAT_T_DOUBLE, 2, dims,
+				tmp_data, MAT_F_DONT_COPY_DATA);
+	}
+	if (!matvar) {
+		ret = -ENOMEM;
+	} else {
+		if (Mat_VarWrite(mat, matvar, MAT_COMPRESSION_ZLIB))
+			ret = -EIO;
+		Mat_VarFree(matvar);
+	}
+	g_free(tmp_data);
+
+	*done += sec->count;
+	if (!ret && !export_job_step(job, *done, total))
+		ret = -ECANCELED;
+
+	return ret;
+}
+
+static int write_mat(struct export_job *job)
+{
+	const struct export_snapshot *s = job->snapshot;
+	const struct export_section *sec = &s->sections[0];
+	size_t done = 0, total = (size_t)sec->num_channels * sec->count;
+	bool chunked = false;
+	mat_t *mat = NULL;
+	unsigned int c;
+	int ret = 0;
+
+	/* v7.3 if matio was built with HDF5, compressed v5 otherwise */
+#ifdef MAT_APPEND
+	mat = Mat_CreateVer(job->path, NULL, MAT_FT_MAT73);
+	chunked = !!mat;
+#endif
+	if (!mat)
+		mat = Mat_CreateVer(job->path, NULL, MAT_FT_MAT5);
+	if (!mat)
+		return errno ? -errno : -EIO;
+
+	for (c = 0; !ret && c < sec->num_channels; c++) {
+		gchar *name = g_strdup_printf("%s_%s", s->hw, sec->names[c]);
+
+		g_strdelimit(name, "-", '_');
+#ifdef MAT_APPEND
+		if (chunked)
+			ret = write_mat_chunked(job, mat, name, c, &done, total);
+		else
+#endif
+			ret = write_mat_whole(job, mat, name, c, &done, total);
+		if (ret && ret != -ECANCELED)
+			fprintf(stderr, "error writing matvar on channel %s\n", name);
+		g_free(name);
+	}
+
+	if (!ret)
+		ret = write_mat_info(mat, s, job->mat_scale);
+
+	Mat_Close(mat);
+	if (ret)
+		remove(job->path);
+
+	return ret;
+}
+
+/* Write the file in the calling thread */
+int export_job_run(struct export_job *job)
+{
+	struct export_writer *w;
+	int ret;
+
+	switch (job->format) {
+	case EXPORT_SIGMF:
+		ret = write_sigmf(job);
+		break;
+	case EXPORT_MAT:
+		ret = write_mat(job);
+		break;
+	default:
+		w = export_writer_open(job->path, false);
+		if (!w) {
+			ret = -errno;
+			break;
+		}
+		ret = write_text(job, w);
+		if (export_writer_close(w) && !ret)
+			ret = -EIO;
+		if (ret == -ECANCELED)
+			remove(job->path);
+		break;
+	}
+
+	return ret;
+}
+
+static void export_worker(gpointer data, gpointer user_data)
+{
+	struct export_job *job = data;
+
+	if (g_atomic_int_get(&job->cancel))
+		job->error = -ECANCELED;
+	else
+		job->error = export_job_run(job);
+
+	g_atomic_int_set(&job->done, 1);
+	export_job_unref(job);
+}
+
+static GThreadPool * export_pool(void)
+{
+	static gsize pool;
+
+	if (g_once_init_enter(&pool)) {
+		GThreadPool *p = g_thread_pool_new(export_worker, NULL,
+				EXPORT_MAX_JOBS, FALSE, NULL);
+
+		g_once_init_leave(&pool, (gsize)p);
+	}
+
+	return (GThreadPool *)pool;
+}
+
+void export_job_start(struct export_job *job)
+{
+	g_atomic_int_inc(&job->ref);
+	g_thread_pool_push(export_pool(), job, NULL);
+}
+
+void export_job_cancel(struct export_job *job)
+{
+	g_atomic_int_set(&job->cancel, 1);
+}
+
+double export_job_progress(struct export_job *job)
+{
+	return g_atomic_int_get(&job->progress) / 1000.0;
+}
+
+/* The error is only meaningful once the job is finished */
+bool export_job_finished(struct export_job *job, int *error)
+{
+	if (!g_atomic_int_get(&job->done))
+		return false;
+
+	if (error)
+		*error = job->error;
+	return true;
+}
@@ -0,0 +1,150 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define EXPORT_BUFFER_SIZE	(1 << 20)
+
+/*
+ * Buffered writer for the capture exports. Everything is formatted into a
+ * large buffer that goes to the file in big writes, instead of one stdio
+ * call per sample. The first error sticks and is returned on close.
+ */
+struct export_writer {
+	FILE *fp;
+	char *buf;
+	size_t len;
+	int error;
+};
+
+struct export_writer * export_writer_open(const char *path, bool binary);
+int export_writer_close(struct export_writer *w);
+
+void export_write(struct export_writer *w, const void *data, size_t len);
+void export_puts(struct export_writer *w, const char *s);
+void export_printf(struct export_writer *w, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void export_put_float(struct export_writer *w, float value);
+
+/*
+ * One row per sample, values separated by sep and the row ended by eol.
+ * Values are formatted the same as "%g".
+ */
+void export_text_samples(struct export_writer *w, const float * const *data,
+		unsigned int num_channels, size_t first, size_t count,
+		const char *sep, const char *eol);
+
+/* Interleaved little endian float32, the SigMF rf32_le layout */
+void export_binary_samples(struct export_writer *w, const float * const *data,
+		unsigned int num_channels, size_t first, size_t count);
+
+struct export_sigmf_info {
+	double sample_rate;
+	gint64 timestamp;		/* us since the epoch */
+	unsigned int num_channels;
+	const char *hw;			/* device name */
+	const char * const *channel_names;
+};
+
+int export_sigmf_meta(const char *path, const struct export_sigmf_info *info);
+
+#define EXPORT_CHUNK_SAMPLES	65536
+#define EXPORT_MAX_JOBS		2
+
+struct iio_channel;
+
+struct export_channel_meta {
+	double full_scale;		/* MAT scaling, 2^(bits - sign) */
+	double lo_freq;			/* Hz, 0 when unknown */
+	double gain;			/* dB, NaN when unknown */
+	const struct iio_channel *chn;	/* gain still to be read from it */
+};
+
+/*
+ * Copy of the capture data, taken in the GUI thread so that the capture
+ * can go on while it is written. One section per device or per transform.
+ *
+ * A borrowing snapshot skips the copy on the capture path: its channels
+ * point to the capture buffers until export_snapshot_detach(), which the
+ * writer calls from its own thread. Whatever overwrites those buffers
+ * calls export_snapshots_detach_all() first, in case the writer has not
+ * got to it yet.
+ */
+struct export_section {
+	gchar *header;			/* transform CSV title, or NULL */
+	unsigned int num_channels;
+	unsigned int count;		/* samples per channel */
+	float **data;
+	bool borrowed;			/* data is not ours */
+	gchar **names;
+	struct export_channel_meta *meta;
+};
+
+struct export_snapshot {
+	gint ref;
+	struct export_section *sections;
+	unsigned int num_sections;
+	double sample_rate;
+	double trigger_position;	/* sample index, NaN without trigger */
+	gint64 timestamp;		/* us since the epoch */
+	guint64 capture;		/* sequence number, for auto export */
+	gchar *hw;
+	bool borrowed;			/* sections added from now on borrow */
+};
+
+struct export_snapshot * export_snapshot_new(double sample_rate, const char *hw);
+struct export_section * export_snapshot_add_section(struct export_snapshot *s,
+		const char *header, unsigned int count);
+void export_section_add_channel(struct export_section *sec, const char *name,
+		const float *data, const struct export_channel_meta *meta);
+void export_snapshot_borrow(struct export_snapshot *s);
+void export_snapshot_detach(struct export_snapshot *s);
+void export_snapshots_detach_all(void);
+struct export_snapshot * export_snapshot_ref(struct export_snapshot *s);
+int export_snapshot_meta(const char *path, const struct export_snapshot *s);
+void export_snapshot_unref(struct export_snapshot *s);
+
+enum export_format {
+	EXPORT_CSV,
+	EXPORT_TRANSFORM_CSV,
+	EXPORT_VSA,
+	EXPORT_SIGMF,		/* path is the base name */
+	EXPORT_MAT,
+};
+
+/*
+ * A file being written in the background. Up to EXPORT_MAX_JOBS run at the
+ * same time, the others wait in turn. The progress and the result are
+ * polled from the GUI thread.
+ */
+struct export_job {
+	gint ref;
+	enum export_format format;
+	gchar *path;
+	struct export_snapshot *snapshot;
+	bool mat_scale;			/* divide by full scale, as doubles */
+
+	gint progress;			/* per mille */
+	gint cancel;
+	gint done;
+	int error;
+};
+
+struct export_job * export_job_new(enum export_format format,
+		const char *path, struct export_snapshot *snapshot);
+void export_job_unref(struct export_job *job);
+int export_job_run(struct export_job *job);
+void export_job_start(struct export_job *job);
+void export_job_cancel(struct export_job *job);
+double export_job_progress(struct export_job *job);
+bool export_job_finished(struct export_job *job, int *error);
+
+#endif /* __EXPORT_H__ */
@@ -142,7 +142,8 @@ static void iio_spin_button_update(struct iio_widget *widget)
 		gtk_widget_hide(widget->widget);
 }
 
-static void spin_button_save(struct iio_widget *widget, bool is_double)
+/* The value of the spin button, as the attribute takes it */
+gdouble iio_spin_button_get_attr_value(struct iio_widget *widget)
 {
 	gdouble freq, min;
 	gdouble scale = widget->priv ? *(gdouble *)widget->priv : 1.0;
@@ -157,6 +158,13 @@ static void spin_button_save(struct iio_widget *widget, bool is_double)
 	if (widget->priv_convert_function)
 		freq = ((double (*)(double, bool))widget->priv_convert_function)(freq, false);
 
+	return freq;
+}
+
+static void spin_button_save(struct iio_widget *widget, bool is_double)
+{
+	gdouble freq = iio_spin_button_get_attr_value(widget);
+
 	if (widget->chn) {
 		if (is_double)
 			iio_channel_attr_write_double(widget->chn,
@@ -112,4 +112,5 @@ void iio_spin_button_set_convert_function(struct iio_widget *iio_w,
 		double (*convert)(double, bool inverse));
 
 void iio_spin_button_save(struct iio_widget *widget);
+gdouble iio_spin_button_get_attr_value(struct iio_widget *widget);
 #endif
@@ -0,0 +1,1206 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "math_compiler.h"
+#include "math_filter.h"
+
+enum math_op {
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_NEG,
+	OP_NOT,
+	OP_LT,
+	OP_GT,
+	OP_LE,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_AND,
+	OP_OR,
+	OP_MIN,
+	OP_MAX,
+	OP_SELECT,
+	OP_CALL1,
+	OP_CALL2,
+	OP_FILTER,
+	OP_TOFLOAT,
+};
+
+enum math_slot_kind {
+	SLOT_REG,
+	SLOT_CONST,
+	SLOT_CHANNEL,
+	SLOT_INDEX,
+	SLOT_COUNT,
+	SLOT_PREVIOUS,
+};
+
+/*
+ * C types of the values. Integers are held as long long, so that integer
+ * division truncates and Index stays exact however long the capture; they
+ * are converted to float where the C code would convert them.
+ */
+enum math_type {
+	MATH_FLOAT,
+	MATH_INT,			/* literals, comparisons */
+	MATH_UINT,			/* Index, SampleCount */
+};
+
+typedef float (*math_fn1)(float);
+typedef float (*math_fn2)(float, float);
+
+struct math_slot {
+	enum math_slot_kind kind;
+	enum math_type type;
+	unsigned int index;		/* register or channel */
+	float value;
+	long long ivalue;		/* of the integer constants */
+	float *block;			/* data of the non register slots */
+	long long *iblock;
+};
+
+struct math_insn {
+	enum math_op op;
+	enum math_type type;		/* of the operands, OP_SELECT's b and c */
+	unsigned int dst, a, b, c;
+	math_fn1 fn1;
+	math_fn2 fn2;
+	unsigned int filter;
+};
+
+struct math_parser {
+	const char *start;
+	const char *pos;
+	GSList *basenames;
+	struct math_program *prog;
+	gchar *error;
+
+	bool reg_used[MATH_MAX_REGISTERS];
+	int reg_slot[MATH_MAX_REGISTERS];
+	int index_slot, count_slot, previous_slot;
+};
+
+struct math_function_def {
+	const char *name;
+	math_fn1 fn1;
+	math_fn2 fn2;
+};
+
+/* Both the float and the double names, they all evaluate in float */
+#define FN1(name) { #name, name##f, NULL }, { #name "f", name##f, NULL }
+#define FN2(name) { #name, NULL, name##f }, { #name "f", NULL, name##f }
+
+static const struct math_function_def functions[] = {
+	FN1(sin), FN1(cos), FN1(tan), FN1(asin), FN1(acos), FN1(atan),
+	FN1(sinh), FN1(cosh), FN1(tanh), FN1(asinh), FN1(acosh), FN1(atanh),
+	FN1(exp), FN1(exp2), FN1(expm1), FN1(log), FN1(log10), FN1(log2),
+	FN1(log1p), FN1(sqrt), FN1(cbrt), FN1(fabs), FN1(floor), FN1(ceil),
+	FN1(round), FN1(trunc),
+	FN2(pow), FN2(atan2), FN2(fmod), FN2(hypot), FN2(fmin), FN2(fmax),
+	FN2(copysign),
+};
+
+static const struct {
+	const char *name;
+	double value;
+} constants[] = {
+	{ "M_E", M_E }, { "M_LOG2E", M_LOG2E }, { "M_LOG10E", M_LOG10E },
+	{ "M_LN2", M_LN2 }, { "M_LN10", M_LN10 }, { "M_PI", M_PI },
+	{ "M_PI_2", M_PI_2 }, { "M_PI_4", M_PI_4 }, { "M_1_PI", M_1_PI },
+	{ "M_2_PI", M_2_PI }, { "M_2_SQRTPI", M_2_SQRTPI },
+	{ "M_SQRT2", M_SQRT2 }, { "M_SQRT1_2", M_SQRT1_2 },
+};
+
+#define BLOCK_LOOP(out, expr) \
+	for (i = 0; i < len; i++) \
+		out[i] = (expr)
+
+/*
+ * One instruction over len samples. Comparisons and logic give a C int,
+ * everything else has the type of its operands. Integers are compared,
+ * divided and converted as unsigned when MATH_UINT; x / 0 gives 0 where
+ * the C code would trap.
+ */
+static void exec_insn(const struct math_insn *insn,
+		struct math_filter **filters,
+		float *__restrict d, long long *__restrict id,
+		const float *__restrict a, const float *__restrict b,
+		const float *__restrict c, const long long *__restrict ia,
+		const long long *__restrict ib, const long long *__restrict ic,
+		unsigned int len)
+{
+	const unsigned long long *ua = (const unsigned long long *)ia;
+	const unsigned long long *ub = (const unsigned long long *)ib;
+	bool u = insn->type == MATH_UINT;
+	unsigned int i;
+
+	if (insn->type == MATH_FLOAT) {
+		switch (insn->op) {
+		case OP_ADD: BLOCK_LOOP(d, a[i] + b[i]); break;
+		case OP_SUB: BLOCK_LOOP(d, a[i] - b[i]); break;
+		case OP_MUL: BLOCK_LOOP(d, a[i] * b[i]); break;
+		case OP_DIV: BLOCK_LOOP(d, a[i] / b[i]); break;
+		case OP_NEG: BLOCK_LOOP(d, -a[i]); break;
+		case OP_NOT: BLOCK_LOOP(id, !a[i]); break;
+		case OP_LT: BLOCK_LOOP(id, a[i] < b[i]); break;
+		case OP_GT: BLOCK_LOOP(id, a[i] > b[i]); break;
+		case OP_LE: BLOCK_LOOP(id, a[i] <= b[i]); break;
+		case OP_GE: BLOCK_LOOP(id, a[i] >= b[i]); break;
+		case OP_EQ: BLOCK_LOOP(id, a[i] == b[i]); break;
+		case OP_NE: BLOCK_LOOP(id, a[i] != b[i]); break;
+		case OP_AND: BLOCK_LOOP(id, a[i] && b[i]); break;
+		case OP_OR: BLOCK_LOOP(id, a[i] || b[i]); break;
+		case OP_MIN: BLOCK_LOOP(d, a[i] < b[i] ? a[i] : b[i]); break;
+		case OP_MAX: BLOCK_LOOP(d, a[i] > b[i] ? a[i] : b[i]); break;
+		case OP_SELECT: BLOCK_LOOP(d, ia[i] ? b[i] : c[i]); break;
+		case OP_CALL1: BLOCK_LOOP(d, insn->fn1(a[i])); break;
+		case OP_CALL2: BLOCK_LOOP(d, insn->fn2(a[i], b[i])); break;
+		case OP_FILTER:
+			math_filter_run(filters[insn->filter], a, d, len);
+			break;
+		case OP_TOFLOAT:
+			break;
+		}
+		return;
+	}
+
+	/* Wrapping arithmetic is done unsigned, as it is defined there */
+	switch (insn->op) {
+	case OP_ADD: BLOCK_LOOP(id, ua[i] + ub[i]); break;
+	case OP_SUB: BLOCK_LOOP(id, ua[i] - ub[i]); break;
+	case OP_MUL: BLOCK_LOOP(id, ua[i] * ub[i]); break;
+	case OP_DIV:
+		if (u)
+			BLOCK_LOOP(id, ub[i] ? ua[i] / ub[i] : 0);
+		else
+			BLOCK_LOOP(id, ib[i] == -1 ? (long long)-ua[i] :
+					ib[i] ? ia[i] / ib[i] : 0);
+		break;
+	case OP_NEG: BLOCK_LOOP(id, -ua[i]); break;
+	case OP_NOT: BLOCK_LOOP(id, !ia[i]); break;
+	case OP_LT:
+		if (u)
+			BLOCK_LOOP(id, ua[i] < ub[i]);
+		else
+			BLOCK_LOOP(id, ia[i] < ib[i]);
+		break;
+	case OP_GT:
+		if (u)
+			BLOCK_LOOP(id, ua[i] > ub[i]);
+		else
+			BLOCK_LOOP(id, ia[i] > ib[i]);
+		break;
+	case OP_LE:
+		if (u)
+			BLOCK_LOOP(id, ua[i] <= ub[i]);
+		else
+			BLOCK_LOOP(id, ia[i] <= ib[i]);
+		break;
+	case OP_GE:
+		if (u)
+			BLOCK_LOOP(id, ua[i] >= ub[i]);
+		else
+			BLOCK_LOOP(id, ia[i] >= ib[i]);
+		break;
+	case OP_EQ: BLOCK_LOOP(id, ia[i] == ib[i]); break;
+	case OP_NE: BLOCK_LOOP(id, ia[i] != ib[i]); break;
+	case OP_AND: BLOCK_LOOP(id, ia[i] && ib[i]); break;
+	case OP_OR: BLOCK_LOOP(id, ia[i] || ib[i]); break;
+	case OP_MIN:
+		if (u)
+			BLOCK_LOOP(id, ua[i] < ub[i] ? ia[i] : ib[i]);
+		else
+			BLOCK_LOOP(id, ia[i] < ib[i] ? ia[i] : ib[i]);
+		break;
+	case OP_MAX:
+		if (u)
+			BLOCK_LOOP(id, ua[i] > ub[i] ? ia[i] : ib[i]);
+		else
+			BLOCK_LOOP(id, ia[i] > ib[i] ? ia[i] : ib[i]);
+		break;
+	case OP_SELECT: BLOCK_LOOP(id, ia[i] ? ib[i] : ic[i]); break;
+	case OP_TOFLOAT:
+		if (u)
+			BLOCK_LOOP(d, ua[i]);
+		else
+			BLOCK_LOOP(d, ia[i]);
+		break;
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_FILTER:
+		break;
+	}
+}
+
+static enum math_type result_type(const struct math_insn *insn)
+{
+	switch (insn->op) {
+	case OP_NOT:
+	case OP_LT:
+	case OP_GT:
+	case OP_LE:
+	case OP_GE:
+	case OP_EQ:
+	case OP_NE:
+	case OP_AND:
+	case OP_OR:
+		return MATH_INT;
+	case OP_TOFLOAT:
+		return MATH_FLOAT;
+	default:
+		return insn->type;
+	}
+}
+
+static void parse_error(struct math_parser *ps, const char *msg)
+{
+	if (!ps->error)
+		ps->error = g_strdup_printf("%s at position %d", msg,
+				(int)(ps->pos - ps->start) + 1);
+}
+
+static int new_slot(struct math_parser *ps, enum math_slot_kind kind,
+		enum math_type type, unsigned int index)
+{
+	struct math_program *prog = ps->prog;
+	struct math_slot *slot;
+
+	prog->slots = g_renew(struct math_slot, prog->slots,
+			prog->num_slots + 1);
+	slot = &prog->slots[prog->num_slots];
+	slot->kind = kind;
+	slot->type = type;
+	slot->index = index;
+	slot->value = 0.0f;
+	slot->ivalue = 0;
+	slot->block = NULL;
+	slot->iblock = NULL;
+	if ((kind == SLOT_CONST || kind == SLOT_COUNT) && type == MATH_FLOAT)
+		slot->block = g_new(float, MATH_BLOCK_SIZE);
+	else if (kind == SLOT_CONST || kind == SLOT_COUNT)
+		slot->iblock = g_new(long long, MATH_BLOCK_SIZE);
+
+	return prog->num_slots++;
+}
+
+static int const_slot(struct math_parser *ps, float value)
+{
+	unsigned int i;
+	int slot;
+
+	for (i = 0; i < ps->prog->num_slots; i++)
+		if (ps->prog->slots[i].kind == SLOT_CONST &&
+				ps->prog->slots[i].type == MATH_FLOAT &&
+				!memcmp(&ps->prog->slots[i].value, &value, sizeof(value)))
+			return i;
+
+	slot = new_slot(ps, SLOT_CONST, MATH_FLOAT, 0);
+	ps->prog->slots[slot].value = value;
+	return slot;
+}
+
+/* value also holds the float of it, for the filter parameters */
+static int int_const_slot(struct math_parser *ps, enum math_type type,
+		long long value)
+{
+	struct math_slot *s;
+	unsigned int i;
+	int slot;
+
+	for (i = 0; i < ps->prog->num_slots; i++)
+		if (ps->prog->slots[i].kind == SLOT_CONST &&
+				ps->prog->slots[i].type == type &&
+				ps->prog->slots[i].ivalue == value)
+			return i;
+
+	slot = new_slot(ps, SLOT_CONST, type, 0);
+	s = &ps->prog->slots[slot];
+	s->ivalue = value;
+	if (type == MATH_UINT)
+		s->value = (unsigned long long)value;
+	else
+		s->value = value;
+	return slot;
+}
+
+static bool slot_is_const(struct math_parser *ps, int slot)
+{
+	return ps->prog->slots[slot].kind == SLOT_CONST;
+}
+
+static int alloc_reg(struct math_parser *ps)
+{
+	unsigned int r;
+
+	for (r = 0; r < MATH_MAX_REGISTERS; r++) {
+		if (ps->reg_used[r])
+			continue;
+
+		ps->reg_used[r] = true;
+		if (ps->reg_slot[r] < 0)
+			ps->reg_slot[r] = new_slot(ps, SLOT_REG, MATH_FLOAT, r);
+		if (r + 1 > ps->prog->num_regs)
+			ps->prog->num_regs = r + 1;
+		return ps->reg_slot[r];
+	}
+
+	parse_error(ps, "Expression too complex");
+	return -1;
+}
+
+static void release_slot(struct math_parser *ps, int slot)
+{
+	if (ps->prog->slots[slot].kind == SLOT_REG)
+		ps->reg_used[ps->prog->slots[slot].index] = false;
+}
+
+static int to_float(struct math_parser *ps, int slot);
+static int to_bool(struct math_parser *ps, int slot);
+
+/* The C usual arithmetic conversions, between long long and float */
+static enum math_type common_type(struct math_parser *ps, int a, int b)
+{
+	enum math_type ta = ps->prog->slots[a].type;
+	enum math_type tb = ps->prog->slots[b].type;
+
+	if (ta == MATH_FLOAT || tb == MATH_FLOAT)
+		return MATH_FLOAT;
+
+	return (ta == MATH_UINT || tb == MATH_UINT) ? MATH_UINT : MATH_INT;
+}
+
+/*
+ * Emit an instruction, or fold it when all its operands are constant.
+ * Integer operands are converted first when the other one is a float,
+ * or when they go to a function or a filter.
+ */
+static int emit(struct math_parser *ps, struct math_insn insn, int nargs,
+		int a, int b, int c)
+{
+	struct math_program *prog = ps->prog;
+	int dst;
+
+	if (a < 0 || (nargs > 1 && b < 0) || (nargs > 2 && c < 0))
+		return -1;
+
+	switch (insn.op) {
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_FILTER:
+		insn.type = MATH_FLOAT;
+		break;
+	case OP_SELECT:
+		insn.type = common_type(ps, b, c);
+		break;
+	case OP_TOFLOAT:
+		break;
+	default:
+		insn.type = common_type(ps, a, nargs > 1 ? b : a);
+		break;
+	}
+
+	if (insn.op == OP_SELECT)
+		a = to_bool(ps, a);
+	else if (insn.type == MATH_FLOAT)
+		a = to_float(ps, a);
+	if (insn.type == MATH_FLOAT && nargs > 1)
+		b = to_float(ps, b);
+	if (insn.type == MATH_FLOAT && nargs > 2)
+		c = to_float(ps, c);
+	if (a < 0 || (nargs > 1 && b < 0) || (nargs > 2 && c < 0))
+		return -1;
+
+	if (insn.op != OP_FILTER &&
+			slot_is_const(ps, a) && (nargs < 2 || slot_is_const(ps, b)) &&
+			(nargs < 3 || slot_is_const(ps, c))) {
+		const struct math_slot *sa = &prog->slots[a];
+		const struct math_slot *sb = &prog->slots[nargs > 1 ? b : a];
+		const struct math_slot *sc = &prog->slots[nargs > 2 ? c : a];
+		float value = 0.0f;
+		long long ivalue = 0;
+
+		exec_insn(&insn, NULL, &value, &ivalue, &sa->value, &sb->value,
+				&sc->value, &sa->ivalue, &sb->ivalue, &sc->ivalue, 1);
+		if (result_type(&insn) == MATH_FLOAT)
+			return const_slot(ps, value);
+		return int_const_slot(ps, result_type(&insn), ivalue);
+	}
+
+	/* The destination never aliases an operand, see run_block() */
+	dst = alloc_reg(ps);
+	if (dst < 0)
+		return -1;
+
+	release_slot(ps, a);
+	if (nargs > 1)
+		release_slot(ps, b);
+	if (nargs > 2)
+		release_slot(ps, c);
+
+	prog->slots[dst].type = result_type(&insn);
+	insn.dst = dst;
+	insn.a = a;
+	insn.b = nargs > 1 ? b : a;
+	insn.c = nargs > 2 ? c : a;
+	prog->insns = g_renew(struct math_insn, prog->insns, prog->num_insns + 1);
+	prog->insns[prog->num_insns++] = insn;
+
+	return dst;
+}
+
+static int emit_op(struct math_parser *ps, enum math_op op, int nargs,
+		int a, int b, int c)
+{
+	struct math_insn insn;
+
+	memset(&insn, 0, sizeof(insn));
+	insn.op = op;
+
+	return emit(ps, insn, nargs, a, b, c);
+}
+
+static int to_float(struct math_parser *ps, int slot)
+{
+	struct math_insn insn;
+
+	if (slot < 0 || ps->prog->slots[slot].type == MATH_FLOAT)
+		return slot;
+
+	memset(&insn, 0, sizeof(insn));
+	insn.op = OP_TOFLOAT;
+	insn.type = ps->prog->slots[slot].type;
+
+	return emit(ps, insn, 1, slot, -1, -1);
+}
+
+/* A float condition, as the int C tests it as */
+static int to_bool(struct math_parser *ps, int slot)
+{
+	if (slot < 0 || ps->prog->slots[slot].type != MATH_FLOAT)
+		return slot;
+
+	return emit_op(ps, OP_NE, 2, slot, const_slot(ps, 0.0f), -1);
+}
+
+static void skip_spaces(struct math_parser *ps)
+{
+	while (g_ascii_isspace(*ps->pos))
+		ps->pos++;
+}
+
+static bool accept(struct math_parser *ps, const char *token)
+{
+	size_t len = strlen(token);
+
+	skip_spaces(ps);
+	if (strncmp(ps->pos, token, len))
+		return false;
+
+	/* Don't take the '<' of "<=" or the '&' of "&&" */
+	if (len == 1 && ps->pos[1] == '=' && strchr("<>=!", token[0]))
+		return false;
+	if (len == 1 && (token[0] == '&' || token[0] == '|') &&
+			ps->pos[1] == token[0])
+		return false;
+
+	ps->pos += len;
+	return true;
+}
+
+static int parse_ternary(struct math_parser *ps);
+
+static int parse_call(struct math_parser *ps, const char *name,
+		const char *start)
+{
+	const struct math_function_def *def = NULL;
+	struct math_insn insn;
+	int a, b = -1, nargs;
+	unsigned int i;
+	bool is_min = !strcmp(name, "min"), is_max = !strcmp(name, "max");
+
+	for (i = 0; i < G_N_ELEMENTS(functions); i++)
+		if (!strcmp(functions[i].name, name))
+			def = &functions[i];
+
+	if (!def && !is_min && !is_max) {
+		ps->pos = start;
+		parse_error(ps, "Unknown function");
+		return -1;
+	}
+	nargs = (is_min || is_max || def->fn2) ? 2 : 1;
+
+	a = parse_ternary(ps);
+	if (nargs == 2) {
+		if (!accept(ps, ",")) {
+			parse_error(ps, "Expected ','");
+			return -1;
+		}
+		b = parse_ternary(ps);
+	}
+	if (!accept(ps, ")")) {
+		parse_error(ps, "Expected ')'");
+		return -1;
+	}
+
+	memset(&insn, 0, sizeof(insn));
+	if (is_min) {
+		insn.op = OP_MIN;
+	} else if (is_max) {
+		insn.op = OP_MAX;
+	} else if (def->fn2) {
+		insn.op = OP_CALL2;
+		insn.fn2 = def->fn2;
+	} else {
+		insn.op = OP_CALL1;
+		insn.fn1 = def->fn1;
+	}
+
+	return emit(ps, insn, nargs, a, b, -1);
+}
+
+static const char * const filter_names[] = {
+	"fir", "biquad", "movavg", "decimate", "dcblock",
+};
+
+static bool is_filter(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(filter_names); i++)
+		if (!strcmp(filter_names[i], name))
+			return true;
+
+	return false;
+}
+
+/* A "quoted" file name, only valid as the taps of fir() */
+static gchar * parse_string(struct math_parser *ps)
+{
+	const char *start;
+
+	if (!accept(ps, "\""))
+		return NULL;
+
+	start = ps->pos;
+	while (*ps->pos && *ps->pos != '"')
+		ps->pos++;
+	if (!*ps->pos) {
+		parse_error(ps, "Unterminated string");
+		return NULL;
+	}
+
+	return g_strndup(start, ps->pos++ - start);
+}
+
+static struct math_filter * filter_create(struct math_parser *ps,
+		const char *name, const float *args, unsigned int nargs,
+		const char *file)
+{
+	struct math_filter *f = NULL;
+
+	if (!strcmp(name, "fir")) {
+		if (file && !nargs)
+			f = math_filter_fir_from_file(file, MATH_BLOCK_SIZE,
+					&ps->error);
+		else if (!file && nargs)
+			f = math_filter_fir_new(args, nargs, MATH_BLOCK_SIZE);
+	} else if (!strcmp(name, "biquad")) {
+		if (nargs == 5)
+			f = math_filter_biquad_new(args[0], args[1], args[2],
+					args[3], args[4]);
+	} else if (!strcmp(name, "movavg")) {
+		if (nargs == 1 && args[0] >= 1)
+			f = math_filter_movavg_new(args[0]);
+	} else if (!strcmp(name, "decimate")) {
+		if ((nargs == 1 || nargs == 2) && args[0] >= 1)
+			f = math_filter_decimate_new(args[0],
+					nargs == 2 ? args[1] : 1);
+	} else if (!strcmp(name, "dcblock")) {
+		if (nargs <= 1)
+			f = math_filter_dcblock_new(nargs ? args[0] : 0.995);
+	}
+
+	if (!f)
+		parse_error(ps, "Invalid filter parameters");
+
+	return f;
+}
+
+/*
+ * name(x, params...): the input can be any expression, the parameters
+ * must be constant. fir() takes its taps inline or from a "file.ftr".
+ */
+static int parse_filter(struct math_parser *ps, const char *name,
+		const char *start)
+{
+	struct math_program *prog = ps->prog;
+	struct math_filter *f;
+	struct math_insn insn;
+	float *args = NULL;
+	unsigned int nargs = 0;
+	gchar *file = NULL;
+	const char *end;
+	int x, arg;
+
+	x = parse_ternary(ps);
+	while (x >= 0 && !ps->error && accept(ps, ",")) {
+		if (!file && !nargs && !strcmp(name, "fir")) {
+			file = parse_string(ps);
+			if (file || ps->error)
+				continue;
+		}
+
+		arg = parse_ternary(ps);
+		if (arg < 0)
+			break;
+		if (!slot_is_const(ps, arg)) {
+			parse_error(ps, "Filter parameters must be constant");
+			break;
+		}
+		args = g_renew(float, args, nargs + 1);
+		args[nargs++] = prog->slots[arg].value;
+	}
+
+	if (x < 0 || ps->error)
+		goto out;
+	if (!accept(ps, ")")) {
+		parse_error(ps, "Expected ')'");
+		goto out;
+	}
+
+	/* Errors point at the filter name */
+	end = ps->pos;
+	ps->pos = start;
+	f = filter_create(ps, name, args, nargs, file);
+	if (!f)
+		goto out;
+	ps->pos = end;
+
+	prog->filters = g_renew(struct math_filter *, prog->filters,
+			prog->num_filters + 1);
+	prog->filters[prog->num_filters] = f;
+	prog->stateful = true;
+
+	memset(&insn, 0, sizeof(insn));
+	insn.op = OP_FILTER;
+	insn.filter = prog->num_filters++;
+	x = emit(ps, insn, 1, x, -1, -1);
+out:
+	g_free(args);
+	g_free(file);
+	return ps->error ? -1 : x;
+}
+
+static int parse_identifier(struct math_parser *ps)
+{
+	const char *start = ps->pos;
+	gchar *name;
+	GSList *node;
+	unsigned int i;
+	int slot = -1;
+
+	while (g_ascii_isalnum(*ps->pos) || *ps->pos == '_')
+		ps->pos++;
+	name = g_strndup(start, ps->pos - start);
+
+	if (accept(ps, "(")) {
+		if (is_filter(name))
+			slot = parse_filter(ps, name, start);
+		else
+			slot = parse_call(ps, name, start);
+		goto out;
+	}
+
+	if (!strcmp(name, "Index")) {
+		if (ps->index_slot < 0)
+			ps->index_slot = new_slot(ps, SLOT_INDEX, MATH_UINT, 0);
+		slot = ps->index_slot;
+		goto out;
+	} else if (!strcmp(name, "SampleCount")) {
+		if (ps->count_slot < 0)
+			ps->count_slot = new_slot(ps, SLOT_COUNT, MATH_UINT, 0);
+		slot = ps->count_slot;
+		goto out;
+	} else if (!strcmp(name, "PreviousValue")) {
+		if (ps->previous_slot < 0)
+			ps->previous_slot = new_slot(ps, SLOT_PREVIOUS,
+					MATH_FLOAT, 0);
+		ps->prog->uses_previous = true;
+		slot = ps->previous_slot;
+		goto out;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(constants); i++) {
+		if (!strcmp(name, constants[i].name)) {
+			slot = const_slot(ps, constants[i].value);
+			goto out;
+		}
+	}
+
+	/* <basename><index>, e.g. voltage0 */
+	for (node = ps->basenames; node; node = g_slist_next(node)) {
+		size_t len = strlen(node->data);
+
+		if (strncmp(name, node->data, len) || !g_ascii_isdigit(name[len]))
+			continue;
+
+		i = atoi(name + len);
+		for (slot = 0; slot < (int)ps->prog->num_slots; slot++)
+			if (ps->prog->slots[slot].kind == SLOT_CHANNEL &&
+					ps->prog->slots[slot].index == i)
+				goto out;
+		slot = new_slot(ps, SLOT_CHANNEL, MATH_FLOAT, i);
+		goto out;
+	}
+
+	ps->pos = start;
+	parse_error(ps, "Unknown identifier");
+out:
+	g_free(name);
+	return slot;
+}
+
+static int parse_primary(struct math_parser *ps)
+{
+	char *end, *iend;
+	guint64 ivalue;
+	double value;
+	int slot;
+
+	skip_spaces(ps);
+
+	if (accept(ps, "(")) {
+		slot = parse_ternary(ps);
+		if (!accept(ps, ")")) {
+			parse_error(ps, "Expected ')'");
+			return -1;
+		}
+		return slot;
+	}
+
+	if (g_ascii_isdigit(*ps->pos) || *ps->pos == '.') {
+		value = g_ascii_strtod(ps->pos, &end);
+		if (end == ps->pos) {
+			parse_error(ps, "Invalid number");
+			return -1;
+		}
+		/* Integer literals, 010 and 0x10 included, are C ints */
+		ivalue = g_ascii_strtoull(ps->pos, &iend, 0);
+		ps->pos = end;
+		if (*ps->pos == 'f' || *ps->pos == 'F')
+			ps->pos++;
+		else if (iend == end)
+			return int_const_slot(ps, ivalue > G_MAXINT64 ?
+					MATH_UINT : MATH_INT, ivalue);
+		return const_slot(ps, value);
+	}
+
+	if (g_ascii_isalpha(*ps->pos) || *ps->pos == '_')
+		return parse_identifier(ps);
+
+	parse_error(ps, *ps->pos ? "Unexpected character" : "Unexpected end");
+	return -1;
+}
+
+static int parse_unary(struct math_parser *ps)
+{
+	if (accept(ps, "-"))
+		return emit_op(ps, OP_NEG, 1, parse_unary(ps), -1, -1);
+	if (accept(ps, "+"))
+		return parse_unary(ps);
+	if (accept(ps, "!"))
+		return emit_op(ps, OP_NOT, 1, parse_unary(ps), -1, -1);
+
+	return parse_primary(ps);
+}
+
+/* One precedence level of left associative binary operators */
+struct math_binary_level {
+	const char *tokens[4];
+	enum math_op ops[4];
+	int (*next)(struct math_parser *ps);
+};
+
+static int parse_binary(struct math_parser *ps,
+		const struct math_binary_level *level)
+{
+	int lhs, i;
+
+	lhs = level->next(ps);
+	while (lhs >= 0) {
+		for (i = 0; i < 4 && level->tokens[i]; i++)
+			if (accept(ps, level->tokens[i]))
+				break;
+		if (i == 4 || !level->tokens[i])
+			break;
+
+		lhs = emit_op(ps, level->ops[i], 2, lhs, level->next(ps), -1);
+	}
+
+	return lhs;
+}
+
+static int parse_multiplicative(struct math_parser *ps)
+{
+	static const struct math_binary_level level = {
+		{ "*", "/" }, { OP_MUL, OP_DIV }, parse_unary };
+
+	return parse_binary(ps, &level);
+}
+
+static int parse_additive(struct math_parser *ps)
+{
+	static const struct math_binary_level level = {
+		{ "+", "-" }, { OP_ADD, OP_SUB }, parse_multiplicative };
+
+	return parse_binary(ps, &level);
+}
+
+static int parse_relational(struct math_parser *ps)
+{
+	static const struct math_binary_level level = {
+		{ "<=", ">=", "<", ">" }, { OP_LE, OP_GE, OP_LT, OP_GT },
+		parse_additive };
+
+	return parse_binary(ps, &level);
+}
+
+static int parse_equality(struct math_parser *ps)
+{
+	static const struct math_binary_level level = {
+		{ "==", "!=" }, { OP_EQ, OP_NE }, parse_relational };
+
+	return parse_binary(ps, &level);
+}
+
+static int parse_and(struct math_parser *ps)
+{
+	static const struct math_binary_level level = {
+		{ "&&" }, { OP_AND }, parse_equality };
+
+	return parse_binary(ps, &level);
+}
+
+static int parse_or(struct math_parser *ps)
+{
+	static const struct math_binary_level level = {
+		{ "||" }, { OP_OR }, parse_and };
+
+	return parse_binary(ps, &level);
+}
+
+static int parse_ternary(struct math_parser *ps)
+{
+	int cond, a, b;
+
+	cond = parse_or(ps);
+	if (cond < 0 || !accept(ps, "?"))
+		return cond;
+
+	a = parse_ternary(ps);
+	if (!accept(ps, ":")) {
+		parse_error(ps, "Expected ':'");
+		return -1;
+	}
+	b = parse_ternary(ps);
+
+	return emit_op(ps, OP_SELECT, 3, cond, a, b);
+}
+
+static unsigned int math_num_workers(void)
+{
+	return CLAMP(g_get_num_processors(), 1, MATH_MAX_WORKERS);
+}
+
+static void math_exec_init(struct math_program *prog, struct math_exec *exec)
+{
+	unsigned int i;
+
+	exec->src = g_new0(const float *, prog->num_slots);
+	exec->isrc = g_new0(const long long *, prog->num_slots);
+	exec->regs = g_new(float, (prog->num_regs ?: 1) * MATH_BLOCK_SIZE);
+	exec->iregs = g_new(long long, (prog->num_regs ?: 1) * MATH_BLOCK_SIZE);
+	exec->index = g_new(long long, MATH_BLOCK_SIZE);
+	exec->previous = g_new(float, 1);
+
+	for (i = 0; i < prog->num_slots; i++) {
+		struct math_slot *slot = &prog->slots[i];
+
+		switch (slot->kind) {
+		case SLOT_REG:
+			exec->src[i] = exec->regs + slot->index * MATH_BLOCK_SIZE;
+			exec->isrc[i] = exec->iregs + slot->index * MATH_BLOCK_SIZE;
+			break;
+		case SLOT_INDEX:
+			exec->isrc[i] = exec->index;
+			break;
+		case SLOT_PREVIOUS:
+			exec->src[i] = exec->previous;
+			break;
+		case SLOT_CONST:
+		case SLOT_COUNT:
+			exec->src[i] = slot->block;
+			exec->isrc[i] = slot->iblock;
+			break;
+		case SLOT_CHANNEL:
+			break;
+		}
+	}
+}
+
+struct math_program * math_program_compile(const char *expression,
+		GSList *basenames, gchar **error)
+{
+	struct math_program *prog;
+	struct math_parser ps;
+	unsigned int i;
+	int result;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.start = ps.pos = expression;
+	ps.basenames = basenames;
+	ps.index_slot = ps.count_slot = ps.previous_slot = -1;
+	for (i = 0; i < MATH_MAX_REGISTERS; i++)
+		ps.reg_slot[i] = -1;
+
+	prog = g_new0(struct math_program, 1);
+	ps.prog = prog;
+
+	result = parse_ternary(&ps);
+	skip_spaces(&ps);
+	if (result >= 0 && *ps.pos)
+		parse_error(&ps, "Unexpected character");
+	/* The C code stores a float */
+	if (!ps.error)
+		result = to_float(&ps, result);
+
+	if (ps.error) {
+		if (error)
+			*error = ps.error;
+		else
+			g_free(ps.error);
+		math_program_free(prog);
+		return NULL;
+	}
+
+	prog->result = result;
+	for (i = 0; i < prog->num_slots; i++) {
+		struct math_slot *slot = &prog->slots[i];
+		unsigned int j;
+
+		if (slot->kind == SLOT_CONST && slot->type == MATH_FLOAT)
+			for (j = 0; j < MATH_BLOCK_SIZE; j++)
+				slot->block[j] = slot->value;
+		else if (slot->kind == SLOT_CONST)
+			for (j = 0; j < MATH_BLOCK_SIZE; j++)
+				slot->iblock[j] = slot->ivalue;
+	}
+
+	/* Sequential expressions, and filters, only use the first context */
+	prog->num_exec = (prog->uses_previous || prog->stateful) ?
+		1 : math_num_workers();
+	prog->exec = g_new0(struct math_exec, prog->num_exec);
+	for (i = 0; i < prog->num_exec; i++)
+		math_exec_init(prog, &prog->exec[i]);
+
+	return prog;
+}
+
+void math_program_free(struct math_program *prog)
+{
+	unsigned int i;
+
+	if (!prog)
+		return;
+
+	for (i = 0; i < prog->num_exec; i++) {
+		g_free(prog->exec[i].src);
+		g_free(prog->exec[i].isrc);
+		g_free(prog->exec[i].regs);
+		g_free(prog->exec[i].iregs);
+		g_free(prog->exec[i].index);
+		g_free(prog->exec[i].previous);
+	}
+	g_free(prog->exec);
+	for (i = 0; i < prog->num_filters; i++)
+		math_filter_free(prog->filters[i]);
+	g_free(prog->filters);
+	for (i = 0; i < prog->num_slots; i++) {
+		g_free(prog->slots[i].block);
+		g_free(prog->slots[i].iblock);
+	}
+	g_free(prog->slots);
+	g_free(prog->insns);
+	g_free(prog);
+}
+
+static void run_block(struct math_program *prog, struct math_exec *exec,
+		unsigned int len)
+{
+	unsigned int n;
+
+	for (n = 0; n < prog->num_insns; n++) {
+		const struct math_insn *insn = &prog->insns[n];
+		unsigned int reg = prog->slots[insn->dst].index * MATH_BLOCK_SIZE;
+
+		exec_insn(insn, prog->filters, exec->regs + reg,
+				exec->iregs + reg, exec->src[insn->a],
+				exec->src[insn->b], exec->src[insn->c],
+				exec->isrc[insn->a], exec->isrc[insn->b],
+				exec->isrc[insn->c], len);
+	}
+}
+
+/* Evaluate samples [start, end) with the scratch of one context */
+static void run_range(struct math_program *prog, struct math_exec *exec,
+		float ***channels_data, float *out_data,
+		unsigned long long start, unsigned long long end)
+{
+	unsigned int block = prog->uses_previous ? 1 : MATH_BLOCK_SIZE;
+	unsigned long long offset;
+	unsigned int len, s, i;
+
+	for (offset = start; offset < end; offset += len) {
+		len = MIN(block, end - offset);
+
+		for (s = 0; s < prog->num_slots; s++) {
+			struct math_slot *slot = &prog->slots[s];
+
+			switch (slot->kind) {
+			case SLOT_CHANNEL:
+				exec->src[s] = *channels_data[slot->index] + offset;
+				break;
+			case SLOT_INDEX:
+				for (i = 0; i < len; i++)
+					exec->index[i] = offset + i;
+				break;
+			case SLOT_PREVIOUS:
+				exec->previous[0] = offset > 0 ? out_data[offset - 1] : 0;
+				break;
+			default:
+				break;
+			}
+		}
+
+		run_block(prog, exec, len);
+		memcpy(out_data + offset, exec->src[prog->result],
+				len * sizeof(*out_data));
+	}
+}
+
+struct math_job {
+	struct math_program *prog;
+	struct math_exec *exec;
+	float ***channels_data;
+	float *out_data;
+	unsigned long long start, end;
+
+	GMutex *lock;
+	GCond *done;
+	unsigned int *pending;
+};
+
+static void math_worker(gpointer data, gpointer user_data)
+{
+	struct math_job *job = data;
+
+	run_range(job->prog, job->exec, job->channels_data, job->out_data,
+			job->start, job->end);
+
+	g_mutex_lock(job->lock);
+	if (--*job->pending == 0)
+		g_cond_signal(job->done);
+	g_mutex_unlock(job->lock);
+}
+
+static GThreadPool * math_pool(void)
+{
+	static gsize pool;
+
+	if (g_once_init_enter(&pool)) {
+		GThreadPool *p = g_thread_pool_new(math_worker, NULL,
+				math_num_workers() - 1, FALSE, NULL);
+
+		g_once_init_leave(&pool, (gsize)p);
+	}
+
+	return (GThreadPool *)pool;
+}
+
+/*
+ * Captures below MATH_PARALLEL_MIN_SAMPLES, or expressions depending on
+ * PreviousValue, are evaluated on the calling thread. Larger ones are split
+ * in one contiguous, block aligned range per context; the caller evaluates
+ * the first range while the pool takes the others.
+ */
+void math_program_run(struct math_program *prog, float ***channels_data,
+		float *out_data, unsigned long long chn_sample_cnt)
+{
+	struct math_job jobs[MATH_MAX_WORKERS];
+	unsigned long long blocks;
+	unsigned int w, s, i, num_jobs, pending;
+	GThreadPool *pool = NULL;
+	GMutex lock;
+	GCond done;
+
+	for (s = 0; s < prog->num_slots; s++)
+		if (prog->slots[s].kind == SLOT_COUNT)
+			for (i = 0; i < MATH_BLOCK_SIZE; i++)
+				prog->slots[s].iblock[i] = chn_sample_cnt;
+
+	num_jobs = 1;
+	if (prog->num_exec > 1 && chn_sample_cnt >= MATH_PARALLEL_MIN_SAMPLES) {
+		pool = math_pool();
+		if (pool)
+			num_jobs = prog->num_exec;
+	}
+
+	if (num_jobs == 1) {
+		run_range(prog, &prog->exec[0], channels_data, out_data,
+				0, chn_sample_cnt);
+		return;
+	}
+
+	g_mutex_init(&lock);
+	g_cond_init(&done);
+	pending = num_jobs - 1;
+
+	blocks = (chn_sample_cnt + MATH_BLOCK_SIZE - 1) / MATH_BLOCK_SIZE;
+	for (w = 0; w < num_jobs; w++) {
+		struct math_job *job = &jobs[w];
+
+		job->prog = prog;
+		job->exec = &prog->exec[w];
+		job->channels_data = channels_data;
+		job->out_data = out_data;
+		job->start = MIN(blocks * w / num_jobs * MATH_BLOCK_SIZE,
+				chn_sample_cnt);
+		job->end = MIN(blocks * (w + 1) / num_jobs * MATH_BLOCK_SIZE,
+				chn_sample_cnt);
+		job->lock = &lock;
+		job->done = &done;
+		job->pending = &pending;
+		if (w)
+			g_thread_pool_push(pool, job, NULL);
+	}
+
+	run_range(prog, &prog->exec[0], channels_data, out_data,
+			jobs[0].start, jobs[0].end);
+
+	g_mutex_lock(&lock);
+	while (pending)
+		g_cond_wait(&done, &lock);
+	g_mutex_unlock(&lock);
+
+	g_mutex_clear(&lock);
+	g_cond_clear(&done);
+}
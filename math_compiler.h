@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __MATH_COMPILER_H__
+#define __MATH_COMPILER_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+/* Samples evaluated per instruction, the size of each register */
+#define MATH_BLOCK_SIZE		256
+#define MATH_MAX_REGISTERS	32
+#define MATH_MAX_WORKERS	16
+/* Captures smaller than this are not worth waking the workers for */
+#define MATH_PARALLEL_MIN_SAMPLES	65536
+
+struct math_insn;
+struct math_slot;
+struct math_filter;
+
+/* Scratch of one evaluating thread */
+struct math_exec {
+	const float **src;		/* per slot data of the current block */
+	const long long **isrc;		/* same, for the integer slots */
+	float *regs;
+	long long *iregs;
+	long long *index;
+	float *previous;
+};
+
+/*
+ * A math expression compiled in-process to a register based bytecode.
+ * Every register holds a block of samples, so each instruction is one
+ * tight loop over MATH_BLOCK_SIZE samples. Expressions that use
+ * PreviousValue depend on the previous output and are run one sample
+ * at a time; the others are split over a pool of worker threads, with one
+ * execution context each.
+ */
+struct math_program {
+	struct math_insn *insns;
+	unsigned int num_insns;
+	struct math_slot *slots;	/* registers, constants and inputs */
+	unsigned int num_slots;
+	unsigned int num_regs;
+	unsigned int result;		/* slot holding the output */
+	bool uses_previous;
+	bool stateful;			/* has filters, runs in order */
+	struct math_filter **filters;
+	unsigned int num_filters;
+
+	struct math_exec *exec;
+	unsigned int num_exec;
+};
+
+/*
+ * Same grammar as the generated C code: C arithmetic, comparison, logic and
+ * ?: operators, the math.h functions offered by the expression dialog,
+ * M_PI/M_E, the Index, PreviousValue and SampleCount keywords and channels
+ * named <basename><index>. As in C, integer literals, Index and SampleCount
+ * are integers: Index / 2 truncates, and Index is exact past 2^24 samples.
+ * The rest is evaluated in float. On top of it, filters that keep their state
+ * from one capture to the next:
+ *   fir(x, "file.ftr") or fir(x, tap0, tap1, ...)
+ *   biquad(x, b0, b1, b2, a1, a2)
+ *   movavg(x, length)
+ *   decimate(x, rate[, order])	CIC style, output held between samples
+ *   dcblock(x[, pole])		pole defaults to 0.995
+ */
+struct math_program * math_program_compile(const char *expression,
+		GSList *basenames, gchar **error);
+void math_program_free(struct math_program *prog);
+
+/* Same arguments as math_function */
+void math_program_run(struct math_program *prog, float ***channels_data,
+		float *out_data, unsigned long long chn_sample_cnt);
+
+#endif /* __MATH_COMPILER_H__ */
@@ -10,12 +10,13 @@
 
 #ifdef linux
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <stdio.h>
 #include <errno.h>
-#include <ftw.h>
 #include <stdlib.h>
 #include <dlfcn.h>
 #include <string.h>
@@ -23,23 +24,15 @@
 #endif
 
 #define MATH_OBJECT_FILES_DIR "math_expressions"
-#define MATH_EXPRESSION_BASE_FILE "math_expression"
 #define MATH_FUNCTION_NAME "expression_function"
+#define MATH_COMPILE_FLAGS "-O3 -Wall -Werror -fpic -shared"
+
+/* Compiled expressions kept in the cache, least recently used go first */
+#define MATH_CACHE_MAX_ENTRIES 64
 
 typedef void (*math_function)(float ***channels_data, float *out_data, unsigned long long chn_sample_cnt);
 
 #ifdef linux
-static int remove_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
-{
-	return remove(fpath);
-}
-
-/* Recursively remove the given path from the filesystem. */
-static int recursive_remove(char *dirpath)
-{
-	return nftw(dirpath, remove_cb, 64, FTW_DEPTH | FTW_PHYS);
-}
-
 static gboolean eval(const GMatchInfo *info, GString *res, gpointer data)
 {
 	gchar *match;
@@ -60,7 +53,9 @@ static gboolean eval(const GMatchInfo *info, GString *res, gpointer data)
 	else
 		index = 0;
 
-	replace = g_strdup_printf("(*channels_data[%d])[i]", index);
+	/* Channels are read through pointers hoisted out of the loop */
+	g_hash_table_add((GHashTable *)data, GINT_TO_POINTER(index));
+	replace = g_strdup_printf("chn%d[i]", index);
 	g_string_append(res, replace);
 	g_free(replace);
 	g_free(match);
@@ -69,14 +64,15 @@ static gboolean eval(const GMatchInfo *info, GString *res, gpointer data)
 }
 
 static char * string_replace(const char * string, const char *pattern,
-			const char *replacement, GRegexEvalCallback eval)
+			const char *replacement, GRegexEvalCallback eval,
+			gpointer eval_data)
 {
 	GRegex *rex;
 	gchar *result;
 
 	rex = g_regex_new(pattern, 0, 0, NULL);
 	if (eval)
-		result = g_regex_replace_eval(rex, string, -1, 0, 0, eval, NULL, NULL);
+		result = g_regex_replace_eval(rex, string, -1, 0, 0, eval, eval_data, NULL);
 	else
 		result = g_regex_replace_literal(rex, string, -1, 0, replacement, 0, NULL);
 	g_regex_unref(rex);
@@ -84,58 +80,67 @@ static char * string_replace(const char * string, const char *pattern,
 	return result;
 }
 
-static char * c_file_create(const char *user_expression, GSList *basenames)
+/* The cache lives in the per-user cache directory and survives restarts */
+static gchar * math_cache_dir(void)
 {
-	char *base_filename, *open_path;
-	FILE *fp;
-	struct stat st;
-	static unsigned long long file_count = 0;
+	gchar *dir;
 
-	if (!user_expression) {
-		fprintf(stderr, "NULL user_expression parameter in %s", __func__);
+	dir = g_build_filename(g_get_user_cache_dir(), "osc",
+			MATH_OBJECT_FILES_DIR, NULL);
+	if (g_mkdir_with_parents(dir, S_IRWXU) < 0) {
+		fprintf(stderr, "Can't create %s: %s\n", dir, strerror(errno));
+		g_free(dir);
 		return NULL;
 	}
-	if (stat(MATH_OBJECT_FILES_DIR, &st) == -1) {
-		mkdir(MATH_OBJECT_FILES_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
-	}
 
-	base_filename = g_strdup_printf("%s_%llu",
-		MATH_EXPRESSION_BASE_FILE, file_count++);
-	open_path = g_strdup_printf("%s/%s.c",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	fp = fopen(open_path, "w+");
-	g_free(open_path);
-	if (!fp) {
-		perror(base_filename);
-		g_free(base_filename);
-		return NULL;
-	}
+	return dir;
+}
+
+static gint channel_index_cmp(gconstpointer a, gconstpointer b)
+{
+	return GPOINTER_TO_INT(a) - GPOINTER_TO_INT(b);
+}
 
+/*
+ * Generate the C source of an expression. Whitespace is collapsed and the
+ * channel names are replaced by their bindings, so the source is the
+ * normalized form of the expression the cache key is computed from.
+ */
+static char * c_source_generate(const char *user_expression, GSList *basenames)
+{
 	char *s1, *s2;
 	GSList *node;
-	char *buf, *old_expr, *new_expr = NULL;
+	char *buf, *old_expr, *new_expr;
+	GHashTable *used;
+	GList *indexes, *l;
+	GString *src;
+
+	if (!user_expression) {
+		fprintf(stderr, "NULL user_expression parameter in %s", __func__);
+		return NULL;
+	}
 
-	old_expr = g_strdup(user_expression);
+	used = g_hash_table_new(NULL, NULL);
+	old_expr = string_replace(user_expression, "\\s+", " ", NULL, NULL);
+	g_strstrip(old_expr);
 	for (node = basenames; node; node = g_slist_next(node)) {
 		buf = g_strdup_printf("(%s[0-9]+)(\\w*)", (char *)node->data);
-		new_expr = string_replace(old_expr, buf, NULL, eval);
+		new_expr = string_replace(old_expr, buf, NULL, eval, used);
 		g_free(buf);
 		g_free(old_expr);
 		old_expr = new_expr;
 	}
-	if (new_expr)
-		s1 = new_expr;
-	else
-		s1 = g_strdup(user_expression);
+	s1 = old_expr;
 
-	s2 = string_replace(s1, "Index", "i", NULL);
+	s2 = string_replace(s1, "Index", "i", NULL, NULL);
 	g_free(s1);
-	s1 = string_replace(s2, "PreviousValue", "(i > 0 ? out_data[i  -1] : 0)", NULL);
-	s2 = string_replace(s1, "SampleCount", "chn_sample_cnt", NULL);
+	s1 = string_replace(s2, "PreviousValue", "(i > 0 ? out_data[i  -1] : 0)", NULL, NULL);
+	g_free(s2);
+	s2 = string_replace(s1, "SampleCount", "chn_sample_cnt", NULL, NULL);
 	g_free(s1);
 
-	fprintf(fp, "#include <math.h>\n");
-	fprintf(fp, "#define max(a,b) \
+	src = g_string_new("#include <math.h>\n");
+	g_string_append(src, "#define max(a,b) \
 		({ __typeof__ (a) _a = (a); \
 		__typeof__ (b) _b = (b); \
 		_a > _b ? _a : _b; })\n \
@@ -143,102 +148,247 @@ static char * c_file_create(const char *user_expression, GSList *basenames)
 		({ __typeof__ (a) _a = (a); \
 		 __typeof__ (b) _b = (b); \
 		 _a < _b ? _a : _b; })\n");
-	fprintf(fp, "\n");
-	fprintf(fp, "void %s(float ***channels_data, float *out_data, unsigned long long chn_sample_cnt)\n", MATH_FUNCTION_NAME);
-	fprintf(fp, "{\n");
-	fprintf(fp, "\tunsigned long long i;\n\n");
-	fprintf(fp, "\tfor (i = 0; i < chn_sample_cnt; i++) {\n");
-	fprintf(fp, "\tout_data[i] = %s;\n", s2);
-	fprintf(fp, "\t}\n");
-	fprintf(fp, "}\n");
-
-	fclose(fp);
+	g_string_append(src, "\n");
+	g_string_append_printf(src, "void %s(float ***channels_data, float *__restrict out_data, unsigned long long chn_sample_cnt)\n", MATH_FUNCTION_NAME);
+	g_string_append(src, "{\n");
+	g_string_append(src, "\tunsigned long long i;\n");
+	/* Sorted, so that equivalent expressions give the same source */
+	indexes = g_list_sort(g_hash_table_get_keys(used), channel_index_cmp);
+	for (l = indexes; l; l = g_list_next(l))
+		g_string_append_printf(src, "\tconst float *__restrict chn%d = *channels_data[%d];\n",
+				GPOINTER_TO_INT(l->data), GPOINTER_TO_INT(l->data));
+	g_list_free(indexes);
+	g_hash_table_destroy(used);
+	g_string_append(src, "\n");
+	g_string_append(src, "\tfor (i = 0; i < chn_sample_cnt; i++) {\n");
+	g_string_append_printf(src, "\tout_data[i] = %s;\n", s2);
+	g_string_append(src, "\t}\n");
+	g_string_append(src, "}\n");
 	g_free(s2);
 
-	return base_filename;
+	return g_string_free(src, FALSE);
 }
 
-static int shared_object_compile(char *base_filename)
+/*
+ * Build <key>.so next to <key>.c. Both are written under temporary names
+ * and renamed into place, so that a concurrent instance never picks up a
+ * half written entry.
+ */
+static int shared_object_compile(const char *dir, const char *key,
+		const char *source)
 {
-	char *pcommand, *object_path;
+	char *tmp_c, *tmp_so, *final_path, *pcommand;
+	char *quoted_c, *quoted_so;
 	FILE *pstream;
-	int ret;
+	int ret = EXIT_FAILURE;
 
-	pcommand = g_strdup_printf("gcc -c -Wall -Werror -fpic %s/%s.c -o %s/%s.o",
-		MATH_OBJECT_FILES_DIR, base_filename, MATH_OBJECT_FILES_DIR, base_filename);
+	tmp_c = g_strdup_printf("%s/%s.%d.tmp.c", dir, key, (int)getpid());
+	tmp_so = g_strdup_printf("%s/%s.%d.tmp.so", dir, key, (int)getpid());
+
+	if (!g_file_set_contents(tmp_c, source, -1, NULL)) {
+		perror(tmp_c);
+		goto out;
+	}
+
+	/* The cache lives under the home directory, whatever its name */
+	quoted_c = g_shell_quote(tmp_c);
+	quoted_so = g_shell_quote(tmp_so);
+	pcommand = g_strdup_printf("gcc %s %s -o %s", MATH_COMPILE_FLAGS,
+			quoted_c, quoted_so);
+	g_free(quoted_c);
+	g_free(quoted_so);
 	pstream = popen(pcommand, "w");
 	g_free(pcommand);
 	if (!pstream) {
 		perror("Error compiling math expression");
-		return EXIT_FAILURE;
+		goto out;
 	}
-	pclose(pstream);
+	if (pclose(pstream) != 0 || access(tmp_so, F_OK) != 0)
+		goto out;
+
+	final_path = g_strdup_printf("%s/%s.so", dir, key);
+	ret = rename(tmp_so, final_path) ? EXIT_FAILURE : EXIT_SUCCESS;
+	g_free(final_path);
+	if (ret == EXIT_FAILURE)
+		goto out;
+
+	/* The source goes in last, it is what validates the entry */
+	final_path = g_strdup_printf("%s/%s.c", dir, key);
+	ret = rename(tmp_c, final_path) ? EXIT_FAILURE : EXIT_SUCCESS;
+	g_free(final_path);
+
+out:
+	g_unlink(tmp_c);
+	g_unlink(tmp_so);
+	g_free(tmp_c);
+	g_free(tmp_so);
+	return ret;
+}
+
+/* An entry is only used if its stored source matches the expected one */
+static gboolean math_cache_entry_valid(const char *dir, const char *key,
+		const char *source)
+{
+	char *path, *contents;
+	gboolean valid;
 
-	object_path = g_strdup_printf("./%s/%s.o",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	ret = access(object_path, F_OK);
-	g_free(object_path);
-	if (ret != 0)
-		return EXIT_FAILURE;
+	path = g_strdup_printf("%s/%s.c", dir, key);
+	valid = g_file_get_contents(path, &contents, NULL, NULL);
+	g_free(path);
+	if (!valid)
+		return FALSE;
 
-	pcommand = g_strdup_printf("gcc -shared -o %s/%s.so %s/%s.o",
-		MATH_OBJECT_FILES_DIR, base_filename, MATH_OBJECT_FILES_DIR, base_filename);
-	pstream = popen(pcommand, "w");
-	g_free(pcommand);
-	if (!pstream) {
-		perror("Error creating math expression library");
-		return EXIT_FAILURE;
+	valid = !strcmp(contents, source);
+	g_free(contents);
+
+	return valid;
+}
+
+static void math_cache_entry_remove(const char *dir, const char *key)
+{
+	char *path;
+
+	path = g_strdup_printf("%s/%s.so", dir, key);
+	g_unlink(path);
+	g_free(path);
+	path = g_strdup_printf("%s/%s.c", dir, key);
+	g_unlink(path);
+	g_free(path);
+}
+
+struct math_cache_entry {
+	char *key;
+	time_t atime;
+};
+
+static gint math_cache_entry_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct math_cache_entry *ea = a, *eb = b;
+
+	return (ea->atime > eb->atime) - (ea->atime < eb->atime);
+}
+
+/* Use time is tracked by the mtime of the .so, refreshed on every hit */
+static void math_cache_evict(const char *dir, unsigned int max_entries)
+{
+	GSList *entries = NULL, *node;
+	struct math_cache_entry *e;
+	const gchar *name;
+	unsigned int count;
+	struct stat st;
+	GDir *gdir;
+
+	gdir = g_dir_open(dir, 0, NULL);
+	if (!gdir)
+		return;
+
+	while ((name = g_dir_read_name(gdir))) {
+		char *path;
+
+		if (!g_str_has_suffix(name, ".so") || strstr(name, ".tmp."))
+			continue;
+
+		path = g_build_filename(dir, name, NULL);
+		if (stat(path, &st) == 0) {
+			e = g_new(struct math_cache_entry, 1);
+			e->key = g_strndup(name, strlen(name) - strlen(".so"));
+			e->atime = st.st_mtime;
+			entries = g_slist_prepend(entries, e);
+		}
+		g_free(path);
+	}
+	g_dir_close(gdir);
+
+	entries = g_slist_sort(entries, math_cache_entry_cmp);
+	count = g_slist_length(entries);
+	for (node = entries; node; node = g_slist_next(node)) {
+		e = node->data;
+		if (count > max_entries) {
+			math_cache_entry_remove(dir, e->key);
+			count--;
+		}
+		g_free(e->key);
+		g_free(e);
 	}
-	pclose(pstream);
+	g_slist_free(entries);
+}
+
+static void * math_cache_dlopen(const char *dir, const char *key)
+{
+	char *path;
+	void *handle;
 
-	object_path = g_strdup_printf("./%s/%s.so",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	ret = access(object_path, F_OK);
-	g_free(object_path);
-	if (ret != 0)
-		return EXIT_FAILURE;
+	path = g_strdup_printf("%s/%s.so", dir, key);
+	handle = dlopen(path, RTLD_LOCAL | RTLD_LAZY);
+	if (handle)
+		utimes(path, NULL);
+	g_free(path);
 
-	return EXIT_SUCCESS;
+	return handle;
 }
 #endif
 
+/*
+ * Compiled expressions are cached, keyed by a hash of the normalized
+ * source (which holds the channel bindings) and of the compiler flags.
+ * A hit is validated against the stored source and by loading it; gcc is
+ * only spawned on a miss or for an invalid entry.
+ */
 math_function math_expression_get_math_function(const char *expression_txt,
 	void **lib_handler, GSList *basenames)
 {
 #ifdef linux
-	math_function math_fn;
-	char *base_filename, *dlopen_path;
-	int ret;
+	math_function math_fn = NULL;
+	char *source, *keyed, *key, *dir;
+
+	*lib_handler = NULL;
 
-	base_filename = c_file_create(expression_txt, basenames);
-	if (!base_filename)
+	dir = math_cache_dir();
+	if (!dir)
 		return NULL;
 
-	ret = shared_object_compile(base_filename);
-	if (ret == EXIT_FAILURE) {
-		goto FAILED_SO;
+	source = c_source_generate(expression_txt, basenames);
+	if (!source) {
+		g_free(dir);
+		return NULL;
 	}
 
-	dlopen_path = g_strdup_printf("./%s/%s.so",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	*lib_handler = dlopen(dlopen_path, RTLD_LOCAL | RTLD_LAZY);
-	g_free(dlopen_path);
+	keyed = g_strdup_printf("%s\n%s", MATH_COMPILE_FLAGS, source);
+	key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, keyed, -1);
+	g_free(keyed);
+
+	if (math_cache_entry_valid(dir, key, source))
+		*lib_handler = math_cache_dlopen(dir, key);
+
 	if (!*lib_handler) {
-		fprintf(stderr, "%s\n", dlerror());
-		goto FAILED_SO;
+		math_cache_entry_remove(dir, key);
+		if (shared_object_compile(dir, key, source) == EXIT_FAILURE)
+			goto out;
+
+		*lib_handler = math_cache_dlopen(dir, key);
+		if (!*lib_handler) {
+			fprintf(stderr, "%s\n", dlerror());
+			goto out;
+		}
+		math_cache_evict(dir, MATH_CACHE_MAX_ENTRIES);
 	}
 
 	math_fn = dlsym(*lib_handler, MATH_FUNCTION_NAME);
 	if (!math_fn) {
 		fprintf(stderr, "Failed to load %s symbol\n", MATH_FUNCTION_NAME);
+		dlclose(*lib_handler);
+		*lib_handler = NULL;
+		math_cache_entry_remove(dir, key);
 	}
 
+out:
+	g_free(key);
+	g_free(source);
+	g_free(dir);
 	return math_fn;
-
-FAILED_SO:
-	g_free(base_filename);
-#endif
+#else
 	return NULL;
+#endif
 }
 
 void math_expression_close_lib_handler(void *lib_handler)
@@ -249,11 +399,15 @@ void math_expression_close_lib_handler(void *lib_handler)
 #endif
 }
 
+/* The compiled expressions are kept across sessions, only trim the cache */
 void math_expression_objects_clean(void)
 {
 #ifdef linux
-	if (recursive_remove(MATH_OBJECT_FILES_DIR) != 0 && errno != ENOENT)
-		fprintf(stderr, "Can't remove %s: %s\n", MATH_OBJECT_FILES_DIR, strerror(errno));
+	char *dir = math_cache_dir();
+
+	if (dir)
+		math_cache_evict(dir, MATH_CACHE_MAX_ENTRIES);
+	g_free(dir);
 #endif
 }
 
@@ -0,0 +1,338 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "config.h"
+#include "math_filter.h"
+
+static void boxcar_init(struct math_boxcar *b, unsigned int length)
+{
+	b->ring = g_new0(float, length);
+	b->length = length;
+	b->pos = 0;
+	b->sum = 0.0;
+}
+
+static inline float boxcar_step(struct math_boxcar *b, float x)
+{
+	unsigned int i;
+
+	b->sum += (double)x - b->ring[b->pos];
+	b->ring[b->pos] = x;
+
+	/* Recompute the sum once per turn, so that rounding can't drift */
+	if (++b->pos == b->length) {
+		b->pos = 0;
+		b->sum = 0.0;
+		for (i = 0; i < b->length; i++)
+			b->sum += b->ring[i];
+	}
+
+	return (float)(b->sum / b->length);
+}
+
+struct math_filter * math_filter_fir_new(const float *taps,
+		unsigned int num_taps, unsigned int block_size)
+{
+	struct math_filter *f;
+	unsigned int k;
+
+	if (!num_taps || num_taps > MATH_FILTER_MAX_TAPS)
+		return NULL;
+
+	f = g_new0(struct math_filter, 1);
+	f->type = MATH_FILTER_FIR;
+	f->num_taps = num_taps;
+	f->taps = g_new(float, num_taps);
+	for (k = 0; k < num_taps; k++)
+		f->taps[k] = taps[num_taps - 1 - k];
+	f->buf_len = num_taps - 1 + block_size;
+	f->buf = g_new0(float, f->buf_len);
+
+	return f;
+}
+
+static FILE * ftr_open(const char *name)
+{
+	gchar *path;
+	FILE *fp;
+
+	fp = fopen(name, "r");
+	if (fp || g_path_is_absolute(name))
+		return fp;
+
+	path = g_build_filename("filters", name, NULL);
+	fp = fopen(path, "r");
+	g_free(path);
+	if (fp)
+		return fp;
+
+	path = g_build_filename(OSC_FILTER_FILE_PATH, name, NULL);
+	fp = fopen(path, "r");
+	g_free(path);
+
+	return fp;
+}
+
+/*
+ * Load the taps of an AD936x style .ftr file: '#' comments, keyword lines,
+ * then one "tx,rx" (or single) coefficient per line. The RX column is used.
+ * The integer taps are scaled to unity DC gain, or to full scale when
+ * they sum to zero.
+ */
+struct math_filter * math_filter_fir_from_file(const char *name,
+		unsigned int block_size, gchar **error)
+{
+	struct math_filter *f = NULL;
+	float *taps;
+	unsigned int num_taps = 0, k;
+	double sum = 0.0, scale;
+	char line[256];
+	FILE *fp;
+
+	fp = ftr_open(name);
+	if (!fp) {
+		*error = g_strdup_printf("Can't open %s: %s", name, strerror(errno));
+		return NULL;
+	}
+
+	taps = g_new(float, MATH_FILTER_MAX_TAPS);
+	while (fgets(line, sizeof(line), fp)) {
+		char *end, *p = line;
+		double tx, rx;
+
+		while (g_ascii_isspace(*p))
+			p++;
+		if (!*p || *p == '#' || g_ascii_isalpha(*p))
+			continue;
+
+		tx = g_ascii_strtod(p, &end);
+		if (end == p)
+			continue;
+		rx = tx;
+		p = end;
+		while (g_ascii_isspace(*p) || *p == ',')
+			p++;
+		if (*p) {
+			rx = g_ascii_strtod(p, &end);
+			if (end == p)
+				rx = tx;
+		}
+
+		if (num_taps == MATH_FILTER_MAX_TAPS) {
+			*error = g_strdup_printf("%s has more than %u taps",
+					name, MATH_FILTER_MAX_TAPS);
+			goto out;
+		}
+		taps[num_taps++] = rx;
+		sum += rx;
+	}
+
+	if (!num_taps) {
+		*error = g_strdup_printf("No taps in %s", name);
+		goto out;
+	}
+
+	scale = fabs(sum) > 1e-9 ? 1.0 / sum : 1.0 / 32768.0;
+	for (k = 0; k < num_taps; k++)
+		taps[k] *= scale;
+
+	f = math_filter_fir_new(taps, num_taps, block_size);
+out:
+	g_free(taps);
+	fclose(fp);
+	return f;
+}
+
+struct math_filter * math_filter_biquad_new(double b0, double b1, double b2,
+		double a1, double a2)
+{
+	struct math_filter *f = g_new0(struct math_filter, 1);
+
+	f->type = MATH_FILTER_BIQUAD;
+	f->b0 = b0;
+	f->b1 = b1;
+	f->b2 = b2;
+	f->a1 = a1;
+	f->a2 = a2;
+
+	return f;
+}
+
+struct math_filter * math_filter_movavg_new(unsigned int length)
+{
+	struct math_filter *f;
+
+	if (!length || length > MATH_FILTER_MAX_TAPS)
+		return NULL;
+
+	f = g_new0(struct math_filter, 1);
+	f->type = MATH_FILTER_MOVAVG;
+	f->order = 1;
+	boxcar_init(&f->stages[0], length);
+
+	return f;
+}
+
+/*
+ * CIC style decimation: order cascaded moving averages over the rate,
+ * which is a CIC filter with its gain normalized, sampled once every rate
+ * inputs. The output is held in between, so it keeps the capture length.
+ */
+struct math_filter * math_filter_decimate_new(unsigned int rate,
+		unsigned int order)
+{
+	struct math_filter *f;
+	unsigned int i;
+
+	if (!rate || rate > MATH_FILTER_MAX_TAPS ||
+			!order || order > MATH_FILTER_MAX_ORDER)
+		return NULL;
+
+	f = g_new0(struct math_filter, 1);
+	f->type = MATH_FILTER_DECIMATE;
+	f->rate = rate;
+	f->order = order;
+	for (i = 0; i < order; i++)
+		boxcar_init(&f->stages[i], rate);
+
+	return f;
+}
+
+/* y[n] = x[n] - x[n - 1] + pole * y[n - 1] */
+struct math_filter * math_filter_dcblock_new(double pole)
+{
+	struct math_filter *f;
+
+	if (pole <= 0.0 || pole >= 1.0)
+		return NULL;
+
+	f = g_new0(struct math_filter, 1);
+	f->type = MATH_FILTER_DCBLOCK;
+	f->pole = pole;
+
+	return f;
+}
+
+void math_filter_free(struct math_filter *f)
+{
+	unsigned int i;
+
+	if (!f)
+		return;
+
+	for (i = 0; i < f->order; i++)
+		g_free(f->stages[i].ring);
+	g_free(f->taps);
+	g_free(f->buf);
+	g_free(f);
+}
+
+/* Loop over the taps outside, so that the inner loop vectorizes */
+static void fir_block(struct math_filter *f, const float *__restrict in,
+		float *__restrict out, unsigned int len)
+{
+	float *__restrict buf = f->buf;
+	const float *__restrict taps = f->taps;
+	unsigned int n = f->num_taps - 1, i, k;
+
+	memcpy(buf + n, in, len * sizeof(*buf));
+
+	for (i = 0; i < len; i++)
+		out[i] = 0.0f;
+	for (k = 0; k <= n; k++) {
+		const float t = taps[k];
+		const float *__restrict x = buf + k;
+
+		for (i = 0; i < len; i++)
+			out[i] += t * x[i];
+	}
+
+	memmove(buf, buf + len, n * sizeof(*buf));
+}
+
+static void biquad_block(struct math_filter *f, const float *__restrict in,
+		float *__restrict out, unsigned int len)
+{
+	double z1 = f->z1, z2 = f->z2, x, y;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		x = in[i];
+		y = f->b0 * x + z1;
+		z1 = f->b1 * x - f->a1 * y + z2;
+		z2 = f->b2 * x - f->a2 * y;
+		out[i] = (float)y;
+	}
+
+	f->z1 = z1;
+	f->z2 = z2;
+}
+
+static void decimate_block(struct math_filter *f, const float *__restrict in,
+		float *__restrict out, unsigned int len)
+{
+	unsigned int i, s;
+	float y;
+
+	for (i = 0; i < len; i++) {
+		y = in[i];
+		for (s = 0; s < f->order; s++)
+			y = boxcar_step(&f->stages[s], y);
+
+		if (++f->phase == f->rate) {
+			f->phase = 0;
+			f->hold = y;
+		}
+		out[i] = f->hold;
+	}
+}
+
+static void dcblock_block(struct math_filter *f, const float *__restrict in,
+		float *__restrict out, unsigned int len)
+{
+	double x1 = f->x1, y1 = f->y1;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		y1 = in[i] - x1 + f->pole * y1;
+		x1 = in[i];
+		out[i] = (float)y1;
+	}
+
+	f->x1 = x1;
+	f->y1 = y1;
+}
+
+void math_filter_run(struct math_filter *f, const float *in, float *out,
+		unsigned int len)
+{
+	unsigned int i;
+
+	switch (f->type) {
+	case MATH_FILTER_FIR:
+		fir_block(f, in, out, len);
+		break;
+	case MATH_FILTER_BIQUAD:
+		biquad_block(f, in, out, len);
+		break;
+	case MATH_FILTER_MOVAVG:
+		for (i = 0; i < len; i++)
+			out[i] = boxcar_step(&f->stages[0], in[i]);
+		break;
+	case MATH_FILTER_DECIMATE:
+		decimate_block(f, in, out, len);
+		break;
+	case MATH_FILTER_DCBLOCK:
+		dcblock_block(f, in, out, len);
+		break;
+	}
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __MATH_FILTER_H__
+#define __MATH_FILTER_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define MATH_FILTER_MAX_TAPS	4096
+#define MATH_FILTER_MAX_ORDER	6
+
+enum math_filter_type {
+	MATH_FILTER_FIR,
+	MATH_FILTER_BIQUAD,
+	MATH_FILTER_MOVAVG,
+	MATH_FILTER_DECIMATE,
+	MATH_FILTER_DCBLOCK,
+};
+
+struct math_boxcar {
+	float *ring;
+	unsigned int length, pos;
+	double sum;
+};
+
+/*
+ * Filter used by a math expression. It processes one block at a time and
+ * keeps its state from one block, and one capture, to the next.
+ */
+struct math_filter {
+	enum math_filter_type type;
+
+	/* FIR: reversed taps, buf holds num_taps - 1 past inputs + a block */
+	float *taps;
+	unsigned int num_taps;
+	float *buf;
+	unsigned int buf_len;
+
+	/* biquad, transposed direct form II, a0 = 1 */
+	double b0, b1, b2, a1, a2;
+	double z1, z2;
+
+	/* moving average (one stage), decimation (order stages) */
+	struct math_boxcar stages[MATH_FILTER_MAX_ORDER];
+	unsigned int order;
+	unsigned int rate, phase;
+	float hold;
+
+	/* DC blocker */
+	double pole;
+	double x1, y1;
+};
+
+struct math_filter * math_filter_fir_new(const float *taps,
+		unsigned int num_taps, unsigned int block_size);
+struct math_filter * math_filter_fir_from_file(const char *name,
+		unsigned int block_size, gchar **error);
+struct math_filter * math_filter_biquad_new(double b0, double b1, double b2,
+		double a1, double a2);
+struct math_filter * math_filter_movavg_new(unsigned int length);
+struct math_filter * math_filter_decimate_new(unsigned int rate,
+		unsigned int order);
+struct math_filter * math_filter_dcblock_new(double pole);
+void math_filter_free(struct math_filter *f);
+
+void math_filter_run(struct math_filter *f, const float *in, float *out,
+		unsigned int len);
+
+#endif /* __MATH_FILTER_H__ */
@@ -33,6 +33,10 @@
 #include "config.h"
 #include "osc_plugin.h"
 #include "iio_utils.h"
+#include "buffer_demux.h"
+#include "coherent_avg.h"
+#include "code_density.h"
+#include "export.h"
 
 GSList *plugin_list = NULL;
 
@@ -47,6 +51,7 @@ static int num_check_fcts = 0;
 static GSList *plugin_lib_list = NULL;
 static GSList *dplugin_list = NULL;
 static struct osc_plugin *spect_analyzer_plugin = NULL;
+static struct code_density *code_density = NULL;
 static OscPreferences *osc_preferences = NULL;
 GtkWidget *notebook;
 GtkWidget *infobar;
@@ -272,6 +277,8 @@ static void close_active_buffers(void)
 			iio_buffer_destroy(info->buffer);
 			info->buffer = NULL;
 		}
+		coherent_avg_free(info->coherent_avg);
+		info->coherent_avg = NULL;
 
 		disable_all_channels(dev);
 	}
@@ -1178,50 +1185,6 @@ static void plugin_state_ini_save(gpointer data, gpointer user_data)
 	}
 }
 
-static ssize_t demux_sample(const struct iio_channel *chn,
-		void *sample, size_t size, void *d)
-{
-	struct extra_info *info = iio_channel_get_data(chn);
-	struct extra_dev_info *dev_info = iio_device_get_data(info->dev);
-	const struct iio_data_format *format = iio_channel_get_data_format(chn);
-
-	/* Prevent buffer overflow */
-	if ((unsigned long) info->offset == (unsigned long) dev_info->sample_count)
-		return 0;
-
-	if (size == 1) {
-		int8_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint8_t)val;
-	} else if (size == 2) {
-		int16_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint16_t)val;
-	} else if (size == 4) {
-		int32_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint32_t)val;
-	} else {
-		int64_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint64_t)val;
-	}
-
-	return size;
-}
-
 static off_t get_trigger_offset(const struct iio_channel *chn,
 		bool falling_edge, float trigger_value)
 {
@@ -1251,6 +1214,42 @@ static void apply_trigger_offset(const struct iio_channel *chn, off_t offset)
 	}
 }
 
+/* Returns true when the channels data holds an average to be plotted */
+static bool coherent_average(struct iio_device *dev,
+		struct extra_dev_info *dev_info)
+{
+	unsigned int i, nb_channels = iio_device_get_channels_count(dev);
+	struct coherent_avg *avg = dev_info->coherent_avg;
+	bool ready = false;
+
+	if (!avg || avg->num_avg != dev_info->time_avg ||
+			avg->moving != dev_info->time_avg_moving ||
+			avg->length != dev_info->sample_count) {
+		coherent_avg_free(avg);
+		avg = coherent_avg_new(dev_info->time_avg,
+				dev_info->time_avg_moving, nb_channels,
+				dev_info->sample_count);
+		dev_info->coherent_avg = avg;
+		if (!avg) {
+			fprintf(stderr, "Error: Unable to allocate the averaging buffers of %u captures\n",
+					dev_info->time_avg);
+			dev_info->time_avg = 0;
+			return true;
+		}
+	}
+
+	for (i = 0; i < nb_channels; i++) {
+		struct iio_channel *ch = iio_device_get_channel(dev, i);
+		struct extra_info *info = iio_channel_get_data(ch);
+
+		if (iio_channel_is_enabled(ch))
+			ready = coherent_avg_update(avg, i, info->data_ref);
+	}
+	coherent_avg_next(avg);
+
+	return ready;
+}
+
 static bool device_is_oneshot(struct iio_device *dev)
 {
 	const char *name = iio_device_get_name(dev);
@@ -1276,6 +1275,7 @@ static gboolean capture_process(void *data)
 		ssize_t sample_count = dev_info->sample_count;
 		struct iio_channel *chn;
 		off_t offset = 0;
+		bool avg_ready = true;
 
 		if (dev_info->input_device == false)
 			continue;
@@ -1313,8 +1313,18 @@ static gboolean capture_process(void *data)
 
 			ret /= iio_buffer_step(dev_info->buffer);
 			if (ret >= sample_count) {
-				iio_buffer_foreach_sample(
-						dev_info->buffer, demux_sample, NULL);
+				/* The last capture may still be waiting for the
+				 * auto export writer to copy it */
+				export_snapshots_detach_all();
+				for (i = 0; i < nb_channels; i++) {
+					struct iio_channel *ch = iio_device_get_channel(dev, i);
+					struct extra_info *info = iio_channel_get_data(ch);
+
+					if (iio_channel_is_enabled(ch))
+						info->offset = buffer_demux_float(
+							dev_info->buffer, ch,
+							info->data_ref, sample_count);
+				}
 
 				if (ret >= sample_count * 2) {
 					printf("Decreasing buffer size\n");
@@ -1360,7 +1370,13 @@ static gboolean capture_process(void *data)
 			}
 		}
 
-		if (dev_info->channels_data_copy) {
+		/* Average the captures aligned on the trigger, the ones where
+		   it wasn't found are not plotted so they aren't summed either */
+		if (dev_info->time_avg > 1 &&
+				(!dev_info->channel_trigger_enabled || offset))
+			avg_ready = coherent_average(dev, dev_info);
+
+		if (dev_info->channels_data_copy && avg_ready) {
 			for (i = 0; i < nb_channels; i++) {
 				struct iio_channel *ch = iio_device_get_channel(dev, i);
 				struct extra_info *info = iio_channel_get_data(ch);
@@ -1376,7 +1392,7 @@ static gboolean capture_process(void *data)
 			dev_info->buffer = NULL;
 		}
 
-		if (!dev_info->channel_trigger_enabled || offset)
+		if ((!dev_info->channel_trigger_enabled || offset) && avg_ready)
 			update_plot(dev_info->buffer);
 	}
 
@@ -1460,6 +1476,9 @@ static int capture_setup(void)
 	unsigned int timeout;
 	double freq;
 
+	/* The capture buffers are reallocated below */
+	export_snapshots_detach_all();
+
 	for (i = 0; i < num_devices; i++) {
 		struct iio_device *dev = iio_context_get_device(ctx, i);
 		struct extra_dev_info *dev_info = iio_device_get_data(dev);
@@ -1500,6 +1519,10 @@ static int capture_setup(void)
 		dev_info->buffer = NULL;
 		dev_info->sample_count = sample_count;
 
+		/* The enabled channels may have changed, restart the average */
+		coherent_avg_free(dev_info->coherent_avg);
+		dev_info->coherent_avg = NULL;
+
 		iio_device_set_data(dev, dev_info);
 
 		freq = read_sampling_frequency(dev);
@@ -1707,6 +1730,8 @@ static void do_quit(bool reload)
 	stop_capture = TRUE;
 	G_TRYLOCK(buffer_full);
 	G_UNLOCK(buffer_full);
+	code_density_free(code_density);
+	code_density = NULL;
 	close_active_buffers();
 
 	close_all_plots();
@@ -2243,6 +2268,145 @@ void save_complete_profile(const char *filename)
 	}
 }
 
+#define CODE_DENSITY_BUFFER_SIZE (1 << 20)
+
+static void code_density_print(void)
+{
+	struct code_density_results *res = &code_density->results;
+
+	if (code_density_compute(code_density) < 0) {
+		printf("Code density: %" G_GUINT64_FORMAT " samples, not enough codes hit\n",
+				res->total);
+		return;
+	}
+
+	printf("Code density: %" G_GUINT64_FORMAT " samples, codes %u..%u, "
+			"DNL %+.3f/%+.3f LSB, INL %+.3f/%+.3f LSB, %u missing codes\n",
+			res->total, res->first_code, res->last_code,
+			res->dnl_min, res->dnl_max, res->inl_min, res->inl_max,
+			res->missing_codes);
+}
+
+static void code_density_end(void)
+{
+	code_density_free(code_density);
+	code_density = NULL;
+
+	/* Give the device back to the plots */
+	if (num_capturing_plots) {
+		capture_setup();
+		capture_start();
+	}
+}
+
+/*
+ * Code density test of an ADC channel, driven from the profile:
+ * code_density.start = device channel sine|ramp samples
+ * code_density.wait = timeout in seconds
+ * code_density.save = file.csv
+ * code_density.stop = 1
+ * test.code_density.{dnl_min,dnl_max,inl_min,inl_max,missing_codes} = min max
+ */
+static int handle_code_density(int line, const char *name, const char *value)
+{
+	if (!strcmp(name, "code_density.start")) {
+		char dev_name[64], chn_name[64], ref_name[16];
+		unsigned long long samples = 0;
+		struct iio_device *dev;
+		struct iio_channel *chn;
+		int ref;
+
+		if (sscanf(value, "%63s %63s %15s %llu", dev_name, chn_name,
+					ref_name, &samples) < 3)
+			return -EINVAL;
+
+		dev = iio_context_find_device(ctx, dev_name);
+		chn = dev ? iio_device_find_channel(dev, chn_name, false) : NULL;
+		ref = code_density_reference_from_string(ref_name);
+		if (!chn || ref < 0)
+			return -EINVAL;
+
+		/* The test streams from the device on its own */
+		if (code_density)
+			code_density_end();
+		stop_sampling();
+
+		code_density = code_density_new(dev, chn, ref,
+				CODE_DENSITY_BUFFER_SIZE, 0);
+		if (!code_density)
+			return -EINVAL;
+
+		return code_density_start(code_density, samples);
+	}
+
+	if (!code_density) {
+		fprintf(stderr, "Line %i: no code density test started\n", line);
+		return -EINVAL;
+	}
+
+	if (!strcmp(name, "code_density.wait")) {
+		gint64 end = g_get_monotonic_time() +
+			(gint64)(atof(value) * G_USEC_PER_SEC);
+
+		while (code_density_running(code_density) &&
+				g_get_monotonic_time() < end) {
+			osc_process_gtk_events(1000);
+			code_density_print();
+		}
+		code_density_print();
+
+		return code_density->error;
+	} else if (!strcmp(name, "code_density.stop")) {
+		code_density_stop(code_density);
+		code_density_print();
+		code_density_end();
+		return 0;
+	} else if (!strcmp(name, "code_density.save")) {
+		code_density_compute(code_density);
+		return code_density_save(code_density, value);
+	} else if (!strncmp(name, "test.code_density.", sizeof("test.code_density.") - 1)) {
+		struct code_density_results *res = &code_density->results;
+		const char *result = name + sizeof("test.code_density.") - 1;
+		double min, max, val;
+
+		if (sscanf(value, "%lf %lf", &min, &max) != 2)
+			return -EINVAL;
+
+		if (code_density_compute(code_density) < 0)
+			return -EAGAIN;
+
+		if (!strcmp(result, "dnl_min"))
+			val = res->dnl_min;
+		else if (!strcmp(result, "dnl_max"))
+			val = res->dnl_max;
+		else if (!strcmp(result, "inl_min"))
+			val = res->inl_min;
+		else if (!strcmp(result, "inl_max"))
+			val = res->inl_max;
+		else if (!strcmp(result, "missing_codes"))
+			val = res->missing_codes;
+		else
+			return -EINVAL;
+
+		printf("Line %i: (%s = %s): value = %lf\n", line, name, value, val);
+		if (val >= min && val <= max) {
+			fprintf(stderr, "Test passed.\n");
+			return 0;
+		}
+
+		create_blocking_popup(GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+				"Test failure",
+				"Test failed! Line: %i\n\n"
+				"Test was: %s = %f %f\n"
+				"Value read = %f\n",
+				line, name, min, max, val);
+		fprintf(stderr, "*** Test failed! ***\n");
+		return -1;
+	}
+
+	return -EINVAL;
+}
+
 static int handle_osc_param(int line, const char *name, const char *value)
 {
 	gchar **elems;
@@ -2257,6 +2421,17 @@ static int handle_osc_param(int line, const char *name, const char *value)
 		return 0;
 	}
 
+	if (!strncmp(name, "code_density.", sizeof("code_density.") - 1) ||
+			!strncmp(name, "test.code_density.", sizeof("test.code_density.") - 1)) {
+		int ret = handle_code_density(line, name, value);
+
+		/* -1 is a failed test, already reported */
+		if (ret < -1)
+			fprintf(stderr, "Line %i: code density: %s = %s failed: %s\n",
+					line, name, value, strerror(-ret));
+		return ret < 0 ? -1 : 0;
+	}
+
 	if (!strcmp(name, "test") || !strcmp(name, "window_x_pos") ||
 			!strcmp(name, "window_y_pos") || !strcmp(name, "remote_ip_addr")) {
 		printf("Ignoring token \'%s\' when loading sequentially\n", name);
@@ -33,6 +33,7 @@ const void *memrchr(const void *src, int c, size_t length);
 #define SAVE_MAT 1
 #define SAVE_VSA 2
 #define SAVE_PNG 3
+#define SAVE_SIGMF 4
 
 extern GtkWidget *capture_graph;
 extern gint capture_function;
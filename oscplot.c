@@ -15,7 +15,6 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <math.h>
-#include <matio.h>
 #include <sys/time.h>
 #include <string.h>
 #include <sys/types.h>
@@ -32,14 +31,13 @@
 #include "datatypes.h"
 #include "osc_plugin.h"
 #include "math_expression_generator.h"
+#include "math_compiler.h"
+#include "export.h"
+#include "auto_export.h"
 #include "iio_utils.h"
-
-/* add backwards compat for <matio-1.5.0 */
-#if MATIO_MAJOR_VERSION == 1 && MATIO_MINOR_VERSION < 5
-typedef int mat_dim;
-#else
-typedef size_t mat_dim;
-#endif
+#include "persistence.h"
+#include "demod.h"
+#include "chanpower.h"
 
 /* timersub, macros are _BSD_SOURCE, and aren't included in windows */
 #ifndef timersub
@@ -95,6 +93,7 @@ static gfloat * plot_channels_get_nth_data_ref(GSList *list, guint n);
 static void transform_add_own_markers(OscPlot *plot, Transform *transform);
 static void transform_remove_own_markers(Transform *transform);
 static bool set_channel_state_in_tree_model(GtkTreeModel *model, GtkTreeIter* chn_iter, gboolean state);
+static void auto_export_capture(OscPlot *plot);
 
 /* IDs of signals */
 enum {
@@ -132,6 +131,13 @@ enum {
 	HOR_SCALE_NUM_OPTIONS
 };
 
+/* What the EVM measurement displays in the XY domain */
+enum {
+	EVM_VIEW_OFF,
+	EVM_VIEW_SYMBOLS,
+	EVM_VIEW_EYE,
+};
+
 /* Types of channels that can be displayed on a plot */
 enum {
 	PLOT_IIO_CHANNEL = 0,
@@ -218,6 +224,7 @@ struct math_channel_settings {
 	int num_channels;
 	char *iio_device_name;
 	char *txt_math_expression;
+	struct math_program *math_program;
 	void (*math_expression)(float ***channels_data, float *out_data, unsigned long long chn_sample_cnt);
 	void *math_lib_handler;
 	float *data_ref;
@@ -229,6 +236,7 @@ struct math_channel_settings {
 #define CONSTELLATION_SETTINGS(obj) ((struct _constellation_settings *)obj->settings)
 #define XCORR_SETTINGS(obj) ((struct _cross_correlation_settings *)obj->settings)
 #define FREQ_SPECTRUM_SETTINGS(obj) ((struct _freq_spectrum_settings *)obj->settings)
+#define EVM_SETTINGS(obj) ((struct _evm_settings *)obj->settings)
 #define MATH_SETTINGS(obj) ((struct _math_settings *)obj->settings)
 
 #define PLOT_CHN(obj) ((PlotChn *)obj)
@@ -315,6 +323,12 @@ struct _OscPlotPrivate
 	GtkWidget *math_device_select;
 	GtkWidget *math_channel_name_entry;
 	GtkWidget *math_expr_error;
+	GtkWidget *save_progress_box;
+	GtkWidget *save_progress;
+	GtkWidget *save_cancel_button;
+
+	GList *save_jobs;
+	guint save_progress_timer;
 
 	GtkCssProvider *provider;
 
@@ -379,6 +393,19 @@ struct _OscPlotPrivate
 
 	gint line_thickness;
 
+	/* Fraction of the persistence histogram kept from one frame to the next */
+	gfloat persistence_decay;
+
+	/* Demodulation / EVM measurement of XY plots */
+	int evm_view;
+	int evm_modulation;
+	gfloat evm_samples_per_symbol;
+
+	/* Channel power / ACLR of FFT plots, off while channel_bw is 0 */
+	struct chanpower_config aclr_cfg;
+	struct auto_export_config auto_export_cfg;
+	struct auto_export *auto_export;
+
 	gint redraw_function;
 	gboolean stop_redraw;
 	gboolean redraw;
@@ -515,6 +542,9 @@ void osc_plot_data_update (OscPlot *plot)
 	if (call_all_transform_functions(plot->priv))
 		plot->priv->redraw = TRUE;
 
+	if (plot->priv->auto_export)
+		auto_export_capture(plot);
+
 	if (plot->priv->single_shot_mode) {
 		plot->priv->single_shot_mode = false;
 		gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(plot->priv->capture_button), false);
@@ -1260,10 +1290,11 @@ static void do_fft_for_spectrum(Transform *tr)
 	gfloat *in_data_c = settings->imag_source;
 	gfloat *out_data = tr->y_axis + (settings->fft_index * fft_clip_size);
 	int fft_size = settings->fft_size;
-	int i, j, k, m;
+	gfloat *mag_data = settings->fft_mag;
+	unsigned i, lower, upper, half;
+	int j, k, m;
 	int cnt;
-	gfloat mag;
-	double avg, pwr_offset;
+	double avg, pwr_offset, scale;
 	unsigned int *maxX = settings->maxXaxis;
 	gfloat *maxY = settings->maxYaxis;
 
@@ -1299,10 +1330,9 @@ static void do_fft_for_spectrum(Transform *tr)
 		fft->cached_num_active_channels = fft->num_active_channels;
 	}
 
-	for (cnt = 0, i = 0; cnt < fft_size; cnt++) {
+	for (cnt = 0; cnt < fft_size; cnt++) {
 		/* normalization and scaling see fft_corr */
-		fft->in_c[cnt] = in_data[i] * fft->win[cnt] + I * in_data_c[i] * fft->win[cnt];
-		i++;
+		fft->in_c[cnt] = (in_data[cnt] + I * in_data_c[cnt]) * fft->win[cnt];
 	}
 
 	fftw_execute(fft->plan_forward);
@@ -1315,65 +1345,70 @@ static void do_fft_for_spectrum(Transform *tr)
 	else
                  pwr_offset = settings->fft_pwr_off;
 
-	for (i = 0, k = 0; i < fft->m; ++i) {
-		if ((unsigned)i < settings->fft_lower_clipping_limit || (unsigned)i >= settings->fft_upper_clipping_limit)
-			continue;
-		if (i < (fft->m / 2))
-			j = i + (fft->m / 2);
-		else
-			j = i - (fft->m / 2);
+	/* Only the bins within the filter bandwidth are kept, the roll-off at
+	 * the edges of each step is left out. The spectrum is centered by
+	 * reading the two halves of the output in turn, so none of the loops
+	 * below has a test in it. */
+	scale = 1.0 / ((unsigned long long)fft->m * fft->m);
+	half = fft->m / 2;
+	lower = settings->fft_lower_clipping_limit;
+	upper = settings->fft_upper_clipping_limit;
+	for (k = 0, i = lower; i < upper && i < half; i++, k++)
+		mag_data[k] = (creal(fft->out[i + half]) * creal(fft->out[i + half]) +
+			cimag(fft->out[i + half]) * cimag(fft->out[i + half])) * scale;
+	for (; i < upper; i++, k++)
+		mag_data[k] = (creal(fft->out[i - half]) * creal(fft->out[i - half]) +
+			cimag(fft->out[i - half]) * cimag(fft->out[i - half])) * scale;
+
+	for (k = 0; k < fft_clip_size; k++) {
+		/* An empty bin would be -inf */
+		if (mag_data[k] < FLT_MIN)
+			mag_data[k] = FLT_MIN;
+		mag_data[k] = 10 * log10(mag_data[k]) + settings->fft_corr + pwr_offset;
+	}
+
+	if (out_data[0] == FLT_MAX) {
+		/* Don't average the first iteration */
+		memcpy(out_data, mag_data, fft_clip_size * sizeof(*out_data));
+	} else if (!avg) {
+		/* keep peaks */
+		for (k = 0; k < fft_clip_size; k++)
+			out_data[k] = out_data[k] > mag_data[k] ? out_data[k] : mag_data[k];
+	} else if (avg == 128) {
+		/* keep min */
+		for (k = 0; k < fft_clip_size; k++)
+			out_data[k] = out_data[k] < mag_data[k] ? out_data[k] : mag_data[k];
+	} else {
+		/* do an average */
+		for (k = 0; k < fft_clip_size; k++)
+			out_data[k] = ((1 - avg) * out_data[k]) + (avg * mag_data[k]);
+	}
 
-		if (creal(fft->out[j]) == 0 && cimag(fft->out[j]) == 0)
-			fft->out[j] = FLT_MIN + I * FLT_MIN;
+	if (!MAX_MARKERS || marker_type != MARKER_PEAK)
+		return;
 
-		mag = 10 * log10((creal(fft->out[j]) * creal(fft->out[j]) +
-				cimag(fft->out[j]) * cimag(fft->out[j])) / ((unsigned long long)fft->m * fft->m)) +
-			settings->fft_corr + pwr_offset;
-		/* it's better for performance to have separate loops,
-		 * rather than do these tests inside the loop, but it makes
-		 * the code harder to understand... Oh well...
-		 ***/
-		if (out_data[k] == FLT_MAX) {
-			/* Don't average the first iteration */
-			 out_data[k] = mag;
-		} else if (!avg) {
-			/* keep peaks */
-			if (out_data[k] <= mag)
-				out_data[k] = mag;
-		} else if (avg == 128) {
-			/* keep min */
-			if (out_data[k] >= mag)
-				out_data[k] = mag;
+	for (k = 0; k < fft_clip_size; k++) {
+		if (settings->fft_index == 0 && k <= 2) {
+			maxX[0] = 0;
+			maxY[0] = out_data[0];
 		} else {
-			/* do an average */
-			out_data[k] = ((1 - avg) * out_data[k]) + (avg * mag);
-		}
-
-		if (MAX_MARKERS && marker_type == MARKER_PEAK) {
-			if (settings->fft_index == 0 && k <= 2) {
-				maxX[0] = 0;
-				maxY[0] = out_data[0];
-			} else {
-				for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
-					if  ((*(out_data + k - 1) > maxY[j]) &&
-						((!((*(out_data + k - 2) > *(out_data + k - 1)) &&
-						 (*(out_data + k - 1) > *(out_data + k)))) &&
-						 (!((*(out_data + k - 2) < *(out_data + k - 1)) &&
-						 (*(out_data + k - 1) < *(out_data + k)))))) {
-
-						for (m = MAX_MARKERS; m > j; m--) {
-							maxY[m] = maxY[m - 1];
-							maxX[m] = maxX[m - 1];
-						}
-						maxY[j] = *(out_data + k - 1);
-						maxX[j] = k + (settings->fft_index * fft_clip_size) - 1;
-						break;
+			for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
+				if  ((*(out_data + k - 1) > maxY[j]) &&
+					((!((*(out_data + k - 2) > *(out_data + k - 1)) &&
+					 (*(out_data + k - 1) > *(out_data + k)))) &&
+					 (!((*(out_data + k - 2) < *(out_data + k - 1)) &&
+					 (*(out_data + k - 1) < *(out_data + k)))))) {
+
+					for (m = MAX_MARKERS; m > j; m--) {
+						maxY[m] = maxY[m - 1];
+						maxX[m] = maxX[m - 1];
 					}
+					maxY[j] = *(out_data + k - 1);
+					maxX[j] = k + (settings->fft_index * fft_clip_size) - 1;
+					break;
 				}
 			}
 		}
-
-		k++;
 	}
 }
 
@@ -1459,6 +1494,16 @@ static void xcorr(fftw_complex *signala, fftw_complex *signalb, fftw_complex *re
 	return;
 }
 
+/* Built-in bytecode when available, the gcc compiled library otherwise */
+static void plot_math_channel_eval(PlotMathChn *m, unsigned long long n)
+{
+	if (m->math_program)
+		math_program_run(m->math_program, m->iio_channels_data,
+				m->data_ref, n);
+	else
+		m->math_expression(m->iio_channels_data, m->data_ref, n);
+}
+
 bool time_transform_function(Transform *tr, gboolean init_transform)
 {
 	struct _time_settings *settings = tr->settings;
@@ -1494,14 +1539,11 @@ bool time_transform_function(Transform *tr, gboolean init_transform)
 
 	if (tr->plot_channels_type == PLOT_MATH_CHANNEL) {
 		PlotMathChn *m = tr->plot_channels->data;
-		m->math_expression(m->iio_channels_data,
-			m->data_ref, settings->num_samples);
-	} else if (tr->plot_channels_type == PLOT_IIO_CHANNEL) {
-		if (!settings->apply_inverse_funct &&
-				!settings->apply_multiply_funct &&
-				!settings->apply_add_funct)
-			return true;
-
+		plot_math_channel_eval(m, settings->num_samples);
+	} else if (tr->plot_channels_type == PLOT_IIO_CHANNEL &&
+			(settings->apply_inverse_funct ||
+			 settings->apply_multiply_funct ||
+			 settings->apply_add_funct)) {
 		in_data = plot_channels_get_nth_data_ref(tr->plot_channels, 0);
 		if (!in_data)
 			return false;
@@ -1522,6 +1564,10 @@ bool time_transform_function(Transform *tr, gboolean init_transform)
 		}
 	}
 
+	if (settings->persistence)
+		persistence_accumulate(settings->persistence, tr->x_axis,
+				tr->y_axis, tr->y_axis_size);
+
 	return true;
 }
 
@@ -1574,8 +1620,7 @@ bool cross_correlation_transform_function(Transform *tr, gboolean init_transform
 	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
 		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
 			PlotMathChn *m = node->data;
-			m->math_expression(m->iio_channels_data,
-				m->data_ref, settings->num_samples);
+			plot_math_channel_eval(m, settings->num_samples);
 		}
 
 	i_0 = settings->i0_source;
@@ -1708,13 +1753,19 @@ bool freq_spectrum_transform_function(Transform *tr, gboolean init_transform)
 		/* Compute FFT normalization and scaling offset */
 		settings->fft_corr = 20 * log10(2.0 / (1ULL << (bits_used - 1)));
 
-		settings->fft_lower_clipping_limit = (fft_size / 2) - (settings->filter_bandwidth * fft_size) / (2 * sampling_freq);
-		settings->fft_upper_clipping_limit = (fft_size / 2) + (settings->filter_bandwidth * fft_size) / (2 * sampling_freq);
+		/* Rounded, so steps a whole number of bins wide stitch exactly */
+		settings->fft_lower_clipping_limit = (fft_size / 2) - (unsigned)((settings->filter_bandwidth * fft_size) / (2 * sampling_freq) + 0.5);
+		settings->fft_upper_clipping_limit = (fft_size / 2) + (unsigned)((settings->filter_bandwidth * fft_size) / (2 * sampling_freq) + 0.5);
 
 		settings->real_source = plot_channels_get_nth_data_ref(tr->plot_channels, 0);
 		settings->imag_source = plot_channels_get_nth_data_ref(tr->plot_channels, 1);
 
 		axis_length = (settings->fft_upper_clipping_limit - settings->fft_lower_clipping_limit) * settings->fft_count;
+		free(settings->fft_mag);
+		settings->fft_mag = malloc(sizeof(*settings->fft_mag) *
+			(settings->fft_upper_clipping_limit - settings->fft_lower_clipping_limit));
+		if (!settings->fft_mag)
+			return false;
 		Transform_resize_x_axis(tr, axis_length);
 		Transform_resize_y_axis(tr, axis_length);
 
@@ -1767,6 +1818,31 @@ bool freq_spectrum_transform_function(Transform *tr, gboolean init_transform)
 	return complete_transform;
 }
 
+static void fft_channel_power(Transform *tr)
+{
+	struct _fft_settings *settings = tr->settings;
+	struct _fft_alg_data *fft = &settings->fft_alg_data;
+	struct chanpower *cp = settings->chanpower;
+	struct iio_device *dev;
+	struct extra_dev_info *dev_info;
+	double db_offset = 0.0;
+
+	dev = transform_get_device_parent(tr);
+	if (!dev)
+		return;
+	dev_info = iio_device_get_data(dev);
+
+	if (cp->win_size != (unsigned int)fft->cached_fft_size)
+		chanpower_set_window(cp, fft->win, fft->cached_fft_size);
+
+	/* The coherent gain correction is wrong for noise-like signals */
+	if (settings->window_correction)
+		db_offset = window_function_offset(settings->fft_win);
+
+	chanpower_process(cp, tr->x_axis, tr->y_axis, tr->y_axis_size,
+			prefix2scale(dev_info->adc_scale), db_offset);
+}
+
 bool fft_transform_function(Transform *tr, gboolean init_transform)
 {
 	struct iio_device *dev;
@@ -1832,6 +1908,9 @@ bool fft_transform_function(Transform *tr, gboolean init_transform)
 				if (settings->markers[i].bin >= axis_length)
 					settings->markers[i].bin = 0;
 
+		if (settings->chanpower)
+			chanpower_reset(settings->chanpower);
+
 		return true;
 	}
 
@@ -1840,11 +1919,13 @@ bool fft_transform_function(Transform *tr, gboolean init_transform)
 	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
 		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
 			PlotMathChn *m = node->data;
-			m->math_expression(m->iio_channels_data,
-				m->data_ref, settings->fft_size);
+			plot_math_channel_eval(m, settings->fft_size);
 		}
 	do_fft(tr);
 
+	if (settings->chanpower)
+		fft_channel_power(tr);
+
 	return true;
 }
 
@@ -1872,13 +1953,182 @@ bool constellation_transform_function(Transform *tr, gboolean init_transform)
 	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
 		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
 			PlotMathChn *m = node->data;
-			m->math_expression(m->iio_channels_data,
-				m->data_ref, settings->num_samples);
+			plot_math_channel_eval(m, settings->num_samples);
 		}
 
+	if (settings->persistence)
+		persistence_accumulate(settings->persistence, settings->x_source,
+				settings->y_source, settings->num_samples);
+
 	return true;
 }
 
+static gpointer evm_worker_func(struct _evm_settings *settings)
+{
+	int ret;
+
+	g_mutex_lock(&settings->lock);
+	while (true) {
+		while (!settings->pending && !settings->stop)
+			g_cond_wait(&settings->cond, &settings->lock);
+		if (settings->stop)
+			break;
+		g_mutex_unlock(&settings->lock);
+
+		ret = demod_process(settings->work, settings->in_i,
+				settings->in_q, settings->num_samples);
+
+		g_mutex_lock(&settings->lock);
+		settings->work_valid = ret >= 0;
+		settings->ready = true;
+		settings->pending = false;
+	}
+	g_mutex_unlock(&settings->lock);
+
+	return NULL;
+}
+
+static void evm_worker_stop(struct _evm_settings *settings)
+{
+	if (!settings->worker)
+		return;
+
+	g_mutex_lock(&settings->lock);
+	settings->stop = true;
+	g_cond_signal(&settings->cond);
+	g_mutex_unlock(&settings->lock);
+	g_thread_join(settings->worker);
+	settings->worker = NULL;
+
+	g_mutex_clear(&settings->lock);
+	g_cond_clear(&settings->cond);
+	demod_free(settings->work);
+	g_free(settings->in_i);
+	g_free(settings->in_q);
+	settings->work = NULL;
+	settings->in_i = settings->in_q = NULL;
+}
+
+static bool evm_worker_start(struct _evm_settings *settings)
+{
+	settings->work = demod_new(settings->modulation,
+			settings->samples_per_symbol, settings->num_samples);
+	if (!settings->work)
+		return false;
+
+	settings->in_i = g_new(gfloat, settings->num_samples);
+	settings->in_q = g_new(gfloat, settings->num_samples);
+	settings->pending = settings->ready = settings->stop = false;
+	settings->work_valid = settings->shown = false;
+	g_mutex_init(&settings->lock);
+	g_cond_init(&settings->cond);
+	settings->worker = g_thread_new("EVM", (GThreadFunc)evm_worker_func,
+			settings);
+
+	return true;
+}
+
+/* Show what the worker last demodulated, then hand it the new capture.
+ * Captures that come while the worker is busy are not demodulated. */
+static bool evm_worker_exchange(struct _evm_settings *settings)
+{
+	struct demod *shown = settings->demod, *work = settings->work;
+	bool updated = false;
+
+	g_mutex_lock(&settings->lock);
+
+	if (settings->ready) {
+		settings->ready = false;
+		if (settings->work_valid) {
+			memcpy(shown->sym_i, work->sym_i,
+				work->max_symbols * sizeof(gfloat));
+			memcpy(shown->sym_q, work->sym_q,
+				work->max_symbols * sizeof(gfloat));
+			memcpy(shown->eye_x, work->eye_x,
+				work->capacity * sizeof(gfloat));
+			memcpy(shown->eye_y, work->eye_y,
+				work->capacity * sizeof(gfloat));
+			shown->results = work->results;
+			settings->shown = updated = true;
+		}
+	}
+
+	if (!settings->pending && settings->i_source && settings->q_source) {
+		memcpy(settings->in_i, settings->i_source,
+			settings->num_samples * sizeof(gfloat));
+		memcpy(settings->in_q, settings->q_source,
+			settings->num_samples * sizeof(gfloat));
+		settings->pending = true;
+		g_cond_signal(&settings->cond);
+	}
+
+	g_mutex_unlock(&settings->lock);
+
+	return updated;
+}
+
+bool evm_transform_function(Transform *tr, gboolean init_transform)
+{
+	struct _evm_settings *settings = tr->settings;
+	struct demod *d;
+	GSList *node;
+
+	if (init_transform) {
+		/* Set the sources of the transfrom */
+		settings->i_source = plot_channels_get_nth_data_ref(tr->plot_channels, 0);
+		settings->q_source = plot_channels_get_nth_data_ref(tr->plot_channels, 1);
+
+		evm_worker_stop(settings);
+		demod_free(settings->demod);
+		settings->demod = d = demod_new(settings->modulation,
+				settings->samples_per_symbol, settings->num_samples);
+		if (d && !evm_worker_start(settings)) {
+			demod_free(d);
+			settings->demod = d = NULL;
+		}
+		if (!d) {
+			fprintf(stderr, "EVM: can't demodulate %u samples at %f samples per symbol\n",
+					settings->num_samples, settings->samples_per_symbol);
+			/* Fall back to the raw constellation */
+			tr->x_axis_size = settings->num_samples;
+			tr->y_axis_size = settings->num_samples;
+			tr->x_axis = settings->i_source;
+			tr->y_axis = settings->q_source;
+			return false;
+		}
+
+		/* Initialize axis */
+		if (settings->eye_diagram) {
+			tr->x_axis_size = settings->num_samples;
+			tr->y_axis_size = settings->num_samples;
+			tr->x_axis = d->eye_x;
+			tr->y_axis = d->eye_y;
+		} else {
+			tr->x_axis_size = d->max_symbols;
+			tr->y_axis_size = d->max_symbols;
+			tr->x_axis = d->sym_i;
+			tr->y_axis = d->sym_q;
+		}
+
+		return true;
+	}
+
+	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
+		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
+			PlotMathChn *m = node->data;
+			plot_math_channel_eval(m, settings->num_samples);
+		}
+
+	if (!settings->demod)
+		return true;
+
+	if (evm_worker_exchange(settings) && settings->persistence)
+		persistence_accumulate(settings->persistence, tr->x_axis,
+				tr->y_axis, tr->y_axis_size);
+
+	return settings->shown;
+}
+
 
 /* Plot iio channel definitions */
 
@@ -2018,6 +2268,7 @@ static void plot_math_channel_destroy(PlotChn *obj)
 	if (this->txt_math_expression)
 		g_free(this->txt_math_expression);
 
+	math_program_free(this->math_program);
 	math_expression_close_lib_handler(this->math_lib_handler);
 
 	free(this);
@@ -2397,6 +2648,8 @@ static void update_transform_settings(OscPlot *plot, Transform *transform)
 		FFT_SETTINGS(transform)->markers_copy = NULL;
 		FFT_SETTINGS(transform)->marker_lock = NULL;
 		FFT_SETTINGS(transform)->marker_type = NULL;
+		if (priv->aclr_cfg.channel_bw > 0.0)
+			FFT_SETTINGS(transform)->chanpower = chanpower_new(&priv->aclr_cfg);
 	} else if (plot_type == TIME_PLOT) {
 		int dev_samples = plot_get_sample_count_for_transform(plot, transform);
 		if (dev_samples < 0)
@@ -2414,6 +2667,11 @@ static void update_transform_settings(OscPlot *plot, Transform *transform)
 			TIME_SETTINGS(transform)->add_value = set->add_value;
 			TIME_SETTINGS(transform)->max_x_axis = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->sample_count_widget));
 		}
+	} else if (plot_type == XY_PLOT && transform->type_id == EVM_TRANSFORM) {
+		EVM_SETTINGS(transform)->num_samples = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->sample_count_widget));
+		EVM_SETTINGS(transform)->modulation = priv->evm_modulation;
+		EVM_SETTINGS(transform)->samples_per_symbol = priv->evm_samples_per_symbol;
+		EVM_SETTINGS(transform)->eye_diagram = priv->evm_view == EVM_VIEW_EYE;
 	} else if (plot_type == XY_PLOT){
 		CONSTELLATION_SETTINGS(transform)->num_samples = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->sample_count_widget));
 	} else if (plot_type == XCORR_PLOT){
@@ -2461,6 +2719,7 @@ static Transform* add_transform_to_list(OscPlot *plot, int tr_type, GSList *chan
 	struct _constellation_settings *constellation_settings;
 	struct _cross_correlation_settings *xcross_settings;
 	struct _freq_spectrum_settings *freq_spectrum_settings;
+	struct _evm_settings *evm_settings;
 	GSList *node;
 
 	bool window_correction = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(plot->priv->fft_win_correction));
@@ -2514,6 +2773,11 @@ static Transform* add_transform_to_list(OscPlot *plot, int tr_type, GSList *chan
 		freq_spectrum_settings = (struct _freq_spectrum_settings *)calloc(1, sizeof(struct _freq_spectrum_settings));
 		Transform_attach_settings(transform, freq_spectrum_settings);
 		break;
+	case EVM_TRANSFORM:
+		Transform_attach_function(transform, evm_transform_function);
+		evm_settings = (struct _evm_settings *)calloc(1, sizeof(struct _evm_settings));
+		Transform_attach_settings(transform, evm_settings);
+		break;
 	default:
 		fprintf(stderr, "Invalid transform\n");
 		return NULL;
@@ -2580,8 +2844,15 @@ static void remove_transform_from_list(OscPlot *plot, Transform *tr)
 	transform_remove_own_markers(tr);
 	if (tr->type_id == FREQ_SPECTRUM_TRANSFORM) {
 		free(FREQ_SPECTRUM_SETTINGS(tr)->ffts_alg_data);
+		free(FREQ_SPECTRUM_SETTINGS(tr)->fft_mag);
 		free(FREQ_SPECTRUM_SETTINGS(tr)->maxXaxis);
 		free(FREQ_SPECTRUM_SETTINGS(tr)->maxYaxis);
+	} else if (tr->type_id == EVM_TRANSFORM) {
+		evm_worker_stop(EVM_SETTINGS(tr));
+		demod_free(EVM_SETTINGS(tr)->demod);
+	} else if (tr->type_id == FFT_TRANSFORM ||
+			tr->type_id == COMPLEX_FFT_TRANSFORM) {
+		chanpower_free(FFT_SETTINGS(tr)->chanpower);
 	}
 	TrList_remove_transform(list, tr);
 	Transform_destroy(tr);
@@ -2607,7 +2878,8 @@ static void markers_init(OscPlot *plot)
 
 	/* Don't go any further with the init when in TIME or XY domains*/
 	if (priv->active_transform_type == TIME_TRANSFORM ||
-			priv->active_transform_type == CONSTELLATION_TRANSFORM)
+			priv->active_transform_type == CONSTELLATION_TRANSFORM ||
+			priv->active_transform_type == EVM_TRANSFORM)
 		return;
 
 	/* Ensure that Marker Image is applied only to Complex FFT Transforms */
@@ -2981,6 +3253,125 @@ static void draw_marker_values(OscPlotPrivate *priv, Transform *tr)
 	}
 }
 
+static void draw_evm_values(OscPlotPrivate *priv, Transform *tr)
+{
+	struct demod *d = EVM_SETTINGS(tr)->demod;
+	struct demod_results *res;
+	char text[256];
+
+	if (priv->tbuf == NULL) {
+		priv->tbuf = gtk_text_buffer_new(NULL);
+		gtk_text_view_set_buffer(GTK_TEXT_VIEW(priv->marker_label), priv->tbuf);
+	}
+
+	if (!d) {
+		gtk_text_buffer_set_text(priv->tbuf, "EVM not available", -1);
+		return;
+	}
+
+	res = &d->results;
+	snprintf(text, sizeof(text),
+		"%s: %u symbols\n"
+		"EVM: %2.2f %% rms, %2.2f %% peak\n"
+		"MER: %2.2f dB\n"
+		"Freq offset: %1.5f cycles/symbol\n"
+		"Phase offset: %2.2f deg",
+		demod_modulation_to_string(d->modulation), res->num_symbols,
+		res->evm_rms, res->evm_peak, res->mer, res->freq_offset,
+		res->phase_offset * 180 / M_PI);
+	gtk_text_buffer_set_text(priv->tbuf, text, -1);
+}
+
+static void draw_aclr_values(OscPlotPrivate *priv, Transform *tr, bool append)
+{
+	struct chanpower *cp = FFT_SETTINGS(tr)->chanpower;
+	GtkTextIter iter;
+	char text[512];
+	int len, c;
+
+	if (priv->tbuf == NULL) {
+		priv->tbuf = gtk_text_buffer_new(NULL);
+		gtk_text_view_set_buffer(GTK_TEXT_VIEW(priv->marker_label), priv->tbuf);
+	}
+
+	if (!cp->valid) {
+		len = snprintf(text, sizeof(text), "%sChannel power not available",
+				append ? "\n" : "");
+	} else {
+		len = snprintf(text, sizeof(text), "%sChannel power: %2.2f dBFS",
+				append ? "\n" : "",
+				cp->power[CHANPOWER_MAX_ADJACENT]);
+		/* adjacent channels outside of the sampled span are NaN */
+		for (c = -(int)cp->cfg.num_adjacent; c <= (int)cp->cfg.num_adjacent; c++) {
+			gfloat aclr = cp->aclr[CHANPOWER_MAX_ADJACENT + c];
+
+			if (c == 0)
+				continue;
+			if (isnan(aclr))
+				len += snprintf(text + len, sizeof(text) - len,
+					"\nACLR %+d: n/a", c);
+			else
+				len += snprintf(text + len, sizeof(text) - len,
+					"\nACLR %+d: %2.2f dBc", c, aclr);
+		}
+	}
+
+	if (append) {
+		gtk_text_buffer_get_end_iter(priv->tbuf, &iter);
+		gtk_text_buffer_insert(priv->tbuf, &iter, text, -1);
+	} else {
+		gtk_text_buffer_set_text(priv->tbuf, text, -1);
+	}
+}
+
+/* Scalar results of the measurement transforms, checked by profile tests */
+static bool plot_measurement_get(OscPlotPrivate *priv, const char *name,
+		double *value)
+{
+	Transform *tr;
+	int i;
+
+	for (i = 0; i < priv->transform_list->size; i++) {
+		tr = priv->transform_list->transforms[i];
+
+		if (tr->type_id == EVM_TRANSFORM && EVM_SETTINGS(tr)->demod) {
+			struct demod_results *res = &EVM_SETTINGS(tr)->demod->results;
+
+			if (!strcmp(name, "evm"))
+				*value = res->evm_rms;
+			else if (!strcmp(name, "evm_peak"))
+				*value = res->evm_peak;
+			else if (!strcmp(name, "mer"))
+				*value = res->mer;
+			else if (!strcmp(name, "freq_offset"))
+				*value = res->freq_offset;
+			else
+				continue;
+			return true;
+		} else if ((tr->type_id == FFT_TRANSFORM ||
+				tr->type_id == COMPLEX_FFT_TRANSFORM) &&
+				FFT_SETTINGS(tr)->chanpower &&
+				FFT_SETTINGS(tr)->chanpower->valid) {
+			struct chanpower *cp = FFT_SETTINGS(tr)->chanpower;
+			unsigned int n;
+
+			if (!strcmp(name, "channel_power"))
+				*value = cp->power[CHANPOWER_MAX_ADJACENT];
+			else if (sscanf(name, "aclr_lower_%u", &n) == 1 &&
+					n >= 1 && n <= cp->cfg.num_adjacent)
+				*value = cp->aclr[CHANPOWER_MAX_ADJACENT - n];
+			else if (sscanf(name, "aclr_upper_%u", &n) == 1 &&
+					n >= 1 && n <= cp->cfg.num_adjacent)
+				*value = cp->aclr[CHANPOWER_MAX_ADJACENT + n];
+			else
+				continue;
+			return !isnan(*value);
+		}
+	}
+
+	return false;
+}
+
 static void device_rx_info_update(OscPlotPrivate *priv)
 {
 	GtkTextIter iter;
@@ -3209,7 +3600,9 @@ static void channels_transform_assignment(GtkTreeModel *model,
 	case XY_PLOT:
 		if (prm->enabled_channels == 2 && num_added_chs == 2) {
 			prm->ch_settings = g_slist_reverse(prm->ch_settings);
-			transform = add_transform_to_list(plot, CONSTELLATION_TRANSFORM, prm->ch_settings);
+			transform = add_transform_to_list(plot,
+				priv->evm_view != EVM_VIEW_OFF ? EVM_TRANSFORM : CONSTELLATION_TRANSFORM,
+				prm->ch_settings);
 		}
 		break;
 	case XCORR_PLOT:
@@ -3348,7 +3741,13 @@ static gboolean plot_redraw(OscPlotPrivate *priv)
 
 					show_diff_phase = true;
 					draw_marker_values(priv, tr);
+				} else if (tr->type_id == EVM_TRANSFORM) {
+					draw_evm_values(priv, tr);
 				}
+				if ((tr->type_id == FFT_TRANSFORM ||
+					tr->type_id == COMPLEX_FFT_TRANSFORM) &&
+					FFT_SETTINGS(tr)->chanpower)
+					draw_aclr_values(priv, tr, tr->has_the_marker);
 			}
 			if (show_diff_phase)
 				markers_phase_diff_show(priv);
@@ -3370,6 +3769,50 @@ static void capture_start(OscPlotPrivate *priv)
 	}
 }
 
+static struct persistence * transform_persistence(Transform *tr)
+{
+	switch (tr->type_id) {
+	case TIME_TRANSFORM:
+		return TIME_SETTINGS(tr)->persistence;
+	case EVM_TRANSFORM:
+		return EVM_SETTINGS(tr)->persistence;
+	case CONSTELLATION_TRANSFORM:
+		return CONSTELLATION_SETTINGS(tr)->persistence;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * The persistence histograms bin the visible area when the scale is fixed,
+ * and size themselves on the data when autoscaling.
+ */
+static void plot_persistence_fit(OscPlot *plot)
+{
+	OscPlotPrivate *priv = plot->priv;
+	TrList *tr_list = priv->transform_list;
+	gfloat left, right, top, bottom;
+	struct persistence *p;
+	bool autoscale;
+	int i;
+
+	autoscale = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priv->enable_auto_scale));
+	gtk_databox_get_visible_limits(GTK_DATABOX(priv->databox), &left, &right,
+			&top, &bottom);
+
+	for (i = 0; i < tr_list->size; i++) {
+		p = transform_persistence(tr_list->transforms[i]);
+		if (!p)
+			continue;
+
+		if (autoscale)
+			persistence_reset(p);
+		else
+			persistence_set_extent(p, MIN(left, right), MAX(left, right),
+					MIN(top, bottom), MAX(top, bottom));
+	}
+}
+
 static void plot_setup(OscPlot *plot)
 {
 	OscPlotPrivate *priv = plot->priv;
@@ -3381,6 +3824,18 @@ static void plot_setup(OscPlot *plot)
 	GtkDataboxGraph *graph;
 	int i;
 
+	/* The phosphor graphs own the persistence of their transform and are
+	 * freed below, the transforms must not keep using it */
+	for (i = 0; i < tr_list->size; i++) {
+		transform = tr_list->transforms[i];
+		if (transform->type_id == TIME_TRANSFORM)
+			TIME_SETTINGS(transform)->persistence = NULL;
+		else if (transform->type_id == EVM_TRANSFORM)
+			EVM_SETTINGS(transform)->persistence = NULL;
+		else if (transform->type_id == CONSTELLATION_TRANSFORM)
+			CONSTELLATION_SETTINGS(transform)->persistence = NULL;
+	}
+
 	gtk_databox_graph_remove_all(GTK_DATABOX(priv->databox));
 	markers_init(plot);
 	for (i = 0; i < tr_list->size; i++) {
@@ -3390,7 +3845,21 @@ static void plot_setup(OscPlot *plot)
 		transform_y_axis = Transform_get_y_axis_ref(transform);
 
 		gchar *plot_type_str = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->plot_type));
-		if (strcmp(plot_type_str, "Lines") &&
+		if (!strcmp(plot_type_str, "Persistence") &&
+			(transform->type_id == TIME_TRANSFORM ||
+			 transform->type_id == CONSTELLATION_TRANSFORM ||
+			 transform->type_id == EVM_TRANSFORM)) {
+			struct persistence *p = persistence_new(PERSISTENCE_WIDTH,
+					PERSISTENCE_HEIGHT, priv->persistence_decay);
+
+			if (transform->type_id == TIME_TRANSFORM)
+				TIME_SETTINGS(transform)->persistence = p;
+			else if (transform->type_id == EVM_TRANSFORM)
+				EVM_SETTINGS(transform)->persistence = p;
+			else
+				CONSTELLATION_SETTINGS(transform)->persistence = p;
+			graph = gtk_databox_phosphor_new(p, transform->graph_color);
+		} else if (strcmp(plot_type_str, "Lines") &&
 			!is_frequency_transform(priv)) {
 			graph = gtk_databox_points_new(transform->y_axis_size,
 					transform_x_axis, transform_y_axis,
@@ -3435,6 +3904,7 @@ static void plot_setup(OscPlot *plot)
 				0.0, -100.0);
 		}
 	}
+	plot_persistence_fit(plot);
 
 	osc_plot_update_rx_lbl(plot, INITIAL_UPDATE);
 
@@ -4151,7 +4621,8 @@ static void add_grid(OscPlot *plot)
 	if (priv->active_transform_type == FFT_TRANSFORM ||
 	    priv->active_transform_type == COMPLEX_FFT_TRANSFORM) {
 		priv->grid = gtk_databox_grid_array_new (25, 14, priv->gridy, priv->gridx, &color_grid, 1);
-	} else if (priv->active_transform_type == CONSTELLATION_TRANSFORM) {
+	} else if (priv->active_transform_type == CONSTELLATION_TRANSFORM ||
+		   priv->active_transform_type == EVM_TRANSFORM) {
 		fill_axis(priv->gridx, -80000, 10000, 18);
 		fill_axis(priv->gridy, -80000, 10000, 18);
 		priv->grid = gtk_databox_grid_array_new (18, 18, priv->gridy, priv->gridx, &color_grid, 1);
@@ -4243,6 +4714,13 @@ static void zoom_fit(GtkButton *btn, gpointer data)
 	rescale_databox(priv, GTK_DATABOX(priv->databox), 0.05);
 }
 
+/* Any change of the visible area, from the axis settings or a zoom */
+static void databox_zoomed_cb(GtkDatabox *box, OscPlot *plot)
+{
+	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(plot->priv->enable_auto_scale)))
+		plot_persistence_fit(plot);
+}
+
 static void zoom_in(GtkButton *btn, gpointer data)
 {
 	OscPlot *plot = data;
@@ -4353,13 +4831,14 @@ static void zoom_out(GtkButton *btn, gpointer data)
 	gtk_databox_set_visible_limits(GTK_DATABOX(priv->databox), left, right, top, bottom);
 }
 
-static void transform_csv_print(OscPlotPrivate *priv, FILE *fp, Transform *tr)
+static void transform_snapshot_add(struct export_snapshot *snapshot, Transform *tr)
 {
+	struct export_section *sec;
 	gfloat *tr_data;
 	gfloat *tr_x_axis;
-	unsigned int i;
 	GSList *node;
 	const char *id1 = NULL, *id2 = NULL;
+	gchar *header = NULL, *no_data;
 
 	switch (g_slist_length(tr->plot_channels)) {
 	case 2:
@@ -4375,31 +4854,51 @@ static void transform_csv_print(OscPlotPrivate *priv, FILE *fp, Transform *tr)
 	}
 
 	if (tr->type_id == TIME_TRANSFORM)
-		fprintf(fp, "X Axis(Sample Index)    Y Axis(%s)\n", id1);
+		header = g_strdup_printf("X Axis(Sample Index)    Y Axis(%s)\n", id1);
 	else if (tr->type_id == FFT_TRANSFORM)
-		fprintf(fp, "X Axis(Frequency)    Y Axis(FFT - %s)\n", id1);
+		header = g_strdup_printf("X Axis(Frequency)    Y Axis(FFT - %s)\n", id1);
 	else if (tr->type_id == COMPLEX_FFT_TRANSFORM)
-		fprintf(fp, "X Axis(Frequency)    Y Axis(Complex FFT - %s, %s)\n", id1, id2);
+		header = g_strdup_printf("X Axis(Frequency)    Y Axis(Complex FFT - %s, %s)\n", id1, id2);
 	else if (tr->type_id == CONSTELLATION_TRANSFORM)
-		fprintf(fp, "X Axis(%s)    Y Axis(%s)\n", id2, id1);
+		header = g_strdup_printf("X Axis(%s)    Y Axis(%s)\n", id2, id1);
+	else if (tr->type_id == EVM_TRANSFORM && EVM_SETTINGS(tr)->eye_diagram)
+		header = g_strdup_printf("X Axis(Symbol)    Y Axis(Eye - %s)\n", id1);
+	else if (tr->type_id == EVM_TRANSFORM)
+		header = g_strdup("X Axis(Symbol I)    Y Axis(Symbol Q)\n");
 
 	tr_x_axis = Transform_get_x_axis_ref(tr);
 	tr_data = Transform_get_y_axis_ref(tr);
 
 	if (tr_x_axis == NULL || tr_data == NULL) {
-		fprintf(fp, "No data\n");
+		no_data = g_strconcat(header ?: "", "No data\n", NULL);
+		export_snapshot_add_section(snapshot, no_data, 0);
+		g_free(no_data);
+		g_free(header);
 		return;
 	}
 
-	for (i = 0; i < tr->x_axis_size; i++) {
-		fprintf(fp, "%g, %g,\n", tr_x_axis[i], tr_data[i]);
-	}
-	fprintf(fp, "\n");
+	sec = export_snapshot_add_section(snapshot, header, tr->x_axis_size);
+	export_section_add_channel(sec, "x", tr_x_axis, NULL);
+	export_section_add_channel(sec, "y", tr_data, NULL);
+	g_free(header);
 }
 
 static void plot_destroyed (GtkWidget *object, OscPlot *plot)
 {
+	GList *node;
+
 	osc_plot_draw_stop(plot);
+
+	auto_export_free(plot->priv->auto_export);
+	plot->priv->auto_export = NULL;
+
+	/* Unfinished saves are dropped along with the plot */
+	if (plot->priv->save_progress_timer)
+		g_source_remove(plot->priv->save_progress_timer);
+	for (node = plot->priv->save_jobs; node; node = g_list_next(node))
+		export_job_cancel(node->data);
+	g_list_free_full(plot->priv->save_jobs, (GDestroyNotify)export_job_unref);
+	plot->priv->save_jobs = NULL;
 	g_slist_free_full(plot->priv->ch_settings_list, (GDestroyNotify)g_free);
 	g_mutex_trylock(&plot->priv->g_marker_copy_lock);
 	g_mutex_unlock(&plot->priv->g_marker_copy_lock);
@@ -4538,6 +5037,175 @@ static int * get_user_saveas_channel_selection(OscPlot *plot, unsigned int *nb_c
 	return mask;
 }
 
+/*
+ * Copy of the capture of the plot device: the channels picked in the Save
+ * As dialog, or the ones being captured.
+ */
+/* What capture_snapshot() is for */
+#define SNAPSHOT_SAVE_AS	false	/* the channels picked, copied */
+#define SNAPSHOT_AUTO_EXPORT	true	/* the enabled channels, borrowed */
+
+static struct export_snapshot * capture_snapshot(OscPlot *plot, bool for_auto_export)
+{
+	OscPlotPrivate *priv = plot->priv;
+	struct export_snapshot *snapshot;
+	struct export_section *sec;
+	struct iio_device *dev;
+	struct extra_dev_info *dev_info;
+	gchar *active_device;
+	int *save_channels_mask;
+	unsigned int nb_channels, dev_sample_count, i;
+	int d;
+
+	active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
+	d = device_find_by_name(priv->ctx, active_device);
+	g_free(active_device);
+	if (d < 0)
+		return NULL;
+
+	dev = iio_context_get_device(priv->ctx, d);
+	dev_info = iio_device_get_data(dev);
+
+	/* Find which channel need to be saved */
+	if (!for_auto_export) {
+		save_channels_mask = get_user_saveas_channel_selection(plot, &nb_channels);
+	} else {
+		nb_channels = iio_device_get_channels_count(dev);
+		save_channels_mask = malloc(sizeof(int) * nb_channels);
+		for (i = 0; i < nb_channels; i++) {
+			struct iio_channel *chn = iio_device_get_channel(dev, i);
+			struct extra_info *info = iio_channel_get_data(chn);
+
+			save_channels_mask[i] = !iio_channel_is_enabled(chn) ||
+				!info || !info->data_ref;
+		}
+	}
+
+	dev_sample_count = dev_info->sample_count;
+	if (dev_info->channel_trigger_enabled)
+		dev_sample_count /= 2;
+
+	snapshot = export_snapshot_new(dev_info->adc_freq * prefix2scale(dev_info->adc_scale),
+			get_iio_device_label_or_name(dev));
+	/* The capture is shifted so that it starts on the trigger */
+	if (dev_info->channel_trigger_enabled)
+		snapshot->trigger_position = 0;
+	/* Copied by the writer, or by the next capture if it comes first */
+	if (for_auto_export)
+		export_snapshot_borrow(snapshot);
+	sec = export_snapshot_add_section(snapshot, NULL, dev_sample_count);
+
+	for (i = 0; i < nb_channels; i++) {
+		struct iio_channel *chn = iio_device_get_channel(dev, i);
+		const struct iio_data_format *format = iio_channel_get_data_format(chn);
+		struct extra_info *info = iio_channel_get_data(chn);
+		const char *ch_name = iio_channel_get_name(chn) ?:
+			iio_channel_get_id(chn);
+		struct export_channel_meta meta;
+
+		if (save_channels_mask[i] == 1)
+			continue;
+
+		meta.full_scale = pow(2.0, format->is_signed ? format->bits - 1 : format->bits);
+		meta.lo_freq = info->lo_freq;
+		meta.gain = NAN;
+		meta.chn = NULL;
+		/* Over the network a read takes a round trip, leave it to the writer */
+		if (for_auto_export)
+			meta.chn = chn;
+		else if (iio_channel_attr_read_double(chn, "hardwaregain", &meta.gain))
+			meta.gain = NAN;
+		export_section_add_channel(sec, ch_name, info->data_ref, &meta);
+	}
+	free(save_channels_mask);
+
+	return snapshot;
+}
+
+static gboolean save_progress_update(OscPlot *plot)
+{
+	OscPlotPrivate *priv = plot->priv;
+	struct export_job *job;
+	GList *node, *next;
+	gchar *base, *text;
+	unsigned int queued;
+	int ret;
+
+	for (node = priv->save_jobs; node; node = next) {
+		next = node->next;
+		job = node->data;
+		if (!export_job_finished(job, &ret))
+			continue;
+
+		if (ret && ret != -ECANCELED)
+			fprintf(stderr, "Error saving %s: %s\n", job->path, strerror(-ret));
+		export_job_unref(job);
+		priv->save_jobs = g_list_delete_link(priv->save_jobs, node);
+	}
+
+	if (!priv->save_jobs) {
+		gtk_widget_hide(priv->save_progress_box);
+		priv->save_progress_timer = 0;
+		return FALSE;
+	}
+
+	job = priv->save_jobs->data;
+	queued = g_list_length(priv->save_jobs) - 1;
+	base = g_path_get_basename(job->path);
+	if (queued)
+		text = g_strdup_printf("Saving %s (%u more)", base, queued);
+	else
+		text = g_strdup_printf("Saving %s", base);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(priv->save_progress), text);
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(priv->save_progress),
+			export_job_progress(job));
+	g_free(text);
+	g_free(base);
+
+	return TRUE;
+}
+
+/* Write the file in the background, the plot keeps capturing meanwhile */
+static void save_job_queue(OscPlot *plot, struct export_job *job)
+{
+	OscPlotPrivate *priv = plot->priv;
+
+	export_job_start(job);
+	priv->save_jobs = g_list_append(priv->save_jobs, job);
+
+	gtk_widget_show(priv->save_progress_box);
+	if (!priv->save_progress_timer)
+		priv->save_progress_timer = g_timeout_add(100,
+				(GSourceFunc)save_progress_update, plot);
+	save_progress_update(plot);
+}
+
+static void save_cancel_clicked_cb(GtkButton *btn, OscPlot *plot)
+{
+	GList *node;
+
+	for (node = plot->priv->save_jobs; node; node = g_list_next(node))
+		export_job_cancel(node->data);
+}
+
+/* Hand the capture over to the auto export writer, when one is due */
+static void auto_export_capture(OscPlot *plot)
+{
+	struct export_snapshot *snapshot;
+	guint64 capture;
+
+	if (!auto_export_due(plot->priv->auto_export, &capture))
+		return;
+
+	snapshot = capture_snapshot(plot, SNAPSHOT_AUTO_EXPORT);
+	if (!snapshot)
+		return;
+
+	snapshot->capture = capture;
+	auto_export_push(plot->priv->auto_export, snapshot);
+	export_snapshot_unref(snapshot);
+}
+
 #define SAVE_AS_RAW_DATA 1
 
 static void saveas_dialog_show(GtkWidget *w, OscPlot *plot)
@@ -4564,24 +5232,13 @@ static void saveas_dialog_show(GtkWidget *w, OscPlot *plot)
 static void save_as(OscPlot *plot, const char *filename, int type)
 {
 	OscPlotPrivate *priv = plot->priv;
-	struct iio_context *ctx = priv->ctx;
-	FILE *fp;
-	mat_t *mat;
-	matvar_t *matvar;
-	struct iio_device *dev;
-	struct extra_dev_info *dev_info;
-	char tmp[100];
-	mat_dim dims[2] = {-1, 1};
-	double freq;
+	struct export_snapshot *snapshot = NULL;
+	struct export_job *job = NULL;
 	char *name;
-	gchar *active_device;
-	int *save_channels_mask;
+	gchar *base;
 	int d;
-	unsigned int nb_channels, i, j;
-	const char *dev_name;
-	unsigned int dev_sample_count;
 
-	name = malloc(strlen(filename) + 5);
+	name = malloc(strlen(filename) + sizeof(".sigmf-data"));
 	switch(type) {
 		case SAVE_VSA:
 			/* Save as Agilent VSA formatted file */
@@ -4589,54 +5246,10 @@ static void save_as(OscPlot *plot, const char *filename, int type)
 					strcpy(name, filename);
 				else
 					sprintf(name, "%s.txt", filename);
-			fp = fopen(name, "w");
-			if (!fp)
-				break;
-
-			active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
-			d = device_find_by_name(ctx, active_device);
-			g_free(active_device);
-			if (d < 0)
-				break;
-			dev = iio_context_get_device(ctx, d);
-			dev_info = iio_device_get_data(dev);
-
-			/* Find which channel need to be saved */
-			save_channels_mask = get_user_saveas_channel_selection(plot, &nb_channels);
-
-			/* Make a VSA file header */
-			fprintf(fp, "InputZoom\tTRUE\n");
-			fprintf(fp, "InputCenter\t0\n");
-			fprintf(fp, "InputRange\t1\n");
-			fprintf(fp, "InputRefImped\t50\n");
-			fprintf(fp, "XStart\t0\n");
-			freq = dev_info->adc_freq * prefix2scale(dev_info->adc_scale);
-			fprintf(fp, "XDelta\t%-.17f\n", 1.0/freq);
-			fprintf(fp, "XDomain\t2\n");
-			fprintf(fp, "XUnit\tSec\n");
-			fprintf(fp, "YUnit\tV\n");
-			fprintf(fp, "FreqValidMax\t%e\n", freq / 2);
-			fprintf(fp, "FreqValidMin\t-%e\n", freq / 2);
-			fprintf(fp, "Y\n");
-
-			dev_sample_count = dev_info->sample_count;
-			if (dev_info->channel_trigger_enabled)
-				dev_sample_count /= 2;
-
-			/* Start writing the samples */
-			for (i = 0; i < dev_sample_count; i++) {
-				for (j = 0; j < nb_channels; j++) {
-					struct extra_info *info = iio_channel_get_data(iio_device_get_channel(dev, j));
-					if (save_channels_mask[j] == 1)
-						continue;
-					fprintf(fp, "%g\t", info->data_ref[i]);
-				}
-				fprintf(fp, "\n");
-			}
-			fprintf(fp, "\n");
-			fclose(fp);
-			free(save_channels_mask);
 
+			snapshot = capture_snapshot(plot, SNAPSHOT_SAVE_AS);
+			if (snapshot)
+				job = export_job_new(EXPORT_VSA, name, snapshot);
 			break;
 		case SAVE_CSV:
 			/* save comma separated values (csv) */
@@ -4644,44 +5257,17 @@ static void save_as(OscPlot *plot, const char *filename, int type)
 					strcpy(name, filename);
 				else
 					sprintf(name, "%s.csv", filename);
-			fp = fopen(name, "w");
-			if (!fp)
-				break;
 			if (priv->active_saveas_type == SAVE_AS_RAW_DATA) {
-				active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
-				d = device_find_by_name(ctx, active_device);
-				g_free(active_device);
-				if (d < 0)
-					break;
-
-				dev = iio_context_get_device(ctx, d);
-				dev_info = iio_device_get_data(dev);
-
-				/* Find which channel need to be saved */
-				save_channels_mask = get_user_saveas_channel_selection(plot, &nb_channels);
-
-				dev_sample_count = dev_info->sample_count;
-				if (dev_info->channel_trigger_enabled)
-					dev_sample_count /= 2;
-
-				for (i = 0; i < dev_sample_count; i++) {
-					for (j = 0; j < nb_channels; j++) {
-						struct extra_info *info = iio_channel_get_data(iio_device_get_channel(dev, j));
-						if (save_channels_mask[j] == 1)
-							continue;
-						fprintf(fp, "%g, ", info->data_ref[i]);
-					}
-					fprintf(fp, "\n");
-				}
-				fprintf(fp, "\n");
-				free(save_channels_mask);
+				snapshot = capture_snapshot(plot, SNAPSHOT_SAVE_AS);
+				if (snapshot)
+					job = export_job_new(EXPORT_CSV, name, snapshot);
 			} else {
+				snapshot = export_snapshot_new(0.0, NULL);
 				for (d = 0; d < priv->transform_list->size; d++) {
-						transform_csv_print(priv, fp, priv->transform_list->transforms[d]);
+						transform_snapshot_add(snapshot, priv->transform_list->transforms[d]);
 				}
+				job = export_job_new(EXPORT_TRANSFORM_CSV, name, snapshot);
 			}
-			fprintf(fp, "\n");
-			fclose(fp);
 			break;
 
 		case SAVE_PNG:
@@ -4703,79 +5289,36 @@ static void save_as(OscPlot *plot, const char *filename, int type)
 				else
 					sprintf(name, "%s.mat", filename);
 
-			mat = Mat_Create(name, NULL);
-			if (!mat) {
-				fprintf(stderr, "Error creating MAT file %s: %s\n", name, strerror(errno));
+			snapshot = capture_snapshot(plot, SNAPSHOT_SAVE_AS);
+			if (!snapshot)
 				break;
-			}
-
-			active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
-			d = device_find_by_name(ctx, active_device);
-			g_free(active_device);
-			if (d < 0)
-				break;
-
-			dev = iio_context_get_device(ctx, d);
-			dev_info = iio_device_get_data(dev);
-			dev_name = get_iio_device_label_or_name(dev);
-
-			/* Find which channel need to be saved */
-			save_channels_mask = get_user_saveas_channel_selection(plot, &nb_channels);
-
-			dev_sample_count = dev_info->sample_count;
-			if (dev_info->channel_trigger_enabled)
-				dev_sample_count /= 2;
-
-			dims[0] = dev_sample_count;
-			for (i = 0; i < nb_channels; i++) {
-				struct iio_channel *chn = iio_device_get_channel(dev, i);
-				const char *ch_name = iio_channel_get_name(chn) ?:
-					iio_channel_get_id(chn);
-				struct extra_info *info = iio_channel_get_data(chn);
-				if (save_channels_mask[i] == 1)
-					continue;
-				sprintf(tmp, "%s_%s", dev_name, ch_name);
-				g_strdelimit(tmp, "-", '_');
-				if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priv->save_mat_scale))) {
-						matvar = Mat_VarCreate(tmp, MAT_C_SINGLE, MAT_T_SINGLE, 2, dims,
-					info->data_ref, 0);
-				} else {
-					const struct iio_data_format* format = iio_channel_get_data_format(chn);
-					gdouble *tmp_data;
-					double k;
-
-					tmp_data = g_new(gdouble, dev_sample_count);
-					if (format->is_signed)
-						k = format->bits - 1;
-					else
-						k = format->bits;
-					for (j = 0; j < dev_sample_count; j++) {
-						tmp_data[j] = (gdouble)info->data_ref[j] /
-									(pow(2.0, k));
-					}
-					matvar = Mat_VarCreate(tmp, MAT_C_DOUBLE, MAT_T_DOUBLE,
-							2, dims, tmp_data, 0);
-					g_free(tmp_data);
-				}
-
-				if (!matvar)
-					fprintf(stderr,
-						"error creating matvar on channel %s\n",
-						tmp);
-				else {
-					Mat_VarWrite(mat, matvar, 0);
-					Mat_VarFree(matvar);
-				}
-			}
-			free(save_channels_mask);
+			job = export_job_new(EXPORT_MAT, name, snapshot);
+			job->mat_scale = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priv->save_mat_scale));
+			break;
 
-			Mat_Close(mat);
+		case SAVE_SIGMF:
+			/* SigMF recording: binary samples plus a JSON description */
+			base = g_strdup(filename);
+			if (g_str_has_suffix(base, ".sigmf-data") ||
+					g_str_has_suffix(base, ".sigmf-meta"))
+				base[strlen(base) - strlen(".sigmf-data")] = '\0';
+			sprintf(name, "%s.sigmf-data", base);
+
+			snapshot = capture_snapshot(plot, SNAPSHOT_SAVE_AS);
+			if (snapshot)
+				job = export_job_new(EXPORT_SIGMF, base, snapshot);
+			g_free(base);
 			break;
 
 		default:
 			fprintf(stderr, "SaveAs response: %i\n", type);
 	}
 
+	if (job)
+		save_job_queue(plot, job);
+	if (snapshot)
+		export_snapshot_unref(snapshot);
+
 	if (priv->saveas_filename)
 		g_free(priv->saveas_filename);
 
@@ -4827,6 +5370,7 @@ static void enable_auto_scale_cb(GtkToggleButton *button, OscPlot *plot)
 			bottom);
 		gtk_widget_set_sensitive(plot->priv->y_axis_min, TRUE);
 	}
+	plot_persistence_fit(plot);
 }
 
 static void max_y_axis_cb(GtkSpinButton *btn, OscPlot *plot)
@@ -5061,6 +5605,38 @@ static void plot_profile_save(OscPlot *plot, char *filename)
 
 	fprintf(fp, "line_thickness = %i\n", priv->line_thickness);
 
+	fprintf(fp, "persistence_decay = %f\n", priv->persistence_decay);
+
+	if (priv->evm_view == EVM_VIEW_OFF)
+		fprintf(fp, "evm_view = off\n");
+	else if (priv->evm_view == EVM_VIEW_EYE)
+		fprintf(fp, "evm_view = eye\n");
+	else
+		fprintf(fp, "evm_view = symbols\n");
+	fprintf(fp, "evm_modulation = %s\n",
+			demod_modulation_to_string(priv->evm_modulation));
+	fprintf(fp, "evm_samples_per_symbol = %f\n", priv->evm_samples_per_symbol);
+
+	if (priv->aclr_cfg.channel_bw > 0.0) {
+		fprintf(fp, "aclr_channel_bw = %f\n", priv->aclr_cfg.channel_bw);
+		fprintf(fp, "aclr_channel_spacing = %f\n", priv->aclr_cfg.channel_spacing);
+		fprintf(fp, "aclr_center = %f\n", priv->aclr_cfg.center);
+		fprintf(fp, "aclr_adjacent_channels = %u\n", priv->aclr_cfg.num_adjacent);
+		fprintf(fp, "aclr_avg = %u\n", priv->aclr_cfg.avg);
+	} else {
+		fprintf(fp, "aclr_standard = off\n");
+	}
+
+	fprintf(fp, "auto_export_format = %s\n",
+			auto_export_format_to_string(priv->auto_export_cfg.format));
+	fprintf(fp, "auto_export_every = %u\n", priv->auto_export_cfg.every);
+	fprintf(fp, "auto_export_duration = %f\n", priv->auto_export_cfg.duration);
+	fprintf(fp, "auto_export_max_files = %u\n", priv->auto_export_cfg.max_files);
+	fprintf(fp, "auto_export_max_size = %f\n",
+			priv->auto_export_cfg.max_bytes / (1024.0 * 1024.0));
+	if (priv->auto_export)
+		fprintf(fp, "auto_export = %s\n", priv->auto_export->prefix);
+
 	fprintf(fp, "plot_title = %s\n", gtk_window_get_title(GTK_WINDOW(priv->window)));
 
 	fprintf(fp, "show_capture_options = %d\n", gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(priv->menu_show_options)));
@@ -5110,6 +5686,12 @@ static void plot_profile_save(OscPlot *plot, char *filename)
 				fprintf(fp, "%s.trigger_value=%f\n", name,
 						info->trigger_value);
 			}
+			if (info->time_avg > 1) {
+				fprintf(fp, "%s.time_avg=%u\n", name,
+						info->time_avg);
+				fprintf(fp, "%s.time_avg_moving=%i\n", name,
+						info->time_avg_moving);
+			}
 		}
 
 		next_ch_iter = gtk_tree_model_iter_children(model, &ch_iter, &dev_iter);
@@ -5460,6 +6042,94 @@ int osc_plot_ini_read_handler (OscPlot *plot, int line, const char *section,
 			} else if (MATCH_NAME("line_thickness")) {
 				if (atoi(value))
 					priv->line_thickness = atoi(value);
+			} else if (MATCH_NAME("persistence_decay")) {
+				float decay = atof(value);
+
+				if (decay > 0.0f && decay <= 1.0f)
+					priv->persistence_decay = decay;
+				else
+					ret = -1;
+			} else if (MATCH_NAME("evm_view")) {
+				if (!strcmp(value, "off"))
+					priv->evm_view = EVM_VIEW_OFF;
+				else if (!strcmp(value, "symbols"))
+					priv->evm_view = EVM_VIEW_SYMBOLS;
+				else if (!strcmp(value, "eye"))
+					priv->evm_view = EVM_VIEW_EYE;
+				else
+					goto unhandled;
+			} else if (MATCH_NAME("evm_modulation")) {
+				int mod = demod_modulation_from_string(value);
+
+				if (mod < 0)
+					goto unhandled;
+				priv->evm_modulation = mod;
+			} else if (MATCH_NAME("evm_samples_per_symbol")) {
+				if (atof(value) >= 2.0)
+					priv->evm_samples_per_symbol = atof(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("aclr_standard")) {
+				if (!strcmp(value, "off"))
+					priv->aclr_cfg.channel_bw = 0.0;
+				else if (chanpower_config_from_standard(&priv->aclr_cfg, value))
+					goto unhandled;
+			} else if (MATCH_NAME("aclr_channel_bw")) {
+				if (atof(value) >= 0.0)
+					priv->aclr_cfg.channel_bw = atof(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("aclr_channel_spacing")) {
+				if (atof(value) >= 0.0)
+					priv->aclr_cfg.channel_spacing = atof(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("aclr_center")) {
+				priv->aclr_cfg.center = atof(value);
+			} else if (MATCH_NAME("aclr_adjacent_channels")) {
+				if (atoi(value) >= 0 && atoi(value) <= CHANPOWER_MAX_ADJACENT)
+					priv->aclr_cfg.num_adjacent = atoi(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("aclr_avg")) {
+				if (atoi(value) >= 0)
+					priv->aclr_cfg.avg = atoi(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("auto_export_format")) {
+				int format = auto_export_format_from_string(value);
+
+				if (format < 0)
+					goto unhandled;
+				priv->auto_export_cfg.format = format;
+			} else if (MATCH_NAME("auto_export_every")) {
+				if (atoi(value) >= 1)
+					priv->auto_export_cfg.every = atoi(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("auto_export_duration")) {
+				if (atof(value) >= 0.0)
+					priv->auto_export_cfg.duration = atof(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("auto_export_max_files")) {
+				if (atoi(value) >= 0)
+					priv->auto_export_cfg.max_files = atoi(value);
+				else
+					ret = -1;
+			} else if (MATCH_NAME("auto_export_max_size")) {
+				/* MiB */
+				if (atof(value) >= 0.0)
+					priv->auto_export_cfg.max_bytes = atof(value) * 1024 * 1024;
+				else
+					ret = -1;
+			} else if (MATCH_NAME("auto_export")) {
+				/* Path prefix of the files, or off */
+				auto_export_free(priv->auto_export);
+				priv->auto_export = NULL;
+				if (strcmp(value, "off"))
+					priv->auto_export = auto_export_new(value,
+							&priv->auto_export_cfg);
 			} else if (MATCH_NAME("quit") || MATCH_NAME("stop")) {
 				application_quit();
 				return 0;
@@ -5530,6 +6200,14 @@ int osc_plot_ini_read_handler (OscPlot *plot, int line, const char *section,
 				if (!dev_info)
 					goto unhandled;
 				dev_info->trigger_value = (float) atof(value);
+			} else if (MATCH(dev_property, "time_avg")) {
+				if (!dev_info)
+					goto unhandled;
+				dev_info->time_avg = atoi(value) > 0 ? atoi(value) : 0;
+			} else if (MATCH(dev_property, "time_avg_moving")) {
+				if (!dev_info)
+					goto unhandled;
+				dev_info->time_avg_moving = !!atoi(value);
 			}
 			break;
 		case CHANNEL:
@@ -5568,6 +6246,37 @@ int osc_plot_ini_read_handler (OscPlot *plot, int line, const char *section,
 								line, i, min_f, max_f, priv->markers[i].y);
 					}
 					g_strfreev(min_max);
+				} else if (MATCH(elems[1], "measure")) {
+					double measured;
+
+					min_max = g_strsplit(value, " ", 0);
+					min_f = atof(min_max[0]);
+					max_f = atof(min_max[1]);
+					g_strfreev(min_max);
+
+					if (!plot_measurement_get(priv, elems[2], &measured)) {
+						fprintf(stderr, "Line %i: no %s measurement on this plot\n",
+								line, elems[2]);
+						ret = -1;
+						break;
+					}
+
+					printf("Line %i: (test.measure.%s = %f %f): %f\n",
+							line, elems[2], min_f, max_f, measured);
+					if (measured >= min_f && measured <= max_f) {
+						ret = 0;
+						printf("Test passed.\n");
+					} else {
+						ret = -1;
+						printf("*** Test failed! ***\n");
+						create_blocking_popup(GTK_MESSAGE_ERROR,
+								GTK_BUTTONS_CLOSE,
+								"Test failure",
+								"Test failed! Line: %i\n\n"
+								"Test was: test.measure.%s = %f %f\n"
+								"Value read = %f\n",
+								line, elems[2], min_f, max_f, measured);
+					}
 				} else {
 					goto unhandled;
 				}
@@ -6288,10 +6997,12 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 	OscPlotPrivate *priv = plot->priv;
 	char *active_device;
 	int ret;
-	void *lhandler;
-	math_function fn;
+	void *lhandler = NULL;
+	math_function fn = NULL;
+	struct math_program *prog = NULL;
+	gchar *compile_error = NULL;
 	GSList *channels = NULL;
-	gchar *txt_math_expr;
+	gchar *txt_math_expr = NULL;
 	bool invalid_channels;
 	const char *channel_name;
 	char *expression_name;
@@ -6338,6 +7049,20 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 		if (ret != GTK_RESPONSE_OK)
 			break;
 
+		/* Drop what the previous, rejected attempt compiled */
+		math_program_free(prog);
+		prog = NULL;
+		math_expression_close_lib_handler(lhandler);
+		lhandler = NULL;
+		fn = NULL;
+		g_free(txt_math_expr);
+		g_free(compile_error);
+		compile_error = NULL;
+		if (channels) {
+			g_slist_free(channels);
+			channels = NULL;
+		}
+
 		g_free(active_device);
 		active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->math_device_select));
 
@@ -6357,24 +7082,38 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 		channels = math_expression_get_iio_channel_list(txt_math_expr,
 				priv->ctx, active_device, &invalid_channels);
 
-		/* Get the compiled math expression */
+		/* Get the compiled math expression. The gcc toolchain is only
+		 * needed for what the built-in compiler does not understand. */
 		GSList *basenames = iio_chn_basenames_get(plot, active_device);
-		fn = math_expression_get_math_function(txt_math_expr, &lhandler, basenames);
+		prog = math_program_compile(txt_math_expr, basenames, &compile_error);
+		if (!prog)
+			fn = math_expression_get_math_function(txt_math_expr, &lhandler, basenames);
 		if (basenames) {
 			g_slist_free_full(basenames, (GDestroyNotify)g_free);
 			basenames = NULL;
 		}
 
 		gtk_widget_set_visible(priv->math_expr_error, true);
-		if (!fn)
-			gtk_label_set_text(GTK_LABEL(priv->math_expr_error), "Invalid math expression.");
-		else if (!channel_name)
+		if (!prog && !fn) {
+			gchar *msg = g_strdup_printf("Invalid math expression: %s.",
+					compile_error);
+
+			gtk_label_set_text(GTK_LABEL(priv->math_expr_error), msg);
+			g_free(msg);
+		} else if (!channel_name) {
 			gtk_label_set_text(GTK_LABEL(priv->math_expr_error), "An expression with the same name already exists");
-		else
+		} else {
 			gtk_widget_set_visible(priv->math_expr_error, false);
-	} while (!fn || !channel_name);
+		}
+	} while ((!prog && !fn) || !channel_name);
 	gtk_widget_hide(priv->math_expression_dialog);
+	g_free(compile_error);
 	if (ret != GTK_RESPONSE_OK) {
+		math_program_free(prog);
+		math_expression_close_lib_handler(lhandler);
+		g_free(txt_math_expr);
+		if (channels)
+			g_slist_free(channels);
 		g_free(active_device);
 		return - 1;
 	}
@@ -6388,11 +7127,16 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 		g_free(pmc->iio_device_name);
 	if (pmc->iio_channels)
 		g_slist_free(pmc->iio_channels);
+	if (pmc->iio_channels_data)
+		free(pmc->iio_channels_data);
+	math_program_free(pmc->math_program);
+	math_expression_close_lib_handler(pmc->math_lib_handler);
 
 	pmc->txt_math_expression = txt_math_expr;
 	pmc->base.name = g_strdup(channel_name);
 	pmc->iio_device_name = g_strdup(active_device);
 	pmc->iio_channels = channels;
+	pmc->math_program = prog;
 	pmc->math_expression = fn;
 	pmc->math_lib_handler = lhandler;
 	pmc->num_channels = g_slist_length(pmc->iio_channels);
@@ -6481,6 +7225,13 @@ static void plot_trigger_save_settings(OscPlotPrivate *priv,
 	GtkSpinButton *btn;
 	gchar *active_channel;
 
+	btn = GTK_SPIN_BUTTON(gtk_builder_get_object(
+				priv->builder, "spin_trigger_averages"));
+	dev_info->time_avg = gtk_spin_button_get_value(btn);
+
+	radio = GTK_TOGGLE_BUTTON(gtk_builder_get_object(priv->builder, "check_trigger_moving_avg"));
+	dev_info->time_avg_moving = gtk_toggle_button_get_active(radio);
+
 	radio = GTK_TOGGLE_BUTTON(gtk_builder_get_object(priv->builder, "radio_enable_trigger"));
 	dev_info->channel_trigger_enabled = gtk_toggle_button_get_active(radio);
 
@@ -6590,6 +7341,12 @@ static void plot_trigger_settings_cb(GtkMenuItem *menuitem, OscPlot *plot)
 	item = GTK_WIDGET(gtk_builder_get_object(priv->builder, "spin_trigger_value"));
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(item), dev_info->trigger_value);
 
+	item = GTK_WIDGET(gtk_builder_get_object(priv->builder, "spin_trigger_averages"));
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(item), MAX(dev_info->time_avg, 1));
+
+	item = GTK_WIDGET(gtk_builder_get_object(priv->builder, "check_trigger_moving_avg"));
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(item), dev_info->time_avg_moving);
+
 	dialog = GTK_DIALOG(gtk_builder_get_object(priv->builder, "channel_trigger_dialog"));
 	switch (gtk_dialog_run(dialog)) {
 	case GTK_RESPONSE_CANCEL:
@@ -7004,6 +7761,21 @@ static void create_plot(OscPlot *plot)
 	priv->math_channel_name_entry = GTK_WIDGET(gtk_builder_get_object(priv->builder, "entry_math_ch_name"));
 	priv->math_expr_error = GTK_WIDGET(gtk_builder_get_object(priv->builder, "label_math_expr_invalid_msg"));
 
+	/* Progress of the files being saved in the background */
+	priv->save_progress_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+	priv->save_progress = gtk_progress_bar_new();
+	gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(priv->save_progress), TRUE);
+	gtk_widget_set_size_request(priv->save_progress, 200, -1);
+	gtk_widget_set_valign(priv->save_progress, GTK_ALIGN_CENTER);
+	priv->save_cancel_button = gtk_button_new_with_label("Cancel");
+	gtk_box_pack_start(GTK_BOX(priv->save_progress_box), priv->save_progress, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(priv->save_progress_box), priv->save_cancel_button, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(gtk_builder_get_object(builder, "box2")),
+		priv->save_progress_box, FALSE, FALSE, 0);
+	gtk_widget_show_all(priv->save_progress_box);
+	gtk_widget_set_no_show_all(priv->save_progress_box, TRUE);
+	gtk_widget_hide(priv->save_progress_box);
+
 	priv->tbuf = NULL;
 	priv->ch_settings_list = NULL;
 
@@ -7171,6 +7943,8 @@ static void create_plot(OscPlot *plot)
 		G_CALLBACK(saveas_dialog_show), plot);
 	g_signal_connect(priv->saveas_dialog, "response",
 		G_CALLBACK(cb_saveas_response), plot);
+	g_signal_connect(priv->save_cancel_button, "clicked",
+		G_CALLBACK(save_cancel_clicked_cb), plot);
 	g_signal_connect(priv->saveas_dialog, "delete-event",
 		G_CALLBACK(gtk_widget_hide_on_delete), plot);
 	g_signal_connect(priv->fullscreen_button, "clicked",
@@ -7216,6 +7990,8 @@ static void create_plot(OscPlot *plot)
 	g_signal_connect(priv->show_grid, "toggled",
 		G_CALLBACK(show_grid_toggled), plot);
 
+	g_signal_connect(GTK_DATABOX(priv->databox), "zoomed",
+		G_CALLBACK(databox_zoomed_cb), plot);
 	g_signal_connect(GTK_DATABOX(priv->databox), "button_press_event",
 		G_CALLBACK(marker_button), plot);
 	g_signal_connect(GTK_DATABOX(priv->databox), "button_release_event",
@@ -7389,6 +8165,12 @@ static void create_plot(OscPlot *plot)
 	priv->off_mrk.string_obj = OFF_MRK;
 
 	priv->line_thickness = 1;
+	priv->persistence_decay = 0.95f;
+	priv->evm_view = EVM_VIEW_OFF;
+	priv->evm_modulation = DEMOD_QPSK;
+	priv->evm_samples_per_symbol = 4.0f;
+	priv->auto_export_cfg.format = EXPORT_SIGMF;
+	priv->auto_export_cfg.every = 1;
 
 	gtk_window_set_modal(GTK_WINDOW(priv->saveas_dialog), FALSE);
 	gtk_widget_show_all(priv->capture_graph);
@@ -0,0 +1,334 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cairo.h>
+
+#include "persistence.h"
+
+struct persistence * persistence_new(unsigned int width, unsigned int height,
+		gfloat decay)
+{
+	struct persistence *p;
+
+	if (!width || !height)
+		return NULL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->width = width;
+	p->height = height;
+	p->decay = decay;
+	/* the extra cell catches everything that falls outside the extent */
+	p->density = calloc((size_t)width * height + 1, sizeof(*p->density));
+	p->argb = calloc((size_t)width * height, sizeof(*p->argb));
+	if (!p->density || !p->argb) {
+		persistence_free(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+void persistence_free(struct persistence *p)
+{
+	if (!p)
+		return;
+
+	free(p->density);
+	free(p->bins);
+	free(p->argb);
+	free(p);
+}
+
+static void persistence_clear(struct persistence *p)
+{
+	memset(p->density, 0, ((size_t)p->width * p->height + 1) *
+			sizeof(*p->density));
+	p->dirty = true;
+}
+
+void persistence_reset(struct persistence *p)
+{
+	persistence_clear(p);
+	p->extent_valid = false;
+	p->extent_fixed = false;
+}
+
+static void persistence_extent(struct persistence *p, gfloat x_min,
+		gfloat x_max, gfloat y_min, gfloat y_max)
+{
+	if (!(x_max > x_min) || !(y_max > y_min))
+		return;
+
+	if (p->extent_valid && p->x_min == x_min && p->x_max == x_max &&
+			p->y_min == y_min && p->y_max == y_max)
+		return;
+
+	/* The cells binned so far are of the old area */
+	persistence_clear(p);
+	p->x_min = x_min;
+	p->x_max = x_max;
+	p->y_min = y_min;
+	p->y_max = y_max;
+	p->extent_valid = true;
+}
+
+void persistence_set_extent(struct persistence *p, gfloat x_min, gfloat x_max,
+		gfloat y_min, gfloat y_max)
+{
+	persistence_extent(p, x_min, x_max, y_min, y_max);
+	p->extent_fixed = p->extent_valid;
+}
+
+/* Size the histogram on a frame, with some room to spare */
+static void persistence_auto_extent(struct persistence *p, const gfloat *x,
+		const gfloat *y, unsigned int n)
+{
+	gfloat x_min = x[0], x_max = x[0], y_min = y[0], y_max = y[0];
+	gfloat margin;
+	unsigned int i;
+
+	for (i = 1; i < n; i++) {
+		x_min = x[i] < x_min ? x[i] : x_min;
+		x_max = x[i] > x_max ? x[i] : x_max;
+		y_min = y[i] < y_min ? y[i] : y_min;
+		y_max = y[i] > y_max ? y[i] : y_max;
+	}
+
+	if (x_max - x_min < 1.0f) {
+		x_min -= 0.5f;
+		x_max += 0.5f;
+	}
+	if (y_max - y_min < 1.0f) {
+		y_min -= 0.5f;
+		y_max += 0.5f;
+	}
+	margin = (y_max - y_min) * 0.1f;
+
+	persistence_extent(p, x_min, x_max, y_min - margin, y_max + margin);
+}
+
+/*
+ * The cell index computation has no dependencies between samples and is
+ * kept branch free so the compiler can vectorize it. Returns how many
+ * samples fall outside of the extent.
+ */
+static unsigned int persistence_bin(struct persistence *p, const gfloat *x,
+		const gfloat *y, unsigned int n)
+{
+	const gint32 cells = p->width * p->height, width = p->width;
+	const gfloat w = p->width, h = p->height;
+	const gfloat sx = w / (p->x_max - p->x_min);
+	const gfloat sy = h / (p->y_max - p->y_min);
+	const gfloat x0 = p->x_min, y0 = p->y_min;
+	gint32 * __restrict bins = p->bins;
+	unsigned int i, outside = 0;
+
+	for (i = 0; i < n; i++) {
+		gfloat fx = (x[i] - x0) * sx;
+		gfloat fy = (y[i] - y0) * sy;
+		int inside = (fx >= 0.0f) & (fx < w) & (fy >= 0.0f) & (fy < h);
+
+		fx = inside ? fx : 0.0f;
+		fy = inside ? fy : 0.0f;
+		bins[i] = inside ? (gint32)fy * width + (gint32)fx : cells;
+		outside += !inside;
+	}
+
+	return outside;
+}
+
+void persistence_accumulate(struct persistence *p, const gfloat *x,
+		const gfloat *y, unsigned int n)
+{
+	const unsigned int cells = p->width * p->height;
+	gfloat * __restrict density = p->density;
+	gint32 * __restrict bins;
+	unsigned int i;
+
+	if (!x || !y || !n)
+		return;
+
+	if (!p->extent_valid)
+		persistence_auto_extent(p, x, y, n);
+
+	if (p->bins_size < n) {
+		free(p->bins);
+		p->bins = malloc(n * sizeof(*p->bins));
+		if (!p->bins) {
+			p->bins_size = 0;
+			return;
+		}
+		p->bins_size = n;
+	}
+	bins = p->bins;
+
+	/* The signal grew out of an auto sized histogram, start over around it */
+	if (persistence_bin(p, x, y, n) > n / PERSISTENCE_MAX_OUTSIDE &&
+			!p->extent_fixed) {
+		persistence_auto_extent(p, x, y, n);
+		persistence_bin(p, x, y, n);
+	}
+
+	if (p->decay < 1.0f) {
+		const gfloat decay = p->decay;
+
+		for (i = 0; i < cells; i++)
+			density[i] *= decay;
+	}
+
+	/* The histogram update is the only scattered (scalar) part */
+	for (i = 0; i < n; i++)
+		density[bins[i]] += 1.0f;
+
+	p->dirty = true;
+}
+
+/* Map the densities to premultiplied ARGB, row 0 is the top of the plot */
+static void persistence_render(struct persistence *p, const GdkRGBA *color)
+{
+	const unsigned int cells = p->width * p->height;
+	gfloat max = 0.0f, scale;
+	unsigned int row, col;
+
+	for (col = 0; col < cells; col++)
+		max = p->density[col] > max ? p->density[col] : max;
+
+	scale = max > 0.0f ? 1.0f / max : 0.0f;
+
+	for (row = 0; row < p->height; row++) {
+		const gfloat *src = p->density + (size_t)row * p->width;
+		guint32 *dst = p->argb + (size_t)(p->height - 1 - row) * p->width;
+
+		for (col = 0; col < p->width; col++) {
+			/* sqrt keeps the rarely hit cells visible */
+			gfloat v = sqrtf(src[col] * scale);
+			guint32 a = (guint32)(v * 255.0f);
+			guint32 r = (guint32)(v * color->red * 255.0f);
+			guint32 g = (guint32)(v * color->green * 255.0f);
+			guint32 b = (guint32)(v * color->blue * 255.0f);
+
+			dst[col] = (a << 24) | (r << 16) | (g << 8) | b;
+		}
+	}
+
+	p->dirty = false;
+}
+
+G_DEFINE_TYPE(GtkDataboxPhosphor, gtk_databox_phosphor, GTK_DATABOX_TYPE_GRAPH)
+
+static GdkRGBA phosphor_color(GtkDataboxGraph *graph)
+{
+	GdkRGBA color = { 0.0, 1.0, 0.0, 1.0 };
+	GdkRGBA *c = NULL;
+
+	g_object_get(G_OBJECT(graph), "color", &c, NULL);
+	if (c) {
+		color = *c;
+		gdk_rgba_free(c);
+	}
+
+	return color;
+}
+
+static void gtk_databox_phosphor_real_draw(GtkDataboxGraph *graph,
+		GtkDatabox *box)
+{
+	struct persistence *p = GTK_DATABOX_PHOSPHOR(graph)->persistence;
+	cairo_surface_t *image;
+	cairo_t *cr;
+	gint16 left, right, top, bottom;
+	GdkRGBA color;
+
+	if (!p || !p->extent_valid)
+		return;
+
+	if (p->dirty) {
+		color = phosphor_color(graph);
+		persistence_render(p, &color);
+	}
+
+	left = gtk_databox_value_to_pixel_x(box, p->x_min);
+	right = gtk_databox_value_to_pixel_x(box, p->x_max);
+	top = gtk_databox_value_to_pixel_y(box, p->y_max);
+	bottom = gtk_databox_value_to_pixel_y(box, p->y_min);
+	if (right == left || bottom == top)
+		return;
+
+	image = cairo_image_surface_create_for_data((unsigned char *)p->argb,
+			CAIRO_FORMAT_ARGB32, p->width, p->height,
+			p->width * sizeof(*p->argb));
+
+	cr = gtk_databox_graph_create_gc(graph, box);
+	cairo_translate(cr, left, top);
+	cairo_scale(cr, (double)(right - left) / p->width,
+			(double)(bottom - top) / p->height);
+	cairo_set_source_surface(cr, image, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+
+	cairo_surface_destroy(image);
+}
+
+static gint gtk_databox_phosphor_real_calculate_extrema(GtkDataboxGraph *graph,
+		gfloat *min_x, gfloat *max_x, gfloat *min_y, gfloat *max_y)
+{
+	struct persistence *p = GTK_DATABOX_PHOSPHOR(graph)->persistence;
+
+	if (!p || !p->extent_valid)
+		return -1;
+
+	*min_x = p->x_min;
+	*max_x = p->x_max;
+	*min_y = p->y_min;
+	*max_y = p->y_max;
+
+	return 0;
+}
+
+static void gtk_databox_phosphor_finalize(GObject *object)
+{
+	GtkDataboxPhosphor *phosphor = GTK_DATABOX_PHOSPHOR(object);
+
+	persistence_free(phosphor->persistence);
+	phosphor->persistence = NULL;
+
+	G_OBJECT_CLASS(gtk_databox_phosphor_parent_class)->finalize(object);
+}
+
+static void gtk_databox_phosphor_class_init(GtkDataboxPhosphorClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GtkDataboxGraphClass *graph_class = GTK_DATABOX_GRAPH_CLASS(klass);
+
+	gobject_class->finalize = gtk_databox_phosphor_finalize;
+	graph_class->draw = gtk_databox_phosphor_real_draw;
+	graph_class->calculate_extrema =
+		gtk_databox_phosphor_real_calculate_extrema;
+}
+
+static void gtk_databox_phosphor_init(GtkDataboxPhosphor *phosphor)
+{
+	phosphor->persistence = NULL;
+}
+
+/* The graph takes ownership of the persistence object */
+GtkDataboxGraph * gtk_databox_phosphor_new(struct persistence *p,
+		GdkRGBA *color)
+{
+	GtkDataboxPhosphor *phosphor;
+
+	phosphor = g_object_new(GTK_DATABOX_TYPE_PHOSPHOR, "color", color, NULL);
+	phosphor->persistence = p;
+
+	return GTK_DATABOX_GRAPH(phosphor);
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#ifndef __PERSISTENCE_H__
+#define __PERSISTENCE_H__
+
+#include <glib.h>
+#include <gtkdatabox.h>
+#include <gtkdatabox_graph.h>
+#include <stdbool.h>
+
+#define PERSISTENCE_WIDTH	512
+#define PERSISTENCE_HEIGHT	512
+/* Auto sized histograms start over when more than 1/N of a frame misses */
+#define PERSISTENCE_MAX_OUTSIDE	16
+
+/*
+ * Digital phosphor: samples are binned into a 2D hit-count histogram
+ * which decays a bit on every frame and is drawn as one intensity image
+ * instead of one databox point per sample.
+ */
+struct persistence {
+	unsigned int width;
+	unsigned int height;
+	gfloat x_min, x_max;
+	gfloat y_min, y_max;
+	bool extent_valid;
+	bool extent_fixed;	/* set by the caller, else sized on the data */
+	gfloat decay;		/* fraction kept per frame, 1.0 = infinite */
+	gfloat *density;	/* width * height cells */
+	gint32 *bins;		/* per sample cell index, scratch */
+	unsigned int bins_size;
+	guint32 *argb;		/* rendered image */
+	bool dirty;
+};
+
+struct persistence * persistence_new(unsigned int width, unsigned int height,
+		gfloat decay);
+void persistence_free(struct persistence *p);
+/* Clear the histogram and size it on the next frame */
+void persistence_reset(struct persistence *p);
+/* Bin into a fixed area, clears the histogram when it changes */
+void persistence_set_extent(struct persistence *p, gfloat x_min, gfloat x_max,
+		gfloat y_min, gfloat y_max);
+void persistence_accumulate(struct persistence *p, const gfloat *x,
+		const gfloat *y, unsigned int n);
+
+/* GtkDatabox graph that draws a persistence histogram */
+#define GTK_DATABOX_TYPE_PHOSPHOR (gtk_databox_phosphor_get_type())
+#define GTK_DATABOX_PHOSPHOR(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), \
+		GTK_DATABOX_TYPE_PHOSPHOR, GtkDataboxPhosphor))
+#define GTK_DATABOX_IS_PHOSPHOR(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), \
+		GTK_DATABOX_TYPE_PHOSPHOR))
+
+typedef struct _GtkDataboxPhosphor GtkDataboxPhosphor;
+typedef struct _GtkDataboxPhosphorClass GtkDataboxPhosphorClass;
+
+struct _GtkDataboxPhosphor {
+	GtkDataboxGraph parent;
+	struct persistence *persistence;
+};
+
+struct _GtkDataboxPhosphorClass {
+	GtkDataboxGraphClass parent_class;
+};
+
+GType gtk_databox_phosphor_get_type(void);
+GtkDataboxGraph * gtk_databox_phosphor_new(struct persistence *p,
+		GdkRGBA *color);
+
+#endif /* __PERSISTENCE_H__ */
@@ -12,6 +12,11 @@
 #include <unistd.h>
 
 #include "dac_data_manager.h"
+#include "waveform_file.h"
+#include "waveform_cache.h"
+#include "waveform_synth.h"
+#include "dac_stream.h"
+#include "dds_config.h"
 #include "../iio_widget.h"
 #include "../osc.h"
 
@@ -134,6 +139,10 @@ struct dac_data_manager {
 	struct iio_buffer *dds_buffer;
 	bool is_local;
 	bool is_cyclic_buffer;
+	struct dac_stream *stream;
+	bool stream_loop;
+	guint stream_timer;
+	struct dds_config *dds_cfg;
 
 	GtkWidget *container;
 };
@@ -226,287 +235,303 @@ static unsigned short convert(double scale, float val, double offset)
 	return (short) (val * scale + offset);
 }
 
-static int parse_wavefile_line(const char *line, double *vals,
-	unsigned int max_num_vals)
-{
-	unsigned int n = 0;
-	gchar *endptr;
+/* A waveform file read and checked, ready to be converted */
+struct wavefile {
+	bool is_mat;
+	struct waveform_text wt;
 
-	while (n < max_num_vals) {
-		/* Skip white space */
-		while (*line == ' ' || *line == '\t' || *line == ',')
-			line++;
+	bool is_synth;
+	struct waveform_synth_output synth;
 
-		if (*line == '\n' || *line == '\r' || *line == '\0')
-			break;
+	mat_t *matfp;
+	matvar_t **matvars;
+	int num_vars;
+	bool complex_format;
+	double max;
 
-		vals[n++] = g_ascii_strtod(line, &endptr);
+	unsigned int size;	/* bytes of DAC buffer it makes */
+};
 
-		/*
-		 * If endptr did not advance this means the value is not a
-		 * number. In that case abort and return an error.
-		 */
-		if (errno || line == (const char *)endptr)
-			return -1;
-		line = (const char *)endptr;
+static void wavefile_close(struct wavefile *wf)
+{
+	int i;
+
+	if (wf->is_synth) {
+		waveform_synth_output_free(&wf->synth);
+		return;
 	}
 
-	return n;
+	if (!wf->is_mat) {
+		waveform_text_free(&wf->wt);
+		return;
+	}
+
+	for (i = 0; i < wf->num_vars; i++)
+		Mat_VarFree(wf->matvars[i]);
+	free(wf->matvars);
+	if (wf->matfp)
+		Mat_Close(wf->matfp);
 }
 
-static int analyse_wavefile(struct dac_data_manager *manager,
-		const char *file_name, char **buf, int *count, int tx_channels, double full_scale)
+static int wavefile_open_mat(const char *file_name, int tx_channels,
+		struct wavefile *wf)
 {
-	int ret, rep;
-	unsigned int size, j, i = 0;
-	double max = 0.0, val[8], scale = 0.0;
-	double offset;
-	char line[80];
-	mat_t *matfp;
-	matvar_t **matvars;
-
+	bool real_format = false;
+	matvar_t *var;
+	unsigned int j, size;
+	int i;
 
-	FILE *infile = fopen(file_name, "r");
+	wf->is_mat = true;
 
-	*buf = NULL;
+	/* Is it a MATLAB file?
+	 * http://na-wiki.csc.kth.se/mediawiki/index.php/MatIO
+	 */
+	wf->matfp = Mat_Open(file_name, MAT_ACC_RDONLY);
+	if (wf->matfp == NULL) {
+		fprintf(stderr, "ERROR: Could not open %s as a matlab file\n", file_name);
+		return WAVEFORM_MAT_INVALID_FORMAT;
+	}
 
-	if (infile == NULL)
+	wf->matvars = malloc(sizeof(matvar_t *) * tx_channels);
+	if (!wf->matvars)
 		return -errno;
 
-	offset = dac_offset_get_value(manager->dac1.iio_dac);
+	while (wf->num_vars < tx_channels && (var = Mat_VarReadNextInfo(wf->matfp)) != NULL) {
+		wf->matvars[wf->num_vars++] = var;
 
-	if (fgets(line, 80, infile) != NULL) {
-		if (strncmp(line, "TEXT", 4) == 0) {
-			/* Unscaled samples need to be in the range +- 2047 */
-			if (strncmp(line, "TEXTU", 5) == 0)
-				scale = 16.0;	/* scale up to 16-bit */
-			ret = sscanf(line, "TEXT%*c REPEAT %d", &rep);
-			if (ret != 1) {
-				rep = 1;
-			}
-			size = 0;
-			while (fgets(line, 80, infile)) {
-				ret = parse_wavefile_line(line, val, 8);
-				if (ret == 0)
-					continue;
-				if (!(ret == 4 || ret == 2 || ret == 8)) {
-					fclose(infile);
-					fprintf(stderr, "ERROR: No 2, 4 or 8 columns of data inside the text file\n");
-					return WAVEFORM_TXT_INVALID_FORMAT;
-				}
+		/* must be a vector */
+		if (var->rank !=2 || (var->dims[0] > 1 && var->dims[1] > 1)) {
+			fprintf(stderr, "ERROR: Data inside the matlab file must be a vector\n");
+			return WAVEFORM_MAT_INVALID_FORMAT;
+		}
+		/* should be a double */
+		if (var->class_type != MAT_C_DOUBLE) {
+			fprintf(stderr, "ERROR: Data inside the matlab file must be of type double\n");
+			return WAVEFORM_MAT_INVALID_FORMAT;
+		}
 
-				for (i = 0; i < (unsigned int) ret; i++)
-					if (fabs(val[i]) > max)
-						max = fabs(val[i]);
+		Mat_VarReadDataAll(wf->matfp, var);
 
-				size += tx_channels * 2;
+		if (var->isComplex) {
+			mat_complex_split_t *complex_data = var->data;
+			double *re, *im;
+			re = complex_data->Re;
+			im = complex_data->Im;
+
+			for (j = 0; j < (unsigned int) var->dims[0] ; j++) {
+				 if (fabs(re[j]) > wf->max)
+					 wf->max = fabs(re[j]);
+				 if (fabs(im[j]) > wf->max)
+					 wf->max = fabs(im[j]);
 			}
+			wf->complex_format = true;
+		} else {
+			double re;
 
-			size *= rep;
-			if (scale == 0.0)
-				scale = 32767.0 * full_scale / max;
+			for (j = 0; j < (unsigned int) var->dims[0] ; j++) {
+				re = ((double *)var->data)[j];
+				if (fabs(re) > wf->max)
+					wf->max = fabs(re);
+			}
+			real_format = true;
+		}
+	}
 
-			while ((size % manager->alignment) != 0)
-				size *= 2;
+	if (!wf->num_vars) {
+		fprintf(stderr, "ERROR: Could not find any valid data in %s\n", file_name);
+		return WAVEFORM_MAT_INVALID_FORMAT;
+	}
 
-			*buf = malloc(size);
-			if (*buf == NULL)
-				return -errno;
+	if (wf->max <= 1.0)
+		wf->max = 1.0;
 
-			unsigned short *sample_16 = *((unsigned short **) buf);
+	size = wf->matvars[0]->dims[0];
 
-			rewind(infile);
+	for (i = 0; i < wf->num_vars; i++) {
+		if (size != (unsigned int) wf->matvars[i]->dims[0]) {
+			fprintf(stderr, "ERROR: Vector dimensions in the matlab file don't match\n");
+			return WAVEFORM_MAT_INVALID_FORMAT;
+		}
+	}
 
-			if (fgets(line, 80, infile) != NULL) {
-				if (strncmp(line, "TEXT", 4) == 0) {
-					int n;
-					size = 0;
-					i = 0;
-					while (fgets(line, 80, infile)) {
-						ret = parse_wavefile_line(line, val, 8);
-						if (ret == 0)
-							continue;
+	if (wf->complex_format && real_format) {
+		fprintf(stderr, "ERROR: Both complex and real data formats in the same matlab file are not supported\n");
+		return WAVEFORM_MAT_INVALID_FORMAT;
+	}
 
-						for (j = 0; j < (unsigned int) rep; j++) {
-							for (n = 0; n < tx_channels; n++)
-								sample_16[i++] = convert(scale, val[n & (ret - 1)], offset);
+	wf->size = size * tx_channels * 2;
 
-							size += tx_channels * 2;
-						}
-					}
-				}
-			}
+	return 0;
+}
 
-			/* When we are in 1 TX mode it is possible that the number of bytes
-			 * is not a multiple of 8, but only a multiple of 4. In this case
-			 * we'll send the same buffer twice to make sure that it becomes a
-			 * multiple of 8. (default manager->alignment)
-			 */
+/* Generates the test signal a .synth file describes */
+static int wavefile_open_synth(struct dac_data_manager *manager,
+		const char *file_name, int tx_channels, struct wavefile *wf)
+{
+	struct waveform_synth_config cfg;
+	int ret;
 
-			while ((size % manager->alignment) != 0) {
-				memcpy(*buf + size, *buf, size);
-				size += size;
-			}
+	wf->is_synth = true;
 
-			fclose(infile);
-			*count = size;
+	ret = waveform_synth_config_load(file_name, &cfg);
+	if (ret)
+		return ret;
 
-		} else {
-			fclose(infile);
-			ret = 0;
-			/* Is it a MATLAB file?
-			 * http://na-wiki.csc.kth.se/mediawiki/index.php/MatIO
-			 */
-			matfp = Mat_Open(file_name, MAT_ACC_RDONLY);
-			if (matfp == NULL) {
-				fprintf(stderr, "ERROR: Could not open %s as a matlab file\n", file_name);
-				return WAVEFORM_MAT_INVALID_FORMAT;
-			}
+	ret = waveform_synth_generate(&cfg, &wf->synth);
+	if (ret)
+		return ret;
 
-			bool complex_format = false;
-			bool real_format = false;
+	wf->size = wf->synth.length * tx_channels * 2;
+	while (wf->size && (wf->size % manager->alignment) != 0)
+		wf->size *= 2;
 
-			rep = 0;
-			matvars = malloc(sizeof(matvar_t *) * tx_channels);
+	return 0;
+}
 
-			while (rep < tx_channels && (matvars[rep] = Mat_VarReadNextInfo(matfp)) != NULL) {
-				/* must be a vector */
-				if (matvars[rep]->rank !=2 || (matvars[rep]->dims[0] > 1 && matvars[rep]->dims[1] > 1)) {
-					fprintf(stderr, "ERROR: Data inside the matlab file must be a vector\n");
-					free(matvars);
-					return WAVEFORM_MAT_INVALID_FORMAT;
-				}
-				/* should be a double */
-				if (matvars[rep]->class_type != MAT_C_DOUBLE) {
-					fprintf(stderr, "ERROR: Data inside the matlab file must be of type double\n");
-					free(matvars);
-					return WAVEFORM_MAT_INVALID_FORMAT;
-				}
 /*
-	printf("%s : %s\n", __func__, matvars[rep]->name);
-	printf("  rank %d\n", matvars[rep]->rank);
-	printf("  dims %d x %d\n", matvars[rep]->dims[0], matvars[rep]->dims[1]);
-	printf("  data %d\n", matvars[rep]->data_type);
-	printf("  class %d\n", matvars[rep]->class_type);
-*/
-				Mat_VarReadDataAll(matfp, matvars[rep]);
-
-				if (matvars[rep]->isComplex) {
-					mat_complex_split_t *complex_data = matvars[rep]->data;
-					double *re, *im;
-					re = complex_data->Re;
-					im = complex_data->Im;
-
-					for (j = 0; j < (unsigned int) matvars[rep]->dims[0] ; j++) {
-						 if (fabs(re[j]) > max)
-							 max = fabs(re[j]);
-						 if (fabs(im[j]) > max)
-							 max = fabs(im[j]);
-					}
-					complex_format = true;
-				} else {
-					double re;
-
-					for (j = 0; j < (unsigned int) matvars[rep]->dims[0] ; j++) {
-						re = ((double *)matvars[rep]->data)[j];
-						if (fabs(re) > max)
-							max = fabs(re);
-					}
-					real_format = true;
-				}
-				rep++;
-			}
-			rep--;
+ * Reads a .txt, .mat or .synth waveform and works out the size of the DAC buffer
+ * it makes, so the buffer can be created before the samples are converted
+ * right into it by wavefile_convert(). A .synth signal is generated whole,
+ * as floats, first.
+ */
+static int wavefile_open(struct dac_data_manager *manager,
+		const char *file_name, int tx_channels, struct wavefile *wf)
+{
+	int ret;
 
-//	printf("read %i vars, length %i, max value %f\n", rep, matvars[rep]->dims[0], max);
+	memset(wf, 0, sizeof(*wf));
 
-			if (rep < 0) {
-				fprintf(stderr, "ERROR: Could not find any valid data in %s\n", file_name);
-				free(matvars);
-				return WAVEFORM_MAT_INVALID_FORMAT;
-			}
+	if (g_str_has_suffix(file_name, ".synth"))
+		return wavefile_open_synth(manager, file_name, tx_channels, wf);
 
-			if (max <= 1.0)
-				max = 1.0;
+	ret = waveform_text_load(file_name, &wf->wt);
+	if (ret < 0)
+		return ret;
+	if (ret == WAVEFORM_TEXT_INVALID)
+		return WAVEFORM_TXT_INVALID_FORMAT;
+	if (ret == WAVEFORM_TEXT_NONE)
+		return wavefile_open_mat(file_name, tx_channels, wf);
 
-			scale = 32767.0 * full_scale / max;
+	wf->size = wf->wt.num_lines * tx_channels * 2 * wf->wt.repeat;
+	while (wf->size && (wf->size % manager->alignment) != 0)
+		wf->size *= 2;
 
-			size = matvars[0]->dims[0];
+	return 0;
+}
 
-			for (i = 0; i <= (unsigned int) rep; i++) {
-				if (size != (unsigned int) matvars[i]->dims[0]) {
-					fprintf(stderr, "ERROR: Vector dimensions in the matlab file don't match\n");
-					free(matvars);
-					return WAVEFORM_MAT_INVALID_FORMAT;
-				}
-			}
+/* Fills buf, wf->size bytes, with the interleaved 16-bit DAC samples */
+static void wavefile_convert(struct dac_data_manager *manager,
+		struct wavefile *wf, char *buf, int tx_channels, double full_scale)
+{
+	unsigned short *sample_16 = (unsigned short *)buf;
+	unsigned int size, j, i = 0;
+	double scale, offset;
 
-			if (complex_format && real_format) {
-				fprintf(stderr, "ERROR: Both complex and real data formats in the same matlab file are not supported\n");
-				free(matvars);
-				return WAVEFORM_MAT_INVALID_FORMAT;
-			}
+	offset = dac_offset_get_value(manager->dac1.iio_dac);
 
-			*buf = malloc((size + 1) * tx_channels * 2);
+	if (wf->is_synth) {
+		const float *si = wf->synth.i, *sq = wf->synth.q;
+		size_t k;
+		int n;
 
-			if (*buf == NULL) {
-				free(matvars);
-				return -errno;
-			}
+		/* The synthesized peak is 1 */
+		scale = 32767.0 * full_scale;
 
-			*count = size * tx_channels * 2;
+		for (k = 0; k < wf->synth.length; k++)
+			for (n = 0; n < tx_channels; n++)
+				sample_16[i++] = convert(scale, n % 2 ? sq[k] : si[k], offset);
 
-			unsigned short *sample_16 = *((unsigned short **) buf);
-			struct _complex_ref *tx_data = calloc(tx_channels, sizeof(struct _complex_ref));
+		size = wf->synth.length * tx_channels * 2;
+		while (size && (size % manager->alignment) != 0) {
+			memcpy(buf + size, buf, size);
+			size += size;
+		}
 
-			mat_complex_split_t *complex_data[64];
+		return;
+	}
 
-			if (complex_format) {
-				for (i = 0; i <= (unsigned int) rep; i++) {
-					complex_data[i] = matvars[i]->data;
-					tx_data[i].re = complex_data[i]->Re;
-					tx_data[i].im = complex_data[i]->Im;
-				}
-			} else if (real_format) {
-				for (i = 0; i <= (unsigned int) rep; i++) {
-					if (i % 2)
-						tx_data[i / 2].im = matvars[i]->data;
-					else
-						tx_data[i / 2].re = matvars[i]->data;
-				}
-			}
-			replicate_tx_data_channels(tx_data, tx_channels);
-
-			unsigned int ch = 0;
-			unsigned int sample_i = 0;
-			unsigned int tx_data_end = (tx_channels % 2 == 0) ? (tx_channels / 2) : tx_channels;
-
-			for (i = 0 ; i < size; i++) {
-				for (ch = 0; ch < tx_data_end; ch++) {
-					if (tx_channels % 2 == 0) {
-						sample_16[sample_i++] = ((unsigned int) convert(scale, tx_data[ch].re[i], offset));
-						sample_16[sample_i++] = ((unsigned int) convert(scale, tx_data[ch].im[i], offset));
-					} else {
-						sample_16[sample_i++] = ((unsigned int) convert(scale, tx_data[ch].re[i], offset));
-					}
+	if (!wf->is_mat) {
+		const struct waveform_text_chunk *chunk;
+		const double *val;
+		size_t line;
+		unsigned int c;
+		int n, cols;
+
+		/* Unscaled samples need to be in the range +- 2047 */
+		if (wf->wt.unscaled)
+			scale = 16.0;	/* scale up to 16-bit */
+		else
+			scale = 32767.0 * full_scale / wf->wt.max;
+
+		size = 0;
+		for (c = 0; c < wf->wt.num_chunks; c++) {
+			chunk = &wf->wt.chunks[c];
+			val = chunk->vals;
+			for (line = 0; line < chunk->num_lines; line++) {
+				cols = chunk->cols[line];
+				for (j = 0; j < wf->wt.repeat; j++) {
+					for (n = 0; n < tx_channels; n++)
+						sample_16[i++] = convert(scale, val[n & (cols - 1)], offset);
+
+					size += tx_channels * 2;
 				}
+				val += cols;
 			}
+		}
 
-			for (j = 0; j <= (unsigned int) rep; j++) {
-				Mat_VarFree(matvars[j]);
-			}
-			free(tx_data);
-			tx_data = NULL;
-			free(matvars);
+		/* When we are in 1 TX mode it is possible that the number of bytes
+		 * is not a multiple of 8, but only a multiple of 4. In this case
+		 * we'll send the same buffer twice to make sure that it becomes a
+		 * multiple of 8. (default manager->alignment)
+		 */
 
-			Mat_Close(matfp);
-			return ret;
+		while (size && (size % manager->alignment) != 0) {
+			memcpy(buf + size, buf, size);
+			size += size;
+		}
+
+		return;
+	}
+
+	scale = 32767.0 * full_scale / wf->max;
+	size = wf->matvars[0]->dims[0];
+
+	struct _complex_ref *tx_data = calloc(tx_channels, sizeof(struct _complex_ref));
+
+	mat_complex_split_t *complex_data[64];
+
+	if (wf->complex_format) {
+		for (i = 0; i < (unsigned int) wf->num_vars; i++) {
+			complex_data[i] = wf->matvars[i]->data;
+			tx_data[i].re = complex_data[i]->Re;
+			tx_data[i].im = complex_data[i]->Im;
 		}
 	} else {
-		fclose(infile);
-		return -EINVAL;
+		for (i = 0; i < (unsigned int) wf->num_vars; i++) {
+			if (i % 2)
+				tx_data[i / 2].im = wf->matvars[i]->data;
+			else
+				tx_data[i / 2].re = wf->matvars[i]->data;
+		}
 	}
-	return 0;
+	replicate_tx_data_channels(tx_data, tx_channels);
+
+	unsigned int ch = 0;
+	unsigned int sample_i = 0;
+	unsigned int tx_data_end = (tx_channels % 2 == 0) ? (tx_channels / 2) : tx_channels;
+
+	for (i = 0 ; i < size; i++) {
+		for (ch = 0; ch < tx_data_end; ch++) {
+			if (tx_channels % 2 == 0) {
+				sample_16[sample_i++] = ((unsigned int) convert(scale, tx_data[ch].re[i], offset));
+				sample_16[sample_i++] = ((unsigned int) convert(scale, tx_data[ch].im[i], offset));
+			} else {
+				sample_16[sample_i++] = ((unsigned int) convert(scale, tx_data[ch].re[i], offset));
+			}
+		}
+	}
+
+	free(tx_data);
 }
 
 static gboolean scale_spin_button_output_cb(GtkSpinButton *spin, gpointer data)
@@ -581,6 +606,16 @@ static void enable_dds_channels(struct dac_buffer *db)
 	}
 }
 
+static void dac_buffer_stream_stop(struct dac_data_manager *manager)
+{
+	if (manager->stream_timer) {
+		g_source_remove(manager->stream_timer);
+		manager->stream_timer = 0;
+	}
+	dac_stream_free(manager->stream);
+	manager->stream = NULL;
+}
+
 static void enable_dds(struct dac_data_manager *manager, bool on_off)
 {
 	struct iio_device *dac1 = NULL;
@@ -595,42 +630,100 @@ static void enable_dds(struct dac_data_manager *manager, bool on_off)
 		iio_buffer_destroy(manager->dds_buffer);
 		manager->dds_buffer = NULL;
 	}
+	dac_buffer_stream_stop(manager);
 
 	dac1 = manager->dac1.iio_dac;
 	if (manager->dacs_count == 2)
 		dac2 = manager->dac2.iio_dac;
 
-	ret = iio_channel_attr_write_bool(iio_device_find_channel(dac1, "altvoltage0", true), "raw", on_off);
-	if (ret < 0) {
+	dds_config_begin(manager->dds_cfg);
+	dds_config_set_bool(manager->dds_cfg,
+			iio_device_find_channel(dac1, "altvoltage0", true), "raw", on_off);
+	if (dac2)
+		dds_config_set_bool(manager->dds_cfg,
+				iio_device_find_channel(dac2, "altvoltage0", true), "raw", on_off);
+	ret = dds_config_commit(manager->dds_cfg);
+	if (ret < 0)
 		fprintf(stderr, "Failed to toggle DDS: %d\n", ret);
-		return;
-	}
-	if (dac2) {
-		ret = iio_channel_attr_write_bool(iio_device_find_channel(dac2, "altvoltage0", true), "raw", on_off);
-		if (ret < 0) {
-			fprintf(stderr, "Failed to toggle DDS: %d\n", ret);
-			return;
-		}
+}
+
+static gboolean dac_buffer_stream_status_update(struct dac_data_manager *manager)
+{
+	struct dac_stream_stats stats;
+	gchar *msg;
+
+	dac_stream_get_stats(manager->stream, &stats);
+
+	if (stats.error)
+		msg = g_strdup_printf("Streaming failed: %s.", strerror(-stats.error));
+	else
+		msg = g_strdup_printf("%s: %.1f MiB/s, %.1f MiB sent, %u loops, %u underflows.",
+				stats.running ? "Streaming" : "Stream done",
+				stats.throughput / (1 << 20),
+				stats.bytes / (double)(1 << 20),
+				stats.loops, stats.underflows);
+	gtk_text_buffer_set_text(manager->dac_buffer_module.load_status_buf, msg, -1);
+	g_free(msg);
+
+	if (!stats.running)
+		manager->stream_timer = 0;
+
+	return stats.running;
+}
+
+/*
+ * Non-cyclic .bin files are played from the disk as they go, so they can
+ * be larger than the memory and than what a single DMA buffer holds.
+ */
+static int stream_dac_buffer_file(struct dac_data_manager *manager,
+		const char *file_name, char **stat_msg)
+{
+	struct iio_device *dac = manager->dac_buffer_module.dac_with_scanelems;
+	char *tmp;
+	int ret;
+
+	enable_dds(manager, false);
+	enable_dds_channels(&manager->dac_buffer_module);
+
+	manager->stream = dac_stream_new(dac, file_name, manager->stream_loop, &ret);
+	if (!manager->stream) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Unable to stream file: %s.", strerror(-ret));
+		return ret;
 	}
+	manager->stream_timer = g_timeout_add_seconds(1,
+			(GSourceFunc)dac_buffer_stream_status_update, manager);
+
+	tmp = strdup(file_name);
+	if (manager->dac_buffer_module.dac_buf_filename)
+		free(manager->dac_buffer_module.dac_buf_filename);
+	manager->dac_buffer_module.dac_buf_filename = tmp;
+
+	if (stat_msg)
+		*stat_msg = g_strdup_printf("Streaming started.");
+
+	return 0;
 }
 
 static int process_dac_buffer_file (struct dac_data_manager *manager, const char *file_name, char **stat_msg)
 {
 	int ret, size = 0, s_size;
-	double scale;
-	/*
+	double scale = 0.0;
 	struct stat st;
-	*/
-	char *buf = NULL, *tmp;
-	/*
-	FILE *infile;
-	*/
+	struct wavefile wf;
+	char *buf, *tmp;
+	const char *data = NULL;
+	gchar *key = NULL;
 	unsigned int buffer_channels = 0;
 
 	if (manager->dds_buffer) {
 		iio_buffer_destroy(manager->dds_buffer);
 		manager->dds_buffer = NULL;
 	}
+	dac_buffer_stream_stop(manager);
+
+	if (g_str_has_suffix(file_name, ".bin") && !manager->is_cyclic_buffer)
+		return stream_dac_buffer_file(manager, file_name, stat_msg);
 
 	if (manager->is_local) {
 #ifdef __linux__
@@ -655,76 +748,100 @@ static int process_dac_buffer_file (struct dac_data_manager *manager, const char
 	}
 
 
-	if (g_str_has_suffix(file_name, ".bin")) {
-		FILE *infile;
-		struct stat st;
+	struct iio_device *dac = manager->dac_buffer_module.dac_with_scanelems;
+
+	memset(&wf, 0, sizeof(wf));
 
+	if (g_str_has_suffix(file_name, ".bin")) {
 		/* Assume Binary format */
-		stat(file_name, &st);
-		buf = malloc(st.st_size);
-		if (buf == NULL) {
+		if (stat(file_name, &st)) {
 			if (stat_msg)
-				*stat_msg = g_strdup_printf("Internal memory allocation failed.");
+				*stat_msg = g_strdup_printf("Error while reading file: %s.", strerror(errno));
 			return -errno;
 		}
-		infile = fopen(file_name, "r");
-		size = fread(buf, 1, st.st_size, infile);
-		fclose(infile);
+		size = st.st_size;
 	} else {
-
 		scale = db_full_scale_convert(gtk_spin_button_get_value(GTK_SPIN_BUTTON(manager->dac_buffer_module.scale)), false);
-		ret = analyse_wavefile(manager, file_name, &buf, &size, buffer_channels, scale);
-		if (ret < 0) {
-			if (stat_msg)
-				*stat_msg = g_strdup_printf("Error while parsing file: %s.", strerror(-ret));
-			free(buf);
-			return ret;
-		} else if (ret > 0) {
-			if (stat_msg)
-				*stat_msg = g_strdup_printf("Invalid data format");
-			free(buf);
-			return -EINVAL;
+
+		/* The same file converted the same way is only copied */
+		key = waveform_cache_key(file_name,
+				iio_device_get_name(dac) ?: iio_device_get_id(dac),
+				buffer_channels, scale,
+				dac_offset_get_value(manager->dac1.iio_dac),
+				manager->alignment);
+		data = key ? waveform_cache_get(key, &size) : NULL;
+		if (!data) {
+			ret = wavefile_open(manager, file_name, buffer_channels, &wf);
+			if (ret < 0) {
+				if (stat_msg)
+					*stat_msg = g_strdup_printf("Error while parsing file: %s.", strerror(-ret));
+				goto out;
+			} else if (ret > 0) {
+				if (stat_msg)
+					*stat_msg = g_strdup_printf("Invalid data format");
+				ret = -EINVAL;
+				goto out;
+			}
+			size = wf.size;
 		}
 	}
 
-	usleep(1000); /* FIXME: Temp Workaround needs some investigation */
-
 	enable_dds(manager, false);
 	enable_dds_channels(&manager->dac_buffer_module);
 
-	struct iio_device *dac = manager->dac_buffer_module.dac_with_scanelems;
-
 	s_size = iio_device_get_sample_size(dac);
 	if (!s_size) {
 		fprintf(stderr, "Unable to create buffer due to sample size");
 		if (stat_msg)
 			*stat_msg = g_strdup_printf("Unable to create buffer due to sample size");
-		free(buf);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 
 	if (size % manager->alignment != 0 || size % s_size != 0) {
 		fprintf(stderr, "Unable to create buffer due to sample size and number of samples");
 		if (stat_msg)
 			*stat_msg = g_strdup_printf("Unable to create buffer due to sample size and number of samples");
-		free(buf);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 
 	manager->dds_buffer = iio_device_create_buffer(dac, size / s_size, manager->is_cyclic_buffer);
 	if (!manager->dds_buffer) {
-		fprintf(stderr, "Unable to create buffer: %s\n", strerror(errno));
+		ret = -errno;
+		fprintf(stderr, "Unable to create buffer: %s\n", strerror(-ret));
 		if (stat_msg)
-			*stat_msg = g_strdup_printf("Unable to create iio buffer: %s", strerror(errno));
-		free(buf);
-		return -errno;
+			*stat_msg = g_strdup_printf("Unable to create iio buffer: %s", strerror(-ret));
+		goto out;
 	}
 
-	memcpy(iio_buffer_start(manager->dds_buffer), buf,
-			iio_buffer_end(manager->dds_buffer) - iio_buffer_start(manager->dds_buffer));
+	/* The samples go straight into the buffer, in one pass */
+	buf = iio_buffer_start(manager->dds_buffer);
+	if (g_str_has_suffix(file_name, ".bin")) {
+		FILE *infile = fopen(file_name, "rb");
+
+		if (!infile || fread(buf, 1, size, infile) != (size_t)size) {
+			ret = infile ? -EIO : -errno;
+			if (infile)
+				fclose(infile);
+			if (stat_msg)
+				*stat_msg = g_strdup_printf("Error while reading file: %s.", strerror(-ret));
+			iio_buffer_destroy(manager->dds_buffer);
+			manager->dds_buffer = NULL;
+			goto out;
+		}
+		fclose(infile);
+	} else if (data) {
+		memcpy(buf, data, size);
+	} else {
+		wavefile_convert(manager, &wf, buf, buffer_channels, scale);
+	}
 
 	iio_buffer_push(manager->dds_buffer);
-	free(buf);
+
+	/* Saved once the DAC runs, the disk write is left to the cache */
+	if (key && !data)
+		waveform_cache_store(key, buf, size);
 
 	tmp = strdup(file_name);
 
@@ -736,7 +853,11 @@ static int process_dac_buffer_file (struct dac_data_manager *manager, const char
 	if (stat_msg)
 		*stat_msg = g_strdup_printf("Waveform loaded successfully.");
 
-	return 0;
+	ret = 0;
+out:
+	wavefile_close(&wf);
+	g_free(key);
+	return ret;
 }
 
 static bool tx_channels_check_valid_setup(struct dac_buffer *dbuf)
@@ -783,8 +904,9 @@ static void waveform_load_button_clicked_cb (GtkButton *btn, struct dac_buffer *
 
 	if (!filename || g_str_has_suffix(filename, "(null)")) {
 		status_msg = g_strdup_printf("No file selected.");
-	} else if (!g_str_has_suffix(filename, ".txt") && !g_str_has_suffix(filename, ".mat") && !g_str_has_suffix(filename, ".bin")) {
-		status_msg = g_strdup_printf("Invalid file type. Please select a .txt, .bin or .mat file.");
+	} else if (!g_str_has_suffix(filename, ".txt") && !g_str_has_suffix(filename, ".mat") &&
+			!g_str_has_suffix(filename, ".bin") && !g_str_has_suffix(filename, ".synth")) {
+		status_msg = g_strdup_printf("Invalid file type. Please select a .txt, .bin, .mat or .synth file.");
 	} else if (!tx_channels_check_valid_setup(dbuf)) {
 		status_msg = g_strdup_printf("Invalid channel selection.");
 	} else {
@@ -801,6 +923,7 @@ static void stop_buffer_tx_button_clicked_cb (GtkButton *btn, struct dac_buffer
 		iio_buffer_destroy(dbuf->parent->dds_buffer);
 		dbuf->parent->dds_buffer = NULL;
 	}
+	dac_buffer_stream_stop(dbuf->parent);
 }
 
 static void cyclic_buffer_button_clicked_cb (GtkButton *btn, struct dac_buffer *dbuf)
@@ -808,6 +931,11 @@ static void cyclic_buffer_button_clicked_cb (GtkButton *btn, struct dac_buffer *
 	dbuf->parent->is_cyclic_buffer = !dbuf->parent->is_cyclic_buffer;
 }
 
+static void stream_loop_button_toggled_cb (GtkToggleButton *btn, struct dac_buffer *dbuf)
+{
+	dbuf->parent->stream_loop = gtk_toggle_button_get_active(btn);
+}
+
 static GtkWidget *spin_button_create(double min, double max, double step, unsigned digits)
 {
 	GtkWidget *spin_button;
@@ -1099,6 +1227,7 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 	GtkWidget *tx_channels_frame;
 	GtkWidget *stop_buff_tx_btn;
 	GtkWidget *cyclic_buff_btn;
+	GtkWidget *stream_loop_btn;
 	GtkTextBuffer *load_status_tb;
 
 	dacbuf_frame = gtk_frame_new("<b>DAC Buffer Settings</b>");
@@ -1113,6 +1242,10 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 	stop_buff_tx_btn = gtk_button_new_with_label("Stop buffer transmission");
 	cyclic_buff_btn = gtk_check_button_new_with_label("Enable/Disable cyclic buffer");
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(cyclic_buff_btn), d_buffer->parent->is_cyclic_buffer);
+	stream_loop_btn = gtk_check_button_new_with_label("Loop file when streaming");
+	gtk_widget_set_tooltip_text(stream_loop_btn,
+			"With the cyclic buffer disabled, .bin files are streamed from the disk");
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(stream_loop_btn), d_buffer->parent->stream_loop);
 
 	fchooser_frame = gtk_frame_new("<b>File Selection</b>");
 	gtk_label_set_markup(GTK_LABEL(gtk_frame_get_label_widget(GTK_FRAME(fchooser_frame))),"<b>File Selection</b>");
@@ -1148,6 +1281,8 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 		1, 3, 1, 1);
 		gtk_grid_attach(GTK_GRID(table), cyclic_buff_btn,
 		0, 3, 1, 1);
+		gtk_grid_attach(GTK_GRID(table), stream_loop_btn,
+		0, 4, 1, 1);
 	}
 
 	table = gtk_grid_new();
@@ -1177,9 +1312,11 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 	g_signal_connect(d_buffer->scale, "output",
 			 G_CALLBACK(scale_spin_button_output_cb), (void*) 1);
 	g_signal_connect(stop_buff_tx_btn, "clicked",
-			 G_CALLBACK(stop_buffer_tx_button_clicked_cb), d_buffer->parent);
+			 G_CALLBACK(stop_buffer_tx_button_clicked_cb), d_buffer);
 	g_signal_connect(cyclic_buff_btn, "toggled",
-			 G_CALLBACK(cyclic_buffer_button_clicked_cb), d_buffer->parent);
+			 G_CALLBACK(cyclic_buffer_button_clicked_cb), d_buffer);
+	g_signal_connect(stream_loop_btn, "toggled",
+			 G_CALLBACK(stream_loop_button_toggled_cb), d_buffer);
 
 
 	gtk_widget_show(dacbuf_frame);
@@ -1370,6 +1507,81 @@ static int manager_channels_assign(struct dac_data_manager *manager)
 	return 0;
 }
 
+static struct dac_data_manager * tone_manager(struct dds_tone *tone)
+{
+	return tone->parent->parent->parent->parent;
+}
+
+/*
+ * The widgets of the tones save through the DDS transaction of the manager,
+ * so what is saved together is written together and the values the device
+ * already holds are not written again.
+ */
+static void dds_tone_widget_save(struct dds_tone *tone, struct iio_widget *w)
+{
+	struct dds_config *cfg = tone_manager(tone)->dds_cfg;
+	gchar *text;
+
+	if (GTK_IS_COMBO_BOX_TEXT(w->widget)) {
+		text = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(w->widget));
+		if (text)
+			dds_config_set(cfg, w->chn, w->attr_name, text);
+		g_free(text);
+	} else if (w == &tone->iio_freq) {
+		dds_config_set_longlong(cfg, w->chn, w->attr_name,
+				(long long)iio_spin_button_get_attr_value(w));
+	} else {
+		dds_config_set_double(cfg, w->chn, w->attr_name,
+				iio_spin_button_get_attr_value(w));
+	}
+}
+
+#define DDS_TONE_OF(w, member) \
+	((struct dds_tone *)((char *)(w) - G_STRUCT_OFFSET(struct dds_tone, member)))
+
+static void dds_freq_save(struct iio_widget *w)
+{
+	dds_tone_widget_save(DDS_TONE_OF(w, iio_freq), w);
+}
+
+static void dds_scale_save(struct iio_widget *w)
+{
+	dds_tone_widget_save(DDS_TONE_OF(w, iio_scale), w);
+}
+
+static void dds_phase_save(struct iio_widget *w)
+{
+	dds_tone_widget_save(DDS_TONE_OF(w, iio_phase), w);
+}
+
+/* Queues what the widgets of a tone show */
+static void dds_tone_queue(struct dds_tone *tone)
+{
+	tone->iio_freq.save(&tone->iio_freq);
+	tone->iio_scale.save(&tone->iio_scale);
+	tone->iio_phase.save(&tone->iio_phase);
+}
+
+/*
+ * In the one and two tone modes the Q tone follows the I tone the user sets,
+ * so both are written in the same transaction.
+ */
+static struct dds_tone * dds_tone_q_follower(struct dds_tone *tone)
+{
+	struct dds_tx *tx = tone->parent->parent;
+
+	if (tone->parent->type != I_CHANNEL || tx->parent->tones_count <= 2)
+		return NULL;
+
+	switch (gtk_combo_box_get_active(GTK_COMBO_BOX(tx->dds_mode_widget))) {
+	case DDS_ONE_TONE:
+	case DDS_TWO_TONE:
+		return tx->dds_tones[tone->number - 1 + TX_T1_Q];
+	default:
+		return NULL;
+	}
+}
+
 static void save_widget_value(GtkWidget *widget, struct iio_widget *iio_w)
 {
 	iio_w->save(iio_w);
@@ -1381,6 +1593,7 @@ static void save_scale_widget_value(void *data)
 	struct dds_channel *dds_ch = tone->parent;
 	struct iio_widget *scale_w = &tone->iio_scale;
 	struct iio_widget *scale_pair_w = (tone->number == 1) ? &dds_ch->t2.iio_scale : &dds_ch->t1.iio_scale;
+	struct dds_tone *q_tone;
 	double old_val, val1, val2;
 
 	val1 = db_full_scale_convert(gtk_spin_button_get_value(GTK_SPIN_BUTTON(scale_w->widget)), false);
@@ -1390,7 +1603,12 @@ static void save_scale_widget_value(void *data)
 	if (val1 + val2 > 1)
 		gtk_spin_button_set_value(GTK_SPIN_BUTTON(scale_w->widget), db_full_scale_convert(old_val, true));
 
+	q_tone = dds_tone_q_follower(tone);
+	dds_config_begin(tone_manager(tone)->dds_cfg);
 	scale_w->save(scale_w);
+	if (q_tone)
+		q_tone->iio_scale.save(&q_tone->iio_scale);
+	dds_config_commit(tone_manager(tone)->dds_cfg);
 }
 
 static void dds_scale_set_value(GtkWidget *scale, gdouble value)
@@ -1500,18 +1718,44 @@ static void save_freq_i_widget_value(void *data)
 {
 	struct dds_tone *tone = data;
 	struct dds_tx *tx = tone->parent->parent;
+	struct dds_tone *q_tone = dds_tone_q_follower(tone);
+	struct dds_config *cfg = tone_manager(tone)->dds_cfg;
+
+	/* The Q tone takes the frequency, and a phase that depends on it */
+	dds_config_begin(cfg);
+	tone->iio_freq.save(&tone->iio_freq);
+	if (q_tone) {
+		q_tone->iio_freq.save(&q_tone->iio_freq);
+		q_tone->iio_phase.save(&q_tone->iio_phase);
+	}
+	dds_config_commit(cfg);
 
 	switch (gtk_combo_box_get_active(GTK_COMBO_BOX(tx->dds_mode_widget))) {
 	case DDS_TWO_TONE:
 	case DDS_ONE_TONE:
-		iio_widget_save_block_signals_by_data(&tone->iio_freq);
+		iio_widget_update_block_signals_by_data(&tone->iio_freq);
 		break;
 	default:
-		iio_widget_save(&tone->iio_freq);
+		iio_widget_update(&tone->iio_freq);
 		break;
 	}
 }
 
+static void save_phase_i_widget_value(void *data)
+{
+	struct dds_tone *tone = data;
+	struct dds_tone *q_tone = dds_tone_q_follower(tone);
+	struct dds_config *cfg = tone_manager(tone)->dds_cfg;
+
+	dds_config_begin(cfg);
+	tone->iio_phase.save(&tone->iio_phase);
+	if (q_tone)
+		q_tone->iio_phase.save(&q_tone->iio_phase);
+	dds_config_commit(cfg);
+
+	iio_widget_update(&tone->iio_phase);
+}
+
 static void dds_locked_scale_cb(GtkWidget *scale, struct dds_tx *tx)
 {
 	struct dds_tone **tones = tx->dds_tones;
@@ -1550,6 +1794,9 @@ static void manage_dds_mode (GtkComboBox *box, struct dds_tx *tx)
 
 	manager = tx->parent->parent;
 	tones_count = manager->dac1.tones_count;
+
+	/* Whatever the mode switch changes goes out at once, at the end */
+	dds_config_begin(manager->dds_cfg);
 	q_tone_exists = (tones_count > 2);
 	min_scale = manager->lowest_scale_point;
 	scale_available_mode = manager->scale_available_mode;
@@ -1605,6 +1852,8 @@ static void manage_dds_mode (GtkComboBox *box, struct dds_tx *tx)
 			iio_buffer_destroy(manager->dds_buffer);
 			manager->dds_buffer = NULL;
 		}
+		if (!manager->dds_activated)
+			dac_buffer_stream_stop(manager);
 		manager->dds_disabled = true;
 		enable_dds(manager, start_dds);
 
@@ -1769,6 +2018,15 @@ static void manage_dds_mode (GtkComboBox *box, struct dds_tx *tx)
 	default:
 		break;
 	}
+
+	if (active != DDS_BUFFER) {
+		for (i = TX_T1_I; i <= TX_T2_Q; i++) {
+			if (i >= tones_count)
+				break;
+			dds_tone_queue(tones[i]);
+		}
+	}
+	dds_config_commit(manager->dds_cfg);
 }
 
 static void tone_setup(struct dds_tone *tone)
@@ -1806,6 +2064,15 @@ static void tone_setup(struct dds_tone *tone)
 	iio_spin_button_init(&tone->iio_phase,
 			tone->iio_dac, tone->iio_ch, "phase", tone->phase, &khz_scale);
 	iio_spin_button_add_progress(&tone->iio_phase);
+	if (tone->parent->type == I_CHANNEL) {
+		iio_spin_button_set_on_complete_function(&tone->iio_phase,
+				save_phase_i_widget_value, tone);
+		iio_spin_button_skip_save_on_complete(&tone->iio_phase, TRUE);
+	}
+
+	tone->iio_freq.save = dds_freq_save;
+	tone->iio_scale.save = dds_scale_save;
+	tone->iio_phase.save = dds_phase_save;
 
 	/* Signals connect */
 	iio_spin_button_progress_activate(&tone->iio_freq);
@@ -1997,6 +2264,7 @@ static int dac_manager_init(struct dac_data_manager *manager,
 	int ret = 0;
 
 	manager->is_cyclic_buffer = true;
+	manager->dds_cfg = dds_config_new();
 
 	ret = dds_dac_init(manager, &manager->dac1, dac);
 	if (ret < 0)
@@ -2075,6 +2343,8 @@ void dac_data_manager_free(struct dac_data_manager *manager)
 			iio_buffer_destroy(manager->dds_buffer);
 			manager->dds_buffer = NULL;
 		}
+		dac_buffer_stream_stop(manager);
+		dds_config_free(manager->dds_cfg);
 		free(manager);
 	}
 }
@@ -2119,6 +2389,9 @@ void dac_data_manager_update_iio_widgets(struct dac_data_manager *manager)
 	if (!manager)
 		return;
 
+	/* The device may have been set up behind the DDS transactions */
+	dds_config_invalidate(manager->dds_cfg);
+
 	for (node = manager->dds_tones; node; node = g_slist_next(node))
 		dds_tone_iio_widgets_update(node->data);
 
@@ -0,0 +1,282 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "dac_stream.h"
+
+/* How often threads waiting on a queue look for a stop request, us */
+#define STOP_POLL_US	(100 * 1000)
+
+struct stream_block {
+	char *data;
+	size_t len;			/* bytes, the last block may be short */
+	bool last;
+};
+
+struct dac_stream {
+	struct iio_device *dev;
+	struct iio_buffer *buf;
+	FILE *file;
+	bool loop;
+	size_t sample_size;
+	size_t block_size;		/* a multiple of sample_size */
+
+	struct stream_block blocks[DAC_STREAM_READ_AHEAD];
+	GAsyncQueue *free_blocks;	/* for the reader to fill */
+	GAsyncQueue *full_blocks;	/* for the pusher, in file order */
+	GThread *reader, *pusher;
+	gint stop;
+
+	GMutex lock;			/* protects stats */
+	struct dac_stream_stats stats;
+	gint64 start;			/* monotonic, us */
+	gint64 window_start;
+	guint64 window_bytes;
+};
+
+static struct stream_block * block_pop(struct dac_stream *s, GAsyncQueue *q)
+{
+	struct stream_block *b = NULL;
+
+	while (!b && !g_atomic_int_get(&s->stop))
+		b = g_async_queue_timeout_pop(q, STOP_POLL_US);
+
+	return b;
+}
+
+static void stream_fail(struct dac_stream *s, int error)
+{
+	g_mutex_lock(&s->lock);
+	if (!s->stats.error)
+		s->stats.error = error;
+	g_mutex_unlock(&s->lock);
+}
+
+static gpointer reader_thread(gpointer data)
+{
+	struct dac_stream *s = data;
+	struct stream_block *b;
+	size_t n;
+
+	while ((b = block_pop(s, s->free_blocks))) {
+		b->len = 0;
+		b->last = false;
+
+		while (b->len < s->block_size) {
+			n = fread(b->data + b->len, 1, s->block_size - b->len,
+					s->file);
+			b->len += n;
+			if (b->len == s->block_size)
+				break;
+
+			if (ferror(s->file)) {
+				stream_fail(s, -EIO);
+				b->last = true;
+				break;
+			}
+
+			/* End of the file, start over or let the DAC drain */
+			g_mutex_lock(&s->lock);
+			s->stats.loops++;
+			g_mutex_unlock(&s->lock);
+
+			if (!s->loop) {
+				b->last = true;
+				break;
+			}
+			rewind(s->file);
+		}
+
+		g_async_queue_push(s->full_blocks, b);
+		if (b->last)
+			break;
+	}
+
+	return NULL;
+}
+
+static void stats_update(struct dac_stream *s, size_t len)
+{
+	gint64 now = g_get_monotonic_time();
+
+	g_mutex_lock(&s->lock);
+	s->stats.bytes += len;
+	s->window_bytes += len;
+	if (now - s->window_start >= G_USEC_PER_SEC) {
+		s->stats.throughput = s->window_bytes * (double)G_USEC_PER_SEC /
+			(now - s->window_start);
+		s->window_bytes = 0;
+		s->window_start = now;
+	}
+	g_mutex_unlock(&s->lock);
+}
+
+static gpointer pusher_thread(gpointer data)
+{
+	struct dac_stream *s = data;
+	struct stream_block *b;
+	bool started = false, last;
+	ssize_t ret;
+
+	for (;;) {
+		b = g_async_queue_try_pop(s->full_blocks);
+		if (!b) {
+			/* The DAC is waiting on the file */
+			if (started) {
+				g_mutex_lock(&s->lock);
+				s->stats.underflows++;
+				g_mutex_unlock(&s->lock);
+			}
+			b = block_pop(s, s->full_blocks);
+			if (!b)
+				break;
+		}
+
+		last = b->last;
+		if (b->len) {
+			memcpy(iio_buffer_start(s->buf), b->data, b->len);
+			if (b->len == s->block_size)
+				ret = iio_buffer_push(s->buf);
+			else
+				ret = iio_buffer_push_partial(s->buf,
+						b->len / s->sample_size);
+			if (ret < 0) {
+				fprintf(stderr, "DAC stream push failed: %s\n",
+						strerror((int)-ret));
+				stream_fail(s, (int)ret);
+				last = true;
+			} else {
+				stats_update(s, b->len);
+				started = true;
+			}
+		}
+
+		g_async_queue_push(s->free_blocks, b);
+		if (last || g_atomic_int_get(&s->stop))
+			break;
+	}
+
+	/* Have the reader return too, if it is still going */
+	g_atomic_int_set(&s->stop, 1);
+
+	g_mutex_lock(&s->lock);
+	s->stats.running = false;
+	g_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+struct dac_stream * dac_stream_new(struct iio_device *dev,
+		const char *file_name, bool loop, int *err)
+{
+	struct dac_stream *s;
+	struct stat st;
+	ssize_t sample_size;
+	unsigned int i;
+
+	sample_size = iio_device_get_sample_size(dev);
+	if (sample_size <= 0) {
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	if (stat(file_name, &st)) {
+		*err = -errno;
+		return NULL;
+	}
+	if (!st.st_size || st.st_size % sample_size) {
+		fprintf(stderr, "ERROR: %s does not hold whole samples of %zd bytes\n",
+				file_name, sample_size);
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	s = g_new0(struct dac_stream, 1);
+	s->dev = dev;
+	s->loop = loop;
+	s->sample_size = sample_size;
+	s->block_size = DAC_STREAM_BLOCK_SIZE - DAC_STREAM_BLOCK_SIZE % sample_size;
+
+	s->file = fopen(file_name, "rb");
+	if (!s->file) {
+		*err = -errno;
+		g_free(s);
+		return NULL;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fileno(s->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	iio_device_set_kernel_buffers_count(dev, DAC_STREAM_KERNEL_BUFFERS);
+	s->buf = iio_device_create_buffer(dev, s->block_size / sample_size, false);
+	if (!s->buf) {
+		*err = -errno;
+		fprintf(stderr, "Unable to create buffer: %s\n", strerror(errno));
+		fclose(s->file);
+		g_free(s);
+		return NULL;
+	}
+
+	s->free_blocks = g_async_queue_new();
+	s->full_blocks = g_async_queue_new();
+	for (i = 0; i < DAC_STREAM_READ_AHEAD; i++) {
+		s->blocks[i].data = g_malloc(s->block_size);
+		g_async_queue_push(s->free_blocks, &s->blocks[i]);
+	}
+
+	g_mutex_init(&s->lock);
+	s->stats.running = true;
+	s->start = s->window_start = g_get_monotonic_time();
+
+	s->reader = g_thread_new("dac_stream_read", reader_thread, s);
+	s->pusher = g_thread_new("dac_stream_push", pusher_thread, s);
+
+	*err = 0;
+	return s;
+}
+
+void dac_stream_free(struct dac_stream *s)
+{
+	struct dac_stream_stats stats;
+	unsigned int i;
+
+	if (!s)
+		return;
+
+	g_atomic_int_set(&s->stop, 1);
+	g_thread_join(s->pusher);
+	g_thread_join(s->reader);
+
+	dac_stream_get_stats(s, &stats);
+	printf("DAC stream: %" G_GUINT64_FORMAT " bytes in %.1f s, %u loops, %u underflows\n",
+			stats.bytes, stats.elapsed, stats.loops, stats.underflows);
+
+	iio_buffer_destroy(s->buf);
+	fclose(s->file);
+
+	g_async_queue_unref(s->free_blocks);
+	g_async_queue_unref(s->full_blocks);
+	for (i = 0; i < DAC_STREAM_READ_AHEAD; i++)
+		g_free(s->blocks[i].data);
+	g_mutex_clear(&s->lock);
+	g_free(s);
+}
+
+void dac_stream_get_stats(struct dac_stream *s, struct dac_stream_stats *stats)
+{
+	g_mutex_lock(&s->lock);
+	*stats = s->stats;
+	g_mutex_unlock(&s->lock);
+
+	stats->elapsed = (g_get_monotonic_time() - s->start) / (double)G_USEC_PER_SEC;
+}
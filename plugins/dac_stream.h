@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __DAC_STREAM_H__
+#define __DAC_STREAM_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <iio.h>
+
+/* Blocks the kernel queues for the DAC, the ring the file is played through */
+#define DAC_STREAM_KERNEL_BUFFERS	4
+/* Bytes per block */
+#define DAC_STREAM_BLOCK_SIZE		(1 << 20)
+/* Blocks read from the file ahead of the DAC */
+#define DAC_STREAM_READ_AHEAD		8
+
+struct dac_stream_stats {
+	guint64 bytes;			/* pushed to the DAC */
+	unsigned int loops;		/* times the end of the file was reached */
+	unsigned int underflows;	/* pushes that had to wait for the file */
+	double elapsed;			/* s */
+	double throughput;		/* bytes/s, over the last second */
+	bool running;
+	int error;			/* -errno, 0 when fine */
+};
+
+/*
+ * Plays a raw file (interleaved samples of the enabled channels, as a
+ * .bin file) through a non-cyclic buffer of dev. One thread reads the file
+ * DAC_STREAM_READ_AHEAD blocks ahead, another pushes the blocks to the DAC,
+ * so files don't have to fit in memory nor in a single DMA buffer.
+ */
+struct dac_stream;
+
+struct dac_stream * dac_stream_new(struct iio_device *dev,
+		const char *file_name, bool loop, int *err);
+void dac_stream_free(struct dac_stream *s);
+void dac_stream_get_stats(struct dac_stream *s, struct dac_stream_stats *stats);
+
+#endif /* __DAC_STREAM_H__ */
@@ -0,0 +1,301 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dds_config.h"
+
+/* Of the commit in progress, printed when it wrote something */
+struct dds_config_stats {
+	unsigned int requested;		/* attributes set in the transaction */
+	unsigned int changed;		/* of those, the ones written */
+	unsigned int writes;		/* calls to the device it took */
+	double latency;			/* ms */
+};
+
+struct pending_channel {
+	struct iio_channel *chn;
+	GHashTable *attrs;		/* attribute -> value */
+};
+
+struct dds_config {
+	unsigned int depth;		/* of nested transactions */
+	GPtrArray *pending;		/* channels, in the order they were set */
+	GHashTable *written;		/* channel -> (attribute -> value) */
+	struct dds_config_stats stats;
+};
+
+static void pending_channel_free(gpointer data)
+{
+	struct pending_channel *p = data;
+
+	g_hash_table_unref(p->attrs);
+	g_free(p);
+}
+
+static GHashTable * attr_table_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+struct dds_config * dds_config_new(void)
+{
+	struct dds_config *cfg = g_new0(struct dds_config, 1);
+
+	cfg->pending = g_ptr_array_new_with_free_func(pending_channel_free);
+	cfg->written = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)g_hash_table_unref);
+
+	return cfg;
+}
+
+void dds_config_free(struct dds_config *cfg)
+{
+	if (!cfg)
+		return;
+
+	g_ptr_array_unref(cfg->pending);
+	g_hash_table_unref(cfg->written);
+	g_free(cfg);
+}
+
+void dds_config_invalidate(struct dds_config *cfg)
+{
+	g_hash_table_remove_all(cfg->written);
+}
+
+void dds_config_begin(struct dds_config *cfg)
+{
+	cfg->depth++;
+}
+
+int dds_config_set(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, const char *value)
+{
+	struct pending_channel *p = NULL;
+	unsigned int i;
+
+	if (!chn)
+		return -ENODEV;
+
+	for (i = 0; i < cfg->pending->len; i++) {
+		p = g_ptr_array_index(cfg->pending, i);
+		if (p->chn == chn)
+			break;
+		p = NULL;
+	}
+
+	if (!p) {
+		p = g_new0(struct pending_channel, 1);
+		p->chn = chn;
+		p->attrs = attr_table_new();
+		g_ptr_array_add(cfg->pending, p);
+	}
+
+	/* The last value set wins */
+	g_hash_table_replace(p->attrs, g_strdup(attr), g_strdup(value));
+
+	if (cfg->depth)
+		return 0;
+
+	cfg->depth++;
+	return dds_config_commit(cfg);
+}
+
+int dds_config_set_double(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, double value)
+{
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	/* The way libiio prints doubles, so equal values compare equal */
+	g_ascii_formatd(buf, sizeof(buf), "%f", value);
+
+	return dds_config_set(cfg, chn, attr, buf);
+}
+
+int dds_config_set_longlong(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, long long value)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%lld", value);
+
+	return dds_config_set(cfg, chn, attr, buf);
+}
+
+int dds_config_set_bool(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, bool value)
+{
+	return dds_config_set(cfg, chn, attr, value ? "1" : "0");
+}
+
+static bool is_enable(const char *attr)
+{
+	return !strcmp(attr, "raw");
+}
+
+static ssize_t write_all_cb(struct iio_channel *chn, const char *attr,
+		void *buf, size_t len, void *d)
+{
+	struct pending_channel *p = d;
+	const char *value;
+	size_t vlen;
+
+	/* Attributes left out are not written */
+	value = g_hash_table_lookup(p->attrs, attr);
+	if (!value || is_enable(attr))
+		return 0;
+
+	vlen = strlen(value) + 1;
+	if (vlen > len)
+		return -ENOMEM;
+
+	memcpy(buf, value, vlen);
+
+	return vlen;
+}
+
+static void written_update(struct dds_config *cfg, struct pending_channel *p,
+		bool enables, int ret)
+{
+	GHashTable *written = g_hash_table_lookup(cfg->written, p->chn);
+	GHashTableIter iter;
+	gpointer attr, value;
+
+	if (ret < 0) {
+		/* Unknown state, have everything written next time */
+		g_hash_table_remove(cfg->written, p->chn);
+		return;
+	}
+
+	if (!written) {
+		written = attr_table_new();
+		g_hash_table_insert(cfg->written, p->chn, written);
+	}
+
+	g_hash_table_iter_init(&iter, p->attrs);
+	while (g_hash_table_iter_next(&iter, &attr, &value)) {
+		if (is_enable(attr) != enables)
+			continue;
+		g_hash_table_replace(written, g_strdup(attr), g_strdup(value));
+	}
+}
+
+static int write_tones(struct dds_config *cfg, struct pending_channel *p)
+{
+	GHashTableIter iter;
+	gpointer attr, value, one_attr = NULL, one_value = NULL;
+	unsigned int count = 0;
+	int ret;
+
+	g_hash_table_iter_init(&iter, p->attrs);
+	while (g_hash_table_iter_next(&iter, &attr, &value)) {
+		if (is_enable(attr))
+			continue;
+		one_attr = attr;
+		one_value = value;
+		count++;
+	}
+
+	if (!count)
+		return 0;
+
+	if (count == 1)
+		ret = (int)iio_channel_attr_write(p->chn, one_attr, one_value);
+	else
+		ret = iio_channel_attr_write_all(p->chn, write_all_cb, p);
+	cfg->stats.writes++;
+	if (ret < 0)
+		fprintf(stderr, "ERROR: Unable to configure DDS channel %s: %s\n",
+				iio_channel_get_id(p->chn), strerror(-ret));
+
+	written_update(cfg, p, false, ret);
+
+	return ret < 0 ? ret : 0;
+}
+
+static int write_enable(struct dds_config *cfg, struct pending_channel *p,
+		bool on)
+{
+	const char *value = g_hash_table_lookup(p->attrs, "raw");
+	int ret;
+
+	if (!value || (strtol(value, NULL, 10) != 0) != on)
+		return 0;
+
+	ret = (int)iio_channel_attr_write(p->chn, "raw", value);
+	cfg->stats.writes++;
+	if (ret < 0)
+		fprintf(stderr, "ERROR: Unable to toggle DDS channel %s: %s\n",
+				iio_channel_get_id(p->chn), strerror(-ret));
+
+	written_update(cfg, p, true, ret);
+
+	return ret < 0 ? ret : 0;
+}
+
+int dds_config_commit(struct dds_config *cfg)
+{
+	struct pending_channel *p;
+	GHashTable *written;
+	GHashTableIter iter;
+	gpointer attr, value;
+	gint64 start;
+	unsigned int i;
+	int ret, err = 0;
+
+	if (cfg->depth && --cfg->depth)
+		return 0;
+
+	start = g_get_monotonic_time();
+	memset(&cfg->stats, 0, sizeof(cfg->stats));
+
+	/* Drop what the channels already hold */
+	for (i = 0; i < cfg->pending->len; i++) {
+		p = g_ptr_array_index(cfg->pending, i);
+		written = g_hash_table_lookup(cfg->written, p->chn);
+
+		g_hash_table_iter_init(&iter, p->attrs);
+		while (g_hash_table_iter_next(&iter, &attr, &value)) {
+			const char *old = written ? g_hash_table_lookup(written, attr) : NULL;
+
+			/* Buffers take the DAC from the DDS behind our back */
+			cfg->stats.requested++;
+			if (old && !strcmp(old, value) && !is_enable(attr))
+				g_hash_table_iter_remove(&iter);
+			else
+				cfg->stats.changed++;
+		}
+	}
+
+	/* Outputs going off do so before the tones change, the others after */
+	for (i = 0; i < cfg->pending->len; i++) {
+		ret = write_enable(cfg, g_ptr_array_index(cfg->pending, i), false);
+		err = err ?: ret;
+	}
+	for (i = 0; i < cfg->pending->len; i++) {
+		ret = write_tones(cfg, g_ptr_array_index(cfg->pending, i));
+		err = err ?: ret;
+	}
+	for (i = 0; i < cfg->pending->len; i++) {
+		ret = write_enable(cfg, g_ptr_array_index(cfg->pending, i), true);
+		err = err ?: ret;
+	}
+
+	g_ptr_array_set_size(cfg->pending, 0);
+
+	cfg->stats.latency = (g_get_monotonic_time() - start) / 1000.0;
+	if (cfg->stats.writes && cfg->stats.changed > 1)
+		printf("DDS: %u of %u attributes changed, %u writes in %.2f ms\n",
+				cfg->stats.changed, cfg->stats.requested,
+				cfg->stats.writes, cfg->stats.latency);
+
+	return err;
+}
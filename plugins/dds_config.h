@@ -0,0 +1,43 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __DDS_CONFIG_H__
+#define __DDS_CONFIG_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <iio.h>
+
+/*
+ * Writes the attributes of DDS channels (frequency, scale, phase, raw) as
+ * transactions. What is set between dds_config_begin() and
+ * dds_config_commit() is compared with what was last written, and only the
+ * attributes that changed go out, all of a channel in a single write.
+ * A raw (enable) attribute is always written: turned off, before the tones,
+ * turned on, after them, so the output never shows a half applied setup.
+ * Transactions nest, a set outside of one is committed right away.
+ * Only used from the GUI thread.
+ */
+struct dds_config;
+
+struct dds_config * dds_config_new(void);
+void dds_config_free(struct dds_config *cfg);
+/* Forget what was written, e.g. after the device was set up elsewhere */
+void dds_config_invalidate(struct dds_config *cfg);
+
+void dds_config_begin(struct dds_config *cfg);
+int dds_config_set(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, const char *value);
+int dds_config_set_double(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, double value);
+int dds_config_set_longlong(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, long long value);
+int dds_config_set_bool(struct dds_config *cfg, struct iio_channel *chn,
+		const char *attr, bool value);
+int dds_config_commit(struct dds_config *cfg);
+
+#endif /* __DDS_CONFIG_H__ */
@@ -0,0 +1,228 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#include "fastlock_cache.h"
+
+/* A slot and at least two values */
+#define PROFILE_MIN_VALUES	3
+#define PROFILE_MAX_VALUES	32
+
+struct fastlock_cache {
+	gchar *identity;		/* first line of the file */
+	gchar *path;
+	GHashTable *profiles;		/* "frequency" -> profile */
+	bool dirty;
+};
+
+/* The values of a profile, "slot v0,v1,..." */
+static int profile_parse(const char *profile, unsigned long *vals)
+{
+	const char *p = profile;
+	char *end;
+	int n = 0;
+
+	while (*p) {
+		if (n == PROFILE_MAX_VALUES)
+			return -EINVAL;
+
+		vals[n] = strtoul(p, &end, 10);
+		if (end == p || vals[n] > 255)
+			return -EINVAL;
+		n++;
+
+		p = end;
+		while (*p == ' ' || *p == ',')
+			p++;
+	}
+
+	return n >= PROFILE_MIN_VALUES ? n : -EINVAL;
+}
+
+bool fastlock_profile_valid(const char *profile)
+{
+	unsigned long vals[PROFILE_MAX_VALUES];
+
+	return profile_parse(profile, vals) > 0;
+}
+
+bool fastlock_profile_matches(const char *a, const char *b)
+{
+	unsigned long va[PROFILE_MAX_VALUES], vb[PROFILE_MAX_VALUES];
+	int i, na, nb;
+
+	na = profile_parse(a, va);
+	nb = profile_parse(b, vb);
+	if (na < 0 || na != nb)
+		return false;
+
+	for (i = 1; i < na - 1; i++)
+		if (va[i] != vb[i])
+			return false;
+
+	return true;
+}
+
+static gchar * device_identity(struct iio_device *dev, struct iio_channel *lo)
+{
+	const struct iio_context *ctx = iio_device_get_context(dev);
+	const char *board;
+	long long xo = 0;
+
+	/* The same board, wherever it is reached from, when it tells */
+	board = iio_context_get_attr_value(ctx, "hw_serial");
+	if (!board)
+		board = iio_context_get_attr_value(ctx, "uri");
+	if (!board)
+		board = iio_context_get_name(ctx);
+
+	iio_device_attr_read_longlong(dev, "xo_correction", &xo);
+
+	return g_strdup_printf("%s %s xo=%lld %s", board,
+			iio_device_get_name(dev) ?: iio_device_get_id(dev),
+			xo, iio_channel_get_id(lo));
+}
+
+static void cache_load(struct fastlock_cache *cache)
+{
+	gchar *contents, **lines;
+	const char *profile;
+	long long frequency;
+	char *end;
+	unsigned i;
+
+	if (!g_file_get_contents(cache->path, &contents, NULL, NULL))
+		return;
+
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+
+	/* Another device with the same hash is a miss */
+	if (!lines[0] || strcmp(lines[0], cache->identity)) {
+		g_strfreev(lines);
+		return;
+	}
+
+	for (i = 1; lines[i]; i++) {
+		frequency = strtoll(lines[i], &end, 10);
+		if (end == lines[i] || *end != ' ')
+			continue;
+		profile = end + 1;
+		if (!fastlock_profile_valid(profile))
+			continue;
+
+		g_hash_table_replace(cache->profiles,
+				g_strdup_printf("%lld", frequency), g_strdup(profile));
+	}
+
+	g_strfreev(lines);
+}
+
+struct fastlock_cache * fastlock_cache_open(struct iio_device *dev,
+		struct iio_channel *lo)
+{
+	struct fastlock_cache *cache;
+	gchar *dir, *digest, *name;
+
+	cache = g_new0(struct fastlock_cache, 1);
+	cache->identity = device_identity(dev, lo);
+	cache->profiles = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+
+	dir = g_build_filename(g_get_user_cache_dir(), "osc", "fastlock", NULL);
+	if (g_mkdir_with_parents(dir, 0755))
+		fprintf(stderr, "Unable to create %s: %s\n", dir, strerror(errno));
+
+	digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+			cache->identity, -1);
+	name = g_strconcat(digest, ".txt", NULL);
+	cache->path = g_build_filename(dir, name, NULL);
+	g_free(name);
+	g_free(digest);
+	g_free(dir);
+
+	cache_load(cache);
+
+	return cache;
+}
+
+void fastlock_cache_close(struct fastlock_cache *cache)
+{
+	if (!cache)
+		return;
+
+	g_hash_table_unref(cache->profiles);
+	g_free(cache->identity);
+	g_free(cache->path);
+	g_free(cache);
+}
+
+const char * fastlock_cache_lookup(struct fastlock_cache *cache,
+		long long frequency)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "%lld", frequency);
+
+	return g_hash_table_lookup(cache->profiles, key);
+}
+
+void fastlock_cache_insert(struct fastlock_cache *cache,
+		long long frequency, const char *profile)
+{
+	if (!fastlock_profile_valid(profile))
+		return;
+
+	g_hash_table_replace(cache->profiles,
+			g_strdup_printf("%lld", frequency), g_strdup(profile));
+	cache->dirty = true;
+}
+
+void fastlock_cache_clear(struct fastlock_cache *cache)
+{
+	g_hash_table_remove_all(cache->profiles);
+	cache->dirty = true;
+}
+
+int fastlock_cache_save(struct fastlock_cache *cache)
+{
+	GString *out;
+	GHashTableIter iter;
+	gpointer frequency, profile;
+	GError *err = NULL;
+	int ret = 0;
+
+	if (!cache->dirty)
+		return 0;
+
+	out = g_string_new(cache->identity);
+	g_string_append_c(out, '\n');
+
+	g_hash_table_iter_init(&iter, cache->profiles);
+	while (g_hash_table_iter_next(&iter, &frequency, &profile))
+		g_string_append_printf(out, "%s %s\n",
+				(char *)frequency, (char *)profile);
+
+	/* Written aside and renamed, a sweep never reads half a file */
+	if (!g_file_set_contents(cache->path, out->str, out->len, &err)) {
+		fprintf(stderr, "Unable to write %s: %s\n", cache->path,
+				err->message);
+		g_error_free(err);
+		ret = -EIO;
+	} else {
+		cache->dirty = false;
+	}
+
+	g_string_free(out, TRUE);
+
+	return ret;
+}
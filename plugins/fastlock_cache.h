@@ -0,0 +1,42 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __FASTLOCK_CACHE_H__
+#define __FASTLOCK_CACHE_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <iio.h>
+
+/*
+ * Fastlock profiles, as the fastlock_save attribute of an LO channel reads
+ * them, of the frequencies already tuned to. A profile only depends on the
+ * device, its reference clock and the frequency, so they are kept on disk
+ * across runs, in a file per device and LO. Entries that don't parse are
+ * dropped when the file is read.
+ * Only used from the GUI thread.
+ */
+struct fastlock_cache;
+
+struct fastlock_cache * fastlock_cache_open(struct iio_device *dev,
+		struct iio_channel *lo);
+void fastlock_cache_close(struct fastlock_cache *cache);
+
+const char * fastlock_cache_lookup(struct fastlock_cache *cache,
+		long long frequency);
+void fastlock_cache_insert(struct fastlock_cache *cache,
+		long long frequency, const char *profile);
+/* Drops all profiles, e.g. once one no longer matches the device */
+void fastlock_cache_clear(struct fastlock_cache *cache);
+/* Writes the profiles inserted since the last save */
+int fastlock_cache_save(struct fastlock_cache *cache);
+
+bool fastlock_profile_valid(const char *profile);
+/* Same tuning words, whatever the slot and the VCO ALC (the last value) */
+bool fastlock_profile_matches(const char *a, const char *b);
+
+#endif /* __FASTLOCK_CACHE_H__ */
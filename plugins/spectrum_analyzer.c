@@ -13,6 +13,8 @@
 #include <gtkdatabox_points.h>
 #include <gtkdatabox_lines.h>
 #include <math.h>
+#include <float.h>
+#include <limits.h>
 #include <stdint.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -24,6 +26,7 @@
 #include <time.h>
 
 #include <ad9361.h>
+#include <fftw3.h>
 
 #include "../datatypes.h"
 #include "../osc.h"
@@ -31,17 +34,33 @@
 #include "../libini2.h"
 #include "../osc_plugin.h"
 #include "../config.h"
+#include "../buffer_demux.h"
+#include "../export.h"
 #include "dac_data_manager.h"
+#include "fastlock_cache.h"
+#include "sweep_profiler.h"
 
 #define THIS_DRIVER "Spectrum Analyzer"
 #define PHY_DEVICE "ad9361-phy"
 #define CAP_DEVICE "cf-ad9361-lpc"
 #define FIR_FILTER "61_44_28MHz.ftr"
+#define FIR_FILTER_RATE 61440000 /* the rate FIR_FILTER is designed for */
 #define ARRAY_SIZE(x) (!sizeof(x) ?: sizeof(x) / sizeof((x)[0]))
 #define MHZ_TO_HZ(x) ((x) * 1000000)
 #define MHZ_TO_KHZ(x) ((x) * 1000)
 #define HZ_TO_MHZ(x) ((x) / 1E6)
 
+/* Sweep steps captured ahead of the FFT */
+#define SWEEP_PIPELINE_DEPTH 4
+/* How often threads waiting on the pipeline look for a stop request, us */
+#define SWEEP_STOP_POLL_US (100 * 1000)
+
+/* Coarse bins around a peak that the zoom pass captures again */
+#define ZOOM_BAND_BINS 16
+#define ZOOM_MAX_BANDS 64
+/* Peaks listed in the adaptive sweep summary */
+#define ZOOM_SUMMARY_PEAKS 5
+
 enum receivers {
 	RX1,
 	RX2
@@ -52,6 +71,13 @@ typedef struct _plugin_setup {
 	double stop_freq;
 	double resolution_bw;
 	unsigned int fft_size;
+	long long sample_rate;
+	double usable_bw;	/* fraction of the sample rate with a flat response */
+	double overlap;		/* fraction of the usable band shared by two steps */
+	double step;		/* MHz, the part of each capture that is shown */
+	bool zoom;		/* adaptive sweep instead of a continuous one */
+	double zoom_threshold;	/* dBFS, of the coarse peaks to zoom in on */
+	unsigned int zoom_fft_size;
 	enum receivers rx;
 	GSList *rx_profiles;
 	unsigned int profile_count;
@@ -64,10 +90,44 @@ typedef struct _fastlock_profile {
 	char data[66];
 } fastlock_profile;
 
-/* Plugin Global Variables */
-static const double sweep_freq_step = 56; /* 56 MHz */
-static const long long sampling_rate = 61440000; /* 61.44 MSPS */
+/* The samples of one sweep step, on their way to the FFT */
+typedef struct _sweep_step {
+	gfloat *data[2];	/* I and Q of the receiver */
+	unsigned index;		/* of the profile */
+	unsigned n;		/* steps since the sweep started */
+	bool valid;
+} sweep_step;
+
+/* A band around a coarse peak, captured again at the zoom resolution */
+typedef struct _zoom_band {
+	double start, stop;	/* MHz */
+	unsigned profile;	/* index of the step the band is in */
+	GArray *x, *y;		/* the fine bins, MHz and dBFS */
+	double peak;		/* MHz */
+	gfloat level;		/* dBFS */
+} zoom_band;
+
+/* Outcome of an adaptive sweep: the coarse trace, with the zoomed bands
+ * spliced in at their own resolution */
+typedef struct _zoom_result {
+	GArray *x, *y;		/* MHz and dBFS */
+	GArray *bands;		/* zoom_band, in frequency order */
+	unsigned dropped;	/* peaks past ZOOM_MAX_BANDS */
+	unsigned steps, captures;
+	gint64 coarse_time, zoom_time;	/* us */
+	bool complete;
+} zoom_result;
+
+/* Power spectrum of I/Q captures, DC in the middle */
+typedef struct _zoom_fft {
+	unsigned size;
+	double *win;
+	fftw_complex *in, *out;
+	fftw_plan plan;
+	double corr;		/* dB, from FFT output to full scale */
+} zoom_fft;
 
+/* Plugin Global Variables */
 static struct iio_context *ctx;
 static struct iio_device *dev, *cap;
 static struct iio_channel *alt_ch0;
@@ -82,29 +142,49 @@ static plugin_setup psetup;
 static GThread *freq_sweep_thread;
 static GThread *capture_thread;
 static GThread *fft_thread;
-
-/* Threads Synchronization */
-static GCond profile_applied_cond,
-		capture_done_cond,
-		demux_done_cond,
-		fft_done_cond;
-static GMutex profile_applied_mutex,
-		capture_done_mutex,
-		demux_done_mutex,
-		fft_done_mutex;
-static bool profile_applied,
-		capture_done,
-		demux_done,
-		fft_done;
-static bool kill_sweep_thread,
-		kill_capture_thread,
-		kill_fft_thread;
+static GThread *zoom_thread;
+
+/* Threads Synchronization
+ * The capture thread retunes to step n + 1 as soon as the samples of step n
+ * are in, while the sweep thread loads the profile of step n + 2 in the
+ * fastlock slot step n used. Captured steps go to the FFT thread, or to the
+ * zoom thread for the coarse pass of an adaptive sweep, through a queue
+ * SWEEP_PIPELINE_DEPTH deep. */
+static sweep_step sweep_steps[SWEEP_PIPELINE_DEPTH];
+static GAsyncQueue *free_steps, *captured_steps;
+static GMutex tune_mutex;
+static GCond tune_cond;
+static unsigned recalled_step, loaded_step;
+static unsigned step_limit;	/* steps to capture, UINT_MAX for no end */
+static bool profiler_keep;	/* adaptive sweeps run back to back */
+static gint stop_sweep;
+static struct sweep_profiler *profiler;
+static zoom_fft coarse_fft, fine_fft;
+static zoom_result zoom;
 
 /* Control Widgets */
 static GtkWidget *center_freq;
 static GtkWidget *freq_bw;
 static GtkWidget *available_RBWs;
+static GtkWidget *sample_rate_spin;
+static GtkWidget *usable_bw_spin;
+static GtkWidget *overlap_spin;
+static GtkWidget *sweep_plan_label;
+static GtkWidget *zoom_check;
+static GtkWidget *zoom_threshold_spin;
+static GtkWidget *zoom_rbws;
+static GtkWidget *zoom_results;
+static GtkWidget *zoom_summary;
+static GtkWidget *zoom_databox;
+
+static GdkRGBA zoom_trace_color = {
+	.red = 1.0,
+	.green = 0.6,
+	.blue = 0,
+	.alpha = 1.0
+};
 static GtkWidget *receiver1;
+static GtkWidget *receiver2;
 static GtkWidget *start_button;
 static GtkWidget *stop_button;
 
@@ -114,56 +194,6 @@ static GtkNotebook *nbook;
 static GtkWidget *analyzer_panel;
 static gboolean plugin_detached;
 
-#if DEBUG
-GTimer *gtimer;
-double loop_durations_sum;
-unsigned long long loop_count;
-#endif
-
-static ssize_t demux_sample(const struct iio_channel *chn,
-		void *sample, size_t size, void *d)
-{
-	struct extra_info *info = iio_channel_get_data(chn);
-	struct extra_dev_info *dev_info = iio_device_get_data(info->dev);
-	const struct iio_data_format *format = iio_channel_get_data_format(chn);
-
-	/* Prevent buffer overflow */
-	if ((unsigned long) info->offset == (unsigned long) dev_info->sample_count)
-		return 0;
-
-	if (size == 1) {
-		int8_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint8_t)val;
-	} else if (size == 2) {
-		int16_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint16_t)val;
-	} else if (size == 4) {
-		int32_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint32_t)val;
-	} else {
-		int64_t val;
-		iio_channel_convert(chn, &val, sample);
-		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
-		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint64_t)val;
-	}
-
-	return size;
-}
-
 static void device_set_rx_sampling_freq(struct iio_device *dev, long long freq_hz)
 {
 	struct iio_channel *ch0;
@@ -259,9 +289,31 @@ static void init_device_list(struct iio_context *ctx)
 	}
 }
 
+/* Each step shows a whole number of FFT bins, so that steps stitch without
+ * gaps: the usable part of the band, less what it shares with the next step.
+ * What is left of a capture on each side is filter roll-off or overlap. */
+static double sweep_step_compute(long long rate, unsigned fft_size,
+		double usable_bw, double overlap)
+{
+	unsigned bins = fft_size * usable_bw * (1 - overlap);
+
+	/* Even, for the step to be centered on the LO */
+	bins &= ~1u;
+	if (bins < 2)
+		bins = 2;
+
+	return bins * HZ_TO_MHZ((double)rate) / fft_size;
+}
+
+static long long sample_rate_get(void)
+{
+	return (long long)(MHZ_TO_HZ(gtk_spin_button_get_value(
+				GTK_SPIN_BUTTON(sample_rate_spin))) + 0.5);
+}
+
 static bool plugin_gather_user_setup(plugin_setup *setup)
 {
-	double center, bw, start_freq, stop_freq;
+	double center, bw, start_freq, stop_freq, step;
 	int rbw_index;
 	bool data_is_new = false;
 
@@ -273,10 +325,25 @@ static bool plugin_gather_user_setup(plugin_setup *setup)
 	start_freq = center - bw / 2;
 	stop_freq = center + bw / 2;
 	setup->fft_size = 65536 >> rbw_index;
-
-	if ((setup->start_freq != start_freq) || (setup->stop_freq != stop_freq)) {
+	setup->sample_rate = sample_rate_get();
+	setup->usable_bw = gtk_spin_button_get_value(
+			GTK_SPIN_BUTTON(usable_bw_spin)) / 100;
+	setup->overlap = gtk_spin_button_get_value(
+			GTK_SPIN_BUTTON(overlap_spin)) / 100;
+	setup->resolution_bw = (double)setup->sample_rate / setup->fft_size;
+	setup->zoom = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(zoom_check));
+	setup->zoom_threshold = gtk_spin_button_get_value(
+			GTK_SPIN_BUTTON(zoom_threshold_spin));
+	setup->zoom_fft_size = 65536 >> MAX(0, gtk_combo_box_get_active(
+				GTK_COMBO_BOX(zoom_rbws)));
+	step = sweep_step_compute(setup->sample_rate, setup->fft_size,
+			setup->usable_bw, setup->overlap);
+
+	if ((setup->start_freq != start_freq) || (setup->stop_freq != stop_freq) ||
+			(setup->step != step)) {
 		setup->start_freq = start_freq;
 		setup->stop_freq = stop_freq;
+		setup->step = step;
 		data_is_new = true;
 	}
 
@@ -293,6 +360,45 @@ static bool plugin_gather_user_setup(plugin_setup *setup)
 	return data_is_new;
 }
 
+/* Tune the LO to a frequency and read back the profile it got */
+static bool read_fastlock_profile(long long freq_hz, char *data, size_t len)
+{
+	iio_channel_attr_write_longlong(alt_ch0, "frequency", freq_hz);
+	iio_channel_attr_write_longlong(alt_ch0, rx_fastlock_store_name, 0);
+
+	return iio_channel_attr_read(alt_ch0, rx_fastlock_save_name,
+			data, len) > 0;
+}
+
+/* The first cached profile of the sweep is read from the device again. When
+ * they differ the whole cache is out of date and is emptied, before any
+ * profile of this sweep goes in. Returns false when it can't be trusted. */
+static bool fastlock_cache_check(struct fastlock_cache *cache,
+		double start, double stop, double step)
+{
+	char data[sizeof(((fastlock_profile *)NULL)->data)];
+	long long freq;
+	const char *cached;
+	double f;
+
+	for (f = start; (f - step / 2) < stop; f += step) {
+		freq = (long long)MHZ_TO_HZ(f);
+		cached = fastlock_cache_lookup(cache, freq);
+		if (!cached)
+			continue;
+
+		if (!read_fastlock_profile(freq, data, sizeof(data)))
+			return false;
+		if (!fastlock_profile_matches(cached, data)) {
+			printf("Fastlock profile cache is out of date\n");
+			fastlock_cache_clear(cache);
+		}
+		break;
+	}
+
+	return true;
+}
+
 static void build_profiles_for_entire_sweep(plugin_setup *setup)
 {
 	double start, stop, step, f;
@@ -300,7 +406,10 @@ static void build_profiles_for_entire_sweep(plugin_setup *setup)
 	static unsigned char prev_alc = 0;
 	unsigned char alc;
 	char *last_byte;
-	unsigned int i = 0;
+	struct fastlock_cache *cache;
+	const char *cached;
+	bool use_cache;
+	unsigned int i = 0, built = 0;
 
 	g_return_if_fail(setup);
 
@@ -308,22 +417,37 @@ static void build_profiles_for_entire_sweep(plugin_setup *setup)
 	g_slist_free_full(setup->rx_profiles, (GDestroyNotify)free);
 	setup->rx_profiles = NULL;
 
-	start = setup->start_freq + sweep_freq_step / 2;
+	/* Opened here, the reference clock may have changed since last time */
+	cache = fastlock_cache_open(dev, alt_ch0);
+
+	start = setup->start_freq + setup->step / 2;
 	stop = setup->stop_freq;
-	step = sweep_freq_step;
+	step = setup->step;
+
+	use_cache = fastlock_cache_check(cache, start, stop, step);
 
-	for (f = start; (f - sweep_freq_step / 2) < stop; f += step) {
-		iio_channel_attr_write_longlong(alt_ch0, "frequency",
-				(long long)MHZ_TO_HZ(f));
-		iio_channel_attr_write_longlong(alt_ch0,
-					rx_fastlock_store_name, 0);
+	for (f = start; (f - step / 2) < stop; f += step) {
 		profile = malloc(sizeof(fastlock_profile));
 		if (!profile)
-			return;
-		iio_channel_attr_read(alt_ch0, rx_fastlock_save_name,
-					profile->data, sizeof(profile->data));
+			break;
 		profile->frequency = (long long)MHZ_TO_HZ(f);
 		profile->index = i++;
+
+		cached = use_cache ?
+			fastlock_cache_lookup(cache, profile->frequency) : NULL;
+		if (cached) {
+			g_strlcpy(profile->data, cached, sizeof(profile->data));
+		} else if (!read_fastlock_profile(profile->frequency,
+					profile->data, sizeof(profile->data))) {
+			fprintf(stderr, "Could not read fastlock profile of "
+					"%lld Hz\n", profile->frequency);
+			free(profile);
+			break;
+		} else {
+			fastlock_cache_insert(cache, profile->frequency,
+					profile->data);
+			built++;
+		}
 		setup->rx_profiles = g_slist_prepend(setup->rx_profiles, profile);
 
 		/* Make sure two consecutive profiles do not have the same ALC.
@@ -339,6 +463,12 @@ static void build_profiles_for_entire_sweep(plugin_setup *setup)
 	}
 	setup->rx_profiles = g_slist_reverse(setup->rx_profiles);
 	setup->profile_count = g_slist_length(setup->rx_profiles);
+
+	printf("Fastlock profiles: %u built, %u from the cache\n", built,
+			setup->profile_count - built);
+	fastlock_cache_save(cache);
+	fastlock_cache_close(cache);
+
 	#if DEBUG
 	log_before_sweep_starts(setup);
 	#endif
@@ -361,7 +491,7 @@ static void configure_spectrum_window(plugin_setup *setup)
 	}
 	osc_plot_spect_set_len(OSC_PLOT(spectrum_window), setup->profile_count);
 	osc_plot_spect_set_start_f(OSC_PLOT(spectrum_window), setup->start_freq);
-	osc_plot_spect_set_filter_bw(OSC_PLOT(spectrum_window), sweep_freq_step);
+	osc_plot_spect_set_filter_bw(OSC_PLOT(spectrum_window), setup->step);
 	osc_plot_set_visible(OSC_PLOT(spectrum_window), true);
 }
 
@@ -386,11 +516,16 @@ static bool configure_data_capture(plugin_setup *setup)
 
 	g_return_val_if_fail(setup, false);
 
-	device_set_rx_sampling_freq(dev, sampling_rate);
+	/* Other rates than the one of FIR_FILTER get a filter from libad9361 */
+	if (setup->sample_rate == FIR_FILTER_RATE)
+		device_set_rx_sampling_freq(dev, setup->sample_rate);
+	else if (ad9361_set_bb_rate(dev, setup->sample_rate) < 0)
+		fprintf(stderr, "Failed to set up the baseband for %lld SPS "
+			"in %s\n", setup->sample_rate, __func__);
 	rate = device_get_rx_sampling_freq(cap);
-	if (rate != sampling_rate) {
+	if (rate != setup->sample_rate) {
 		fprintf(stderr, "Failed to set the rx sampling rate to %lld "
-			"(actual rate is %lld) in %s\n", sampling_rate, rate, __func__);
+			"(actual rate is %lld) in %s\n", setup->sample_rate, rate, __func__);
 	}
 
 	dev_info = iio_device_get_data(cap);
@@ -409,6 +544,8 @@ static bool configure_data_capture(plugin_setup *setup)
 		dev_info->adc_freq = 0.0;
 	}
 
+	/* The plot buffers are reallocated below */
+	export_snapshots_detach_all();
 	for (i = 0; i < iio_device_get_channels_count(cap); i++) {
 		chn = iio_device_get_channel(cap, i);
 		info = iio_channel_get_data(chn);
@@ -427,192 +564,638 @@ static bool configure_data_capture(plugin_setup *setup)
 	return true;
 }
 
-static gpointer capture_data_thread_func(plugin_setup *setup)
+static sweep_step * sweep_step_pop(GAsyncQueue *queue)
 {
-	while (!kill_capture_thread) {
+	sweep_step *step = NULL;
 
-		/* Clean iio buffer */
-		if (capture_buffer) {
-			iio_buffer_destroy(capture_buffer);
-			capture_buffer = NULL;
-		}
+	while (!step && !g_atomic_int_get(&stop_sweep))
+		step = g_async_queue_timeout_pop(queue, SWEEP_STOP_POLL_US);
 
-		/* Capture new data */
-		capture_buffer = iio_device_create_buffer(cap, setup->fft_size, false);
-		if (!capture_buffer) {
-			fprintf(stderr, "Could not create iio buffer in %s\n", __func__);
-			break;
-		}
+	return step;
+}
 
-		/* Reset the data offset for all channels */
-		unsigned int i;
-		for (i = 0; i < iio_device_get_channels_count(cap); i++) {
-			struct iio_channel *ch = iio_device_get_channel(cap, i);
-			struct extra_info *info = iio_channel_get_data(ch);
-			info->offset = 0;
-		}
+static void sweep_abort(void)
+{
+	g_mutex_lock(&tune_mutex);
+	g_atomic_int_set(&stop_sweep, 1);
+	g_cond_broadcast(&tune_cond);
+	g_mutex_unlock(&tune_mutex);
+}
 
-		/* Get captured data */
-		ssize_t ret = iio_buffer_refill(capture_buffer);
-		if (ret < 0) {
-			fprintf(stderr, "Error while refilling iio buffer: %s\n", strerror(-ret));
-			break;
-		}
+/* Recall the fastlock slot of step n, once the sweep thread has loaded it */
+static bool tune_to_step(plugin_setup *setup, unsigned n)
+{
+	unsigned slot = setup->profile_count == 1 ? 0 : n % 2;
+	gint64 start;
+	ssize_t ret;
+
+	start = g_get_monotonic_time();
+	g_mutex_lock(&tune_mutex);
+	while (loaded_step < n && !g_atomic_int_get(&stop_sweep))
+		g_cond_wait(&tune_cond, &tune_mutex);
+	g_mutex_unlock(&tune_mutex);
+	if (g_atomic_int_get(&stop_sweep))
+		return false;
+	sweep_profiler_add(profiler, n, SWEEP_STAGE_WAIT,
+			g_get_monotonic_time() - start);
+
+	start = g_get_monotonic_time();
+	ret = iio_channel_attr_write_longlong(alt_ch0, "fastlock_recall", slot);
+	sweep_profiler_add(profiler, n, SWEEP_STAGE_RETUNE,
+			g_get_monotonic_time() - start);
+	if (ret < 0)
+		fprintf(stderr, "Could not write to fastlock_recall"
+			"attribute in %s\n", __func__);
+
+	g_mutex_lock(&tune_mutex);
+	recalled_step = n;
+	g_cond_broadcast(&tune_cond);
+	g_mutex_unlock(&tune_mutex);
+
+	return true;
+}
+
+/* Samples taken after the last fastlock_recall. Locally the refill queues
+ * the only kernel block again, so it fills after the recall. iiod reads
+ * ahead as soon as a block is handed out, so over the network or USB the
+ * first block may predate the recall and is dropped. */
+static ssize_t capture_after_retune(void)
+{
+	ssize_t ret;
+
+	ret = iio_buffer_refill(capture_buffer);
+	if (ret >= 0 && strcmp(iio_context_get_name(ctx), "local"))
+		ret = iio_buffer_refill(capture_buffer);
+	if (ret < 0)
+		fprintf(stderr, "Error while refilling iio buffer: %s\n",
+			strerror(-ret));
+
+	return ret;
+}
+
+static gpointer capture_data_thread_func(plugin_setup *setup)
+{
+	unsigned n, i, ch = 2 * setup->rx;
+	sweep_step *step;
+	gint64 start;
+	ssize_t ret;
 
-		/* Signal the "Frequency Sweep" thread that data capture has completed */
-		g_mutex_lock(&capture_done_mutex);
-		capture_done = true;
-		g_cond_signal(&capture_done_cond);
-		g_mutex_unlock(&capture_done_mutex);
-
-		/* Block until the "Do FFT" thread has finished doing a FFT*/
-		g_mutex_lock(&fft_done_mutex);
-		while (!fft_done)
-			g_cond_wait(&fft_done_cond, &fft_done_mutex);
-		fft_done = false;
-		g_mutex_unlock(&fft_done_mutex);
-		if (kill_capture_thread)
+	for (n = 0; n < step_limit && (step = sweep_step_pop(free_steps)); n++) {
+
+		/* Get the samples of step n, recalled by the last iteration */
+		start = g_get_monotonic_time();
+		ret = capture_after_retune();
+		sweep_profiler_add(profiler, n, SWEEP_STAGE_CAPTURE,
+				g_get_monotonic_time() - start);
+		if (ret < 0)
 			break;
 
-		/* Demux captured data */
-		ret /= iio_buffer_step(capture_buffer);
-		if ((unsigned)ret >= setup->fft_size)
-			iio_buffer_foreach_sample(capture_buffer, demux_sample, NULL);
-
-		/* Signal the "Do FFT" thread that data demux has completed */
-		g_mutex_lock(&demux_done_mutex);
-		demux_done = true;
-		g_cond_signal(&demux_done_cond);
-		g_mutex_unlock(&demux_done_mutex);
-
-		/* Block until the "Data Capture" thread has recalled a new profile */
-		g_mutex_lock(&profile_applied_mutex);
-		while (!profile_applied)
-			g_cond_wait(&profile_applied_cond, &profile_applied_mutex);
-		profile_applied = false;
-		g_mutex_unlock(&profile_applied_mutex);
-		if (kill_capture_thread)
+		/* Move on to the next frequency while this one is demuxed */
+		if (n + 1 < step_limit && !tune_to_step(setup, n + 1))
 			break;
-	}
 
-	/* Wake-up the "Frequency Sweep" thread and kill it */
-	kill_sweep_thread = true;
-	g_mutex_lock(&capture_done_mutex);
-	capture_done = true;
-	g_cond_signal(&capture_done_cond);
-	g_mutex_unlock(&capture_done_mutex);
+		start = g_get_monotonic_time();
+		step->index = n % setup->profile_count;
+		step->n = n;
+		step->valid = (unsigned)(ret / iio_buffer_step(capture_buffer)) >= setup->fft_size;
+		if (step->valid) {
+			for (i = 0; i < 2; i++)
+				buffer_demux_float(capture_buffer,
+					iio_device_get_channel(cap, ch + i),
+					step->data[i], setup->fft_size);
+		}
+		sweep_profiler_add(profiler, n, SWEEP_STAGE_DEMUX,
+				g_get_monotonic_time() - start);
+
+		g_async_queue_push(captured_steps, step);
+	}
 
-	g_thread_join(freq_sweep_thread);
+	/* Have the other threads return too, unless all steps are in */
+	if (n < step_limit)
+		sweep_abort();
 
 	return NULL;
 }
 
 static gpointer profile_load_thread_func(plugin_setup *setup)
 {
-	GSList *node = g_slist_nth(setup->rx_profiles, 1);
+	GSList *node = g_slist_nth(setup->rx_profiles, 2 % setup->profile_count);
 	fastlock_profile *profile;
+	unsigned n;
+	gint64 start;
 	ssize_t ret;
 
-	while (!kill_sweep_thread) {
+	/* Steps 0 and 1 were loaded before the sweep started */
+	for (n = 2; n < step_limit; n++) {
 
-		/* Block until the "Capture" thread has finished a data capture */
-		g_mutex_lock(&capture_done_mutex);
-		while (!capture_done)
-			g_cond_wait(&capture_done_cond, &capture_done_mutex);
-		capture_done = false;
-		g_mutex_unlock(&capture_done_mutex);
-		if (kill_sweep_thread)
+		/* The slot of step n is free once step n - 1 is recalled */
+		g_mutex_lock(&tune_mutex);
+		while (recalled_step < n - 1 && !g_atomic_int_get(&stop_sweep))
+			g_cond_wait(&tune_cond, &tune_mutex);
+		g_mutex_unlock(&tune_mutex);
+		if (g_atomic_int_get(&stop_sweep))
 			break;
 
-		/* Recall profile at slot 0 or 1 (alternative) */
-		ret = iio_channel_attr_write_longlong(alt_ch0,
-			"fastlock_recall", setup->profile_slot);
-		setup->profile_slot = (setup->profile_slot + 1) % 2;
-		if (setup->profile_count == 1)
-			setup->profile_slot = 0;
-		if (ret < 0)
-		fprintf(stderr, "Could not write to fastlock_recall"
-			"attribute in %s\n", __func__);
+		/* With one or two profiles, they stay in their slots */
+		if (setup->profile_count > 2) {
+			profile = node->data;
+			profile->data[0] = '0' + n % 2;
+			start = g_get_monotonic_time();
+			ret = iio_channel_attr_write(alt_ch0, "fastlock_load",
+					profile->data);
+			sweep_profiler_add(profiler, n, SWEEP_STAGE_LOAD,
+					g_get_monotonic_time() - start);
+			if (ret < 0)
+				fprintf(stderr, "Could not write to fastlock_load"
+					"attribute in %s\n", __func__);
+		}
 
-		/* Signal the "Data Capture" thread that a new profile has been applied */
-		g_mutex_lock(&profile_applied_mutex);
-		profile_applied = true;
-		g_cond_signal(&profile_applied_cond);
-		g_mutex_unlock(&profile_applied_mutex);
+		g_mutex_lock(&tune_mutex);
+		loaded_step = n;
+		g_cond_broadcast(&tune_cond);
+		g_mutex_unlock(&tune_mutex);
 
 		/* Move to the next fastlock profile */
 		node = g_slist_next(node);
-		if (!node) {
+		if (!node)
 			node = setup->rx_profiles;
-			#if DEBUG
-			g_timer_stop(gtimer);
-			loop_durations_sum += g_timer_elapsed(gtimer, NULL);
-			loop_count++;
-			g_timer_start(gtimer);
-			#endif
-		}
-		profile = node->data;
-		profile->data[0] = '0' + setup->profile_slot;
-		ret = iio_channel_attr_write(alt_ch0, "fastlock_load",
-				profile->data);
-		if (ret < 0)
-			fprintf(stderr, "Could not write to fastlock_load"
-				"attribute in %s\n", __func__);
 	}
 
-	/* Wake-up and kill "Do FFT" thread */
-	kill_fft_thread = true;
-	g_mutex_lock(&demux_done_mutex);
-	demux_done = true;
-	g_cond_signal(&demux_done_cond);
-	g_mutex_unlock(&demux_done_mutex);
-
-	g_thread_join(fft_thread);
-
 	return NULL;
 }
 
 static gpointer do_fft_thread_func(plugin_setup *setup)
 {
-	while (!kill_fft_thread) {
-
-		/* Block until the "Data Capture" thread finishes to demux data */
-		g_mutex_lock(&demux_done_mutex);
-		while (!demux_done)
-			g_cond_wait(&demux_done_cond, &demux_done_mutex);
-		demux_done = false;
-		g_mutex_unlock(&demux_done_mutex);
-		if (kill_fft_thread)
-			break;
+	unsigned i, ch = 2 * setup->rx;
+	struct extra_info *info;
+	sweep_step *step;
+	gint64 start;
+
+	while ((step = sweep_step_pop(captured_steps))) {
+		start = g_get_monotonic_time();
+
+		if (step->valid) {
+			/* An auto export of the plot may still borrow them */
+			export_snapshots_detach_all();
+			for (i = 0; i < 2; i++) {
+				info = iio_channel_get_data(iio_device_get_channel(cap, ch + i));
+				memcpy(info->data_ref, step->data[i],
+					setup->fft_size * sizeof(gfloat));
+			}
+		}
+		sweep_profiler_add(profiler, step->n, SWEEP_STAGE_HANDOFF,
+				g_get_monotonic_time() - start);
 
 		/* Tell the oscplot object to process the captured data, perform FFT
 		 * and concatenate with the rest of the FFTs in order to build the spectrum */
+		start = g_get_monotonic_time();
 		if (spectrum_window)
 			osc_plot_data_update(OSC_PLOT(spectrum_window));
+		sweep_profiler_add(profiler, step->n, SWEEP_STAGE_FFT,
+				g_get_monotonic_time() - start);
 
-		/* Signal the "Data Capture" thread that the FFT has finished */
-		g_mutex_lock(&fft_done_mutex);
-		fft_done = true;
-		g_cond_signal(&fft_done_cond);
-		g_mutex_unlock(&fft_done_mutex);
+		sweep_profiler_step_done(profiler, step->n, setup->start_freq +
+				setup->step * (step->index + 0.5));
+
+		g_async_queue_push(free_steps, step);
 	}
 
 	return NULL;
 }
 
-static bool setup_before_sweep_start(plugin_setup *setup)
+static void sweep_pipeline_free(void)
 {
-	GSList *node;
-	fastlock_profile *profile;
+	unsigned i;
+
+	if (free_steps) {
+		g_async_queue_unref(free_steps);
+		free_steps = NULL;
+	}
+	if (captured_steps) {
+		g_async_queue_unref(captured_steps);
+		captured_steps = NULL;
+	}
+	for (i = 0; i < SWEEP_PIPELINE_DEPTH; i++) {
+		g_free(sweep_steps[i].data[0]);
+		g_free(sweep_steps[i].data[1]);
+		sweep_steps[i].data[0] = sweep_steps[i].data[1] = NULL;
+	}
+}
+
+static bool sweep_pipeline_create(plugin_setup *setup)
+{
+	unsigned i;
+
+	/* A single block, see capture_after_retune() */
+	iio_device_set_kernel_buffers_count(cap, 1);
+	capture_buffer = iio_device_create_buffer(cap, setup->fft_size, false);
+	if (!capture_buffer) {
+		fprintf(stderr, "Could not create iio buffer in %s\n", __func__);
+		return false;
+	}
+
+	free_steps = g_async_queue_new();
+	captured_steps = g_async_queue_new();
+	for (i = 0; i < SWEEP_PIPELINE_DEPTH; i++) {
+		sweep_steps[i].data[0] = g_new(gfloat, setup->fft_size);
+		sweep_steps[i].data[1] = g_new(gfloat, setup->fft_size);
+		g_async_queue_push(free_steps, &sweep_steps[i]);
+	}
+
+	return true;
+}
+
+static gboolean zoom_sweep_done(GThread *thread);
+
+static bool zoom_fft_init(zoom_fft *z, unsigned size, unsigned bits)
+{
+	unsigned i;
+
+	z->size = size;
+	z->win = g_new(double, size);
+	z->in = fftw_malloc(sizeof(fftw_complex) * size);
+	z->out = fftw_malloc(sizeof(fftw_complex) * size);
+	if (!z->in || !z->out)
+		return false;
+	z->plan = fftw_plan_dft_1d(size, z->in, z->out, FFTW_FORWARD, FFTW_ESTIMATE);
+
+	/* Hann, scaled as in oscplot: a full scale tone reads 0 dBFS */
+	for (i = 0; i < size; i++)
+		z->win[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (size - 1));
+	z->corr = 20 * log10(2.0 / (1ULL << (bits - 1)));
+
+	return true;
+}
+
+static void zoom_fft_free(zoom_fft *z)
+{
+	if (z->plan)
+		fftw_destroy_plan(z->plan);
+	fftw_free(z->in);
+	fftw_free(z->out);
+	g_free(z->win);
+	memset(z, 0, sizeof(*z));
+}
+
+static void zoom_fft_run(zoom_fft *z, const gfloat *i_data, const gfloat *q_data,
+		gfloat *db)
+{
+	unsigned k, half = z->size / 2;
+	double scale = 1.0 / ((double)z->size * z->size), pwr;
+	fftw_complex *bin;
+
+	for (k = 0; k < z->size; k++) {
+		z->in[k][0] = i_data[k] * z->win[k];
+		z->in[k][1] = q_data[k] * z->win[k];
+	}
+
+	fftw_execute(z->plan);
+
+	for (k = 0; k < z->size; k++) {
+		bin = &z->out[k < half ? k + half : k - half];
+		pwr = ((*bin)[0] * (*bin)[0] + (*bin)[1] * (*bin)[1]) * scale;
+		db[k] = 10 * log10(pwr > DBL_MIN ? pwr : DBL_MIN) + z->corr;
+	}
+}
+
+static void zoom_result_clear(zoom_result *res)
+{
+	zoom_band *band;
+	unsigned i;
+
+	if (zoom_databox)
+		gtk_databox_graph_remove_all(GTK_DATABOX(zoom_databox));
+
+	if (res->bands) {
+		for (i = 0; i < res->bands->len; i++) {
+			band = &g_array_index(res->bands, zoom_band, i);
+			g_array_free(band->x, TRUE);
+			g_array_free(band->y, TRUE);
+		}
+		g_array_free(res->bands, TRUE);
+	}
+	if (res->x)
+		g_array_free(res->x, TRUE);
+	if (res->y)
+		g_array_free(res->y, TRUE);
+
+	memset(res, 0, sizeof(*res));
+	res->x = g_array_new(FALSE, FALSE, sizeof(gfloat));
+	res->y = g_array_new(FALSE, FALSE, sizeof(gfloat));
+	res->bands = g_array_new(FALSE, FALSE, sizeof(zoom_band));
+}
+
+/* Retune to a profile and capture count samples taken after it */
+static bool zoom_capture(plugin_setup *setup, fastlock_profile *profile,
+		unsigned slot, gfloat *i_data, gfloat *q_data, unsigned count)
+{
+	unsigned ch = 2 * setup->rx;
 	ssize_t ret;
-	int i;
 
-	g_return_val_if_fail(setup, false);
+	/* Not the slot in use, so the LO does not move while loading */
+	profile->data[0] = '0' + slot;
+	ret = iio_channel_attr_write(alt_ch0, "fastlock_load", profile->data);
+	if (ret >= 0)
+		ret = iio_channel_attr_write_longlong(alt_ch0,
+				"fastlock_recall", slot);
+	if (ret < 0) {
+		fprintf(stderr, "Could not retune to %lld Hz in %s. %s\n",
+			profile->frequency, __func__, strerror(-ret));
+		return false;
+	}
+
+	if (capture_after_retune() < 0)
+		return false;
+
+	buffer_demux_float(capture_buffer, iio_device_get_channel(cap, ch),
+			i_data, count);
+	buffer_demux_float(capture_buffer, iio_device_get_channel(cap, ch + 1),
+			q_data, count);
+
+	return true;
+}
+
+static bool zoom_buffer_create(unsigned count)
+{
+	if (capture_buffer)
+		iio_buffer_destroy(capture_buffer);
+
+	iio_device_set_kernel_buffers_count(cap, 1);
+	capture_buffer = iio_device_create_buffer(cap, count, false);
+	if (!capture_buffer)
+		fprintf(stderr, "Could not create iio buffer in %s\n", __func__);
 
-	/* Configure the FIR filter */
+	return !!capture_buffer;
+}
+
+/* Bands around the local maxima of the coarse trace above the threshold.
+ * Those close enough to share coarse bins become one band. */
+static void zoom_find_bands(plugin_setup *setup, zoom_result *res,
+		unsigned step_bins)
+{
+	const gfloat *x = (gfloat *)res->x->data, *y = (gfloat *)res->y->data;
+	double rbw = HZ_TO_MHZ(setup->resolution_bw);
+	double center, half = ZOOM_BAND_BINS / 2 * rbw;
+	zoom_band band, *last;
+	unsigned k;
+
+	for (k = 1; k + 1 < res->x->len; k++) {
+		if (y[k] < setup->zoom_threshold || y[k] < y[k - 1] ||
+				y[k] <= y[k + 1])
+			continue;
+
+		/* Within the part of its step that is shown */
+		band.profile = k / step_bins;
+		center = setup->start_freq + setup->step * (band.profile + 0.5);
+		band.start = MAX(x[k] - half, center - setup->step / 2);
+		band.stop = MIN(x[k] + half, center + setup->step / 2);
+
+		last = res->bands->len ? &g_array_index(res->bands, zoom_band,
+				res->bands->len - 1) : NULL;
+		if (last && last->profile == band.profile &&
+				band.start <= last->stop) {
+			last->stop = band.stop;
+			continue;
+		}
+		if (res->bands->len == ZOOM_MAX_BANDS) {
+			res->dropped++;
+			continue;
+		}
+
+		band.x = g_array_new(FALSE, FALSE, sizeof(gfloat));
+		band.y = g_array_new(FALSE, FALSE, sizeof(gfloat));
+		band.peak = x[k];
+		band.level = y[k];
+		g_array_append_val(res->bands, band);
+	}
+}
+
+/* Replace the coarse bins of each band with its fine ones */
+static void zoom_merge(zoom_result *res)
+{
+	GArray *x = g_array_new(FALSE, FALSE, sizeof(gfloat));
+	GArray *y = g_array_new(FALSE, FALSE, sizeof(gfloat));
+	zoom_band *band = NULL;
+	unsigned k, b = 0;
+	gfloat f;
+
+	for (k = 0; k < res->x->len; k++) {
+		f = g_array_index(res->x, gfloat, k);
+
+		for (; b < res->bands->len; b++) {
+			band = &g_array_index(res->bands, zoom_band, b);
+			if (f < band->start)
+				break;
+			if (f < band->stop)
+				break;
+			g_array_append_vals(x, band->x->data, band->x->len);
+			g_array_append_vals(y, band->y->data, band->y->len);
+		}
+		if (b < res->bands->len && f >= band->start)
+			continue;
+
+		g_array_append_val(x, f);
+		g_array_append_val(y, g_array_index(res->y, gfloat, k));
+	}
+	for (; b < res->bands->len; b++) {
+		band = &g_array_index(res->bands, zoom_band, b);
+		g_array_append_vals(x, band->x->data, band->x->len);
+		g_array_append_vals(y, band->y->data, band->y->len);
+	}
+
+	g_array_free(res->x, TRUE);
+	g_array_free(res->y, TRUE);
+	res->x = x;
+	res->y = y;
+}
+
+/* The coarse pass is one sweep of the capture pipeline, at the RBW of the
+ * sweep, its steps come from captured_steps. Then each step a peak was found
+ * in is captured again at the zoom RBW. The steps keep their fastlock
+ * profiles, so no LO is tuned from scratch. */
+static gpointer zoom_sweep_thread_func(plugin_setup *setup)
+{
+	zoom_result *res = &zoom;
+	double rate = HZ_TO_MHZ((double)setup->sample_rate);
+	unsigned step_bins, first, n, k, slot, profile = UINT_MAX;
+	fastlock_profile *p;
+	sweep_step *step;
+	zoom_band *band;
+	gfloat *i_data, *q_data, *db, f;
+	GSList *node = setup->rx_profiles;
+	gint64 start, fft_start;
+
+	i_data = g_new(gfloat, fine_fft.size);
+	q_data = g_new(gfloat, fine_fft.size);
+	db = g_new(gfloat, MAX(coarse_fft.size, fine_fft.size));
+
+	start = g_get_monotonic_time();
+	step_bins = (unsigned)(setup->step * coarse_fft.size / rate + 0.5);
+	first = coarse_fft.size / 2 - step_bins / 2;
+	for (n = 0; n < setup->profile_count; n++, node = g_slist_next(node)) {
+		step = sweep_step_pop(captured_steps);
+		if (!step || !step->valid)
+			goto out;
+
+		/* The steps of one sweep come in profile order */
+		fft_start = g_get_monotonic_time();
+		p = node->data;
+		zoom_fft_run(&coarse_fft, step->data[0], step->data[1], db);
+		g_async_queue_push(free_steps, step);
+
+		for (k = first; k < first + step_bins; k++) {
+			f = HZ_TO_MHZ((double)p->frequency) +
+				((double)k - coarse_fft.size / 2) * rate / coarse_fft.size;
+			g_array_append_val(res->x, f);
+			g_array_append_val(res->y, db[k]);
+		}
+		res->steps++;
+		sweep_profiler_add(profiler, n, SWEEP_STAGE_FFT,
+				g_get_monotonic_time() - fft_start);
+		sweep_profiler_step_done(profiler, n, setup->start_freq +
+				setup->step * (n + 0.5));
+	}
+	res->coarse_time = g_get_monotonic_time() - start;
+
+	zoom_find_bands(setup, res, step_bins);
+
+	/* The capture thread is done with the buffer once the last step is
+	 * in. The next load goes to the slot it did not recall last. */
+	slot = setup->profile_count == 1 ? 0 : (setup->profile_count - 1) % 2;
+	start = g_get_monotonic_time();
+	if (res->bands->len && !zoom_buffer_create(fine_fft.size))
+		goto out;
+
+	for (n = 0; n < res->bands->len; n++) {
+		if (g_atomic_int_get(&stop_sweep))
+			goto out;
+
+		band = &g_array_index(res->bands, zoom_band, n);
+		p = g_slist_nth_data(setup->rx_profiles, band->profile);
+
+		/* Bands of the same step come from the same capture */
+		if (band->profile != profile) {
+			slot ^= 1;
+			if (!zoom_capture(setup, p, slot, i_data, q_data,
+						fine_fft.size))
+				goto out;
+			zoom_fft_run(&fine_fft, i_data, q_data, db);
+			profile = band->profile;
+			res->captures++;
+		}
+
+		for (k = 0; k < fine_fft.size; k++) {
+			f = HZ_TO_MHZ((double)p->frequency) +
+				((double)k - fine_fft.size / 2) * rate / fine_fft.size;
+			if (f < band->start || f >= band->stop)
+				continue;
+			g_array_append_val(band->x, f);
+			g_array_append_val(band->y, db[k]);
+			if (band->x->len == 1 || db[k] > band->level) {
+				band->peak = f;
+				band->level = db[k];
+			}
+		}
+	}
+	res->zoom_time = g_get_monotonic_time() - start;
+
+	zoom_merge(res);
+	res->complete = true;
+
+out:
+	g_free(i_data);
+	g_free(q_data);
+	g_free(db);
+
+	g_idle_add((GSourceFunc)zoom_sweep_done, g_thread_self());
+
+	return NULL;
+}
+
+static gint zoom_band_level_cmp(gconstpointer a, gconstpointer b)
+{
+	gfloat la = ((const zoom_band *)a)->level;
+	gfloat lb = ((const zoom_band *)b)->level;
+
+	return (la < lb) - (la > lb);
+}
+
+static void zoom_show_result(plugin_setup *setup, zoom_result *res)
+{
+	GtkDataboxGraph *graph;
+	GString *summary;
+	GArray *peaks;
+	zoom_band *band;
+	unsigned i;
+
+	if (!res->complete)
+		return;
+
+	summary = g_string_new(NULL);
+	g_string_append_printf(summary, "Coarse pass: %u steps at %.3f kHz in "
+		"%.1f ms. Zoom: %u bands, %u captures at %.3f kHz in %.1f ms",
+		res->steps, setup->resolution_bw / 1000, res->coarse_time / 1e3,
+		res->bands->len, res->captures,
+		setup->sample_rate / 1000.0 / setup->zoom_fft_size,
+		res->zoom_time / 1e3);
+	/* What every step at the zoom RBW would have taken */
+	if (res->captures)
+		g_string_append_printf(summary, " (%.1f ms for the whole span)",
+			res->zoom_time / 1e3 / res->captures * res->steps);
+	if (res->dropped)
+		g_string_append_printf(summary, "\n%u more peaks above the "
+			"threshold were left out", res->dropped);
+
+	peaks = g_array_sized_new(FALSE, FALSE, sizeof(zoom_band),
+			res->bands->len);
+	g_array_append_vals(peaks, res->bands->data, res->bands->len);
+	g_array_sort(peaks, zoom_band_level_cmp);
+	for (i = 0; i < MIN(peaks->len, ZOOM_SUMMARY_PEAKS); i++) {
+		band = &g_array_index(peaks, zoom_band, i);
+		g_string_append_printf(summary, "%s%.6f MHz: %.1f dBFS",
+			i ? ", " : "\nPeaks: ", band->peak, band->level);
+	}
+	g_array_free(peaks, TRUE);
+
+	printf("Adaptive sweep: %s\n", summary->str);
+	gtk_label_set_text(GTK_LABEL(zoom_summary), summary->str);
+	g_string_free(summary, TRUE);
+
+	graph = gtk_databox_lines_new(res->x->len, (gfloat *)res->x->data,
+			(gfloat *)res->y->data, &zoom_trace_color, 1);
+	gtk_databox_graph_add(GTK_DATABOX(zoom_databox), graph);
+	gtk_databox_auto_rescale(GTK_DATABOX(zoom_databox), 0.05);
+	gtk_widget_show_all(zoom_results);
+}
+
+static bool zoom_sweep_start(plugin_setup *setup)
+{
+	unsigned bits;
+
+	zoom_result_clear(&zoom);
+	zoom_fft_free(&coarse_fft);
+	zoom_fft_free(&fine_fft);
+
+	/* Planned here, the FFTW planner is not thread safe */
+	bits = iio_channel_get_data_format(iio_device_get_channel(cap,
+				2 * setup->rx))->bits;
+	if (!zoom_fft_init(&coarse_fft, setup->fft_size, bits) ||
+			!zoom_fft_init(&fine_fft, setup->zoom_fft_size, bits)) {
+		fprintf(stderr, "Could not allocate the FFTs in %s\n", __func__);
+		return false;
+	}
+
+	zoom_thread = g_thread_new("Adaptive Sweep",
+			(GThreadFunc)zoom_sweep_thread_func, setup);
+
+	return true;
+}
+
+static bool load_fir_filter(void)
+{
 	FILE *fp;
 	char *buf;
-	ssize_t len;
+	ssize_t len, ret;
 
 	fp = fopen("filters/"FIR_FILTER, "r");
 	if (!fp)
@@ -620,7 +1203,7 @@ static bool setup_before_sweep_start(plugin_setup *setup)
 	if (!fp) {
 		fprintf(stderr, "Could not open file %s for reading in %s. %s\n",
 			FIR_FILTER, __func__, strerror(errno));
-		goto fail;
+		return false;
 	}
 
 	fseek(fp, 0, SEEK_END);
@@ -632,19 +1215,43 @@ static bool setup_before_sweep_start(plugin_setup *setup)
 
 	ret = iio_device_attr_write_raw(dev,
 			"filter_fir_config", buf, len);
+	free(buf);
 	if (ret < 0) {
 		fprintf(stderr, "FIR filter config failed in %s. %s\n",
 			__func__, strerror(ret));
-		goto fail;
+		return false;
 	}
-	free(buf);
 
 	ret = ad9361_set_trx_fir_enable(dev, true);
 	if (ret < 0) {
 		fprintf(stderr, "a write to in_out_voltage_filter_fir_en failed"
 			"in %s. %s\n", __func__, strerror(ret));
-		goto fail;
+		return false;
 	}
+
+	return true;
+}
+
+static bool setup_before_sweep_start(plugin_setup *setup)
+{
+	GSList *node;
+	fastlock_profile *profile;
+	struct iio_channel *rx_ch;
+	ssize_t ret;
+	int i;
+
+	g_return_val_if_fail(setup, false);
+
+	/* At other rates, the filter came with the rate */
+	if (setup->sample_rate == FIR_FILTER_RATE && !load_fir_filter())
+		goto fail;
+
+	/* Keep the analog filter to the band the steps use */
+	rx_ch = iio_device_find_channel(dev, "voltage0", false);
+	if (rx_ch && setup->sample_rate != FIR_FILTER_RATE)
+		iio_channel_attr_write_longlong(rx_ch, "rf_bandwidth",
+			(long long)(setup->sample_rate * setup->usable_bw));
+
 	/* Fill fastlock slots 0 and 1 */
 	for (i = 0, node = setup->rx_profiles; i < 2 && node;
 					i++, node = g_slist_next(node)) {
@@ -669,14 +1276,9 @@ static bool setup_before_sweep_start(plugin_setup *setup)
 		goto fail;
 	}
 
-	kill_capture_thread = false;
-	kill_sweep_thread = false;
-	kill_fft_thread = false;
-
-	capture_done = false;
-	profile_applied = false;
-	demux_done = false;
-	fft_done = true;
+	g_atomic_int_set(&stop_sweep, 0);
+	recalled_step = 0;
+	loaded_step = 1;
 
 	return true;
 
@@ -686,38 +1288,60 @@ fail:
 
 static void start_sweep_clicked(GtkButton *btn, gpointer data)
 {
-	gtk_widget_set_sensitive(GTK_WIDGET(btn), false);
+	gint64 start, profiles_time, buffer_time;
 
-#if DEBUG
-	gtimer = g_timer_new();
-	loop_durations_sum = 0;
-	loop_count = 0;
-#endif
+	gtk_widget_set_sensitive(GTK_WIDGET(btn), false);
 
 	/* This capture process and the capture process from osc.c are designed
 	 * to access the same iio devices but they do it from different threads,
 	 * thus should not run simultaneously. */
 	plugin_osc_stop_all_plots();
 
+	start = g_get_monotonic_time();
 	if (plugin_gather_user_setup(&psetup))
 		build_profiles_for_entire_sweep(&psetup);
+	profiles_time = g_get_monotonic_time() - start;
 	if (!configure_data_capture(&psetup))
 		goto abort;
-	if (!spectrum_window)
-		build_spectrum_window(&psetup);
-	else
-		configure_spectrum_window(&psetup);
-	osc_plot_draw_start(OSC_PLOT(spectrum_window));
+
+	/* An adaptive sweep shows its own trace, once it is done */
+	if (!psetup.zoom) {
+		if (!spectrum_window)
+			build_spectrum_window(&psetup);
+		else
+			configure_spectrum_window(&psetup);
+		osc_plot_draw_start(OSC_PLOT(spectrum_window));
+	}
 
 	if (!setup_before_sweep_start(&psetup))
 		goto abort;
+	start = g_get_monotonic_time();
+	if (!sweep_pipeline_create(&psetup))
+		goto abort;
+	buffer_time = g_get_monotonic_time() - start;
+
+	/* Rates are of the sweep alone, from its first step */
+	if (profiler_keep)
+		sweep_profiler_continue(profiler);
+	else
+		sweep_profiler_reset(profiler, psetup.profile_count * psetup.step,
+				psetup.profile_count);
+	sweep_profiler_add_setup(profiler, "fastlock profiles", profiles_time);
+	sweep_profiler_add_setup(profiler, "buffer", buffer_time);
 
+	/* The coarse pass of an adaptive sweep is a single sweep */
+	step_limit = psetup.zoom ? psetup.profile_count : UINT_MAX;
 	capture_thread = g_thread_new("Data Capture",
 				(GThreadFunc)capture_data_thread_func, &psetup);
 	freq_sweep_thread = g_thread_new("Frequency Sweep",
 				(GThreadFunc)profile_load_thread_func, &psetup);
-	fft_thread = g_thread_new("Do FFT",
+	if (psetup.zoom) {
+		if (!zoom_sweep_start(&psetup))
+			goto abort;
+	} else {
+		fft_thread = g_thread_new("Do FFT",
 				(GThreadFunc)do_fft_thread_func, &psetup);
+	}
 
 	gtk_widget_set_sensitive(GTK_WIDGET(stop_button), true);
 
@@ -730,24 +1354,46 @@ abort:
 
 static void stop_sweep_clicked(GtkButton *btn, gpointer data)
 {
+	bool was_sweeping = capture_thread != NULL;
+
 	gtk_widget_set_sensitive(GTK_WIDGET(btn), false);
 
 	if (spectrum_window)
 		osc_plot_draw_stop(OSC_PLOT(spectrum_window));
 	if (capture_thread) {
-		kill_capture_thread = true;
+		sweep_abort();
 		g_thread_join(capture_thread);
+		g_thread_join(freq_sweep_thread);
+		if (fft_thread)
+			g_thread_join(fft_thread);
 		capture_thread = NULL;
+		freq_sweep_thread = NULL;
+		fft_thread = NULL;
+	}
+	if (zoom_thread) {
+		sweep_abort();
+		g_thread_join(zoom_thread);
+		zoom_thread = NULL;
+		zoom_show_result(&psetup, &zoom);
 	}
+	if (was_sweeping)
+		sweep_profiler_print(profiler, stdout);
 	if (capture_buffer) {
 		iio_buffer_destroy(capture_buffer);
 		capture_buffer = NULL;
 	}
+	sweep_pipeline_free();
 
 	gtk_widget_set_sensitive(GTK_WIDGET(start_button), true);
-#if DEBUG
-fprintf(stderr, "Average Sweep Duration: %f\n", loop_durations_sum / loop_count);
-#endif
+}
+
+/* The adaptive sweep ended by itself */
+static gboolean zoom_sweep_done(GThread *thread)
+{
+	if (thread == zoom_thread)
+		stop_sweep_clicked(GTK_BUTTON(stop_button), NULL);
+
+	return FALSE;
 }
 
 static void center_freq_changed(GtkSpinButton *btn, gpointer data)
@@ -766,6 +1412,47 @@ static void center_freq_changed(GtkSpinButton *btn, gpointer data)
 		gtk_spin_button_set_value(bw_spin, upper);
 }
 
+/* Show what the settings trade: the step each capture covers, the number
+ * of steps the span takes and the resolution they are swept at */
+static void sweep_plan_changed(GtkWidget *widget, gpointer data)
+{
+	long long rate = sample_rate_get();
+	int rbw_index = gtk_combo_box_get_active(GTK_COMBO_BOX(available_RBWs));
+	unsigned fft_size = 65536 >> (rbw_index < 0 ? 0 : rbw_index);
+	double bw = gtk_spin_button_get_value(GTK_SPIN_BUTTON(freq_bw));
+	double step;
+	char buf[128];
+
+	step = sweep_step_compute(rate, fft_size,
+		gtk_spin_button_get_value(GTK_SPIN_BUTTON(usable_bw_spin)) / 100,
+		gtk_spin_button_get_value(GTK_SPIN_BUTTON(overlap_spin)) / 100);
+
+	gtk_spin_button_set_range(GTK_SPIN_BUTTON(center_freq),
+		70 + step / 2, 6000 - step / 2);
+	gtk_adjustment_set_lower(gtk_spin_button_get_adjustment(
+		GTK_SPIN_BUTTON(freq_bw)), step);
+
+	snprintf(buf, sizeof(buf), "Step: %.3f MHz, %u steps, RBW %.3f kHz",
+		step, (unsigned)ceil(bw / step - 1e-9),
+		rate / 1000.0 / fft_size);
+	gtk_label_set_text(GTK_LABEL(sweep_plan_label), buf);
+}
+
+static void sample_rate_changed(GtkSpinButton *btn, gpointer data)
+{
+	int rbw_index = gtk_combo_box_get_active(GTK_COMBO_BOX(available_RBWs));
+	int zoom_index = gtk_combo_box_get_active(GTK_COMBO_BOX(zoom_rbws));
+
+	/* The same FFT sizes, at the new rate */
+	comboboxtext_rbw_fill(GTK_COMBO_BOX_TEXT(available_RBWs),
+		gtk_spin_button_get_value(btn));
+	gtk_combo_box_set_active(GTK_COMBO_BOX(available_RBWs), rbw_index);
+	comboboxtext_rbw_fill(GTK_COMBO_BOX_TEXT(zoom_rbws),
+		gtk_spin_button_get_value(btn));
+	gtk_combo_box_set_active(GTK_COMBO_BOX(zoom_rbws), zoom_index);
+	sweep_plan_changed(GTK_WIDGET(btn), data);
+}
+
 static void spectrum_window_destroyed_cb(OscPlot *plot)
 {
 	stop_sweep_clicked(GTK_BUTTON(stop_button), NULL);
@@ -784,15 +1471,169 @@ static int handle_external_request (struct osc_plugin *plugin, const char *reque
 	return ret;
 }
 
+/* Run sweeps until the given number is done, then stop */
+static int analyzer_benchmark(unsigned long long sweeps, double timeout)
+{
+	gint64 end = g_get_monotonic_time() +
+		(gint64)(timeout * G_USEC_PER_SEC);
+	unsigned long long done;
+	bool adaptive;
+
+	adaptive = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(zoom_check));
+
+	if (capture_thread || zoom_thread)
+		gtk_button_clicked(GTK_BUTTON(stop_button));
+	gtk_button_clicked(GTK_BUTTON(start_button));
+	if (!capture_thread)
+		return -EIO;
+
+	/* Adaptive sweeps stop after one, they are started again with the
+	 * profiler counting on, so the rates include the zoom captures */
+	profiler_keep = adaptive;
+	while (sweep_profiler_get_sweeps(profiler) < sweeps &&
+			g_get_monotonic_time() < end) {
+		if (!capture_thread) {
+			if (!adaptive)
+				break;
+			gtk_button_clicked(GTK_BUTTON(start_button));
+			if (!capture_thread)
+				break;
+		}
+		osc_process_gtk_events(100);
+	}
+	profiler_keep = false;
+
+	done = sweep_profiler_get_sweeps(profiler);
+	if (capture_thread)
+		gtk_button_clicked(GTK_BUTTON(stop_button));
+
+	if (done < sweeps) {
+		fprintf(stderr, "Sweep benchmark: %llu of %llu sweeps done\n",
+				done, sweeps);
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+static int analyzer_handle_driver(struct osc_plugin *plugin, const char *attrib,
+		const char *value)
+{
+	unsigned long long sweeps;
+	double timeout = 60;
+
+	if (MATCH_ATTRIB("center_freq")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(center_freq), atof(value));
+	} else if (MATCH_ATTRIB("span")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(freq_bw), atof(value));
+	} else if (MATCH_ATTRIB("sample_rate")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(sample_rate_spin),
+				atof(value));
+	} else if (MATCH_ATTRIB("usable_bw")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(usable_bw_spin),
+				atof(value));
+	} else if (MATCH_ATTRIB("overlap")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(overlap_spin),
+				atof(value));
+	} else if (MATCH_ATTRIB("rbw")) {
+		gtk_combo_box_set_active(GTK_COMBO_BOX(available_RBWs),
+				atoi(value));
+	} else if (MATCH_ATTRIB("rx")) {
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(
+				atoi(value) == 2 ? receiver2 : receiver1), true);
+	} else if (MATCH_ATTRIB("zoom")) {
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(zoom_check),
+				!!atoi(value));
+	} else if (MATCH_ATTRIB("zoom_threshold")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(zoom_threshold_spin),
+				atof(value));
+	} else if (MATCH_ATTRIB("benchmark")) {
+		/* "sweeps [timeout in seconds]" */
+		if (sscanf(value, "%llu %lf", &sweeps, &timeout) < 1)
+			return -EINVAL;
+		return analyzer_benchmark(sweeps, timeout);
+	} else if (MATCH_ATTRIB("benchmark.save")) {
+		return sweep_profiler_save_csv(profiler, value);
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* test.benchmark.<result> = min max, of the last sweep run */
+static int analyzer_test_benchmark(int line, const char *attrib,
+		const char *value)
+{
+	const char *result = attrib + sizeof("test.benchmark.") - 1;
+	struct sweep_profiler_summary sum;
+	double min, max, val;
+	char name[32];
+	unsigned i;
+
+	if (sscanf(value, "%lf %lf", &min, &max) != 2)
+		return -EINVAL;
+
+	sweep_profiler_get_summary(profiler, &sum);
+
+	if (!strcmp(result, "steps_per_s"))
+		val = sum.steps_per_s;
+	else if (!strcmp(result, "ghz_per_s"))
+		val = sum.ghz_per_s;
+	else if (!strcmp(result, "sweep_ms"))
+		val = sum.sweep_ms;
+	else {
+		/* Mean time of a stage, e.g. retune_us */
+		for (i = 0; i < SWEEP_STAGES; i++) {
+			snprintf(name, sizeof(name), "%s_us", sweep_stage_name(i));
+			if (!strcmp(result, name))
+				break;
+		}
+		if (i == SWEEP_STAGES)
+			return -EINVAL;
+		val = sum.mean_us[i];
+	}
+
+	printf("Line %i: (%s = %s): value = %lf\n", line, attrib, value, val);
+	if (val >= min && val <= max) {
+		fprintf(stderr, "Test passed.\n");
+		return 0;
+	}
+
+	create_blocking_popup(GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+			"Test failure",
+			"Test failed! Line: %i\n\n"
+			"Test was: %s = %f %f\n"
+			"Value read = %f\n",
+			line, attrib, min, max, val);
+	fprintf(stderr, "*** Test failed! ***\n");
+	return -1;
+}
+
+static int analyzer_handle(struct osc_plugin *plugin, int line,
+		const char *attrib, const char *value)
+{
+	if (!strncmp(attrib, "test.benchmark.", sizeof("test.benchmark.") - 1))
+		return analyzer_test_benchmark(line, attrib, value);
+
+	return osc_plugin_default_handle(ctx, line, attrib, value,
+			analyzer_handle_driver, plugin);
+}
+
 static GtkWidget * analyzer_init(struct osc_plugin *plugin, GtkWidget *notebook, const char *ini_fn)
 {
 	GtkBuilder *builder;
-	struct iio_channel *ch1;
+	struct iio_channel *ch1, *rx_ch;
+	GtkWidget *table;
+	double rate_min, rate_max;
+	char buf[128];
 
 	ctx = osc_create_context();
 	if (!ctx)
 		return NULL;
 
+	profiler = sweep_profiler_new();
+
 	dev = iio_context_find_device(ctx, PHY_DEVICE);
 	if (!dev)
 		goto destroy_ctx;
@@ -833,19 +1674,54 @@ static GtkWidget * analyzer_init(struct osc_plugin *plugin, GtkWidget *notebook,
 				"cmb_available_rbw"));
 	receiver1 = GTK_WIDGET(gtk_builder_get_object(builder,
 				"radiobutton_rx1"));
+	receiver2 = GTK_WIDGET(gtk_builder_get_object(builder,
+				"radiobutton_rx2"));
 	start_button = GTK_WIDGET(gtk_builder_get_object(builder,
 				"start_sweep_btn"));
 	stop_button = GTK_WIDGET(gtk_builder_get_object(builder,
 				"stop_sweep_btn"));
+	sample_rate_spin = GTK_WIDGET(gtk_builder_get_object(builder,
+				"spin_sample_rate"));
+	usable_bw_spin = GTK_WIDGET(gtk_builder_get_object(builder,
+				"spin_usable_bw"));
+	overlap_spin = GTK_WIDGET(gtk_builder_get_object(builder,
+				"spin_overlap"));
+	sweep_plan_label = GTK_WIDGET(gtk_builder_get_object(builder,
+				"label_sweep_plan"));
+	zoom_check = GTK_WIDGET(gtk_builder_get_object(builder,
+				"checkbutton_zoom"));
+	zoom_threshold_spin = GTK_WIDGET(gtk_builder_get_object(builder,
+				"spin_zoom_threshold"));
+	zoom_rbws = GTK_WIDGET(gtk_builder_get_object(builder,
+				"cmb_zoom_rbw"));
+	zoom_results = GTK_WIDGET(gtk_builder_get_object(builder,
+				"zoom_results"));
+	zoom_summary = GTK_WIDGET(gtk_builder_get_object(builder,
+				"label_zoom_summary"));
 
 	/* Widgets initialization */
-	gtk_spin_button_set_range(GTK_SPIN_BUTTON(center_freq),
-		70 + sweep_freq_step / 2, 6000 - sweep_freq_step / 2);
-	gtk_adjustment_set_lower(gtk_spin_button_get_adjustment(
-		GTK_SPIN_BUTTON(freq_bw)), sweep_freq_step);
+	rx_ch = iio_device_find_channel(dev, "voltage0", false);
+	if (rx_ch && iio_channel_attr_read(rx_ch, "sampling_frequency_available",
+				buf, sizeof(buf)) > 0 &&
+			sscanf(buf, "[%lf %*f %lf]", &rate_min, &rate_max) == 2)
+		gtk_spin_button_set_range(GTK_SPIN_BUTTON(sample_rate_spin),
+			HZ_TO_MHZ(rate_min), HZ_TO_MHZ(rate_max));
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(sample_rate_spin),
+				HZ_TO_MHZ(FIR_FILTER_RATE));
 	comboboxtext_rbw_fill(GTK_COMBO_BOX_TEXT(available_RBWs),
-				HZ_TO_MHZ(sampling_rate));
+				HZ_TO_MHZ(FIR_FILTER_RATE));
 	gtk_combo_box_set_active(GTK_COMBO_BOX(available_RBWs), 6);
+	comboboxtext_rbw_fill(GTK_COMBO_BOX_TEXT(zoom_rbws),
+				HZ_TO_MHZ(FIR_FILTER_RATE));
+	gtk_combo_box_set_active(GTK_COMBO_BOX(zoom_rbws), 0);
+	sweep_plan_changed(NULL, NULL);
+
+	gtk_databox_create_box_with_scrollbars_and_rulers(&zoom_databox, &table,
+						TRUE, TRUE, TRUE, TRUE);
+	gtk_container_add(GTK_CONTAINER(gtk_builder_get_object(builder,
+				"zoom_trace")), table);
+	gtk_widget_set_size_request(table, 450, 300);
+	zoom_result_clear(&zoom);
 
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(receiver1), true);
 	if (!is_2rx_2tx)
@@ -863,10 +1739,22 @@ static GtkWidget * analyzer_init(struct osc_plugin *plugin, GtkWidget *notebook,
 			G_CALLBACK(center_freq_changed), NULL);
 	g_signal_connect_swapped(freq_bw, "value-changed",
 			G_CALLBACK(center_freq_changed), center_freq);
+	g_builder_connect_signal(builder, "spin_sample_rate", "value-changed",
+			G_CALLBACK(sample_rate_changed), NULL);
+	g_builder_connect_signal(builder, "spin_usable_bw", "value-changed",
+			G_CALLBACK(sweep_plan_changed), NULL);
+	g_builder_connect_signal(builder, "spin_overlap", "value-changed",
+			G_CALLBACK(sweep_plan_changed), NULL);
+	g_builder_connect_signal(builder, "spin_freq_bw", "value-changed",
+			G_CALLBACK(sweep_plan_changed), NULL);
+	g_builder_connect_signal(builder, "cmb_available_rbw", "changed",
+			G_CALLBACK(sweep_plan_changed), NULL);
 
 	return analyzer_panel;
 
 destroy_ctx:
+	sweep_profiler_free(profiler);
+	profiler = NULL;
 	osc_destroy_context(ctx);
 	return NULL;
 }
@@ -893,6 +1781,8 @@ static void context_destroy(struct osc_plugin *plugin, const char *ini_fn)
 	}
 	g_source_remove_by_user_data(ctx);
 
+	sweep_profiler_free(profiler);
+	profiler = NULL;
 	osc_destroy_context(ctx);
 }
 
@@ -911,6 +1801,7 @@ struct osc_plugin plugin = {
 	.name = THIS_DRIVER,
 	.identify = analyzer_identify,
 	.init = analyzer_init,
+	.handle_item = analyzer_handle,
 	.handle_external_request = handle_external_request,
 	.update_active_page = update_active_page,
 	.get_preferred_size = analyzer_get_preferred_size,
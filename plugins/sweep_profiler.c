@@ -0,0 +1,320 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include "sweep_profiler.h"
+
+/* Bucket b of a histogram counts the times in [2^b, 2^(b+1)) us */
+#define HISTOGRAM_BUCKETS 24
+#define HISTOGRAM_BAR 40
+
+struct step_record {
+	unsigned step;
+	double freq;			/* MHz */
+	gint64 done;			/* us since the run started */
+	gint64 us[SWEEP_STAGES];
+	bool valid;
+};
+
+struct setup_cost {
+	char *what;
+	gint64 us;
+};
+
+struct sweep_profiler {
+	GMutex lock;			/* of the totals, taken by step_done */
+	struct step_record *records;	/* ring, by step */
+	GArray *setup;
+	double span;
+	unsigned steps_per_sweep;
+	gint64 start, last;
+	unsigned long long steps;
+	unsigned first;			/* of the run, see sweep_profiler_continue */
+	gint64 total[SWEEP_STAGES], max[SWEEP_STAGES];
+	unsigned long long histogram[SWEEP_STAGES][HISTOGRAM_BUCKETS];
+};
+
+static const char * const stage_names[SWEEP_STAGES] = {
+	[SWEEP_STAGE_LOAD] = "load",
+	[SWEEP_STAGE_WAIT] = "wait",
+	[SWEEP_STAGE_RETUNE] = "retune",
+	[SWEEP_STAGE_CAPTURE] = "capture",
+	[SWEEP_STAGE_DEMUX] = "demux",
+	[SWEEP_STAGE_HANDOFF] = "handoff",
+	[SWEEP_STAGE_FFT] = "fft",
+};
+
+const char * sweep_stage_name(enum sweep_stage stage)
+{
+	return stage < SWEEP_STAGES ? stage_names[stage] : NULL;
+}
+
+static void setup_cost_clear(gpointer data)
+{
+	g_free(((struct setup_cost *)data)->what);
+}
+
+struct sweep_profiler * sweep_profiler_new(void)
+{
+	struct sweep_profiler *p = g_new0(struct sweep_profiler, 1);
+
+	g_mutex_init(&p->lock);
+	p->records = g_new0(struct step_record, SWEEP_PROFILER_STEPS);
+	p->setup = g_array_new(FALSE, FALSE, sizeof(struct setup_cost));
+	g_array_set_clear_func(p->setup, setup_cost_clear);
+
+	return p;
+}
+
+void sweep_profiler_free(struct sweep_profiler *p)
+{
+	if (!p)
+		return;
+
+	g_array_free(p->setup, TRUE);
+	g_free(p->records);
+	g_mutex_clear(&p->lock);
+	g_free(p);
+}
+
+void sweep_profiler_reset(struct sweep_profiler *p, double span_mhz,
+		unsigned steps_per_sweep)
+{
+	g_mutex_lock(&p->lock);
+
+	memset(p->records, 0, sizeof(*p->records) * SWEEP_PROFILER_STEPS);
+	g_array_set_size(p->setup, 0);
+	p->span = span_mhz;
+	p->steps_per_sweep = steps_per_sweep ? steps_per_sweep : 1;
+	p->start = p->last = g_get_monotonic_time();
+	p->steps = 0;
+	p->first = 0;
+	memset(p->total, 0, sizeof(p->total));
+	memset(p->max, 0, sizeof(p->max));
+	memset(p->histogram, 0, sizeof(p->histogram));
+
+	g_mutex_unlock(&p->lock);
+}
+
+void sweep_profiler_continue(struct sweep_profiler *p)
+{
+	unsigned i;
+
+	g_mutex_lock(&p->lock);
+
+	/* Stages of steps the last run did not finish are dropped */
+	for (i = 0; i < SWEEP_PROFILER_STEPS; i++)
+		if (p->records[i].step >= p->steps)
+			p->records[i].valid = false;
+	p->first = p->steps;
+
+	g_mutex_unlock(&p->lock);
+}
+
+void sweep_profiler_add_setup(struct sweep_profiler *p, const char *what,
+		gint64 us)
+{
+	struct setup_cost cost = { g_strdup(what), us };
+
+	g_mutex_lock(&p->lock);
+	g_array_append_val(p->setup, cost);
+	g_mutex_unlock(&p->lock);
+}
+
+/* The stages of a step are added one after the other, if by different
+ * threads, so the first one to come reclaims the slot of the ring */
+static struct step_record * record_get(struct sweep_profiler *p, unsigned step)
+{
+	struct step_record *rec = &p->records[step % SWEEP_PROFILER_STEPS];
+
+	if (rec->step != step || !rec->valid) {
+		memset(rec, 0, sizeof(*rec));
+		rec->step = step;
+		rec->valid = true;
+	}
+
+	return rec;
+}
+
+void sweep_profiler_add(struct sweep_profiler *p, unsigned step,
+		enum sweep_stage stage, gint64 us)
+{
+	record_get(p, p->first + step)->us[stage] += us;
+}
+
+static unsigned histogram_bucket(gint64 us)
+{
+	unsigned b = 0;
+
+	while (us > 1 && b < HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+void sweep_profiler_step_done(struct sweep_profiler *p, unsigned step,
+		double freq_mhz)
+{
+	struct step_record *rec = record_get(p, p->first + step);
+	unsigned i;
+
+	g_mutex_lock(&p->lock);
+
+	p->last = g_get_monotonic_time();
+	rec->freq = freq_mhz;
+	rec->done = p->last - p->start;
+
+	for (i = 0; i < SWEEP_STAGES; i++) {
+		p->total[i] += rec->us[i];
+		if (rec->us[i] > p->max[i])
+			p->max[i] = rec->us[i];
+		p->histogram[i][histogram_bucket(rec->us[i])]++;
+	}
+	p->steps++;
+
+	g_mutex_unlock(&p->lock);
+}
+
+unsigned long long sweep_profiler_get_sweeps(struct sweep_profiler *p)
+{
+	unsigned long long sweeps;
+
+	g_mutex_lock(&p->lock);
+	sweeps = p->steps / p->steps_per_sweep;
+	g_mutex_unlock(&p->lock);
+
+	return sweeps;
+}
+
+void sweep_profiler_get_summary(struct sweep_profiler *p,
+		struct sweep_profiler_summary *s)
+{
+	unsigned i;
+
+	memset(s, 0, sizeof(*s));
+
+	g_mutex_lock(&p->lock);
+
+	s->steps = p->steps;
+	s->sweeps = p->steps / p->steps_per_sweep;
+	s->seconds = (p->last - p->start) / 1e6;
+	if (s->seconds > 0) {
+		s->steps_per_s = s->steps / s->seconds;
+		/* Partial sweeps count for the band they covered */
+		s->ghz_per_s = s->steps * p->span / p->steps_per_sweep / 1e3 /
+			s->seconds;
+	}
+	if (s->sweeps)
+		s->sweep_ms = s->seconds * 1e3 * p->steps_per_sweep / s->steps;
+	for (i = 0; i < SWEEP_STAGES; i++) {
+		s->mean_us[i] = s->steps ? (double)p->total[i] / s->steps : 0;
+		s->max_us[i] = p->max[i];
+	}
+
+	g_mutex_unlock(&p->lock);
+}
+
+void sweep_profiler_print(struct sweep_profiler *p, FILE *f)
+{
+	struct sweep_profiler_summary s;
+	unsigned long long peak;
+	unsigned i, b, first, last;
+	struct setup_cost *cost;
+
+	sweep_profiler_get_summary(p, &s);
+
+	fprintf(f, "Spectrum sweep: %llu sweeps, %llu steps in %.2f s: "
+		"%.1f steps/s, %.3f GHz/s, %.1f ms per sweep\n",
+		s.sweeps, s.steps, s.seconds, s.steps_per_s, s.ghz_per_s,
+		s.sweep_ms);
+
+	g_mutex_lock(&p->lock);
+
+	for (i = 0; i < p->setup->len; i++) {
+		cost = &g_array_index(p->setup, struct setup_cost, i);
+		fprintf(f, "  setup %s: %" G_GINT64_FORMAT " us\n",
+			cost->what, cost->us);
+	}
+
+	for (i = 0; i < SWEEP_STAGES && s.steps; i++) {
+		fprintf(f, "  %-8s mean %9.1f us, max %9.0f us\n",
+			stage_names[i], s.mean_us[i], s.max_us[i]);
+
+		first = HISTOGRAM_BUCKETS;
+		for (b = 0, last = 0, peak = 0; b < HISTOGRAM_BUCKETS; b++) {
+			if (p->histogram[i][b] && first == HISTOGRAM_BUCKETS)
+				first = b;
+			if (p->histogram[i][b])
+				last = b;
+			if (p->histogram[i][b] > peak)
+				peak = p->histogram[i][b];
+		}
+		/* Nothing to see for stages that take no time */
+		if (!last)
+			continue;
+
+		for (b = first; b <= last; b++)
+			fprintf(f, "    %8u us %10llu %.*s\n", 1u << b,
+				p->histogram[i][b],
+				(int)(p->histogram[i][b] * HISTOGRAM_BAR / peak),
+				"########################################");
+	}
+
+	g_mutex_unlock(&p->lock);
+}
+
+int sweep_profiler_save_csv(struct sweep_profiler *p, const char *path)
+{
+	struct step_record *rec;
+	unsigned long long first, n;
+	unsigned i;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	fprintf(f, "step,frequency_mhz,time_us");
+	for (i = 0; i < SWEEP_STAGES; i++)
+		fprintf(f, ",%s_us", stage_names[i]);
+	fprintf(f, "\n");
+
+	g_mutex_lock(&p->lock);
+
+	/* The steps still in the ring, oldest first */
+	first = p->steps > SWEEP_PROFILER_STEPS ?
+		p->steps - SWEEP_PROFILER_STEPS : 0;
+	for (n = first; n < p->steps; n++) {
+		rec = &p->records[n % SWEEP_PROFILER_STEPS];
+		if (!rec->valid || rec->step != n)
+			continue;
+
+		fprintf(f, "%u,%.6f,%" G_GINT64_FORMAT, rec->step, rec->freq,
+			rec->done);
+		for (i = 0; i < SWEEP_STAGES; i++)
+			fprintf(f, ",%" G_GINT64_FORMAT, rec->us[i]);
+		fprintf(f, "\n");
+	}
+
+	g_mutex_unlock(&p->lock);
+
+	if (fclose(f)) {
+		fprintf(stderr, "Unable to write %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __SWEEP_PROFILER_H__
+#define __SWEEP_PROFILER_H__
+
+#include <glib.h>
+#include <stdio.h>
+
+/* Where the time of a sweep step goes */
+enum sweep_stage {
+	SWEEP_STAGE_LOAD,	/* fastlock profile written to its slot */
+	SWEEP_STAGE_WAIT,	/* capture waiting on the load */
+	SWEEP_STAGE_RETUNE,	/* fastlock recall */
+	SWEEP_STAGE_CAPTURE,	/* buffer refill, LO settling included */
+	SWEEP_STAGE_DEMUX,
+	SWEEP_STAGE_HANDOFF,	/* samples copied to the plot */
+	SWEEP_STAGE_FFT,	/* FFT and stitching into the trace */
+	SWEEP_STAGES,
+};
+
+struct sweep_profiler_summary {
+	unsigned long long steps;
+	unsigned long long sweeps;
+	double seconds;
+	double steps_per_s;
+	double ghz_per_s;
+	double sweep_ms;			/* mean */
+	double mean_us[SWEEP_STAGES];
+	double max_us[SWEEP_STAGES];
+};
+
+/*
+ * Per step timings of a frequency sweep. Each stage of a step is added by
+ * the thread doing it; the step is accounted for once sweep_profiler_step_done()
+ * is called for it, after all its stages. The last SWEEP_PROFILER_STEPS steps
+ * are kept for CSV export, histograms and totals cover the whole run.
+ */
+#define SWEEP_PROFILER_STEPS 16384
+
+struct sweep_profiler;
+
+struct sweep_profiler * sweep_profiler_new(void);
+void sweep_profiler_free(struct sweep_profiler *p);
+/* Start a run sweeping span_mhz in steps_per_sweep steps */
+void sweep_profiler_reset(struct sweep_profiler *p, double span_mhz,
+		unsigned steps_per_sweep);
+/* Go on with the run, the steps of the next sweep are numbered from 0 again */
+void sweep_profiler_continue(struct sweep_profiler *p);
+/* One-off costs of the run, e.g. buffer creation */
+void sweep_profiler_add_setup(struct sweep_profiler *p, const char *what,
+		gint64 us);
+
+void sweep_profiler_add(struct sweep_profiler *p, unsigned step,
+		enum sweep_stage stage, gint64 us);
+void sweep_profiler_step_done(struct sweep_profiler *p, unsigned step,
+		double freq_mhz);
+/* Can be called while the sweep runs */
+unsigned long long sweep_profiler_get_sweeps(struct sweep_profiler *p);
+
+void sweep_profiler_get_summary(struct sweep_profiler *p,
+		struct sweep_profiler_summary *s);
+void sweep_profiler_print(struct sweep_profiler *p, FILE *f);
+int sweep_profiler_save_csv(struct sweep_profiler *p, const char *path);
+
+const char * sweep_stage_name(enum sweep_stage stage);
+
+#endif /* __SWEEP_PROFILER_H__ */
@@ -0,0 +1,348 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "waveform_cache.h"
+
+struct cache_entry {
+	gchar *key;
+	char *buf;			/* malloc()ed */
+	int size;
+	GList *link;			/* in cache.lru */
+};
+
+/* Content hash of a file, good as long as its size and mtime stay */
+struct file_digest {
+	goffset size;
+	gint64 mtime;			/* ns */
+	gchar *digest;
+};
+
+struct disk_file {
+	gchar *path;
+	guint64 size;
+	gint64 mtime;			/* ns */
+};
+
+static struct {
+	GHashTable *entries;		/* key -> struct cache_entry */
+	GQueue lru;			/* most recently used first */
+	size_t bytes;
+	GHashTable *digests;		/* file name -> struct file_digest */
+	gchar *dir;
+	GThreadPool *writer;		/* of the disk files */
+} cache;
+
+static void cache_entry_free(gpointer data)
+{
+	struct cache_entry *e = data;
+
+	g_free(e->key);
+	free(e->buf);
+	g_free(e);
+}
+
+static void file_digest_free(gpointer data)
+{
+	struct file_digest *d = data;
+
+	g_free(d->digest);
+	g_free(d);
+}
+
+static void cache_init(void)
+{
+	if (cache.entries)
+		return;
+
+	cache.entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, cache_entry_free);
+	cache.digests = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, file_digest_free);
+	g_queue_init(&cache.lru);
+
+	cache.dir = g_build_filename(g_get_user_cache_dir(), "osc",
+			"waveforms", NULL);
+	if (g_mkdir_with_parents(cache.dir, 0755))
+		fprintf(stderr, "Unable to create %s: %s\n", cache.dir,
+				strerror(errno));
+}
+
+/* Files rewritten within the same second still get a new mtime */
+static gint64 stat_mtime(const struct stat *st)
+{
+#ifndef __MINGW__
+	return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+		st->st_mtim.tv_nsec;
+#else
+	return (gint64)st->st_mtime * G_GINT64_CONSTANT(1000000000);
+#endif
+}
+
+static const gchar * file_digest(const char *file_name)
+{
+	struct file_digest *d;
+	GMappedFile *file;
+	struct stat st;
+
+	if (stat(file_name, &st))
+		return NULL;
+
+	d = g_hash_table_lookup(cache.digests, file_name);
+	if (d && d->size == st.st_size && d->mtime == stat_mtime(&st))
+		return d->digest;
+
+	file = g_mapped_file_new(file_name, FALSE, NULL);
+	if (!file)
+		return NULL;
+
+	d = g_new(struct file_digest, 1);
+	d->size = st.st_size;
+	d->mtime = stat_mtime(&st);
+	d->digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+			(const guchar *)g_mapped_file_get_contents(file),
+			g_mapped_file_get_length(file));
+	g_mapped_file_unref(file);
+
+	g_hash_table_replace(cache.digests, g_strdup(file_name), d);
+
+	return d->digest;
+}
+
+/* Returns NULL when the file can't be read, there is nothing to cache then */
+gchar * waveform_cache_key(const char *file_name, const char *device,
+		unsigned int channels, double scale, double offset,
+		unsigned int alignment)
+{
+	const gchar *digest;
+
+	cache_init();
+
+	digest = file_digest(file_name);
+	if (!digest)
+		return NULL;
+
+	return g_strdup_printf("%s-%s-%u-%a-%a-%u", digest, device, channels,
+			scale, offset, alignment);
+}
+
+static gchar * disk_path(const char *key)
+{
+	gchar *digest, *name, *path;
+
+	digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key, -1);
+	name = g_strconcat(digest, ".bin", NULL);
+	path = g_build_filename(cache.dir, name, NULL);
+	g_free(digest);
+	g_free(name);
+
+	return path;
+}
+
+static void memory_remove(struct cache_entry *e)
+{
+	g_queue_delete_link(&cache.lru, e->link);
+	cache.bytes -= e->size;
+	g_hash_table_remove(cache.entries, e->key);
+}
+
+static void memory_evict(void)
+{
+	/* Evicted buffers are still on disk */
+	while (cache.lru.length > 1 && cache.bytes > WAVEFORM_CACHE_MAX_MEMORY)
+		memory_remove(cache.lru.tail->data);
+}
+
+static struct cache_entry * memory_add(const char *key, char *buf, int size)
+{
+	struct cache_entry *e = g_hash_table_lookup(cache.entries, key);
+
+	if (e)
+		memory_remove(e);
+
+	e = g_new(struct cache_entry, 1);
+	e->key = g_strdup(key);
+	e->buf = buf;
+	e->size = size;
+	g_queue_push_head(&cache.lru, e);
+	e->link = cache.lru.head;
+	cache.bytes += size;
+
+	g_hash_table_insert(cache.entries, e->key, e);
+	memory_evict();
+
+	return e;
+}
+
+static char * disk_read(const char *path, int *size)
+{
+	struct stat st;
+	char *buf;
+	FILE *f;
+
+	if (stat(path, &st) || st.st_size <= 0 || st.st_size > G_MAXINT)
+		return NULL;
+
+	buf = malloc(st.st_size);
+	f = fopen(path, "rb");
+	if (!buf || !f || fread(buf, 1, st.st_size, f) != (size_t)st.st_size) {
+		if (f)
+			fclose(f);
+		free(buf);
+		return NULL;
+	}
+	fclose(f);
+
+	/* Recently used files are the last to be pruned */
+	g_utime(path, NULL);
+
+	*size = st.st_size;
+	return buf;
+}
+
+static gint disk_file_older(gconstpointer a, gconstpointer b)
+{
+	const struct disk_file *fa = a, *fb = b;
+
+	return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+/* Drop the least recently used files until under the cap, except keep */
+static void disk_prune(const char *keep)
+{
+	GSList *files = NULL, *node;
+	struct disk_file *f;
+	guint64 total = 0;
+	const gchar *name;
+	struct stat st;
+	GDir *dir;
+
+	dir = g_dir_open(cache.dir, 0, NULL);
+	if (!dir)
+		return;
+
+	while ((name = g_dir_read_name(dir))) {
+		gchar *path;
+
+		if (!g_str_has_suffix(name, ".bin"))
+			continue;
+
+		path = g_build_filename(cache.dir, name, NULL);
+		if (stat(path, &st)) {
+			g_free(path);
+			continue;
+		}
+
+		f = g_new(struct disk_file, 1);
+		f->path = path;
+		f->size = st.st_size;
+		f->mtime = stat_mtime(&st);
+		files = g_slist_prepend(files, f);
+		total += f->size;
+	}
+	g_dir_close(dir);
+
+	files = g_slist_sort(files, disk_file_older);
+	for (node = files; node; node = node->next) {
+		f = node->data;
+
+		if (total > WAVEFORM_CACHE_MAX_DISK && strcmp(f->path, keep)) {
+			g_remove(f->path);
+			total -= f->size;
+		}
+		g_free(f->path);
+		g_free(f);
+	}
+	g_slist_free(files);
+}
+
+/*
+ * Returns the converted buffer of key and its size in bytes, NULL when it
+ * isn't cached. The buffer belongs to the cache and stays valid until the
+ * next waveform_cache_get().
+ */
+const char * waveform_cache_get(const char *key, int *size)
+{
+	struct cache_entry *e;
+	gchar *path;
+	char *buf;
+
+	cache_init();
+
+	e = g_hash_table_lookup(cache.entries, key);
+	if (e) {
+		g_queue_unlink(&cache.lru, e->link);
+		g_queue_push_head_link(&cache.lru, e->link);
+		*size = e->size;
+		return e->buf;
+	}
+
+	path = disk_path(key);
+	buf = disk_read(path, size);
+	g_free(path);
+	if (!buf)
+		return NULL;
+
+	return memory_add(key, buf, *size)->buf;
+}
+
+struct disk_job {
+	gchar *path;
+	char *buf;
+	int size;
+};
+
+static void disk_worker(gpointer data, gpointer user_data)
+{
+	struct disk_job *job = data;
+	GError *err = NULL;
+
+	if (g_file_set_contents(job->path, job->buf, job->size, &err)) {
+		disk_prune(job->path);
+	} else {
+		fprintf(stderr, "Unable to cache waveform: %s\n", err->message);
+		g_error_free(err);
+	}
+
+	g_free(job->path);
+	g_free(job->buf);
+	g_free(job);
+}
+
+/*
+ * Saves the converted buffer of key, which stays with the caller. A copy
+ * is written to disk by a worker, one file at a time, so the GUI thread
+ * doesn't wait on it; the memory copy is made by the next
+ * waveform_cache_get(), so a first load doesn't hold the waveform twice
+ * for longer than the write takes.
+ */
+void waveform_cache_store(const char *key, const char *buf, int size)
+{
+	struct disk_job *job;
+
+	cache_init();
+
+	if (!cache.writer) {
+		cache.writer = g_thread_pool_new(disk_worker, NULL, 1,
+				FALSE, NULL);
+		if (!cache.writer)
+			return;
+	}
+
+	job = g_new(struct disk_job, 1);
+	job->path = disk_path(key);
+	job->buf = g_malloc(size);
+	memcpy(job->buf, buf, size);
+	job->size = size;
+	g_thread_pool_push(cache.writer, job, NULL);
+}
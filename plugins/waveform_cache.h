@@ -0,0 +1,31 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __WAVEFORM_CACHE_H__
+#define __WAVEFORM_CACHE_H__
+
+#include <glib.h>
+
+/* Converted buffers kept in memory, the least recently used go first */
+#define WAVEFORM_CACHE_MAX_MEMORY	(256 << 20)
+/* Converted buffers kept on disk, across runs */
+#define WAVEFORM_CACHE_MAX_DISK		(G_GUINT64_CONSTANT(1) << 30)
+
+/*
+ * Interleaved DAC buffers, ready to be copied into an iio buffer, of the
+ * waveform files already loaded. An entry is found by the content of the
+ * file and everything the conversion depends on, so a file changed on
+ * disk or a different scale, device or channel count is a miss.
+ * Only used from the GUI thread, files are written in the background.
+ */
+gchar * waveform_cache_key(const char *file_name, const char *device,
+		unsigned int channels, double scale, double offset,
+		unsigned int alignment);
+const char * waveform_cache_get(const char *key, int *size);
+void waveform_cache_store(const char *key, const char *buf, int size);
+
+#endif /* __WAVEFORM_CACHE_H__ */
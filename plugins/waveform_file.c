@@ -0,0 +1,337 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "waveform_file.h"
+
+/* Below this much data per worker, threads cost more than they bring */
+#define WAVEFORM_CHUNK_MIN	(256 * 1024)
+#define WAVEFORM_MAX_WORKERS	16
+
+/* Longest number handed over to g_ascii_strtod() */
+#define NUMBER_TEXT_MAX		64
+
+struct waveform_chunk {
+	const char *start, *end;
+	struct waveform_text_chunk *out;
+	size_t lines_capacity, vals_capacity;
+	double max;
+	const char *error;		/* first bad line */
+};
+
+static inline bool is_separator(char c)
+{
+	return c == ' ' || c == '\t' || c == ',';
+}
+
+static inline bool is_line_end(char c)
+{
+	return c == '\n' || c == '\r' || c == '\0';
+}
+
+/*
+ * Decimal numbers of up to 15 significant digits with a power of ten
+ * within 1e22 are exact doubles divided or multiplied by an exact power of
+ * ten: one correctly rounded operation, the same result as strtod. The
+ * rest (more digits, inf, nan, hex, ...) goes through g_ascii_strtod().
+ */
+static const double pow10_exact[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const char * parse_number_slow(const char *p, const char *end,
+		double *val)
+{
+	char text[NUMBER_TEXT_MAX];
+	size_t len = 0;
+	gchar *endptr;
+
+	while (p + len < end && len < sizeof(text) - 1 &&
+			!is_separator(p[len]) && !is_line_end(p[len]))
+		len++;
+	memcpy(text, p, len);
+	text[len] = '\0';
+
+	*val = g_ascii_strtod(text, &endptr);
+	if (endptr == text)
+		return NULL;
+
+	return p + (endptr - text);
+}
+
+/* Returns where the number ends, NULL when there is none */
+static const char * parse_number(const char *p, const char *end, double *val)
+{
+	const char *s = p;
+	guint64 mantissa = 0;
+	int digits = 0, exp10 = 0, e = 0;
+	bool negative = false, any = false, exp_negative = false;
+
+	if (s < end && (*s == '-' || *s == '+'))
+		negative = *s++ == '-';
+
+	for (; s < end && *s >= '0' && *s <= '9'; s++, any = true) {
+		if (digits || *s != '0')
+			digits++;
+		if (digits <= 19)
+			mantissa = mantissa * 10 + (*s - '0');
+		else
+			exp10++;
+	}
+	if (s < end && *s == '.') {
+		for (s++; s < end && *s >= '0' && *s <= '9'; s++, any = true) {
+			if (digits || *s != '0')
+				digits++;
+			if (digits <= 19) {
+				mantissa = mantissa * 10 + (*s - '0');
+				exp10--;
+			}
+		}
+	}
+	if (!any)
+		return parse_number_slow(p, end, val);
+
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		const char *x = s + 1;
+
+		if (x < end && (*x == '-' || *x == '+'))
+			exp_negative = *x++ == '-';
+		if (x < end && *x >= '0' && *x <= '9') {
+			for (; x < end && *x >= '0' && *x <= '9'; x++)
+				if (e < 10000)
+					e = e * 10 + (*x - '0');
+			exp10 += exp_negative ? -e : e;
+			s = x;
+		}
+	}
+
+	/* Only plain numbers followed by a separator take the fast path */
+	if (digits > 15 || exp10 < -22 || exp10 > 22 ||
+			(s < end && !is_separator(*s) && !is_line_end(*s)))
+		return parse_number_slow(p, end, val);
+
+	*val = exp10 < 0 ? (double)mantissa / pow10_exact[-exp10] :
+		(double)mantissa * pow10_exact[exp10];
+	if (negative)
+		*val = -*val;
+
+	return s;
+}
+
+/*
+ * Values of one line, at most WAVEFORM_MAX_COLUMNS (the rest of the line
+ * is ignored). Returns their number, -1 when one isn't a number.
+ */
+static int parse_line(const char *p, const char *end, double *vals,
+		const char **next)
+{
+	int n = 0;
+
+	while (n < WAVEFORM_MAX_COLUMNS) {
+		while (p < end && is_separator(*p))
+			p++;
+		if (p == end || is_line_end(*p))
+			break;
+
+		p = parse_number(p, end, &vals[n]);
+		if (!p) {
+			n = -1;
+			break;
+		}
+		n++;
+	}
+
+	p = memchr(p ?: end, '\n', end - (p ?: end));
+	*next = p ? p + 1 : end;
+
+	return n;
+}
+
+static gpointer parse_chunk(gpointer data)
+{
+	struct waveform_chunk *c = data;
+	struct waveform_text_chunk *out = c->out;
+	const char *p = c->start, *next;
+	double vals[WAVEFORM_MAX_COLUMNS];
+	int n, i;
+
+	while (p < c->end) {
+		n = parse_line(p, c->end, vals, &next);
+		if (n == 0) {
+			p = next;
+			continue;
+		}
+		if (n != 2 && n != 4 && n != 8) {
+			c->error = p;
+			break;
+		}
+
+		if (out->num_lines == c->lines_capacity) {
+			c->lines_capacity = c->lines_capacity ?
+				c->lines_capacity * 2 : 4096;
+			out->cols = g_renew(guint8, out->cols, c->lines_capacity);
+		}
+		if (out->num_vals + n > c->vals_capacity) {
+			c->vals_capacity = c->vals_capacity ?
+				c->vals_capacity * 2 : 4096 * 2;
+			out->vals = g_renew(double, out->vals, c->vals_capacity);
+		}
+
+		out->cols[out->num_lines++] = n;
+		memcpy(out->vals + out->num_vals, vals, n * sizeof(double));
+		out->num_vals += n;
+		for (i = 0; i < n; i++)
+			if (fabs(vals[i]) > c->max)
+				c->max = fabs(vals[i]);
+
+		p = next;
+	}
+
+	return NULL;
+}
+
+static unsigned int num_workers(size_t len)
+{
+	unsigned int n = g_get_num_processors();
+
+	if (n > WAVEFORM_MAX_WORKERS)
+		n = WAVEFORM_MAX_WORKERS;
+	if (n > len / WAVEFORM_CHUNK_MIN)
+		n = len / WAVEFORM_CHUNK_MIN;
+
+	return n ?: 1;
+}
+
+/*
+ * The file is mapped and split at line boundaries into one chunk per
+ * worker; the chunks are parsed at the same time and kept in file order.
+ */
+static int parse_samples(const char *data, const char *end,
+		struct waveform_text *wt)
+{
+	struct waveform_chunk chunks[WAVEFORM_MAX_WORKERS];
+	GThread *threads[WAVEFORM_MAX_WORKERS];
+	unsigned int i, n = num_workers(end - data);
+	const char *p = data, *split;
+	size_t line = 0;
+
+	memset(chunks, 0, sizeof(chunks));
+	wt->chunks = g_new0(struct waveform_text_chunk, n);
+	wt->num_chunks = n;
+	for (i = 0; i < n; i++) {
+		chunks[i].out = &wt->chunks[i];
+		chunks[i].start = p;
+		split = i == n - 1 ? end : p + (end - p) / (n - i);
+		if (split < end) {
+			split = memchr(split, '\n', end - split);
+			split = split ? split + 1 : end;
+		}
+		chunks[i].end = split;
+		p = split;
+	}
+
+	for (i = 1; i < n; i++)
+		threads[i] = g_thread_new("waveform", parse_chunk, &chunks[i]);
+	parse_chunk(&chunks[0]);
+	for (i = 1; i < n; i++)
+		g_thread_join(threads[i]);
+
+	for (i = 0; i < n; i++) {
+		if (chunks[i].error) {
+			const char *q;
+
+			for (q = data; q < chunks[i].error; q++)
+				line += *q == '\n';
+			fprintf(stderr, "ERROR: No 2, 4 or 8 columns of data inside the text file (line %zu)\n",
+					line + 2);
+			return WAVEFORM_TEXT_INVALID;
+		}
+		wt->num_lines += wt->chunks[i].num_lines;
+		if (chunks[i].max > wt->max)
+			wt->max = chunks[i].max;
+	}
+
+	return 0;
+}
+
+int waveform_text_load(const char *file_name, struct waveform_text *wt)
+{
+	GMappedFile *file;
+	GError *err = NULL;
+	const char *data, *end, *eol;
+	char header[80];
+	size_t len;
+	int fd, ret, rep;
+
+	memset(wt, 0, sizeof(*wt));
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	file = g_mapped_file_new_from_fd(fd, FALSE, &err);
+	close(fd);
+	if (!file) {
+		fprintf(stderr, "ERROR: Could not map %s: %s\n", file_name,
+				err->message);
+		g_error_free(err);
+		return -EIO;
+	}
+
+	data = g_mapped_file_get_contents(file);
+	end = data + g_mapped_file_get_length(file);
+	if (data == end) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (end - data < 4 || strncmp(data, "TEXT", 4)) {
+		ret = WAVEFORM_TEXT_NONE;
+		goto out;
+	}
+
+	eol = memchr(data, '\n', end - data);
+	eol = eol ? eol + 1 : end;
+	len = MIN((size_t)(eol - data), sizeof(header) - 1);
+	memcpy(header, data, len);
+	header[len] = '\0';
+
+	/* Unscaled samples need to be in the range +- 2047 */
+	wt->unscaled = !strncmp(header, "TEXTU", 5);
+	if (sscanf(header, "TEXT%*c REPEAT %d", &rep) != 1 || rep < 1)
+		rep = 1;
+	wt->repeat = rep;
+
+	ret = parse_samples(eol, end, wt);
+	if (ret)
+		waveform_text_free(wt);
+out:
+	g_mapped_file_unref(file);
+	return ret;
+}
+
+void waveform_text_free(struct waveform_text *wt)
+{
+	unsigned int i;
+
+	for (i = 0; i < wt->num_chunks; i++) {
+		g_free(wt->chunks[i].vals);
+		g_free(wt->chunks[i].cols);
+	}
+	g_free(wt->chunks);
+	wt->chunks = NULL;
+	wt->num_chunks = 0;
+	wt->num_lines = 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __WAVEFORM_FILE_H__
+#define __WAVEFORM_FILE_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define WAVEFORM_MAX_COLUMNS	8
+
+/* Returned by waveform_text_load(), besides 0 and -errno */
+#define WAVEFORM_TEXT_NONE	1	/* no TEXT header, try another format */
+#define WAVEFORM_TEXT_INVALID	2
+
+/*
+ * Text waveform: a "TEXT" or "TEXTU" (unscaled, +-2047) header line with an
+ * optional "REPEAT n", then 2, 4 or 8 columns of samples per line.
+ */
+struct waveform_text_chunk {
+	double *vals;			/* the columns of each line, packed */
+	guint8 *cols;			/* number of columns, per line */
+	size_t num_lines, num_vals;
+};
+
+/*
+ * The lines are kept in the chunks they were parsed in, in file order.
+ * Output channel n takes column n % cols of each line.
+ */
+struct waveform_text {
+	bool unscaled;
+	unsigned int repeat;
+	size_t num_lines;
+	struct waveform_text_chunk *chunks;
+	unsigned int num_chunks;
+	double max;			/* largest magnitude */
+};
+
+int waveform_text_load(const char *file_name, struct waveform_text *wt);
+void waveform_text_free(struct waveform_text *wt);
+
+#endif /* __WAVEFORM_FILE_H__ */
@@ -0,0 +1,555 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fftw3.h>
+
+#include "waveform_synth.h"
+#include "../libini/ini.h"
+
+/* Samples handed to a worker at a time, the result doesn't depend on it */
+#define SYNTH_CHUNK	65536
+/* Samples filtered at a time, on the stack */
+#define SYNTH_BLOCK	1024
+#define NOISE_TAPS	255
+/* Symbols each side of the root raised cosine peak */
+#define RRC_SPAN	8
+
+struct synth_state {
+	const struct waveform_synth_config *cfg;
+	size_t length;
+	float *i, *q;
+
+	/* SYNTH_MULTITONE: one inverse FFT of the tones */
+	fftw_complex *spectrum;
+
+	/* SYNTH_NOISE: white noise, wrapped around by the filter length */
+	float *wi, *wq;
+
+	/* FIR taps, of the noise filter or of the RRC pulse */
+	float *taps;
+	unsigned int num_taps;
+
+	/* modulations: symbols, wrapped around by RRC_SPAN + 1 */
+	float *si, *sq;
+	size_t num_symbols;
+	unsigned int sps;
+
+	void (*fill)(struct synth_state *st, size_t first, size_t count);
+	size_t num_chunks;
+	gint next_chunk;
+};
+
+static const char * const synth_type_names[] = {
+	[SYNTH_MULTITONE] = "multitone",
+	[SYNTH_CHIRP] = "chirp",
+	[SYNTH_NOISE] = "noise",
+	[SYNTH_QPSK] = "qpsk",
+	[SYNTH_QAM16] = "qam16",
+	[SYNTH_QAM64] = "qam64",
+};
+
+static int synth_type_from_string(const char *type)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(synth_type_names); i++)
+		if (!strcmp(type, synth_type_names[i]))
+			return i;
+
+	return -EINVAL;
+}
+
+/* splitmix64, good enough for test signals and cheap to seed per chunk */
+static inline guint64 rng_next(guint64 *state)
+{
+	guint64 z = (*state += G_GUINT64_CONSTANT(0x9E3779B97F4A7C15));
+
+	z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+/* In (0, 1) */
+static inline double rng_uniform(guint64 *state)
+{
+	return ((rng_next(state) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static gpointer synth_worker(gpointer data)
+{
+	struct synth_state *st = data;
+	size_t chunk, first;
+
+	while ((chunk = (guint)g_atomic_int_add(&st->next_chunk, 1)) < st->num_chunks) {
+		first = chunk * SYNTH_CHUNK;
+		st->fill(st, first, MIN(SYNTH_CHUNK, st->length - first));
+	}
+
+	return NULL;
+}
+
+/* Calls fill over the whole buffer, chunks spread over the processors */
+static void synth_run(struct synth_state *st,
+		void (*fill)(struct synth_state *, size_t, size_t))
+{
+	GThread *threads[64];
+	unsigned int i, n = g_get_num_processors();
+
+	st->fill = fill;
+	st->num_chunks = (st->length + SYNTH_CHUNK - 1) / SYNTH_CHUNK;
+	st->next_chunk = 0;
+
+	n = MIN(n, G_N_ELEMENTS(threads));
+	n = MIN(n, st->num_chunks);
+
+	for (i = 1; i < n; i++)
+		threads[i] = g_thread_new("waveform_synth", synth_worker, st);
+	synth_worker(st);
+	for (i = 1; i < n; i++)
+		g_thread_join(threads[i]);
+}
+
+static void fill_multitone(struct synth_state *st, size_t first, size_t count)
+{
+	const fftw_complex *x = st->spectrum + first;
+	size_t m;
+
+	for (m = 0; m < count; m++) {
+		st->i[first + m] = x[m][0];
+		st->q[first + m] = x[m][1];
+	}
+}
+
+/*
+ * Each tone is one bin of the spectrum, so the time signal is a single
+ * inverse FFT rather than a sum over the tones. Tones land on the nearest
+ * bin so the buffer loops.
+ */
+static int multitone_spectrum(struct synth_state *st)
+{
+	const struct waveform_synth_config *cfg = st->cfg;
+	fftw_plan plan;
+	double bin, ph;
+	size_t b;
+	unsigned int k;
+
+	st->spectrum = fftw_malloc(sizeof(fftw_complex) * st->length);
+	if (!st->spectrum)
+		return -ENOMEM;
+
+	plan = fftw_plan_dft_1d(st->length, st->spectrum, st->spectrum,
+			FFTW_BACKWARD, FFTW_ESTIMATE);
+	if (!plan)
+		return -ENOMEM;
+
+	memset(st->spectrum, 0, sizeof(fftw_complex) * st->length);
+	for (k = 0; k < cfg->num_tones; k++) {
+		bin = round((cfg->start + k * cfg->spacing) *
+				st->length / cfg->sample_rate);
+		bin = fmod(bin, (double)st->length);
+		b = bin < 0.0 ? bin + st->length : bin;
+		/* Newman phases keep the crest factor near 4.6 dB */
+		ph = cfg->newman_phases ? M_PI * k * k / cfg->num_tones : 0.0;
+		st->spectrum[b][0] += cos(ph);
+		st->spectrum[b][1] += sin(ph);
+	}
+
+	fftw_execute(plan);
+	fftw_destroy_plan(plan);
+
+	return 0;
+}
+
+static void fill_chirp(struct synth_state *st, size_t first, size_t count)
+{
+	const struct waveform_synth_config *cfg = st->cfg;
+	double fs = cfg->sample_rate, f0 = cfg->start;
+	double duration = st->length / fs, t, ph, k;
+	size_t m;
+
+	if (cfg->log_sweep)
+		k = log(cfg->stop / f0) / duration;
+	else
+		k = (cfg->stop - f0) / duration;
+
+	for (m = 0; m < count; m++) {
+		t = (first + m) / fs;
+		if (cfg->log_sweep)
+			ph = 2.0 * M_PI * f0 * expm1(k * t) / k;
+		else
+			ph = 2.0 * M_PI * (f0 * t + 0.5 * k * t * t);
+		st->i[first + m] = cos(ph);
+		st->q[first + m] = sin(ph);
+	}
+}
+
+static void fill_white_noise(struct synth_state *st, size_t first, size_t count)
+{
+	guint64 rng = st->cfg->seed ^ (first * G_GUINT64_CONSTANT(0xD1B54A32D192ED03));
+	double r, a;
+	size_t m;
+
+	/* Box-Muller, one pair of gaussians per complex sample */
+	for (m = first; m < first + count; m++) {
+		r = sqrt(-2.0 * log(rng_uniform(&rng)));
+		a = 2.0 * M_PI * rng_uniform(&rng);
+		st->i[m] = r * cos(a);
+		st->q[m] = r * sin(a);
+	}
+}
+
+static void fill_noise(struct synth_state *st, size_t first, size_t count)
+{
+	float ai[SYNTH_BLOCK], aq[SYNTH_BLOCK];
+	const float *wi, *wq, *h = st->taps;
+	size_t m, n, len;
+	unsigned int k;
+
+	/*
+	 * Circular convolution, so the buffer loops without a seam. Tap by
+	 * tap over a block of samples, which the compiler vectorizes.
+	 */
+	for (m = first; m < first + count; m += len) {
+		len = MIN(SYNTH_BLOCK, first + count - m);
+		memset(ai, 0, sizeof(ai));
+		memset(aq, 0, sizeof(aq));
+		for (k = 0; k < st->num_taps; k++) {
+			wi = st->wi + m + k;
+			wq = st->wq + m + k;
+			for (n = 0; n < len; n++) {
+				ai[n] += h[k] * wi[n];
+				aq[n] += h[k] * wq[n];
+			}
+		}
+		memcpy(st->i + m, ai, len * sizeof(*ai));
+		memcpy(st->q + m, aq, len * sizeof(*aq));
+	}
+}
+
+static void fill_modulated(struct synth_state *st, size_t first, size_t count)
+{
+	unsigned int sps = st->sps, half = st->num_taps / 2, idx;
+	const float *h = st->taps;
+	float ai, aq;
+	size_t n, s;
+
+	for (n = first; n < first + count; n++) {
+		ai = aq = 0.0f;
+		/* Symbol s sits at s * sps, its pulse reaches half samples around */
+		s = (n + half) / sps + RRC_SPAN + 1;
+		for (idx = (n + half) % sps; idx < st->num_taps; idx += sps, s--) {
+			ai += h[idx] * st->si[s];
+			aq += h[idx] * st->sq[s];
+		}
+		st->i[n] = ai;
+		st->q[n] = aq;
+	}
+}
+
+/* Blackman windowed sinc, passing bandwidth around DC */
+static void noise_taps(struct synth_state *st)
+{
+	double fc = st->cfg->bandwidth / st->cfg->sample_rate / 2.0;
+	int k, half = NOISE_TAPS / 2;
+	double x, w;
+
+	st->num_taps = NOISE_TAPS;
+	st->taps = g_new(float, NOISE_TAPS);
+	for (k = -half; k <= half; k++) {
+		x = 2.0 * fc * k;
+		w = 0.42 + 0.5 * cos(M_PI * k / (half + 1)) +
+			0.08 * cos(2.0 * M_PI * k / (half + 1));
+		st->taps[k + half] = 2.0 * fc * (k ? sin(M_PI * x) / (M_PI * x) : 1.0) * w;
+	}
+}
+
+static void rrc_taps(struct synth_state *st)
+{
+	double beta = st->cfg->rolloff, t, den;
+	int k, half = RRC_SPAN * st->sps;
+
+	st->num_taps = 2 * half + 1;
+	st->taps = g_new(float, st->num_taps);
+	for (k = -half; k <= half; k++) {
+		t = (double)k / st->sps;
+		if (k == 0) {
+			st->taps[k + half] = 1.0 - beta + 4.0 * beta / M_PI;
+		} else if (beta > 0.0 && fabs(fabs(t) - 1.0 / (4.0 * beta)) < 1e-9) {
+			st->taps[k + half] = beta / M_SQRT2 *
+				((1.0 + 2.0 / M_PI) * sin(M_PI / (4.0 * beta)) +
+				 (1.0 - 2.0 / M_PI) * cos(M_PI / (4.0 * beta)));
+		} else {
+			den = M_PI * t * (1.0 - 16.0 * beta * beta * t * t);
+			st->taps[k + half] = (sin(M_PI * t * (1.0 - beta)) +
+				4.0 * beta * t * cos(M_PI * t * (1.0 + beta))) / den;
+		}
+	}
+}
+
+/* Random symbols, levels -(M - 1) to M - 1 on each axis, unit mean power */
+static void modulation_symbols(struct synth_state *st)
+{
+	unsigned int levels = st->cfg->type == SYNTH_QPSK ? 2 :
+		st->cfg->type == SYNTH_QAM16 ? 4 : 8;
+	double norm = sqrt(2.0 * (levels * levels - 1) / 3.0);
+	size_t s, j, pad = RRC_SPAN + 1, total = st->num_symbols + 2 * pad;
+	guint64 rng = st->cfg->seed;
+
+	st->si = g_new(float, total);
+	st->sq = g_new(float, total);
+	for (s = pad; s < pad + st->num_symbols; s++) {
+		st->si[s] = (2.0 * (rng_next(&rng) % levels) - (levels - 1)) / norm;
+		st->sq[s] = (2.0 * (rng_next(&rng) % levels) - (levels - 1)) / norm;
+	}
+	/* Both ends wrap around, so the buffer loops without a seam */
+	for (s = 0; s < total; s++) {
+		if (s >= pad && s < pad + st->num_symbols)
+			continue;
+		j = pad + (s + st->num_symbols * pad - pad) % st->num_symbols;
+		st->si[s] = st->si[j];
+		st->sq[s] = st->sq[j];
+	}
+}
+
+static int synth_check(const struct waveform_synth_config *cfg)
+{
+	if (cfg->sample_rate <= 0.0 || !cfg->length ||
+			cfg->length > WAVEFORM_SYNTH_MAX_LENGTH)
+		return -EINVAL;
+
+	switch (cfg->type) {
+	case SYNTH_MULTITONE:
+		if (!cfg->num_tones || cfg->num_tones > WAVEFORM_SYNTH_MAX_TONES)
+			return -EINVAL;
+		break;
+	case SYNTH_CHIRP:
+		if (cfg->log_sweep && (cfg->start * cfg->stop <= 0.0))
+			return -EINVAL;
+		break;
+	case SYNTH_NOISE:
+		if (cfg->bandwidth <= 0.0)
+			return -EINVAL;
+		break;
+	default:
+		if (cfg->symbol_rate <= 0.0 || cfg->rolloff < 0.0 ||
+				cfg->rolloff > 1.0 ||
+				cfg->sample_rate / cfg->symbol_rate < 1.5 ||
+				cfg->length < (size_t)lround(cfg->sample_rate / cfg->symbol_rate))
+			return -EINVAL;
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Generates the signal of cfg, normalized to a peak of 1. Modulated
+ * signals are cut to a whole number of symbols, out->length tells.
+ */
+int waveform_synth_generate(const struct waveform_synth_config *cfg,
+		struct waveform_synth_output *out)
+{
+	struct synth_state st;
+	double max = 0.0;
+	size_t n, j;
+	int ret;
+
+	memset(out, 0, sizeof(*out));
+
+	ret = synth_check(cfg);
+	if (ret) {
+		fprintf(stderr, "ERROR: Invalid %s waveform settings\n",
+				synth_type_names[cfg->type]);
+		return ret;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.cfg = cfg;
+	st.length = cfg->length;
+
+	if (cfg->type >= SYNTH_QPSK) {
+		st.sps = lround(cfg->sample_rate / cfg->symbol_rate);
+		st.num_symbols = cfg->length / st.sps;
+		st.length = st.num_symbols * st.sps;
+	}
+
+	st.i = g_new(float, st.length);
+	st.q = g_new(float, st.length);
+
+	switch (cfg->type) {
+	case SYNTH_MULTITONE:
+		ret = multitone_spectrum(&st);
+		if (ret) {
+			fftw_free(st.spectrum);
+			g_free(st.i);
+			g_free(st.q);
+			return ret;
+		}
+		synth_run(&st, fill_multitone);
+		break;
+	case SYNTH_CHIRP:
+		synth_run(&st, fill_chirp);
+		break;
+	case SYNTH_NOISE:
+		noise_taps(&st);
+		synth_run(&st, fill_white_noise);
+		st.wi = g_new(float, st.length + st.num_taps - 1);
+		st.wq = g_new(float, st.length + st.num_taps - 1);
+		for (n = 0; n < st.length + st.num_taps - 1; n++) {
+			j = (n + st.length - (st.num_taps / 2) % st.length) % st.length;
+			st.wi[n] = st.i[j];
+			st.wq[n] = st.q[j];
+		}
+		synth_run(&st, fill_noise);
+		break;
+	default:
+		rrc_taps(&st);
+		modulation_symbols(&st);
+		synth_run(&st, fill_modulated);
+		break;
+	}
+
+	for (n = 0; n < st.length; n++) {
+		if (fabsf(st.i[n]) > max)
+			max = fabsf(st.i[n]);
+		if (fabsf(st.q[n]) > max)
+			max = fabsf(st.q[n]);
+	}
+	if (max > 0.0) {
+		float gain = 1.0 / max;
+
+		for (n = 0; n < st.length; n++) {
+			st.i[n] *= gain;
+			st.q[n] *= gain;
+		}
+	}
+
+	out->i = st.i;
+	out->q = st.q;
+	out->length = st.length;
+
+	fftw_free(st.spectrum);
+	g_free(st.wi);
+	g_free(st.wq);
+	g_free(st.taps);
+	g_free(st.si);
+	g_free(st.sq);
+
+	return 0;
+}
+
+void waveform_synth_output_free(struct waveform_synth_output *out)
+{
+	g_free(out->i);
+	g_free(out->q);
+	out->i = out->q = NULL;
+	out->length = 0;
+}
+
+static int synth_config_set(struct waveform_synth_config *cfg,
+		const char *key, const char *value)
+{
+	int type;
+
+	if (!strcmp(key, "type")) {
+		type = synth_type_from_string(value);
+		if (type < 0)
+			return type;
+		cfg->type = type;
+	} else if (!strcmp(key, "sample_rate")) {
+		cfg->sample_rate = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "length")) {
+		cfg->length = g_ascii_strtoull(value, NULL, 0);
+	} else if (!strcmp(key, "tones")) {
+		cfg->num_tones = g_ascii_strtoull(value, NULL, 0);
+	} else if (!strcmp(key, "start")) {
+		cfg->start = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "spacing")) {
+		cfg->spacing = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "phases")) {
+		if (strcmp(value, "newman") && strcmp(value, "zero"))
+			return -EINVAL;
+		cfg->newman_phases = !strcmp(value, "newman");
+	} else if (!strcmp(key, "stop")) {
+		cfg->stop = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "sweep")) {
+		if (strcmp(value, "log") && strcmp(value, "linear"))
+			return -EINVAL;
+		cfg->log_sweep = !strcmp(value, "log");
+	} else if (!strcmp(key, "bandwidth")) {
+		cfg->bandwidth = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "symbol_rate")) {
+		cfg->symbol_rate = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "rolloff")) {
+		cfg->rolloff = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(key, "seed")) {
+		cfg->seed = g_ascii_strtoull(value, NULL, 0);
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the [synth] section of a .synth file, e.g.
+ *   [synth]
+ *   type = multitone
+ *   sample_rate = 30720000
+ *   length = 1048576
+ *   tones = 32
+ *   start = -8000000
+ *   spacing = 500000
+ */
+int waveform_synth_config_load(const char *file_name,
+		struct waveform_synth_config *cfg)
+{
+	const char *name, *key, *value;
+	size_t nlen, klen, vlen;
+	struct INI *ini;
+	int ret = -EINVAL;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->length = 65536;
+	cfg->num_tones = 1;
+	cfg->newman_phases = true;
+	cfg->rolloff = 0.35;
+	cfg->seed = 1;
+
+	ini = ini_open(file_name);
+	if (!ini)
+		return -errno ?: -EIO;
+
+	while (ini_next_section(ini, &name, &nlen) > 0) {
+		if (nlen != strlen("synth") || strncmp(name, "synth", nlen))
+			continue;
+
+		ret = 0;
+		while (!ret && ini_read_pair(ini, &key, &klen, &value, &vlen) > 0) {
+			gchar *k = g_strndup(key, klen), *v = g_strndup(value, vlen);
+
+			ret = synth_config_set(cfg, k, v);
+			if (ret)
+				fprintf(stderr, "ERROR: Invalid '%s = %s' in %s\n",
+						k, v, file_name);
+			g_free(k);
+			g_free(v);
+		}
+		break;
+	}
+	ini_close(ini);
+
+	if (!ret && cfg->type == SYNTH_NOISE && cfg->bandwidth == 0.0)
+		cfg->bandwidth = cfg->sample_rate;
+
+	return ret;
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2024 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ */
+
+#ifndef __WAVEFORM_SYNTH_H__
+#define __WAVEFORM_SYNTH_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+#define WAVEFORM_SYNTH_MAX_TONES	4096
+#define WAVEFORM_SYNTH_MAX_LENGTH	(64 << 20)
+
+enum waveform_synth_type {
+	SYNTH_MULTITONE,
+	SYNTH_CHIRP,
+	SYNTH_NOISE,
+	SYNTH_QPSK,
+	SYNTH_QAM16,
+	SYNTH_QAM64,
+};
+
+/*
+ * A test signal, as complex baseband. Frequencies are in Hz, from
+ * -sample_rate / 2 to sample_rate / 2.
+ */
+struct waveform_synth_config {
+	enum waveform_synth_type type;
+	double sample_rate;
+	size_t length;			/* samples */
+
+	/* SYNTH_MULTITONE, tones land on the nearest bin so the buffer loops */
+	unsigned int num_tones;
+	double start;			/* also the chirp start */
+	double spacing;
+	bool newman_phases;		/* low crest factor, else all in phase */
+
+	/* SYNTH_CHIRP */
+	double stop;
+	bool log_sweep;
+
+	/* SYNTH_NOISE */
+	double bandwidth;
+
+	/* SYNTH_QPSK, SYNTH_QAM16, SYNTH_QAM64 */
+	double symbol_rate;		/* sample_rate / symbol_rate is rounded */
+	double rolloff;			/* of the root raised cosine */
+
+	guint64 seed;			/* SYNTH_NOISE and modulations */
+};
+
+/* Peak magnitude of i and q is 1 */
+struct waveform_synth_output {
+	float *i, *q;
+	size_t length;
+};
+
+int waveform_synth_config_load(const char *file_name,
+		struct waveform_synth_config *cfg);
+int waveform_synth_generate(const struct waveform_synth_config *cfg,
+		struct waveform_synth_output *out);
+void waveform_synth_output_free(struct waveform_synth_output *out);
+
+#endif /* __WAVEFORM_SYNTH_H__ */